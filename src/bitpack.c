@@ -0,0 +1,193 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#include "bitpack.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The number of values unpacked at a time by searches
+ */
+#define BITPACK_BATCH 256
+
+/**
+ * The number of values unpacked at a time by the kernels of each width, which start and end on a word boundary
+ */
+#define BITPACK_BLOCK 64
+
+unsigned int get_bitpack_width(uint32_t max) {
+  unsigned int bits = 0;
+  while(bits < MAX_BITPACK_WIDTH && (max >> bits) != 0) {
+    ++bits;
+  }
+  return bits;
+}
+
+size_t get_bitpack_words(size_t count, unsigned int bits) {
+  return (count * bits + 63) / 64;
+}
+
+void pack_bits(uint64_t * dest, const uint32_t * values, size_t count, unsigned int bits) {
+  assert(bits <= MAX_BITPACK_WIDTH);
+
+  size_t words = get_bitpack_words(count, bits);
+  if(words == 0) {
+    return;
+  }
+  memset(dest, 0, words * sizeof(uint64_t));
+  uint64_t bit = 0;
+  for(size_t i = 0; i < count; ++i, bit += bits) {
+    size_t word = (size_t) (bit / 64);
+    unsigned int shift = (unsigned int) (bit % 64);
+    dest[word] |= (uint64_t) values[i] << shift;
+    if(shift + bits > 64) {
+      dest[word + 1] |= (uint64_t) values[i] >> (64 - shift);
+    }
+  }
+}
+
+uint32_t get_packed_value(const uint64_t * words, unsigned int bits, size_t index) {
+  if(bits == 0) {
+    return 0;
+  }
+  uint64_t bit = (uint64_t) index * bits;
+  size_t word = (size_t) (bit / 64);
+  unsigned int shift = (unsigned int) (bit % 64);
+  uint64_t value = words[word] >> shift;
+  if(shift + bits > 64) {
+    value |= words[word + 1] << (64 - shift);
+  }
+  return (uint32_t) (value & ((UINT64_C(1) << bits) - 1));
+}
+
+/**
+ * Unpacks values one at a time from any position
+ * \param dest the destination for the values
+ * \param words the packed words
+ * \param bits the width of the values, at least 1
+ * \param first the index of the first value
+ * \param count the number of values
+ */
+static void unpack_bits_slowly(uint32_t * dest, const uint64_t * words, unsigned int bits, size_t first, size_t count) {
+  // Walking the bit position avoids a multiplication and a division per value
+  uint64_t mask = (UINT64_C(1) << bits) - 1;
+  uint64_t bit = (uint64_t) first * bits;
+  size_t word = (size_t) (bit / 64);
+  unsigned int shift = (unsigned int) (bit % 64);
+  for(size_t i = 0; i < count; ++i) {
+    uint64_t value = words[word] >> shift;
+    if(shift + bits > 64) {
+      value |= words[word + 1] << (64 - shift);
+    }
+    dest[i] = (uint32_t) (value & mask);
+    shift += bits;
+    if(shift >= 64) {
+      shift -= 64;
+      ++word;
+    }
+  }
+}
+
+/**
+ * Unpacks a block of BITPACK_BLOCK values starting at a word boundary, which take exactly bits words
+ * Inlined with a constant width, every shift and word index is a constant and the loop unrolls without branches
+ * \param dest the destination for the values
+ * \param words the first packed word of the block
+ * \param bits the width of the values
+ */
+static inline __attribute__((always_inline)) void unpack_bit_block(uint32_t * dest, const uint64_t * words, unsigned int bits) {
+  uint64_t mask = (UINT64_C(1) << bits) - 1;
+#pragma GCC unroll 64
+  for(unsigned int i = 0; i < BITPACK_BLOCK; ++i) {
+    unsigned int bit = i * bits;
+    unsigned int shift = bit % 64;
+    uint64_t value = words[bit / 64] >> shift;
+    if(shift + bits > 64) {
+      value |= words[bit / 64 + 1] << (64 - shift);
+    }
+    dest[i] = (uint32_t) (value & mask);
+  }
+}
+
+/**
+ * Defines the function unpacking a block of values of a width
+ * \param bits the width
+ */
+#define DEFINE_UNPACK_BIT_BLOCK(bits) \
+  static void unpack_bit_block_##bits(uint32_t * dest, const uint64_t * words) { \
+    unpack_bit_block(dest, words, bits); \
+  }
+
+DEFINE_UNPACK_BIT_BLOCK(1) DEFINE_UNPACK_BIT_BLOCK(2) DEFINE_UNPACK_BIT_BLOCK(3) DEFINE_UNPACK_BIT_BLOCK(4)
+DEFINE_UNPACK_BIT_BLOCK(5) DEFINE_UNPACK_BIT_BLOCK(6) DEFINE_UNPACK_BIT_BLOCK(7) DEFINE_UNPACK_BIT_BLOCK(8)
+DEFINE_UNPACK_BIT_BLOCK(9) DEFINE_UNPACK_BIT_BLOCK(10) DEFINE_UNPACK_BIT_BLOCK(11) DEFINE_UNPACK_BIT_BLOCK(12)
+DEFINE_UNPACK_BIT_BLOCK(13) DEFINE_UNPACK_BIT_BLOCK(14) DEFINE_UNPACK_BIT_BLOCK(15) DEFINE_UNPACK_BIT_BLOCK(16)
+DEFINE_UNPACK_BIT_BLOCK(17) DEFINE_UNPACK_BIT_BLOCK(18) DEFINE_UNPACK_BIT_BLOCK(19) DEFINE_UNPACK_BIT_BLOCK(20)
+DEFINE_UNPACK_BIT_BLOCK(21) DEFINE_UNPACK_BIT_BLOCK(22) DEFINE_UNPACK_BIT_BLOCK(23) DEFINE_UNPACK_BIT_BLOCK(24)
+DEFINE_UNPACK_BIT_BLOCK(25) DEFINE_UNPACK_BIT_BLOCK(26) DEFINE_UNPACK_BIT_BLOCK(27) DEFINE_UNPACK_BIT_BLOCK(28)
+DEFINE_UNPACK_BIT_BLOCK(29) DEFINE_UNPACK_BIT_BLOCK(30) DEFINE_UNPACK_BIT_BLOCK(31) DEFINE_UNPACK_BIT_BLOCK(32)
+
+/**
+ * The functions unpacking a block of values, by width
+ */
+static void (* const unpack_bit_blocks[MAX_BITPACK_WIDTH + 1])(uint32_t *, const uint64_t *) = {
+  NULL,
+  unpack_bit_block_1, unpack_bit_block_2, unpack_bit_block_3, unpack_bit_block_4,
+  unpack_bit_block_5, unpack_bit_block_6, unpack_bit_block_7, unpack_bit_block_8,
+  unpack_bit_block_9, unpack_bit_block_10, unpack_bit_block_11, unpack_bit_block_12,
+  unpack_bit_block_13, unpack_bit_block_14, unpack_bit_block_15, unpack_bit_block_16,
+  unpack_bit_block_17, unpack_bit_block_18, unpack_bit_block_19, unpack_bit_block_20,
+  unpack_bit_block_21, unpack_bit_block_22, unpack_bit_block_23, unpack_bit_block_24,
+  unpack_bit_block_25, unpack_bit_block_26, unpack_bit_block_27, unpack_bit_block_28,
+  unpack_bit_block_29, unpack_bit_block_30, unpack_bit_block_31, unpack_bit_block_32
+};
+
+void unpack_bits(uint32_t * dest, const uint64_t * words, unsigned int bits, size_t first, size_t count) {
+  assert(bits <= MAX_BITPACK_WIDTH);
+
+  if(bits == 0) {
+    memset(dest, 0, count * sizeof(uint32_t));
+    return;
+  }
+  // The values up to the next block boundary and after the last whole block are unpacked one at a time
+  size_t head = (BITPACK_BLOCK - first % BITPACK_BLOCK) % BITPACK_BLOCK;
+  if(head >= count) {
+    unpack_bits_slowly(dest, words, bits, first, count);
+    return;
+  }
+  unpack_bits_slowly(dest, words, bits, first, head);
+  size_t i = head;
+  for(; count - i >= BITPACK_BLOCK; i += BITPACK_BLOCK) {
+    unpack_bit_blocks[bits](dest + i, words + (first + i) / BITPACK_BLOCK * bits);
+  }
+  unpack_bits_slowly(dest + i, words, bits, first + i, count - i);
+}
+
+size_t find_packed_value(const uint64_t * words, unsigned int bits, size_t first, size_t count, uint32_t value) {
+  if(bits == 0) {
+    return value == 0 && first < count ? first : count;
+  }
+  uint32_t batch[BITPACK_BATCH];
+  for(size_t start = first; start < count; start += BITPACK_BATCH) {
+    size_t n = count - start < BITPACK_BATCH ? count - start : BITPACK_BATCH;
+    unpack_bits(batch, words, bits, start, n);
+    for(size_t i = 0; i < n; ++i) {
+      if(batch[i] == value) {
+	return start + i;
+      }
+    }
+  }
+  return count;
+}
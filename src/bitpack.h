@@ -0,0 +1,78 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef BITPACK_H
+#define BITPACK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The maximum width in bits of a packed value
+ */
+#define MAX_BITPACK_WIDTH 32
+
+/**
+ * Finds the number of bits needed to pack values up to a maximum
+ * \param max the largest value
+ * \return the width in bits, 0 if every value is 0
+ */
+unsigned int get_bitpack_width(uint32_t max);
+
+/**
+ * Finds the number of 64 bit words holding packed values
+ * \param count the number of values
+ * \param bits the width of the values
+ * \return the number of words
+ */
+size_t get_bitpack_words(size_t count, unsigned int bits);
+
+/**
+ * Packs values into consecutive fields of a fixed width, low bits first, which may straddle two words
+ * \param dest the destination words, get_bitpack_words(count, bits) of them
+ * \param values the values, each below 2^bits
+ * \param count the number of values
+ * \param bits the width of the values, at most MAX_BITPACK_WIDTH
+ */
+void pack_bits(uint64_t * dest, const uint32_t * values, size_t count, unsigned int bits);
+
+/**
+ * Reads one packed value
+ * \param words the packed words
+ * \param bits the width of the values
+ * \param index the index of the value
+ * \return the value
+ */
+uint32_t get_packed_value(const uint64_t * words, unsigned int bits, size_t index);
+
+/**
+ * Unpacks consecutive values
+ * \param dest the destination for the values
+ * \param words the packed words
+ * \param bits the width of the values
+ * \param first the index of the first value
+ * \param count the number of values
+ */
+void unpack_bits(uint32_t * dest, const uint64_t * words, unsigned int bits, size_t first, size_t count);
+
+/**
+ * Finds the next packed value equal to a value
+ * \param words the packed words
+ * \param bits the width of the values
+ * \param first the index to start at
+ * \param count the number of values
+ * \param value the value
+ * \return the index of the first equal value from first on, or count if there is none
+ */
+size_t find_packed_value(const uint64_t * words, unsigned int bits, size_t first, size_t count, uint32_t value);
+
+#endif
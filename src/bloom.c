@@ -0,0 +1,108 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "bloom"
+
+#include "bloom.h"
+#include "hash_index.h"
+#include "logger.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The minimum number of bytes of a Bloom filter, so tiny filters are not all false positives
+ */
+#define MIN_BLOOM_FILTER_SIZE 8
+
+int init_bloom_filter(struct bloom_filter * b, size_t count, unsigned int bits_per_key) {
+  assert(b != NULL);
+  assert(bits_per_key > 0);
+
+  // k = bits per key * ln 2 minimizes the false positive rate
+  uint32_t hash_count = (uint32_t) (bits_per_key * 69 / 100);
+  if(hash_count < 1) {
+    hash_count = 1;
+  } else if(hash_count > MAX_BLOOM_HASH_COUNT) {
+    hash_count = MAX_BLOOM_HASH_COUNT;
+  }
+  size_t size = (count * bits_per_key + 7) / 8;
+  return init_bloom_filter_bits(b, size < MIN_BLOOM_FILTER_SIZE ? MIN_BLOOM_FILTER_SIZE : size, hash_count);
+}
+
+int init_bloom_filter_bits(struct bloom_filter * b, size_t size, uint32_t hash_count) {
+  assert(b != NULL);
+
+  if(size == 0 || hash_count == 0 || hash_count > MAX_BLOOM_HASH_COUNT) {
+    LOG_ERROR("invalid Bloom filter of %lu bytes and %u hashes", (unsigned long) size, hash_count);
+    return -1;
+  }
+  b->bits = (unsigned char *) calloc(size, 1);
+  if(b->bits == NULL) {
+    LOG_ERROR("could not allocate a Bloom filter of %lu bytes", (unsigned long) size);
+    return -1;
+  }
+  b->size = size;
+  b->hash_count = hash_count;
+  return 0;
+}
+
+uint64_t hash_bloom_key(const char * key, size_t len) {
+  return hash_index_key(key, len);
+}
+
+void add_bloom_hash(struct bloom_filter * b, uint64_t hash) {
+  assert(b != NULL);
+
+  uint64_t bits = (uint64_t) b->size * 8;
+  uint32_t h = (uint32_t) hash;
+  uint32_t delta = (uint32_t) (hash >> 32) | 1;
+  for(uint32_t i = 0; i < b->hash_count; ++i) {
+    uint64_t bit = h % bits;
+    b->bits[bit / 8] |= (unsigned char) (1u << (bit % 8));
+    h += delta;
+  }
+}
+
+bool test_bloom_hash(const struct bloom_filter * b, uint64_t hash) {
+  assert(b != NULL);
+
+  uint64_t bits = (uint64_t) b->size * 8;
+  uint32_t h = (uint32_t) hash;
+  uint32_t delta = (uint32_t) (hash >> 32) | 1;
+  for(uint32_t i = 0; i < b->hash_count; ++i) {
+    uint64_t bit = h % bits;
+    if((b->bits[bit / 8] & (1u << (bit % 8))) == 0) {
+      return false;
+    }
+    h += delta;
+  }
+  return true;
+}
+
+void add_bloom_key(struct bloom_filter * b, const char * key, size_t len) {
+  add_bloom_hash(b, hash_bloom_key(key, len));
+}
+
+bool test_bloom_key(const struct bloom_filter * b, const char * key, size_t len) {
+  return test_bloom_hash(b, hash_bloom_key(key, len));
+}
+
+void dispose_bloom_filter(struct bloom_filter * b) {
+  assert(b != NULL);
+
+  free(b->bits);
+  b->bits = NULL;
+  b->size = 0;
+}
@@ -0,0 +1,115 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The default number of bits per key, for a false positive rate of about 1%
+ */
+#define DEFAULT_BLOOM_BITS_PER_KEY 10
+
+/**
+ * The maximum number of hash functions of a Bloom filter
+ */
+#define MAX_BLOOM_HASH_COUNT 30
+
+/**
+ * A Bloom filter, answering whether a key may have been added with no false negatives
+ * The probes are derived from a single 64 bit hash of the key by double hashing
+ */
+struct bloom_filter {
+  /**
+   * The bits
+   */
+  unsigned char * bits;
+
+  /**
+   * The number of bytes of the bits
+   */
+  size_t size;
+
+  /**
+   * The number of bits set per key
+   */
+  uint32_t hash_count;
+};
+
+/**
+ * Initializes an empty Bloom filter sized for a number of keys
+ * \param b the Bloom filter
+ * \param count the expected number of keys
+ * \param bits_per_key the number of bits per key, trading memory for fewer false positives
+ * \return 0 on success, -1 on error
+ */
+int init_bloom_filter(struct bloom_filter * b, size_t count, unsigned int bits_per_key);
+
+/**
+ * Initializes an empty Bloom filter of a given size, to read stored bits into
+ * \param b the Bloom filter
+ * \param size the number of bytes of the bits
+ * \param hash_count the number of bits set per key
+ * \return 0 on success, -1 on error
+ */
+int init_bloom_filter_bits(struct bloom_filter * b, size_t size, uint32_t hash_count);
+
+/**
+ * Hashes a key for a Bloom filter
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \return the hash
+ */
+uint64_t hash_bloom_key(const char * key, size_t len);
+
+/**
+ * Adds a key to a Bloom filter by its hash
+ * \param b the Bloom filter
+ * \param hash the hash of the key
+ */
+void add_bloom_hash(struct bloom_filter * b, uint64_t hash);
+
+/**
+ * Tests whether a key may have been added to a Bloom filter by its hash
+ * \param b the Bloom filter
+ * \param hash the hash of the key
+ * \return false if the key was never added, true if it may have been
+ */
+bool test_bloom_hash(const struct bloom_filter * b, uint64_t hash);
+
+/**
+ * Adds a key to a Bloom filter
+ * \param b the Bloom filter
+ * \param key the bytes of the key
+ * \param len the length of the key
+ */
+void add_bloom_key(struct bloom_filter * b, const char * key, size_t len);
+
+/**
+ * Tests whether a key may have been added to a Bloom filter
+ * \param b the Bloom filter
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \return false if the key was never added, true if it may have been
+ */
+bool test_bloom_key(const struct bloom_filter * b, const char * key, size_t len);
+
+/**
+ * Releases the memory of a Bloom filter
+ * \param b the Bloom filter
+ */
+void dispose_bloom_filter(struct bloom_filter * b);
+
+#endif
@@ -0,0 +1,1071 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "btree"
+
+#include "btree.h"
+#include "logger.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * The permissions of newly created B+tree files
+ */
+#define BTREE_FILE_MODE 0644
+
+/**
+ * The value written to detect files of a different byte order
+ */
+#define BTREE_BYTE_ORDER 0x01020304u
+
+/**
+ * The version of the file format
+ */
+#define BTREE_FORMAT_VERSION 1
+
+/**
+ * The page holding the root and the height
+ */
+#define BTREE_META_PAGE 0
+
+/**
+ * The link of the last leaf
+ */
+#define NO_BTREE_PAGE UINT64_MAX
+
+/**
+ * The type of a node
+ */
+enum btree_node_type {
+  /**
+   * A node holding entries
+   */
+  BTREE_NODE_LEAF = 1,
+
+  /**
+   * A node holding separator keys and children
+   */
+  BTREE_NODE_INTERNAL
+};
+
+/**
+ * The contents of the meta page
+ */
+struct btree_meta {
+  /**
+   * BTREE_MAGIC
+   */
+  char magic[8];
+
+  /**
+   * BTREE_BYTE_ORDER
+   */
+  uint32_t byte_order;
+
+  /**
+   * BTREE_FORMAT_VERSION
+   */
+  uint32_t version;
+
+  /**
+   * The page of the root node
+   */
+  uint64_t root;
+
+  /**
+   * The number of levels
+   */
+  uint32_t height;
+
+  /**
+   * Unused
+   */
+  uint32_t reserved;
+
+  /**
+   * The number of entries
+   */
+  uint64_t entry_count;
+};
+
+/**
+ * The header at the start of every node, followed by the common prefix of the keys,
+ * the offsets of the entries and the entries: the length of the rest of the key, the rest of the key,
+ * the value and for internal nodes the child holding the keys from this one up to the next
+ */
+struct btree_node_header {
+  /**
+   * The type of the node
+   */
+  uint8_t type;
+
+  /**
+   * Unused
+   */
+  uint8_t reserved;
+
+  /**
+   * The number of entries
+   */
+  uint16_t count;
+
+  /**
+   * The length of the common prefix of the keys
+   */
+  uint16_t prefix_len;
+
+  /**
+   * Unused
+   */
+  uint16_t reserved2;
+
+  /**
+   * The next leaf for leaves, the child holding the keys before the first one for internal nodes
+   */
+  uint64_t link;
+};
+
+/**
+ * The space taken in a node by an entry besides the rest of its key
+ */
+#define BTREE_LEAF_ENTRY_OVERHEAD (sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint64_t))
+
+/**
+ * The space taken in an internal node by an entry besides the rest of its key
+ */
+#define BTREE_INTERNAL_ENTRY_OVERHEAD (BTREE_LEAF_ENTRY_OVERHEAD + sizeof(uint64_t))
+
+/**
+ * The maximum number of entries of a node
+ */
+#define MAX_BTREE_NODE_ENTRIES ((BUFFER_PAGE_SIZE - sizeof(struct btree_node_header)) / BTREE_LEAF_ENTRY_OVERHEAD)
+
+/**
+ * An entry of a node in memory, its key is the concatenation of two byte ranges
+ * so that entries can point at the shared prefix of the node they come from
+ */
+struct btree_item {
+  /**
+   * The first part of the key
+   */
+  const char * prefix;
+
+  /**
+   * The length of the first part
+   */
+  size_t prefix_len;
+
+  /**
+   * The second part of the key
+   */
+  const char * suffix;
+
+  /**
+   * The length of the second part
+   */
+  size_t suffix_len;
+
+  /**
+   * The value
+   */
+  uint64_t value;
+
+  /**
+   * The child of an internal node entry
+   */
+  uint64_t child;
+};
+
+/**
+ * The node being filled at one level of a bulk load
+ */
+struct btree_builder_level {
+  /**
+   * The entries, for internal levels the first one names the leftmost child and is moved up when the node is written
+   */
+  struct btree_item items[MAX_BTREE_NODE_ENTRIES + 1];
+
+  /**
+   * The number of entries
+   */
+  size_t count;
+
+  /**
+   * The key of the first entry, the other entries share its first bytes
+   */
+  char first[MAX_BTREE_KEY_LENGTH];
+
+  /**
+   * The bytes of the other keys after the part shared with the first key
+   */
+  char suffixes[BUFFER_PAGE_SIZE + MAX_BTREE_KEY_LENGTH];
+
+  /**
+   * The number of bytes used in the suffixes
+   */
+  size_t suffixes_len;
+
+  /**
+   * The common prefix length of the keys
+   */
+  size_t prefix_len;
+
+  /**
+   * The total length of the keys
+   */
+  size_t keys_len;
+
+  /**
+   * Whether a node was written at this level, if not the level holds the root
+   */
+  bool written;
+};
+
+/**
+ * The state of a bulk load
+ */
+struct btree_builder {
+  /**
+   * The B+tree
+   */
+  struct btree * tree;
+
+  /**
+   * The levels being filled, allocated as the tree grows
+   */
+  struct btree_builder_level * levels[MAX_BTREE_HEIGHT];
+
+  /**
+   * The last leaf written, whose link is set when the next one is written
+   */
+  uint64_t last_leaf;
+};
+
+/**
+ * Gets the header of a node
+ * \param page the bytes of the page
+ * \return the header
+ */
+static struct btree_node_header * get_btree_node_header(char * page) {
+  return (struct btree_node_header *) page;
+}
+
+/**
+ * Gets the common prefix of the keys of a node
+ * \param page the bytes of the page
+ * \return the prefix
+ */
+static const char * get_btree_node_prefix(char * page) {
+  return page + sizeof(struct btree_node_header);
+}
+
+/**
+ * Reads an entry of a node
+ * \param page the bytes of the page
+ * \param index the index of the entry
+ * \param suffix the destination for the rest of the key after the common prefix
+ * \param suffix_len the destination for the length of the rest of the key
+ * \param value the destination for the value
+ * \param child the destination for the child, or NULL for leaves
+ */
+static void read_btree_entry(char * page, size_t index, const char ** suffix, size_t * suffix_len, uint64_t * value, uint64_t * child) {
+  struct btree_node_header * header = get_btree_node_header(page);
+  const char * offsets = get_btree_node_prefix(page) + header->prefix_len;
+  uint16_t offset;
+  uint16_t len;
+  memcpy(&offset, offsets + index * sizeof(uint16_t), sizeof(uint16_t));
+  memcpy(&len, page + offset, sizeof(uint16_t));
+  *suffix = page + offset + sizeof(uint16_t);
+  *suffix_len = len;
+  memcpy(value, *suffix + len, sizeof(uint64_t));
+  if(child != NULL) {
+    memcpy(child, *suffix + len + sizeof(uint64_t), sizeof(uint64_t));
+  }
+}
+
+/**
+ * Compares an entry of a node with a key whose first bytes equal the common prefix of the node
+ * \param page the bytes of the page
+ * \param index the index of the entry
+ * \param rest the bytes of the key after the common prefix
+ * \param rest_len the length of the rest of the key
+ * \param value the value
+ * \return less than, equal to or greater than 0 if the entry is less than, equal to or greater than the key and value
+ */
+static int compare_btree_entry(char * page, size_t index, const char * rest, size_t rest_len, uint64_t value) {
+  const char * suffix;
+  size_t suffix_len;
+  uint64_t entry_value;
+  read_btree_entry(page, index, &suffix, &suffix_len, &entry_value, NULL);
+  int result = memcmp(suffix, rest, suffix_len < rest_len ? suffix_len : rest_len);
+  if(result != 0) {
+    return result;
+  }
+  if(suffix_len != rest_len) {
+    return suffix_len < rest_len ? -1 : 1;
+  }
+  if(entry_value != value) {
+    return entry_value < value ? -1 : 1;
+  }
+  return 0;
+}
+
+/**
+ * Counts the entries of a node ordered before a key and value
+ * The key is compared with the common prefix once and with the rest of the entry keys by binary search
+ * \param page the bytes of the page
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param value the value
+ * \param inclusive whether entries equal to the key and value are counted
+ * \return the number of entries
+ */
+static size_t count_btree_entries_before(char * page, const char * key, size_t len, uint64_t value, bool inclusive) {
+  struct btree_node_header * header = get_btree_node_header(page);
+  size_t prefix_len = header->prefix_len;
+  int result = memcmp(get_btree_node_prefix(page), key, prefix_len < len ? prefix_len : len);
+  if(result < 0) {
+    return header->count;
+  }
+  if(result > 0 || len < prefix_len) {
+    return 0;
+  }
+  size_t low = 0;
+  size_t high = header->count;
+  while(low < high) {
+    size_t middle = low + (high - low) / 2;
+    result = compare_btree_entry(page, middle, key + prefix_len, len - prefix_len, value);
+    if(result < 0 || (inclusive && result == 0)) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+/**
+ * Gets the length of the key of an item
+ * \param item the item
+ * \return the length
+ */
+static size_t get_btree_item_length(const struct btree_item * item) {
+  return item->prefix_len + item->suffix_len;
+}
+
+/**
+ * Copies bytes of the key of an item, the destination may be the first part of the key itself
+ * \param item the item
+ * \param from the offset of the first byte to copy
+ * \param len the number of bytes to copy
+ * \param dest the destination
+ */
+static void copy_btree_item_key(const struct btree_item * item, size_t from, size_t len, char * dest) {
+  if(from < item->prefix_len) {
+    size_t part = item->prefix_len - from < len ? item->prefix_len - from : len;
+    memmove(dest, item->prefix + from, part);
+    dest += part;
+    from += part;
+    len -= part;
+  }
+  if(len > 0) {
+    memmove(dest, item->suffix + (from - item->prefix_len), len);
+  }
+}
+
+/**
+ * Gets a byte of the key of an item
+ * \param item the item
+ * \param index the index of the byte
+ * \return the byte
+ */
+static char get_btree_item_byte(const struct btree_item * item, size_t index) {
+  return index < item->prefix_len ? item->prefix[index] : item->suffix[index - item->prefix_len];
+}
+
+/**
+ * Computes the length of the common prefix of the keys of two items
+ * \param a the first item
+ * \param b the second item
+ * \return the length
+ */
+static size_t get_btree_common_prefix(const struct btree_item * a, const struct btree_item * b) {
+  size_t a_len = get_btree_item_length(a);
+  size_t b_len = get_btree_item_length(b);
+  size_t len = a_len < b_len ? a_len : b_len;
+  size_t i = 0;
+  while(i < len && get_btree_item_byte(a, i) == get_btree_item_byte(b, i)) {
+    ++i;
+  }
+  return i;
+}
+
+/**
+ * Compares an item with a key and value
+ * \param item the item
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param value the value
+ * \return less than, equal to or greater than 0 if the item is less than, equal to or greater than the key and value
+ */
+static int compare_btree_item(const struct btree_item * item, const char * key, size_t len, uint64_t value) {
+  struct btree_item other = {key, len, NULL, 0, value, 0};
+  size_t common = get_btree_common_prefix(item, &other);
+  size_t item_len = get_btree_item_length(item);
+  if(common < item_len && common < len) {
+    return (unsigned char) get_btree_item_byte(item, common) < (unsigned char) key[common] ? -1 : 1;
+  }
+  if(item_len != len) {
+    return item_len < len ? -1 : 1;
+  }
+  if(item->value != value) {
+    return item->value < value ? -1 : 1;
+  }
+  return 0;
+}
+
+/**
+ * Computes the size of a node, the items being sorted
+ * \param items the items
+ * \param count the number of items
+ * \param leaf whether the node is a leaf
+ * \return the size in bytes
+ */
+static size_t get_btree_node_size(const struct btree_item * items, size_t count, bool leaf) {
+  size_t size = sizeof(struct btree_node_header);
+  if(count == 0) {
+    return size;
+  }
+  size_t prefix_len = get_btree_common_prefix(&items[0], &items[count - 1]);
+  size += prefix_len + count * (leaf ? BTREE_LEAF_ENTRY_OVERHEAD : BTREE_INTERNAL_ENTRY_OVERHEAD);
+  for(size_t i = 0; i < count; ++i) {
+    size += get_btree_item_length(&items[i]) - prefix_len;
+  }
+  return size;
+}
+
+/**
+ * Writes a node, the items being sorted and fitting in a page
+ * \param page the bytes of the page
+ * \param leaf whether the node is a leaf
+ * \param link the next leaf or the leftmost child
+ * \param items the items, which must not point into the page
+ * \param count the number of items
+ */
+static void write_btree_node(char * page, bool leaf, uint64_t link, const struct btree_item * items, size_t count) {
+  assert(get_btree_node_size(items, count, leaf) <= BUFFER_PAGE_SIZE);
+
+  struct btree_node_header * header = get_btree_node_header(page);
+  size_t prefix_len = count != 0 ? get_btree_common_prefix(&items[0], &items[count - 1]) : 0;
+  memset(header, 0, sizeof(struct btree_node_header));
+  header->type = leaf ? BTREE_NODE_LEAF : BTREE_NODE_INTERNAL;
+  header->count = (uint16_t) count;
+  header->prefix_len = (uint16_t) prefix_len;
+  header->link = link;
+  char * prefix = page + sizeof(struct btree_node_header);
+  if(count != 0) {
+    copy_btree_item_key(&items[0], 0, prefix_len, prefix);
+  }
+  char * offsets = prefix + prefix_len;
+  size_t offset = (size_t) (offsets - page) + count * sizeof(uint16_t);
+  for(size_t i = 0; i < count; ++i) {
+    uint16_t entry_offset = (uint16_t) offset;
+    uint16_t suffix_len = (uint16_t) (get_btree_item_length(&items[i]) - prefix_len);
+    memcpy(offsets + i * sizeof(uint16_t), &entry_offset, sizeof(uint16_t));
+    memcpy(page + offset, &suffix_len, sizeof(uint16_t));
+    offset += sizeof(uint16_t);
+    copy_btree_item_key(&items[i], prefix_len, suffix_len, page + offset);
+    offset += suffix_len;
+    memcpy(page + offset, &items[i].value, sizeof(uint64_t));
+    offset += sizeof(uint64_t);
+    if(!leaf) {
+      memcpy(page + offset, &items[i].child, sizeof(uint64_t));
+      offset += sizeof(uint64_t);
+    }
+  }
+}
+
+/**
+ * Reads the entries of a node as items pointing into the page
+ * \param page the bytes of the page
+ * \param items the destination for the items
+ * \return the number of items
+ */
+static size_t read_btree_node(char * page, struct btree_item * items) {
+  struct btree_node_header * header = get_btree_node_header(page);
+  bool leaf = header->type == BTREE_NODE_LEAF;
+  for(size_t i = 0; i < header->count; ++i) {
+    items[i].prefix = get_btree_node_prefix(page);
+    items[i].prefix_len = header->prefix_len;
+    read_btree_entry(page, i, &items[i].suffix, &items[i].suffix_len, &items[i].value, leaf ? NULL : &items[i].child);
+  }
+  return header->count;
+}
+
+/**
+ * Finds where to split an overflowing node so that both halves fit in a page and are about the same size
+ * \param items the items
+ * \param count the number of items
+ * \param leaf whether the node is a leaf, internal nodes move the item at the split point up
+ * \return the index of the first item of the right half or 0 if there is none
+ */
+static size_t find_btree_split(const struct btree_item * items, size_t count, bool leaf) {
+  size_t best = 0;
+  size_t best_difference = SIZE_MAX;
+  for(size_t i = 1; i + 1 < count + (leaf ? 1 : 0); ++i) {
+    size_t left = get_btree_node_size(items, i, leaf);
+    size_t right = leaf ? get_btree_node_size(items + i, count - i, leaf) : get_btree_node_size(items + i + 1, count - i - 1, leaf);
+    if(left > BUFFER_PAGE_SIZE || right > BUFFER_PAGE_SIZE) {
+      continue;
+    }
+    size_t difference = left > right ? left - right : right - left;
+    if(difference < best_difference) {
+      best = i;
+      best_difference = difference;
+    }
+  }
+  return best;
+}
+
+/**
+ * Writes the root, the height and the number of entries to the meta page
+ * \param tree the B+tree
+ * \return 0 on success, -1 on error
+ */
+static int write_btree_meta(struct btree * tree) {
+  char * page = pin_buffer_page(tree->pool, tree->file, BTREE_META_PAGE);
+  if(page == NULL) {
+    return -1;
+  }
+  struct btree_meta meta;
+  memset(&meta, 0, sizeof(struct btree_meta));
+  memcpy(meta.magic, BTREE_MAGIC, sizeof(meta.magic));
+  meta.byte_order = BTREE_BYTE_ORDER;
+  meta.version = BTREE_FORMAT_VERSION;
+  meta.root = tree->root;
+  meta.height = tree->height;
+  meta.entry_count = tree->entry_count;
+  memcpy(page, &meta, sizeof(struct btree_meta));
+  unpin_buffer_page(tree->pool, page, true);
+  return 0;
+}
+
+/**
+ * Creates the meta page and an empty root leaf in an empty file
+ * \param tree the B+tree
+ * \return 0 on success, -1 on error
+ */
+static int create_btree(struct btree * tree) {
+  uint64_t page_number;
+  char * page = allocate_buffer_page(tree->pool, tree->file, &page_number);
+  if(page == NULL) {
+    return -1;
+  }
+  unpin_buffer_page(tree->pool, page, true);
+  page = allocate_buffer_page(tree->pool, tree->file, &tree->root);
+  if(page == NULL) {
+    return -1;
+  }
+  write_btree_node(page, true, NO_BTREE_PAGE, NULL, 0);
+  unpin_buffer_page(tree->pool, page, true);
+  tree->height = 1;
+  tree->entry_count = 0;
+  return write_btree_meta(tree);
+}
+
+/**
+ * Reads the meta page of an existing file
+ * \param tree the B+tree
+ * \param path the path of the file for messages
+ * \return 0 on success, -1 on error
+ */
+static int read_btree_meta(struct btree * tree, const char * path) {
+  char * page = pin_buffer_page(tree->pool, tree->file, BTREE_META_PAGE);
+  if(page == NULL) {
+    return -1;
+  }
+  struct btree_meta meta;
+  memcpy(&meta, page, sizeof(struct btree_meta));
+  unpin_buffer_page(tree->pool, page, false);
+  if(memcmp(meta.magic, BTREE_MAGIC, sizeof(meta.magic)) != 0) {
+    LOG_ERROR("%s is not a B+tree file", path);
+    return -1;
+  }
+  if(meta.byte_order != BTREE_BYTE_ORDER || meta.version != BTREE_FORMAT_VERSION) {
+    LOG_ERROR("B+tree file %s has an unsupported byte order or version", path);
+    return -1;
+  }
+  if(meta.height == 0 || meta.height > MAX_BTREE_HEIGHT || meta.root >= get_buffer_page_count(tree->pool, tree->file)) {
+    LOG_ERROR("B+tree file %s is corrupt", path);
+    return -1;
+  }
+  tree->root = meta.root;
+  tree->height = meta.height;
+  tree->entry_count = meta.entry_count;
+  return 0;
+}
+
+int open_btree(struct btree * tree, struct buffer_pool * pool, const char * path) {
+  assert(tree != NULL);
+  assert(pool != NULL);
+  assert(path != NULL);
+
+  memset(tree, 0, sizeof(struct btree));
+  tree->pool = pool;
+  tree->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, BTREE_FILE_MODE);
+  if(tree->fd < 0) {
+    LOG_ERROR("could not open B+tree file %s: %s", path, strerror(errno));
+    return -1;
+  }
+  int file = add_buffer_file(pool, tree->fd);
+  if(file < 0) {
+    close(tree->fd);
+    return -1;
+  }
+  tree->file = (uint32_t) file;
+  int result = pthread_mutex_init(&tree->mutex, NULL);
+  if(result != 0) {
+    LOG_ERROR("could not initialize B+tree mutex: %s", strerror(result));
+    remove_buffer_file(pool, tree->file);
+    close(tree->fd);
+    return -1;
+  }
+  if(get_buffer_page_count(pool, tree->file) == 0) {
+    result = create_btree(tree);
+  } else {
+    result = read_btree_meta(tree, path);
+  }
+  if(result != 0) {
+    close_btree(tree);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Finds the nodes from the root to the leaf where a key and value belong
+ * \param tree the B+tree
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param value the value
+ * \param path the destination for the pages of the nodes, from the root to the leaf
+ * \return 0 on success, -1 on error
+ */
+static int find_btree_path(struct btree * tree, const char * key, size_t len, uint64_t value, uint64_t * path) {
+  path[0] = tree->root;
+  for(uint32_t level = 0; level + 1 < tree->height; ++level) {
+    char * page = pin_buffer_page(tree->pool, tree->file, path[level]);
+    if(page == NULL) {
+      return -1;
+    }
+    struct btree_node_header * header = get_btree_node_header(page);
+    if(header->type != BTREE_NODE_INTERNAL) {
+      LOG_ERROR("B+tree page %lu is not an internal node", (unsigned long) path[level]);
+      unpin_buffer_page(tree->pool, page, false);
+      return -1;
+    }
+    // The separators are the first entries of their children, so equal entries are on the right
+    size_t index = count_btree_entries_before(page, key, len, value, true);
+    if(index == 0) {
+      path[level + 1] = header->link;
+    } else {
+      const char * suffix;
+      size_t suffix_len;
+      uint64_t separator_value;
+      read_btree_entry(page, index - 1, &suffix, &suffix_len, &separator_value, &path[level + 1]);
+    }
+    unpin_buffer_page(tree->pool, page, false);
+  }
+  return 0;
+}
+
+int insert_btree_entry(struct btree * tree, const char * key, size_t len, uint64_t value) {
+  assert(tree != NULL);
+  assert(key != NULL || len == 0);
+
+  if(len > MAX_BTREE_KEY_LENGTH) {
+    LOG_ERROR("B+tree key of %zu bytes too long", len);
+    return -1;
+  }
+  if(pthread_mutex_lock(&tree->mutex) != 0) {
+    LOG_ERROR("could not lock B+tree");
+    return -1;
+  }
+  uint64_t path[MAX_BTREE_HEIGHT];
+  if(find_btree_path(tree, key, len, value, path) != 0) {
+    pthread_mutex_unlock(&tree->mutex);
+    return -1;
+  }
+
+  // The entry is added to the leaf, and each split adds a separator to the level above
+  static _Thread_local char copy[BUFFER_PAGE_SIZE];
+  static _Thread_local struct btree_item items[MAX_BTREE_NODE_ENTRIES + 1];
+  char separator[MAX_BTREE_KEY_LENGTH];
+  struct btree_item carry = {key, len, NULL, 0, value, 0};
+  int result = 0;
+  for(uint32_t level = tree->height; level-- > 0;) {
+    char * page = pin_buffer_page(tree->pool, tree->file, path[level]);
+    if(page == NULL) {
+      result = -1;
+      break;
+    }
+    memcpy(copy, page, BUFFER_PAGE_SIZE);
+    struct btree_node_header * header = get_btree_node_header(copy);
+    bool leaf = header->type == BTREE_NODE_LEAF;
+    size_t index = count_btree_entries_before(copy, carry.prefix, carry.prefix_len, carry.value, true);
+    size_t count = read_btree_node(copy, items);
+    memmove(items + index + 1, items + index, (count - index) * sizeof(struct btree_item));
+    items[index] = carry;
+    ++count;
+    if(get_btree_node_size(items, count, leaf) <= BUFFER_PAGE_SIZE) {
+      write_btree_node(page, leaf, header->link, items, count);
+      unpin_buffer_page(tree->pool, page, true);
+      break;
+    }
+
+    size_t split = find_btree_split(items, count, leaf);
+    uint64_t right_number;
+    char * right = split != 0 ? allocate_buffer_page(tree->pool, tree->file, &right_number) : NULL;
+    if(right == NULL) {
+      if(split == 0) {
+	LOG_ERROR("could not split B+tree page %lu", (unsigned long) path[level]);
+      }
+      unpin_buffer_page(tree->pool, page, false);
+      result = -1;
+      break;
+    }
+    if(leaf) {
+      write_btree_node(right, true, header->link, items + split, count - split);
+      write_btree_node(page, true, right_number, items, split);
+    } else {
+      write_btree_node(right, false, items[split].child, items + split + 1, count - split - 1);
+      write_btree_node(page, false, header->link, items, split);
+    }
+    size_t separator_len = get_btree_item_length(&items[split]);
+    copy_btree_item_key(&items[split], 0, separator_len, separator);
+    carry = (struct btree_item) {separator, separator_len, NULL, 0, items[split].value, right_number};
+    unpin_buffer_page(tree->pool, right, true);
+    unpin_buffer_page(tree->pool, page, true);
+
+    if(level == 0) {
+      if(tree->height == MAX_BTREE_HEIGHT) {
+	LOG_ERROR("B+tree too high");
+	result = -1;
+	break;
+      }
+      uint64_t root_number;
+      char * root = allocate_buffer_page(tree->pool, tree->file, &root_number);
+      if(root == NULL) {
+	result = -1;
+	break;
+      }
+      write_btree_node(root, false, tree->root, &carry, 1);
+      unpin_buffer_page(tree->pool, root, true);
+      tree->root = root_number;
+      ++tree->height;
+    }
+  }
+  if(result == 0) {
+    ++tree->entry_count;
+    result = write_btree_meta(tree);
+  }
+  pthread_mutex_unlock(&tree->mutex);
+  return result;
+}
+
+static int add_btree_builder_item(struct btree_builder * builder, size_t level, const struct btree_item * item);
+
+/**
+ * Writes the node being filled at a level of a bulk load and adds its first key to the level above
+ * \param builder the bulk load
+ * \param level the level
+ * \return 0 on success, -1 on error
+ */
+static int write_btree_builder_level(struct btree_builder * builder, size_t level) {
+  struct btree * tree = builder->tree;
+  struct btree_builder_level * l = builder->levels[level];
+  uint64_t page_number;
+  char * page;
+  if(level == 0 && builder->last_leaf == NO_BTREE_PAGE) {
+    // The first leaf goes to the empty root leaf of the new tree
+    page_number = tree->root;
+    page = pin_buffer_page(tree->pool, tree->file, page_number);
+  } else {
+    page = allocate_buffer_page(tree->pool, tree->file, &page_number);
+  }
+  if(page == NULL) {
+    return -1;
+  }
+  if(level == 0) {
+    write_btree_node(page, true, NO_BTREE_PAGE, l->items, l->count);
+    unpin_buffer_page(tree->pool, page, true);
+    if(builder->last_leaf != NO_BTREE_PAGE) {
+      char * last = pin_buffer_page(tree->pool, tree->file, builder->last_leaf);
+      if(last == NULL) {
+	return -1;
+      }
+      get_btree_node_header(last)->link = page_number;
+      unpin_buffer_page(tree->pool, last, true);
+    }
+    builder->last_leaf = page_number;
+  } else {
+    write_btree_node(page, false, l->items[0].child, l->items + 1, l->count - 1);
+    unpin_buffer_page(tree->pool, page, true);
+  }
+  l->written = true;
+  if(level + 1 == MAX_BTREE_HEIGHT) {
+    LOG_ERROR("B+tree too high");
+    return -1;
+  }
+  struct btree_item first = l->items[0];
+  first.child = page_number;
+  int result = add_btree_builder_item(builder, level + 1, &first);
+  l->count = 0;
+  return result;
+}
+
+/**
+ * Adds an item to the node being filled at a level of a bulk load, writing the node first if the item does not fit
+ * \param builder the bulk load
+ * \param level the level
+ * \param item the item, copied
+ * \return 0 on success, -1 on error
+ */
+static int add_btree_builder_item(struct btree_builder * builder, size_t level, const struct btree_item * item) {
+  struct btree_builder_level * l = builder->levels[level];
+  if(l == NULL) {
+    l = (struct btree_builder_level *) calloc(1, sizeof(struct btree_builder_level));
+    if(l == NULL) {
+      LOG_ERROR("could not allocate B+tree bulk load level");
+      return -1;
+    }
+    builder->levels[level] = l;
+  }
+  bool leaf = level == 0;
+  size_t len = get_btree_item_length(item);
+  size_t common = 0;
+  if(l->count > 0) {
+    // The keys are sorted, so the common prefix of the node is the one of its first and last keys
+    struct btree_item first = {l->first, l->prefix_len, NULL, 0, 0, 0};
+    common = get_btree_common_prefix(&first, item);
+    size_t count = l->count + 1;
+    size_t size = sizeof(struct btree_node_header) + common + l->keys_len + len - count * common
+      + count * (leaf ? BTREE_LEAF_ENTRY_OVERHEAD : BTREE_INTERNAL_ENTRY_OVERHEAD);
+    if(size > BUFFER_PAGE_SIZE) {
+      if(write_btree_builder_level(builder, level) != 0) {
+	return -1;
+      }
+    }
+  }
+  struct btree_item * added = &l->items[l->count];
+  if(l->count == 0) {
+    copy_btree_item_key(item, 0, len, l->first);
+    *added = (struct btree_item) {l->first, len, NULL, 0, item->value, item->child};
+    l->prefix_len = len;
+    l->keys_len = 0;
+    l->suffixes_len = 0;
+  } else {
+    char * suffix = l->suffixes + l->suffixes_len;
+    copy_btree_item_key(item, common, len - common, suffix);
+    *added = (struct btree_item) {l->first, common, suffix, len - common, item->value, item->child};
+    l->suffixes_len += len - common;
+    l->prefix_len = common;
+  }
+  l->keys_len += len;
+  ++l->count;
+  return 0;
+}
+
+/**
+ * Writes the remaining nodes of a bulk load, the highest level holding a single node becomes the root
+ * \param builder the bulk load
+ * \return 0 on success, -1 on error
+ */
+static int finish_btree_builder(struct btree_builder * builder) {
+  struct btree * tree = builder->tree;
+  for(size_t level = 0; level < MAX_BTREE_HEIGHT && builder->levels[level] != NULL; ++level) {
+    struct btree_builder_level * l = builder->levels[level];
+    if(l->written) {
+      if(l->count > 0 && write_btree_builder_level(builder, level) != 0) {
+	return -1;
+      }
+      continue;
+    }
+    if(level == 0) {
+      char * page = pin_buffer_page(tree->pool, tree->file, tree->root);
+      if(page == NULL) {
+	return -1;
+      }
+      write_btree_node(page, true, NO_BTREE_PAGE, l->items, l->count);
+      unpin_buffer_page(tree->pool, page, true);
+    } else {
+      uint64_t page_number;
+      char * page = allocate_buffer_page(tree->pool, tree->file, &page_number);
+      if(page == NULL) {
+	return -1;
+      }
+      write_btree_node(page, false, l->items[0].child, l->items + 1, l->count - 1);
+      unpin_buffer_page(tree->pool, page, true);
+      tree->root = page_number;
+    }
+    tree->height = (uint32_t) level + 1;
+    break;
+  }
+  return 0;
+}
+
+int load_btree(struct btree * tree, int (*next)(void * context, struct btree_entry * entry), void * context) {
+  assert(tree != NULL);
+  assert(next != NULL);
+
+  if(pthread_mutex_lock(&tree->mutex) != 0) {
+    LOG_ERROR("could not lock B+tree");
+    return -1;
+  }
+  if(tree->entry_count != 0 || tree->height != 1) {
+    LOG_ERROR("B+tree bulk load needs an empty tree");
+    pthread_mutex_unlock(&tree->mutex);
+    return -1;
+  }
+  struct btree_builder builder;
+  memset(&builder, 0, sizeof(struct btree_builder));
+  builder.tree = tree;
+  builder.last_leaf = NO_BTREE_PAGE;
+  int result = 0;
+  struct btree_entry entry;
+  uint64_t count = 0;
+  while(result == 0 && (result = next(context, &entry)) == 1) {
+    result = 0;
+    if(entry.len > MAX_BTREE_KEY_LENGTH) {
+      LOG_ERROR("B+tree key of %zu bytes too long", entry.len);
+      result = -1;
+      break;
+    }
+    struct btree_builder_level * leaves = builder.levels[0];
+    if(leaves != NULL && leaves->count > 0 && compare_btree_item(&leaves->items[leaves->count - 1], entry.key, entry.len, entry.value) > 0) {
+      LOG_ERROR("B+tree bulk load entries are not sorted");
+      result = -1;
+      break;
+    }
+    struct btree_item item = {entry.key, entry.len, NULL, 0, entry.value, 0};
+    result = add_btree_builder_item(&builder, 0, &item);
+    ++count;
+  }
+  if(result == 0) {
+    result = finish_btree_builder(&builder);
+  }
+  if(result == 0) {
+    tree->entry_count = count;
+  }
+  if(write_btree_meta(tree) != 0) {
+    result = -1;
+  }
+  for(size_t i = 0; i < MAX_BTREE_HEIGHT; ++i) {
+    free(builder.levels[i]);
+  }
+  pthread_mutex_unlock(&tree->mutex);
+  return result;
+}
+
+int seek_btree(struct btree * tree, const char * key, size_t len, struct btree_cursor * cursor) {
+  assert(tree != NULL);
+  assert(key != NULL || len == 0);
+  assert(cursor != NULL);
+
+  if(pthread_mutex_lock(&tree->mutex) != 0) {
+    LOG_ERROR("could not lock B+tree");
+    return -1;
+  }
+  uint64_t path[MAX_BTREE_HEIGHT];
+  int result = find_btree_path(tree, key, len, 0, path);
+  char * page = NULL;
+  if(result == 0) {
+    page = pin_buffer_page(tree->pool, tree->file, path[tree->height - 1]);
+    result = page != NULL ? 0 : -1;
+  }
+  if(result == 0) {
+    cursor->tree = tree;
+    cursor->page = path[tree->height - 1];
+    cursor->index = count_btree_entries_before(page, key, len, 0, false);
+    unpin_buffer_page(tree->pool, page, false);
+  }
+  pthread_mutex_unlock(&tree->mutex);
+  return result;
+}
+
+int next_btree_entry(struct btree_cursor * cursor, char * key, size_t size, size_t * len, uint64_t * value) {
+  assert(cursor != NULL);
+  assert(key != NULL || size == 0);
+  assert(len != NULL);
+  assert(value != NULL);
+
+  struct btree * tree = cursor->tree;
+  if(pthread_mutex_lock(&tree->mutex) != 0) {
+    LOG_ERROR("could not lock B+tree");
+    return -1;
+  }
+  int result = 0;
+  while(cursor->page != NO_BTREE_PAGE) {
+    char * page = pin_buffer_page(tree->pool, tree->file, cursor->page);
+    if(page == NULL) {
+      result = -1;
+      break;
+    }
+    struct btree_node_header * header = get_btree_node_header(page);
+    if(cursor->index < header->count) {
+      struct btree_item item;
+      item.prefix = get_btree_node_prefix(page);
+      item.prefix_len = header->prefix_len;
+      read_btree_entry(page, cursor->index, &item.suffix, &item.suffix_len, value, NULL);
+      *len = get_btree_item_length(&item);
+      copy_btree_item_key(&item, 0, *len < size ? *len : size, key);
+      ++cursor->index;
+      unpin_buffer_page(tree->pool, page, false);
+      result = 1;
+      break;
+    }
+    cursor->page = header->link;
+    cursor->index = 0;
+    unpin_buffer_page(tree->pool, page, false);
+  }
+  pthread_mutex_unlock(&tree->mutex);
+  return result;
+}
+
+int close_btree(struct btree * tree) {
+  assert(tree != NULL);
+
+  int result = flush_buffer_file(tree->pool, tree->file);
+  if(remove_buffer_file(tree->pool, tree->file) != 0) {
+    result = -1;
+  }
+  if(close(tree->fd) != 0) {
+    LOG_ERROR("could not close B+tree file: %s", strerror(errno));
+    result = -1;
+  }
+  pthread_mutex_destroy(&tree->mutex);
+  return result;
+}
+
+void encode_btree_integer(int64_t value, char * dest) {
+  // Flipping the sign bit makes negative numbers sort before positive ones
+  uint64_t bits = (uint64_t) value ^ (UINT64_C(1) << 63);
+  for(size_t i = 0; i < BTREE_INTEGER_KEY_LENGTH; ++i) {
+    dest[i] = (char) (bits >> (8 * (BTREE_INTEGER_KEY_LENGTH - 1 - i)));
+  }
+}
@@ -0,0 +1,189 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef BTREE_H
+#define BTREE_H
+
+#include "buffer_pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The magic number at the start of a B+tree file
+ */
+#define BTREE_MAGIC "DBBTREE\1"
+
+/**
+ * The maximum length of a key, so that every node holds several entries
+ */
+#define MAX_BTREE_KEY_LENGTH 1024
+
+/**
+ * The maximum number of levels of a B+tree
+ */
+#define MAX_BTREE_HEIGHT 16
+
+/**
+ * The length of an integer key
+ */
+#define BTREE_INTEGER_KEY_LENGTH 8
+
+/**
+ * An entry of a B+tree: a key and a value, entries are ordered by key and then by value
+ */
+struct btree_entry {
+  /**
+   * The bytes of the key
+   */
+  const char * key;
+
+  /**
+   * The length of the key
+   */
+  size_t len;
+
+  /**
+   * The value
+   */
+  uint64_t value;
+};
+
+/**
+ * A B+tree of page sized nodes in a file cached by a buffer pool
+ * Page 0 holds the root and the height, the other pages are nodes storing the common prefix of their keys once
+ * followed by the remaining bytes of each key, and the leaves are linked in key order for range scans
+ */
+struct btree {
+  /**
+   * The buffer pool caching the pages
+   */
+  struct buffer_pool * pool;
+
+  /**
+   * The ID of the file in the buffer pool
+   */
+  uint32_t file;
+
+  /**
+   * The file descriptor
+   */
+  int fd;
+
+  /**
+   * The mutex serializing the operations on the tree
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * The page of the root node
+   */
+  uint64_t root;
+
+  /**
+   * The number of levels, 1 when the root is a leaf
+   */
+  uint32_t height;
+
+  /**
+   * The number of entries
+   */
+  uint64_t entry_count;
+};
+
+/**
+ * A position in the leaves of a B+tree, invalidated by inserts
+ */
+struct btree_cursor {
+  /**
+   * The B+tree
+   */
+  struct btree * tree;
+
+  /**
+   * The leaf of the next entry
+   */
+  uint64_t page;
+
+  /**
+   * The index of the next entry in the leaf
+   */
+  size_t index;
+};
+
+/**
+ * Opens a B+tree, creating an empty one if the file does not exist or is empty
+ * \param tree the B+tree
+ * \param pool the buffer pool to cache the pages in
+ * \param path the path of the file
+ * \return 0 on success, -1 on error
+ */
+int open_btree(struct btree * tree, struct buffer_pool * pool, const char * path);
+
+/**
+ * Inserts an entry, splitting the nodes that overflow
+ * \param tree the B+tree
+ * \param key the bytes of the key
+ * \param len the length of the key, at most MAX_BTREE_KEY_LENGTH
+ * \param value the value
+ * \return 0 on success, -1 on error
+ */
+int insert_btree_entry(struct btree * tree, const char * key, size_t len, uint64_t value);
+
+/**
+ * Builds the nodes of an empty B+tree bottom up from sorted entries, filling each node
+ * \param tree the B+tree, without entries
+ * \param next the function returning the next entry: 1 for an entry, 0 at the end, -1 on error,
+ *   the key must stay valid until the next call
+ * \param context the argument for the function
+ * \return 0 on success, -1 on error or if the entries are not sorted
+ */
+int load_btree(struct btree * tree, int (*next)(void * context, struct btree_entry * entry), void * context);
+
+/**
+ * Positions a cursor at the first entry whose key is not less than a key
+ * \param tree the B+tree
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param cursor the cursor
+ * \return 0 on success, -1 on error
+ */
+int seek_btree(struct btree * tree, const char * key, size_t len, struct btree_cursor * cursor);
+
+/**
+ * Reads the entry at a cursor and advances it
+ * \param cursor the cursor
+ * \param key the destination buffer for the key
+ * \param size the size of the destination buffer, the key is truncated if it is too small
+ * \param len the destination for the length of the key
+ * \param value the destination for the value
+ * \return 1 if there was an entry, 0 at the end of the tree, -1 on error
+ */
+int next_btree_entry(struct btree_cursor * cursor, char * key, size_t size, size_t * len, uint64_t * value);
+
+/**
+ * Writes back the pages of a B+tree, syncs it and closes it
+ * \param tree the B+tree
+ * \return 0 on success, -1 on error
+ */
+int close_btree(struct btree * tree);
+
+/**
+ * Encodes an integer as a key whose byte order matches the integer order
+ * \param value the integer
+ * \param dest the destination for the BTREE_INTEGER_KEY_LENGTH bytes of the key
+ */
+void encode_btree_integer(int64_t value, char * dest);
+
+#endif
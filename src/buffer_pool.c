@@ -0,0 +1,594 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "buffer_pool"
+
+#include "buffer_pool.h"
+#include "logger.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Marks the end of a page table chain
+ */
+#define NO_BUFFER_FRAME SIZE_MAX
+
+/**
+ * Hashes a page to a page table bucket
+ * \param pool the buffer pool
+ * \param file the ID of the file
+ * \param page the number of the page
+ * \return the bucket
+ */
+static size_t hash_buffer_page(const struct buffer_pool * pool, uint32_t file, uint64_t page) {
+  uint64_t hash = (page ^ ((uint64_t) file << 48)) * 0x9e3779b97f4a7c15ull;
+  return (size_t) (hash >> 32) & (pool->bucket_count - 1);
+}
+
+/**
+ * Finds the frame holding a page
+ * The pool mutex should be held by the caller
+ * \param pool the buffer pool
+ * \param file the ID of the file
+ * \param page the number of the page
+ * \return the index of the frame or NO_BUFFER_FRAME if the page is not cached
+ */
+static size_t find_buffer_frame(const struct buffer_pool * pool, uint32_t file, uint64_t page) {
+  size_t i = pool->buckets[hash_buffer_page(pool, file, page)];
+  while(i != NO_BUFFER_FRAME && (pool->frames[i].file != file || pool->frames[i].page != page)) {
+    i = pool->frames[i].next;
+  }
+  return i;
+}
+
+/**
+ * Enters a frame into the page table
+ * The pool mutex should be held by the caller
+ * \param pool the buffer pool
+ * \param i the index of the frame
+ */
+static void insert_buffer_frame(struct buffer_pool * pool, size_t i) {
+  size_t bucket = hash_buffer_page(pool, pool->frames[i].file, pool->frames[i].page);
+  pool->frames[i].next = pool->buckets[bucket];
+  pool->buckets[bucket] = i;
+}
+
+/**
+ * Removes a frame from the page table and marks it free
+ * The pool mutex should be held by the caller
+ * \param pool the buffer pool
+ * \param i the index of the frame
+ */
+static void remove_buffer_frame(struct buffer_pool * pool, size_t i) {
+  struct buffer_frame * f = &pool->frames[i];
+  size_t * link = &pool->buckets[hash_buffer_page(pool, f->file, f->page)];
+  while(*link != i) {
+    link = &pool->frames[*link].next;
+  }
+  *link = f->next;
+  f->valid = false;
+  f->dirty = false;
+  f->next = NO_BUFFER_FRAME;
+}
+
+/**
+ * Records a reference to a frame
+ * The pool mutex should be held by the caller
+ * \param pool the buffer pool
+ * \param f the frame
+ */
+static void touch_buffer_frame(struct buffer_pool * pool, struct buffer_frame * f) {
+  for(int k = BUFFER_LRU_K - 1; k > 0; --k) {
+    f->history[k] = f->history[k - 1];
+  }
+  f->history[0] = ++pool->clock;
+}
+
+/**
+ * Gets the data of a frame
+ * \param pool the buffer pool
+ * \param i the index of the frame
+ * \return the BUFFER_PAGE_SIZE bytes of the frame
+ */
+static char * get_buffer_frame_data(const struct buffer_pool * pool, size_t i) {
+  return pool->memory + i * BUFFER_PAGE_SIZE;
+}
+
+/**
+ * Writes a page to its file
+ * \param fd the file descriptor
+ * \param file the ID of the file
+ * \param page the number of the page
+ * \param data the memory of the frame
+ * \return 0 on success, -1 on error
+ */
+static int write_buffer_page(int fd, uint32_t file, uint64_t page, const char * data) {
+  off_t offset = (off_t) (page * BUFFER_PAGE_SIZE);
+  size_t done = 0;
+  while(done < BUFFER_PAGE_SIZE) {
+    ssize_t written = pwrite(fd, data + done, BUFFER_PAGE_SIZE - done, offset + (off_t) done);
+    if(written < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      LOG_ERROR("could not write page %lu of file %u: %s", (unsigned long) page, file, strerror(errno));
+      return -1;
+    }
+    done += (size_t) written;
+  }
+  return 0;
+}
+
+/**
+ * Writes the page of a frame to its file
+ * The pool mutex should be held by the caller, it is released while the page is written
+ * \param pool the buffer pool
+ * \param i the index of the frame, not being written by another thread
+ * \return 0 on success, -1 on error
+ */
+static int write_buffer_frame(struct buffer_pool * pool, size_t i) {
+  struct buffer_frame * f = &pool->frames[i];
+  uint32_t file = f->file;
+  uint64_t page = f->page;
+  int fd = pool->fds[file];
+  f->writing = true;
+  // Cleared before the write, so a page modified by a user that pinned it before stays dirty
+  f->dirty = false;
+  pthread_mutex_unlock(&pool->mutex);
+
+  // The page is written without holding the mutex, the writing flag keeps others from pinning or evicting the frame
+  int result = write_buffer_page(fd, file, page, get_buffer_frame_data(pool, i));
+
+  pthread_mutex_lock(&pool->mutex);
+  f->writing = false;
+  if(result != 0) {
+    f->dirty = true;
+  } else {
+    ++pool->stats.writebacks;
+  }
+  pthread_cond_broadcast(&pool->cond);
+  return result;
+}
+
+/**
+ * Waits until a frame holding a page of a file is not being written by another thread
+ * The pool mutex should be held by the caller
+ * \param pool the buffer pool
+ * \param i the index of the frame
+ * \param file the ID of the file
+ * \return 0 on success, -1 on error
+ */
+static int wait_buffer_frame(struct buffer_pool * pool, size_t i, uint32_t file) {
+  const struct buffer_frame * f = &pool->frames[i];
+  while(f->valid && f->file == file && f->writing) {
+    if(pthread_cond_wait(&pool->cond, &pool->mutex) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Reads a page into a frame, the part of the page beyond the end of the file reads as zeros
+ * \param fd the file descriptor
+ * \param page the number of the page
+ * \param data the memory of the frame
+ * \return 0 on success, -1 on error
+ */
+static int read_buffer_page(int fd, uint64_t page, char * data) {
+  off_t offset = (off_t) (page * BUFFER_PAGE_SIZE);
+  size_t done = 0;
+  while(done < BUFFER_PAGE_SIZE) {
+    ssize_t count = pread(fd, data + done, BUFFER_PAGE_SIZE - done, offset + (off_t) done);
+    if(count < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      LOG_ERROR("could not read page %lu: %s", (unsigned long) page, strerror(errno));
+      return -1;
+    }
+    if(count == 0) {
+      memset(data + done, 0, BUFFER_PAGE_SIZE - done);
+      break;
+    }
+    done += (size_t) count;
+  }
+  return 0;
+}
+
+/**
+ * Finds a frame for a new page, evicting the page with the oldest K-th most recent reference if there is no free frame
+ * The pool mutex should be held by the caller, it is released while a dirty victim is written
+ * \param pool the buffer pool
+ * \return the index of the frame or NO_BUFFER_FRAME if all frames are pinned or a dirty victim could not be written
+ */
+static size_t take_buffer_frame(struct buffer_pool * pool) {
+  for(;;) {
+    size_t victim = NO_BUFFER_FRAME;
+    bool victim_full = true;
+    uint64_t victim_time = UINT64_MAX;
+    bool writing = false;
+    for(size_t i = 0; i < pool->frame_count; ++i) {
+      struct buffer_frame * f = &pool->frames[i];
+      if(!f->valid) {
+	return i;
+      }
+      writing = writing || f->writing;
+      if(f->pins != 0 || f->loading || f->writing) {
+	continue;
+      }
+      // Pages with fewer than K references have an infinite backward K-distance, the least recently used of them goes first
+      bool full = f->history[BUFFER_LRU_K - 1] != 0;
+      uint64_t time = full ? f->history[BUFFER_LRU_K - 1] : f->history[0];
+      if((!full && victim_full) || (full == victim_full && time < victim_time)) {
+	victim = i;
+	victim_full = full;
+	victim_time = time;
+      }
+    }
+    if(victim == NO_BUFFER_FRAME) {
+      if(!writing) {
+	LOG_ERROR("all %zu buffer frames are pinned", pool->frame_count);
+	return NO_BUFFER_FRAME;
+      }
+      // The frames being written by other threads can be evicted once they are written
+      if(pthread_cond_wait(&pool->cond, &pool->mutex) != 0) {
+	return NO_BUFFER_FRAME;
+      }
+      continue;
+    }
+    struct buffer_frame * f = &pool->frames[victim];
+    if(f->dirty && write_buffer_frame(pool, victim) != 0) {
+      return NO_BUFFER_FRAME;
+    }
+    // The mutex was released while the victim was written, it is only evicted if it is still unpinned and clean
+    if(f->pins == 0 && !f->dirty) {
+      remove_buffer_frame(pool, victim);
+      ++pool->stats.evictions;
+      return victim;
+    }
+  }
+}
+
+/**
+ * Assigns a frame to a page, pinned once
+ * The pool mutex should be held by the caller
+ * \param pool the buffer pool
+ * \param i the index of the frame
+ * \param file the ID of the file
+ * \param page the number of the page
+ */
+static void assign_buffer_frame(struct buffer_pool * pool, size_t i, uint32_t file, uint64_t page) {
+  struct buffer_frame * f = &pool->frames[i];
+  f->file = file;
+  f->page = page;
+  f->valid = true;
+  f->loading = false;
+  f->dirty = false;
+  f->pins = 1;
+  for(int k = 0; k < BUFFER_LRU_K; ++k) {
+    f->history[k] = 0;
+  }
+  touch_buffer_frame(pool, f);
+  insert_buffer_frame(pool, i);
+}
+
+int init_buffer_pool(struct buffer_pool * pool, size_t budget) {
+  assert(pool != NULL);
+
+  memset(pool, 0, sizeof(struct buffer_pool));
+  pool->frame_count = budget / BUFFER_PAGE_SIZE;
+  if(pool->frame_count < MIN_BUFFER_FRAMES) {
+    pool->frame_count = MIN_BUFFER_FRAMES;
+  }
+  pool->bucket_count = 1;
+  while(pool->bucket_count < pool->frame_count * 2) {
+    pool->bucket_count *= 2;
+  }
+
+  void * memory;
+  if(posix_memalign(&memory, BUFFER_PAGE_SIZE, pool->frame_count * BUFFER_PAGE_SIZE) != 0) {
+    LOG_ERROR("could not allocate %zu buffer frames", pool->frame_count);
+    return -1;
+  }
+  pool->memory = (char *) memory;
+  pool->frames = (struct buffer_frame *) calloc(pool->frame_count, sizeof(struct buffer_frame));
+  pool->buckets = (size_t *) malloc(pool->bucket_count * sizeof(size_t));
+  if(pool->frames == NULL || pool->buckets == NULL) {
+    LOG_ERROR("could not allocate the buffer page table");
+    free(pool->memory);
+    free(pool->frames);
+    free(pool->buckets);
+    return -1;
+  }
+  for(size_t i = 0; i < pool->bucket_count; ++i) {
+    pool->buckets[i] = NO_BUFFER_FRAME;
+  }
+  for(size_t i = 0; i < pool->frame_count; ++i) {
+    pool->frames[i].next = NO_BUFFER_FRAME;
+  }
+
+  int result = pthread_mutex_init(&pool->mutex, NULL);
+  if(result == 0) {
+    result = pthread_cond_init(&pool->cond, NULL);
+    if(result != 0) {
+      pthread_mutex_destroy(&pool->mutex);
+    }
+  }
+  if(result != 0) {
+    LOG_ERROR("could not initialize buffer pool mutex: %s", strerror(result));
+    free(pool->memory);
+    free(pool->frames);
+    free(pool->buckets);
+    return -1;
+  }
+  return 0;
+}
+
+int add_buffer_file(struct buffer_pool * pool, int fd) {
+  assert(pool != NULL);
+
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    LOG_ERROR("could not stat buffered file: %s", strerror(errno));
+    return -1;
+  }
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    LOG_ERROR("could not lock buffer pool");
+    return -1;
+  }
+  int file = -1;
+  for(size_t i = 0; i < pool->file_count && file < 0; ++i) {
+    if(pool->fds[i] < 0) {
+      file = (int) i;
+    }
+  }
+  if(file < 0 && pool->file_count < MAX_BUFFER_FILES) {
+    file = (int) pool->file_count++;
+  }
+  if(file >= 0) {
+    pool->fds[file] = fd;
+    pool->page_counts[file] = ((uint64_t) st.st_size + BUFFER_PAGE_SIZE - 1) / BUFFER_PAGE_SIZE;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  if(file < 0) {
+    LOG_ERROR("too many buffered files");
+  }
+  return file;
+}
+
+/**
+ * Writes back the dirty pages of a file, including the pages other threads are writing
+ * The pool mutex should be held by the caller, it is released while the pages are written
+ * \param pool the buffer pool
+ * \param file the ID of the file
+ * \return 0 on success, -1 on error
+ */
+static int write_buffer_file(struct buffer_pool * pool, uint32_t file) {
+  int result = 0;
+  for(size_t i = 0; i < pool->frame_count; ++i) {
+    struct buffer_frame * f = &pool->frames[i];
+    if(wait_buffer_frame(pool, i, file) != 0) {
+      return -1;
+    }
+    if(f->valid && f->file == file && f->dirty && write_buffer_frame(pool, i) != 0) {
+      result = -1;
+    }
+  }
+  return result;
+}
+
+int remove_buffer_file(struct buffer_pool * pool, uint32_t file) {
+  assert(pool != NULL);
+  assert(file < pool->file_count);
+
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    LOG_ERROR("could not lock buffer pool");
+    return -1;
+  }
+  int result = write_buffer_file(pool, file);
+  for(size_t i = 0; i < pool->frame_count; ++i) {
+    struct buffer_frame * f = &pool->frames[i];
+    // Other threads may have started evicting pages of the file while the mutex was released
+    if(wait_buffer_frame(pool, i, file) != 0) {
+      result = -1;
+      continue;
+    }
+    if(f->valid && f->file == file) {
+      assert(f->pins == 0);
+      remove_buffer_frame(pool, i);
+    }
+  }
+  pool->fds[file] = -1;
+  pthread_mutex_unlock(&pool->mutex);
+  return result;
+}
+
+uint64_t get_buffer_page_count(struct buffer_pool * pool, uint32_t file) {
+  assert(pool != NULL);
+  assert(file < pool->file_count);
+
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    return 0;
+  }
+  uint64_t count = pool->page_counts[file];
+  pthread_mutex_unlock(&pool->mutex);
+  return count;
+}
+
+char * pin_buffer_page(struct buffer_pool * pool, uint32_t file, uint64_t page) {
+  assert(pool != NULL);
+  assert(file < pool->file_count);
+
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    LOG_ERROR("could not lock buffer pool");
+    return NULL;
+  }
+  size_t i;
+  for(;;) {
+    while((i = find_buffer_frame(pool, file, page)) != NO_BUFFER_FRAME && (pool->frames[i].loading || pool->frames[i].writing)) {
+      // Another thread reads or writes the page, its frame may be gone once the read fails or the page is evicted
+      if(pthread_cond_wait(&pool->cond, &pool->mutex) != 0) {
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+      }
+    }
+    if(i != NO_BUFFER_FRAME) {
+      ++pool->frames[i].pins;
+      touch_buffer_frame(pool, &pool->frames[i]);
+      ++pool->stats.hits;
+      pthread_mutex_unlock(&pool->mutex);
+      return get_buffer_frame_data(pool, i);
+    }
+    if(page >= pool->page_counts[file]) {
+      LOG_ERROR("page %lu is beyond the end of file %u", (unsigned long) page, file);
+      pthread_mutex_unlock(&pool->mutex);
+      return NULL;
+    }
+    i = take_buffer_frame(pool);
+    if(i == NO_BUFFER_FRAME) {
+      pthread_mutex_unlock(&pool->mutex);
+      return NULL;
+    }
+    // Another thread may have read the page while the mutex was released to write back a victim, the free frame stays free then
+    if(find_buffer_frame(pool, file, page) == NO_BUFFER_FRAME) {
+      break;
+    }
+  }
+  assign_buffer_frame(pool, i, file, page);
+  pool->frames[i].loading = true;
+  ++pool->stats.misses;
+  int fd = pool->fds[file];
+  pthread_mutex_unlock(&pool->mutex);
+
+  // The page is read without holding the mutex, the loading flag keeps others away from the frame
+  char * data = get_buffer_frame_data(pool, i);
+  int result = read_buffer_page(fd, page, data);
+
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    LOG_ERROR("could not lock buffer pool");
+    return NULL;
+  }
+  pool->frames[i].loading = false;
+  if(result != 0) {
+    pool->frames[i].pins = 0;
+    remove_buffer_frame(pool, i);
+    data = NULL;
+  }
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  return data;
+}
+
+char * allocate_buffer_page(struct buffer_pool * pool, uint32_t file, uint64_t * page) {
+  assert(pool != NULL);
+  assert(file < pool->file_count);
+  assert(page != NULL);
+
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    LOG_ERROR("could not lock buffer pool");
+    return NULL;
+  }
+  size_t i = take_buffer_frame(pool);
+  if(i == NO_BUFFER_FRAME) {
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+  }
+  *page = pool->page_counts[file]++;
+  assign_buffer_frame(pool, i, file, *page);
+  // A new page is written out even if the caller leaves it empty
+  pool->frames[i].dirty = true;
+  char * data = get_buffer_frame_data(pool, i);
+  memset(data, 0, BUFFER_PAGE_SIZE);
+  pthread_mutex_unlock(&pool->mutex);
+  return data;
+}
+
+void unpin_buffer_page(struct buffer_pool * pool, const char * data, bool dirty) {
+  assert(pool != NULL);
+  assert(data >= pool->memory && data < pool->memory + pool->frame_count * BUFFER_PAGE_SIZE);
+
+  size_t i = (size_t) (data - pool->memory) / BUFFER_PAGE_SIZE;
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    LOG_ERROR("could not lock buffer pool");
+    return;
+  }
+  struct buffer_frame * f = &pool->frames[i];
+  assert(f->valid && f->pins > 0);
+  f->dirty = f->dirty || dirty;
+  --f->pins;
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+int flush_buffer_file(struct buffer_pool * pool, uint32_t file) {
+  assert(pool != NULL);
+  assert(file < pool->file_count);
+
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    LOG_ERROR("could not lock buffer pool");
+    return -1;
+  }
+  int result = write_buffer_file(pool, file);
+  int fd = pool->fds[file];
+  pthread_mutex_unlock(&pool->mutex);
+  if(result == 0 && fdatasync(fd) != 0) {
+    LOG_ERROR("could not sync file %u: %s", file, strerror(errno));
+    result = -1;
+  }
+  return result;
+}
+
+void get_buffer_pool_stats(struct buffer_pool * pool, struct buffer_pool_stats * stats) {
+  assert(pool != NULL);
+  assert(stats != NULL);
+
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    memset(stats, 0, sizeof(struct buffer_pool_stats));
+    return;
+  }
+  *stats = pool->stats;
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+int dispose_buffer_pool(struct buffer_pool * pool) {
+  assert(pool != NULL);
+
+  int result = 0;
+  if(pthread_mutex_lock(&pool->mutex) != 0) {
+    LOG_ERROR("could not lock buffer pool");
+    result = -1;
+  } else {
+    for(size_t i = 0; i < pool->file_count; ++i) {
+      if(pool->fds[i] >= 0 && write_buffer_file(pool, (uint32_t) i) != 0) {
+	result = -1;
+      }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+  }
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->memory);
+  free(pool->frames);
+  free(pool->buckets);
+  pool->memory = NULL;
+  pool->frames = NULL;
+  pool->buckets = NULL;
+  return result;
+}
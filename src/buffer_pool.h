@@ -0,0 +1,268 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The size of a page in bytes
+ */
+#define BUFFER_PAGE_SIZE 8192
+
+/**
+ * The maximum number of files served by a buffer pool
+ */
+#define MAX_BUFFER_FILES 64
+
+/**
+ * The default memory budget of a buffer pool in bytes
+ */
+#define DEFAULT_BUFFER_POOL_SIZE (64 * 1024 * 1024)
+
+/**
+ * The minimum number of frames of a buffer pool
+ */
+#define MIN_BUFFER_FRAMES 16
+
+/**
+ * The number of most recent references remembered per frame, the K of LRU-K
+ */
+#define BUFFER_LRU_K 2
+
+/**
+ * A frame holding a page of a file
+ */
+struct buffer_frame {
+  /**
+   * The file of the page
+   */
+  uint32_t file;
+
+  /**
+   * The number of the page in the file
+   */
+  uint64_t page;
+
+  /**
+   * Whether the frame holds a page
+   */
+  bool valid;
+
+  /**
+   * Whether the page is being read from its file, other threads wait until it is loaded
+   */
+  bool loading;
+
+  /**
+   * Whether the page is being written to its file, other threads wait until it is written
+   */
+  bool writing;
+
+  /**
+   * Whether the page was modified since it was read or last written
+   */
+  bool dirty;
+
+  /**
+   * The number of users of the page, pinned pages are never evicted
+   */
+  unsigned int pins;
+
+  /**
+   * The logical times of the last BUFFER_LRU_K references, most recent first, 0 for none
+   */
+  uint64_t history[BUFFER_LRU_K];
+
+  /**
+   * The next frame in the same page table bucket, or SIZE_MAX
+   */
+  size_t next;
+};
+
+/**
+ * Counters of a buffer pool
+ */
+struct buffer_pool_stats {
+  /**
+   * The number of pins served from memory
+   */
+  uint64_t hits;
+
+  /**
+   * The number of pins that had to read the page
+   */
+  uint64_t misses;
+
+  /**
+   * The number of pages evicted to make room
+   */
+  uint64_t evictions;
+
+  /**
+   * The number of dirty pages written back
+   */
+  uint64_t writebacks;
+};
+
+/**
+ * A fixed set of page frames caching the pages of files within a memory budget
+ * Frames are replaced with LRU-K: the page whose K-th most recent reference is oldest is evicted first,
+ * and pages referenced fewer than K times go before all others, so a single scan can not flush the hot pages
+ */
+struct buffer_pool {
+  /**
+   * The mutex protecting the frames, the page table and the files
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signals that a page finished loading or writing
+   */
+  pthread_cond_t cond;
+
+  /**
+   * The memory of the frames, BUFFER_PAGE_SIZE bytes per frame
+   */
+  char * memory;
+
+  /**
+   * The frames
+   */
+  struct buffer_frame * frames;
+
+  /**
+   * The number of frames
+   */
+  size_t frame_count;
+
+  /**
+   * The page table, the first frame of each bucket or SIZE_MAX
+   */
+  size_t * buckets;
+
+  /**
+   * The number of buckets, a power of two
+   */
+  size_t bucket_count;
+
+  /**
+   * The file descriptors of the files, -1 for removed files
+   */
+  int fds[MAX_BUFFER_FILES];
+
+  /**
+   * The number of pages of each file, including pages not written yet
+   */
+  uint64_t page_counts[MAX_BUFFER_FILES];
+
+  /**
+   * The number of files
+   */
+  size_t file_count;
+
+  /**
+   * The logical time, incremented on every reference
+   */
+  uint64_t clock;
+
+  /**
+   * The counters
+   */
+  struct buffer_pool_stats stats;
+};
+
+/**
+ * Initializes a buffer pool
+ * \param pool the buffer pool
+ * \param budget the memory budget in bytes for the frames
+ * \return 0 on success, -1 on error
+ */
+int init_buffer_pool(struct buffer_pool * pool, size_t budget);
+
+/**
+ * Adds a file to a buffer pool
+ * \param pool the buffer pool
+ * \param fd the file descriptor, opened for reading and writing and still owned by the caller
+ * \return the ID of the file in the pool or -1 on error
+ */
+int add_buffer_file(struct buffer_pool * pool, int fd);
+
+/**
+ * Writes back the dirty pages of a file and removes them from a buffer pool
+ * \param pool the buffer pool
+ * \param file the ID of the file, none of its pages may be pinned
+ * \return 0 on success, -1 on error
+ */
+int remove_buffer_file(struct buffer_pool * pool, uint32_t file);
+
+/**
+ * Gets the number of pages of a file
+ * \param pool the buffer pool
+ * \param file the ID of the file
+ * \return the number of pages
+ */
+uint64_t get_buffer_page_count(struct buffer_pool * pool, uint32_t file);
+
+/**
+ * Pins a page in memory, reading it if it is not cached
+ * \param pool the buffer pool
+ * \param file the ID of the file
+ * \param page the number of the page
+ * \return the BUFFER_PAGE_SIZE bytes of the page or NULL on error
+ */
+char * pin_buffer_page(struct buffer_pool * pool, uint32_t file, uint64_t page);
+
+/**
+ * Appends a zeroed page to a file and pins it, the page is written when it is evicted or flushed
+ * \param pool the buffer pool
+ * \param file the ID of the file
+ * \param page the destination for the number of the new page
+ * \return the BUFFER_PAGE_SIZE bytes of the page or NULL on error
+ */
+char * allocate_buffer_page(struct buffer_pool * pool, uint32_t file, uint64_t * page);
+
+/**
+ * Unpins a page
+ * \param pool the buffer pool
+ * \param data the bytes of the page as returned when it was pinned
+ * \param dirty whether the page was modified
+ */
+void unpin_buffer_page(struct buffer_pool * pool, const char * data, bool dirty);
+
+/**
+ * Writes back the dirty pages of a file and syncs the file
+ * \param pool the buffer pool
+ * \param file the ID of the file
+ * \return 0 on success, -1 on error
+ */
+int flush_buffer_file(struct buffer_pool * pool, uint32_t file);
+
+/**
+ * Copies the counters of a buffer pool
+ * \param pool the buffer pool
+ * \param stats the destination for the counters
+ */
+void get_buffer_pool_stats(struct buffer_pool * pool, struct buffer_pool_stats * stats);
+
+/**
+ * Writes back all dirty pages and releases the memory of a buffer pool
+ * \param pool the buffer pool
+ * \return 0 on success, -1 if dirty pages could not be written
+ */
+int dispose_buffer_pool(struct buffer_pool * pool);
+
+#endif
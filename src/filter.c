@@ -0,0 +1,453 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#include "filter.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_HAS_X86 1
+#else
+#define FILTER_HAS_X86 0
+#endif
+
+/**
+ * The instruction set of the kernels, or -1 before the first filter
+ */
+static atomic_int selected_isa = -1;
+
+/**
+ * Finds the best instruction set the processor and the operating system support
+ * \return the instruction set
+ */
+static enum filter_isa detect_filter_isa() {
+#if FILTER_HAS_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) {
+    return FILTER_ISA_AVX512;
+  }
+  if(__builtin_cpu_supports("avx2")) {
+    return FILTER_ISA_AVX2;
+  }
+  if(__builtin_cpu_supports("sse2")) {
+    return FILTER_ISA_SSE2;
+  }
+#endif
+  return FILTER_ISA_SCALAR;
+}
+
+enum filter_isa get_filter_isa() {
+  int isa = atomic_load_explicit(&selected_isa, memory_order_relaxed);
+  if(isa < 0) {
+    isa = (int) detect_filter_isa();
+    atomic_store_explicit(&selected_isa, isa, memory_order_relaxed);
+  }
+  return (enum filter_isa) isa;
+}
+
+int set_filter_isa(enum filter_isa isa) {
+  if(isa > detect_filter_isa()) {
+    return -1;
+  }
+  atomic_store_explicit(&selected_isa, (int) isa, memory_order_relaxed);
+  return 0;
+}
+
+const char * get_filter_isa_name(enum filter_isa isa) {
+  switch(isa) {
+  case FILTER_ISA_SCALAR:
+    return "scalar";
+  case FILTER_ISA_SSE2:
+    return "sse2";
+  case FILTER_ISA_AVX2:
+    return "avx2";
+  case FILTER_ISA_AVX512:
+    return "avx512";
+  default:
+    return "unknown";
+  }
+}
+
+/**
+ * Combines the equal and greater masks of 64 values into the bitmap word of an operator, without branches
+ * \param op the operator
+ * \param equal the bits of the values equal to the literal
+ * \param greater the bits of the values greater than the literal
+ * \return the bits of the matching values
+ */
+static inline uint64_t combine_filter_masks(unsigned int op, uint64_t equal, uint64_t greater) {
+  uint64_t less = ~(equal | greater);
+  return (less & -(uint64_t) (op & 1)) | (equal & -(uint64_t) ((op >> 1) & 1)) | (greater & -(uint64_t) ((op >> 2) & 1));
+}
+
+/**
+ * Compares up to 64 integers with a literal into one bitmap word
+ * \param values the values
+ * \param count the number of values, at most 64
+ * \param op the operator
+ * \param literal the literal
+ * \return the bitmap word
+ */
+static uint64_t filter_int64_word(const int64_t * values, size_t count, unsigned int op, int64_t literal) {
+  uint64_t word = 0;
+  for(size_t i = 0; i < count; ++i) {
+    // The outcome of the comparison is 0, 1 or 2, the position of its bit in the operator
+    unsigned int outcome = (unsigned int) ((values[i] > literal) - (values[i] < literal) + 1);
+    word |= (uint64_t) ((op >> outcome) & 1) << i;
+  }
+  return word;
+}
+
+/**
+ * Compares up to 64 codes with a literal into one bitmap word
+ * \param codes the codes
+ * \param count the number of codes, at most 64
+ * \param op the operator
+ * \param literal the literal
+ * \return the bitmap word
+ */
+static uint64_t filter_code_word(const uint32_t * codes, size_t count, unsigned int op, uint32_t literal) {
+  uint64_t word = 0;
+  for(size_t i = 0; i < count; ++i) {
+    unsigned int outcome = (unsigned int) ((codes[i] > literal) - (codes[i] < literal) + 1);
+    word |= (uint64_t) ((op >> outcome) & 1) << i;
+  }
+  return word;
+}
+
+#if FILTER_HAS_X86
+
+/**
+ * Compares whole words of 64 integers with SSE2, which has no 64 bit comparisons
+ * \param values the values
+ * \param words the number of bitmap words
+ * \param op the operator
+ * \param literal the literal
+ * \param bitmap the destination for the bitmap words
+ */
+__attribute__((target("sse2")))
+static void filter_int64_sse2(const int64_t * values, size_t words, unsigned int op, int64_t literal, uint64_t * bitmap) {
+  // Flipping the sign of the low halves makes their signed 32 bit comparison an unsigned one
+  const __m128i low_sign = _mm_set_epi32(0, INT32_MIN, 0, INT32_MIN);
+  const __m128i l = _mm_xor_si128(_mm_set1_epi64x(literal), low_sign);
+  for(size_t w = 0; w < words; ++w) {
+    const __m128i * p = (const __m128i *) (values + w * 64);
+    uint64_t equal = 0;
+    uint64_t greater = 0;
+    for(unsigned int j = 0; j < 32; ++j) {
+      __m128i x = _mm_xor_si128(_mm_loadu_si128(p + j), low_sign);
+      __m128i eq = _mm_cmpeq_epi32(x, l);
+      __m128i gt = _mm_cmpgt_epi32(x, l);
+      // Greater if the high half is, or if it is equal and the low half is
+      __m128i eq_high = _mm_shuffle_epi32(eq, _MM_SHUFFLE(3, 3, 1, 1));
+      __m128i gt64 = _mm_or_si128(_mm_shuffle_epi32(gt, _MM_SHUFFLE(3, 3, 1, 1)), _mm_and_si128(eq_high, _mm_shuffle_epi32(gt, _MM_SHUFFLE(2, 2, 0, 0))));
+      __m128i eq64 = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+      equal |= (uint64_t) _mm_movemask_pd(_mm_castsi128_pd(eq64)) << (j * 2);
+      greater |= (uint64_t) _mm_movemask_pd(_mm_castsi128_pd(gt64)) << (j * 2);
+    }
+    bitmap[w] = combine_filter_masks(op, equal, greater);
+  }
+}
+
+/**
+ * Compares whole words of 64 codes with SSE2
+ * \param codes the codes
+ * \param words the number of bitmap words
+ * \param op the operator
+ * \param literal the literal
+ * \param bitmap the destination for the bitmap words
+ */
+__attribute__((target("sse2")))
+static void filter_code_sse2(const uint32_t * codes, size_t words, unsigned int op, uint32_t literal, uint64_t * bitmap) {
+  const __m128i sign = _mm_set1_epi32(INT32_MIN);
+  const __m128i l = _mm_xor_si128(_mm_set1_epi32((int32_t) literal), sign);
+  for(size_t w = 0; w < words; ++w) {
+    const __m128i * p = (const __m128i *) (codes + w * 64);
+    uint64_t equal = 0;
+    uint64_t greater = 0;
+    for(unsigned int j = 0; j < 16; ++j) {
+      __m128i x = _mm_xor_si128(_mm_loadu_si128(p + j), sign);
+      equal |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, l))) << (j * 4);
+      greater |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x, l))) << (j * 4);
+    }
+    bitmap[w] = combine_filter_masks(op, equal, greater);
+  }
+}
+
+/**
+ * Compares whole words of 64 integers with AVX2
+ * \param values the values
+ * \param words the number of bitmap words
+ * \param op the operator
+ * \param literal the literal
+ * \param bitmap the destination for the bitmap words
+ */
+__attribute__((target("avx2")))
+static void filter_int64_avx2(const int64_t * values, size_t words, unsigned int op, int64_t literal, uint64_t * bitmap) {
+  const __m256i l = _mm256_set1_epi64x(literal);
+  for(size_t w = 0; w < words; ++w) {
+    const __m256i * p = (const __m256i *) (values + w * 64);
+    uint64_t equal = 0;
+    uint64_t greater = 0;
+    for(unsigned int j = 0; j < 16; ++j) {
+      __m256i x = _mm256_loadu_si256(p + j);
+      equal |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x, l))) << (j * 4);
+      greater |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, l))) << (j * 4);
+    }
+    bitmap[w] = combine_filter_masks(op, equal, greater);
+  }
+}
+
+/**
+ * Compares whole words of 64 codes with AVX2
+ * \param codes the codes
+ * \param words the number of bitmap words
+ * \param op the operator
+ * \param literal the literal
+ * \param bitmap the destination for the bitmap words
+ */
+__attribute__((target("avx2")))
+static void filter_code_avx2(const uint32_t * codes, size_t words, unsigned int op, uint32_t literal, uint64_t * bitmap) {
+  const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+  const __m256i l = _mm256_xor_si256(_mm256_set1_epi32((int32_t) literal), sign);
+  for(size_t w = 0; w < words; ++w) {
+    const __m256i * p = (const __m256i *) (codes + w * 64);
+    uint64_t equal = 0;
+    uint64_t greater = 0;
+    for(unsigned int j = 0; j < 8; ++j) {
+      __m256i x = _mm256_xor_si256(_mm256_loadu_si256(p + j), sign);
+      equal |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, l))) << (j * 8);
+      greater |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, l))) << (j * 8);
+    }
+    bitmap[w] = combine_filter_masks(op, equal, greater);
+  }
+}
+
+/**
+ * Compares whole words of 64 integers with AVX-512, whose comparisons write mask registers directly
+ * \param values the values
+ * \param words the number of bitmap words
+ * \param op the operator
+ * \param literal the literal
+ * \param bitmap the destination for the bitmap words
+ */
+__attribute__((target("avx512f")))
+static void filter_int64_avx512(const int64_t * values, size_t words, unsigned int op, int64_t literal, uint64_t * bitmap) {
+  const __m512i l = _mm512_set1_epi64(literal);
+  for(size_t w = 0; w < words; ++w) {
+    const int64_t * p = values + w * 64;
+    uint64_t equal = 0;
+    uint64_t greater = 0;
+    for(unsigned int j = 0; j < 8; ++j) {
+      __m512i x = _mm512_loadu_si512(p + j * 8);
+      equal |= (uint64_t) _mm512_cmpeq_epi64_mask(x, l) << (j * 8);
+      greater |= (uint64_t) _mm512_cmpgt_epi64_mask(x, l) << (j * 8);
+    }
+    bitmap[w] = combine_filter_masks(op, equal, greater);
+  }
+}
+
+/**
+ * Compares whole words of 64 codes with AVX-512
+ * \param codes the codes
+ * \param words the number of bitmap words
+ * \param op the operator
+ * \param literal the literal
+ * \param bitmap the destination for the bitmap words
+ */
+__attribute__((target("avx512f")))
+static void filter_code_avx512(const uint32_t * codes, size_t words, unsigned int op, uint32_t literal, uint64_t * bitmap) {
+  const __m512i l = _mm512_set1_epi32((int32_t) literal);
+  for(size_t w = 0; w < words; ++w) {
+    const uint32_t * p = codes + w * 64;
+    uint64_t equal = 0;
+    uint64_t greater = 0;
+    for(unsigned int j = 0; j < 4; ++j) {
+      __m512i x = _mm512_loadu_si512(p + j * 16);
+      equal |= (uint64_t) _mm512_cmpeq_epu32_mask(x, l) << (j * 16);
+      greater |= (uint64_t) _mm512_cmpgt_epu32_mask(x, l) << (j * 16);
+    }
+    bitmap[w] = combine_filter_masks(op, equal, greater);
+  }
+}
+
+#endif
+
+/**
+ * Counts the set bits of a bitmap
+ * \param bitmap the bitmap
+ * \param words the number of words
+ * \return the number of set bits
+ */
+static size_t count_filter_bitmap(const uint64_t * bitmap, size_t words) {
+  size_t count = 0;
+  for(size_t w = 0; w < words; ++w) {
+    count += (size_t) __builtin_popcountll(bitmap[w]);
+  }
+  return count;
+}
+
+size_t filter_int64_bitmap(const int64_t * values, size_t count, enum filter_operator op, int64_t literal, uint64_t * bitmap) {
+  assert(values != NULL || count == 0);
+  assert(bitmap != NULL || count == 0);
+
+  size_t words = count / 64;
+  switch(get_filter_isa()) {
+#if FILTER_HAS_X86
+  case FILTER_ISA_SSE2:
+    filter_int64_sse2(values, words, op, literal, bitmap);
+    break;
+  case FILTER_ISA_AVX2:
+    filter_int64_avx2(values, words, op, literal, bitmap);
+    break;
+  case FILTER_ISA_AVX512:
+    filter_int64_avx512(values, words, op, literal, bitmap);
+    break;
+#endif
+  default:
+    for(size_t w = 0; w < words; ++w) {
+      bitmap[w] = filter_int64_word(values + w * 64, 64, op, literal);
+    }
+    break;
+  }
+  if(count % 64 != 0) {
+    bitmap[words++] = filter_int64_word(values + count / 64 * 64, count % 64, op, literal);
+  }
+  return count_filter_bitmap(bitmap, words);
+}
+
+size_t filter_code_bitmap(const uint32_t * codes, size_t count, enum filter_operator op, uint32_t literal, uint64_t * bitmap) {
+  assert(codes != NULL || count == 0);
+  assert(bitmap != NULL || count == 0);
+
+  size_t words = count / 64;
+  switch(get_filter_isa()) {
+#if FILTER_HAS_X86
+  case FILTER_ISA_SSE2:
+    filter_code_sse2(codes, words, op, literal, bitmap);
+    break;
+  case FILTER_ISA_AVX2:
+    filter_code_avx2(codes, words, op, literal, bitmap);
+    break;
+  case FILTER_ISA_AVX512:
+    filter_code_avx512(codes, words, op, literal, bitmap);
+    break;
+#endif
+  default:
+    for(size_t w = 0; w < words; ++w) {
+      bitmap[w] = filter_code_word(codes + w * 64, 64, op, literal);
+    }
+    break;
+  }
+  if(count % 64 != 0) {
+    bitmap[words++] = filter_code_word(codes + count / 64 * 64, count % 64, op, literal);
+  }
+  return count_filter_bitmap(bitmap, words);
+}
+
+size_t convert_filter_bitmap(const uint64_t * bitmap, size_t count, uint32_t offset, uint32_t * selection) {
+  assert(bitmap != NULL || count == 0);
+  assert(selection != NULL || count == 0);
+
+  size_t n = 0;
+  for(size_t w = 0; w * 64 < count; ++w) {
+    uint64_t word = bitmap[w];
+    if(count - w * 64 < 64) {
+      word &= (UINT64_C(1) << (count - w * 64)) - 1;
+    }
+    // One iteration per set bit rather than one branch per row
+    while(word != 0) {
+      selection[n++] = offset + (uint32_t) (w * 64) + (uint32_t) __builtin_ctzll(word);
+      word &= word - 1;
+    }
+  }
+  return n;
+}
+
+size_t select_int64(const int64_t * values, size_t count, enum filter_operator op, int64_t literal, uint32_t * selection) {
+  assert(count <= UINT32_MAX);
+
+  uint64_t bitmap[FILTER_BLOCK_ROWS / 64];
+  size_t n = 0;
+  for(size_t first = 0; first < count; first += FILTER_BLOCK_ROWS) {
+    size_t rows = count - first < FILTER_BLOCK_ROWS ? count - first : FILTER_BLOCK_ROWS;
+    if(filter_int64_bitmap(values + first, rows, op, literal, bitmap) != 0) {
+      n += convert_filter_bitmap(bitmap, rows, (uint32_t) first, selection + n);
+    }
+  }
+  return n;
+}
+
+size_t select_codes(const uint32_t * codes, size_t count, enum filter_operator op, uint32_t literal, uint32_t * selection) {
+  assert(count <= UINT32_MAX);
+
+  uint64_t bitmap[FILTER_BLOCK_ROWS / 64];
+  size_t n = 0;
+  for(size_t first = 0; first < count; first += FILTER_BLOCK_ROWS) {
+    size_t rows = count - first < FILTER_BLOCK_ROWS ? count - first : FILTER_BLOCK_ROWS;
+    if(filter_code_bitmap(codes + first, rows, op, literal, bitmap) != 0) {
+      n += convert_filter_bitmap(bitmap, rows, (uint32_t) first, selection + n);
+    }
+  }
+  return n;
+}
+
+/**
+ * Appends the rows of a matching run to a selection vector
+ * \param selection the selection vector
+ * \param n the number of indexes in the selection vector
+ * \param begin the index of the first row of the run, relative to the first row filtered
+ * \param end the index after the last row of the run, relative to the first row filtered
+ * \return the number of indexes in the selection vector
+ */
+static size_t select_filter_run(uint32_t * selection, size_t n, size_t begin, size_t end) {
+  for(size_t i = begin; i < end; ++i) {
+    selection[n++] = (uint32_t) i;
+  }
+  return n;
+}
+
+size_t select_int64_runs(const int64_t * values, const uint32_t * ends, size_t run, size_t first, size_t count, enum filter_operator op, int64_t literal, uint32_t * selection) {
+  assert(count <= UINT32_MAX);
+
+  // One comparison per run, the rows of a run all share its outcome
+  size_t n = 0;
+  for(size_t row = first; row < first + count; ++run) {
+    size_t end = ends[run] < first + count ? ends[run] : first + count;
+    unsigned int outcome = (unsigned int) ((values[run] > literal) - (values[run] < literal) + 1);
+    if((op >> outcome) & 1) {
+      n = select_filter_run(selection, n, row - first, end - first);
+    }
+    row = end;
+  }
+  return n;
+}
+
+size_t select_code_runs(const uint32_t * codes, const uint32_t * ends, size_t run, size_t first, size_t count, enum filter_operator op, uint32_t literal, uint32_t * selection) {
+  assert(count <= UINT32_MAX);
+
+  size_t n = 0;
+  for(size_t row = first; row < first + count; ++run) {
+    size_t end = ends[run] < first + count ? ends[run] : first + count;
+    unsigned int outcome = (unsigned int) ((codes[run] > literal) - (codes[run] < literal) + 1);
+    if((op >> outcome) & 1) {
+      n = select_filter_run(selection, n, row - first, end - first);
+    }
+    row = end;
+  }
+  return n;
+}
@@ -0,0 +1,206 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The number of rows a selection vector is computed for at a time through a bitmap on the stack
+ */
+#define FILTER_BLOCK_ROWS 1024
+
+/**
+ * The outcomes of a comparison a filter operator accepts
+ */
+enum filter_outcome {
+  /**
+   * The value is less than the literal
+   */
+  FILTER_OUTCOME_LESS = 1,
+
+  /**
+   * The value equals the literal
+   */
+  FILTER_OUTCOME_EQUAL = 2,
+
+  /**
+   * The value is greater than the literal
+   */
+  FILTER_OUTCOME_GREATER = 4
+};
+
+/**
+ * A comparison of values with a literal, as the set of outcomes it accepts
+ */
+enum filter_operator {
+  /**
+   * value < literal
+   */
+  FILTER_LESS = FILTER_OUTCOME_LESS,
+
+  /**
+   * value = literal
+   */
+  FILTER_EQUALS = FILTER_OUTCOME_EQUAL,
+
+  /**
+   * value <= literal
+   */
+  FILTER_LESS_EQUALS = FILTER_OUTCOME_LESS | FILTER_OUTCOME_EQUAL,
+
+  /**
+   * value > literal
+   */
+  FILTER_GREATER = FILTER_OUTCOME_GREATER,
+
+  /**
+   * value != literal
+   */
+  FILTER_NOT_EQUALS = FILTER_OUTCOME_LESS | FILTER_OUTCOME_GREATER,
+
+  /**
+   * value >= literal
+   */
+  FILTER_GREATER_EQUALS = FILTER_OUTCOME_GREATER | FILTER_OUTCOME_EQUAL
+};
+
+/**
+ * An instruction set filter kernels are written for
+ */
+enum filter_isa {
+  /**
+   * Portable branch-free C
+   */
+  FILTER_ISA_SCALAR,
+
+  /**
+   * 128 bit vectors, available on every x86-64 processor
+   */
+  FILTER_ISA_SSE2,
+
+  /**
+   * 256 bit vectors
+   */
+  FILTER_ISA_AVX2,
+
+  /**
+   * 512 bit vectors with mask registers
+   */
+  FILTER_ISA_AVX512
+};
+
+/**
+ * Finds the best instruction set the processor supports, the first call selects the kernels
+ * \return the instruction set the kernels use
+ */
+enum filter_isa get_filter_isa();
+
+/**
+ * Selects the kernels of an instruction set, to compare them
+ * \param isa the instruction set
+ * \return 0 on success, -1 if the processor does not support it
+ */
+int set_filter_isa(enum filter_isa isa);
+
+/**
+ * Names an instruction set
+ * \param isa the instruction set
+ * \return the name
+ */
+const char * get_filter_isa_name(enum filter_isa isa);
+
+/**
+ * Compares 64 bit integers with a literal into a bitmap
+ * \param values the values
+ * \param count the number of values
+ * \param op the operator
+ * \param literal the literal
+ * \param bitmap the destination for the bitmap, bit i % 64 of word i / 64 set if value i matches, (count + 63) / 64 words
+ * \return the number of matching values
+ */
+size_t filter_int64_bitmap(const int64_t * values, size_t count, enum filter_operator op, int64_t literal, uint64_t * bitmap);
+
+/**
+ * Compares dictionary codes with the code of a literal into a bitmap, codes comparing as unsigned
+ * \param codes the codes
+ * \param count the number of codes
+ * \param op the operator
+ * \param literal the code of the literal
+ * \param bitmap the destination for the bitmap, bit i % 64 of word i / 64 set if code i matches, (count + 63) / 64 words
+ * \return the number of matching codes
+ */
+size_t filter_code_bitmap(const uint32_t * codes, size_t count, enum filter_operator op, uint32_t literal, uint64_t * bitmap);
+
+/**
+ * Lists the set bits of a bitmap
+ * \param bitmap the bitmap
+ * \param count the number of bits
+ * \param offset the number added to every index
+ * \param selection the destination for the indexes of the set bits plus the offset, in increasing order
+ * \return the number of indexes
+ */
+size_t convert_filter_bitmap(const uint64_t * bitmap, size_t count, uint32_t offset, uint32_t * selection);
+
+/**
+ * Compares 64 bit integers with a literal into a selection vector
+ * \param values the values
+ * \param count the number of values
+ * \param op the operator
+ * \param literal the literal
+ * \param selection the destination for the indexes of the matching values, in increasing order, up to count of them
+ * \return the number of matching values
+ */
+size_t select_int64(const int64_t * values, size_t count, enum filter_operator op, int64_t literal, uint32_t * selection);
+
+/**
+ * Compares dictionary codes with the code of a literal into a selection vector
+ * \param codes the codes
+ * \param count the number of codes
+ * \param op the operator
+ * \param literal the code of the literal
+ * \param selection the destination for the indexes of the matching codes, in increasing order, up to count of them
+ * \return the number of matching codes
+ */
+size_t select_codes(const uint32_t * codes, size_t count, enum filter_operator op, uint32_t literal, uint32_t * selection);
+
+/**
+ * Compares run-length encoded 64 bit integers with a literal into a selection vector, a run at a time
+ * \param values the value of each run
+ * \param ends the index of the row after each run, increasing
+ * \param run the run holding the first row
+ * \param first the index of the first row
+ * \param count the number of rows
+ * \param op the operator
+ * \param literal the literal
+ * \param selection the destination for the indexes of the matching rows minus first, in increasing order, up to count of them
+ * \return the number of matching rows
+ */
+size_t select_int64_runs(const int64_t * values, const uint32_t * ends, size_t run, size_t first, size_t count, enum filter_operator op, int64_t literal, uint32_t * selection);
+
+/**
+ * Compares run-length encoded dictionary codes with the code of a literal into a selection vector, a run at a time
+ * \param codes the code of each run
+ * \param ends the index of the row after each run, increasing
+ * \param run the run holding the first row
+ * \param first the index of the first row
+ * \param count the number of rows
+ * \param op the operator
+ * \param literal the code of the literal
+ * \param selection the destination for the indexes of the matching rows minus first, in increasing order, up to count of them
+ * \return the number of matching rows
+ */
+size_t select_code_runs(const uint32_t * codes, const uint32_t * ends, size_t run, size_t first, size_t count, enum filter_operator op, uint32_t literal, uint32_t * selection);
+
+#endif
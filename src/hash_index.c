@@ -0,0 +1,884 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "hash_index"
+
+#include "hash_index.h"
+#include "logger.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * The permissions of newly created hash index files
+ */
+#define HASH_INDEX_FILE_MODE 0644
+
+/**
+ * The value written to detect files of a different byte order
+ */
+#define HASH_INDEX_BYTE_ORDER 0x01020304u
+
+/**
+ * The version of the file format
+ */
+#define HASH_INDEX_FORMAT_VERSION 1
+
+/**
+ * The page holding the split state
+ */
+#define HASH_INDEX_META_PAGE 0
+
+/**
+ * The end of a chain of pages
+ */
+#define NO_HASH_INDEX_PAGE UINT64_MAX
+
+/**
+ * The type of a page
+ */
+enum hash_page_type {
+  /**
+   * A page not in use, linked to the next unused page
+   */
+  HASH_PAGE_FREE,
+
+  /**
+   * The first page of a bucket or one of its overflow pages
+   */
+  HASH_PAGE_BUCKET,
+
+  /**
+   * A page of the directory of the first pages of the buckets
+   */
+  HASH_PAGE_DIRECTORY
+};
+
+/**
+ * The contents of the meta page
+ */
+struct hash_index_meta {
+  /**
+   * HASH_INDEX_MAGIC
+   */
+  char magic[8];
+
+  /**
+   * HASH_INDEX_BYTE_ORDER
+   */
+  uint32_t byte_order;
+
+  /**
+   * HASH_INDEX_FORMAT_VERSION
+   */
+  uint32_t version;
+
+  /**
+   * The number of times the buckets doubled
+   */
+  uint32_t level;
+
+  /**
+   * Unused
+   */
+  uint32_t reserved;
+
+  /**
+   * The next bucket to split
+   */
+  uint64_t split;
+
+  /**
+   * The number of entries
+   */
+  uint64_t entry_count;
+
+  /**
+   * The number of bytes of the entries
+   */
+  uint64_t entry_bytes;
+
+  /**
+   * The first unused page
+   */
+  uint64_t free_page;
+
+  /**
+   * The first page of the directory
+   */
+  uint64_t directory;
+
+  /**
+   * The number of buckets
+   */
+  uint64_t bucket_count;
+};
+
+/**
+ * The header at the start of every page
+ * Bucket pages are followed by entries: the hash, the length of the key, the key and the value,
+ * directory pages by the first pages of the buckets
+ */
+struct hash_page_header {
+  /**
+   * The type of the page
+   */
+  uint8_t type;
+
+  /**
+   * Unused
+   */
+  uint8_t reserved;
+
+  /**
+   * The number of bytes used after the header
+   */
+  uint16_t used;
+
+  /**
+   * The number of entries
+   */
+  uint32_t count;
+
+  /**
+   * The next page of the bucket, directory or unused pages
+   */
+  uint64_t next;
+};
+
+/**
+ * The number of bytes of a page after the header
+ */
+#define HASH_PAGE_CAPACITY (BUFFER_PAGE_SIZE - sizeof(struct hash_page_header))
+
+/**
+ * The space taken by an entry besides its key
+ */
+#define HASH_ENTRY_OVERHEAD (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint64_t))
+
+/**
+ * The number of buckets listed per directory page
+ */
+#define HASH_DIRECTORY_CAPACITY (HASH_PAGE_CAPACITY / sizeof(uint64_t))
+
+/**
+ * Appends entries to a chain of bucket pages, reusing the pages of the chain before taking new ones
+ */
+struct hash_chain_writer {
+  /**
+   * The hash index
+   */
+  struct hash_index * h;
+
+  /**
+   * The pinned page being filled
+   */
+  char * page;
+
+  /**
+   * The pages to reuse
+   */
+  const uint64_t * reuse;
+
+  /**
+   * The number of pages to reuse
+   */
+  size_t reuse_count;
+};
+
+uint64_t hash_index_key(const char * key, size_t len) {
+  // FNV-1a followed by the splitmix64 finalizer to spread the low bits used for the buckets
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for(size_t i = 0; i < len; ++i) {
+    hash = (hash ^ (unsigned char) key[i]) * 0x100000001b3ull;
+  }
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+  return hash ^ (hash >> 31);
+}
+
+/**
+ * Gets the header of a page
+ * \param page the bytes of the page
+ * \return the header
+ */
+static struct hash_page_header * get_hash_page_header(char * page) {
+  return (struct hash_page_header *) page;
+}
+
+/**
+ * Gets the bytes after the header of a page
+ * \param page the bytes of the page
+ * \return the bytes
+ */
+static char * get_hash_page_data(char * page) {
+  return page + sizeof(struct hash_page_header);
+}
+
+/**
+ * Turns a page into an empty page of a type
+ * \param page the bytes of the page
+ * \param type the type
+ */
+static void init_hash_page(char * page, enum hash_page_type type) {
+  struct hash_page_header * header = get_hash_page_header(page);
+  memset(header, 0, sizeof(struct hash_page_header));
+  header->type = (uint8_t) type;
+  header->next = NO_HASH_INDEX_PAGE;
+}
+
+/**
+ * Pins an unused page, growing the file if there is none
+ * \param h the hash index
+ * \param type the type of the page
+ * \param page_number the destination for the number of the page
+ * \return the bytes of the page, initialized to the type, or NULL on error
+ */
+static char * take_hash_page(struct hash_index * h, enum hash_page_type type, uint64_t * page_number) {
+  char * page;
+  if(h->free_page != NO_HASH_INDEX_PAGE) {
+    *page_number = h->free_page;
+    page = pin_buffer_page(h->pool, h->file, *page_number);
+    if(page != NULL) {
+      h->free_page = get_hash_page_header(page)->next;
+    }
+  } else {
+    page = allocate_buffer_page(h->pool, h->file, page_number);
+  }
+  if(page != NULL) {
+    init_hash_page(page, type);
+  }
+  return page;
+}
+
+/**
+ * Adds a page to the unused pages
+ * \param h the hash index
+ * \param page_number the number of the page
+ * \return 0 on success, -1 on error
+ */
+static int release_hash_page(struct hash_index * h, uint64_t page_number) {
+  char * page = pin_buffer_page(h->pool, h->file, page_number);
+  if(page == NULL) {
+    return -1;
+  }
+  init_hash_page(page, HASH_PAGE_FREE);
+  get_hash_page_header(page)->next = h->free_page;
+  h->free_page = page_number;
+  unpin_buffer_page(h->pool, page, true);
+  return 0;
+}
+
+/**
+ * Finds the bucket of a hash: the low bits for the current level, one more bit for buckets already split
+ * \param h the hash index
+ * \param hash the hash
+ * \return the bucket
+ */
+static uint64_t get_hash_bucket(const struct hash_index * h, uint32_t hash) {
+  uint64_t buckets = (uint64_t) HASH_INDEX_INITIAL_BUCKETS << h->level;
+  uint64_t bucket = hash & (buckets - 1);
+  if(bucket < h->split) {
+    bucket = hash & (2 * buckets - 1);
+  }
+  return bucket;
+}
+
+/**
+ * Writes the split state to the meta page
+ * \param h the hash index
+ * \return 0 on success, -1 on error
+ */
+static int write_hash_meta(struct hash_index * h) {
+  char * page = pin_buffer_page(h->pool, h->file, HASH_INDEX_META_PAGE);
+  if(page == NULL) {
+    return -1;
+  }
+  struct hash_index_meta meta;
+  memset(&meta, 0, sizeof(struct hash_index_meta));
+  memcpy(meta.magic, HASH_INDEX_MAGIC, sizeof(meta.magic));
+  meta.byte_order = HASH_INDEX_BYTE_ORDER;
+  meta.version = HASH_INDEX_FORMAT_VERSION;
+  meta.level = h->level;
+  meta.split = h->split;
+  meta.entry_count = h->entry_count;
+  meta.entry_bytes = h->entry_bytes;
+  meta.free_page = h->free_page;
+  meta.directory = h->directory;
+  meta.bucket_count = h->bucket_count;
+  memcpy(page, &meta, sizeof(struct hash_index_meta));
+  unpin_buffer_page(h->pool, page, true);
+  return 0;
+}
+
+/**
+ * Records the first page of a new bucket in memory and in the directory
+ * \param h the hash index
+ * \param page_number the first page of the bucket
+ * \return 0 on success, -1 on error
+ */
+static int add_hash_bucket(struct hash_index * h, uint64_t page_number) {
+  if(h->bucket_count == h->buckets_size) {
+    size_t size = h->buckets_size != 0 ? h->buckets_size * 2 : 64;
+    uint64_t * buckets = (uint64_t *) realloc(h->buckets, size * sizeof(uint64_t));
+    if(buckets == NULL) {
+      LOG_ERROR("could not grow the bucket array");
+      return -1;
+    }
+    h->buckets = buckets;
+    h->buckets_size = size;
+  }
+  char * tail = pin_buffer_page(h->pool, h->file, h->directory_tail);
+  if(tail == NULL) {
+    return -1;
+  }
+  if(get_hash_page_header(tail)->count == HASH_DIRECTORY_CAPACITY) {
+    uint64_t next_number;
+    char * next = take_hash_page(h, HASH_PAGE_DIRECTORY, &next_number);
+    if(next == NULL) {
+      unpin_buffer_page(h->pool, tail, false);
+      return -1;
+    }
+    get_hash_page_header(tail)->next = next_number;
+    unpin_buffer_page(h->pool, tail, true);
+    tail = next;
+    h->directory_tail = next_number;
+  }
+  struct hash_page_header * header = get_hash_page_header(tail);
+  memcpy(get_hash_page_data(tail) + header->count * sizeof(uint64_t), &page_number, sizeof(uint64_t));
+  ++header->count;
+  unpin_buffer_page(h->pool, tail, true);
+  h->buckets[h->bucket_count++] = page_number;
+  return 0;
+}
+
+/**
+ * Creates the meta page, the directory and the initial buckets in an empty file
+ * \param h the hash index
+ * \return 0 on success, -1 on error
+ */
+static int create_hash_index(struct hash_index * h) {
+  uint64_t page_number;
+  char * page = allocate_buffer_page(h->pool, h->file, &page_number);
+  if(page == NULL) {
+    return -1;
+  }
+  unpin_buffer_page(h->pool, page, true);
+  page = take_hash_page(h, HASH_PAGE_DIRECTORY, &h->directory);
+  if(page == NULL) {
+    return -1;
+  }
+  unpin_buffer_page(h->pool, page, true);
+  h->directory_tail = h->directory;
+  for(size_t i = 0; i < HASH_INDEX_INITIAL_BUCKETS; ++i) {
+    page = take_hash_page(h, HASH_PAGE_BUCKET, &page_number);
+    if(page == NULL) {
+      return -1;
+    }
+    unpin_buffer_page(h->pool, page, true);
+    if(add_hash_bucket(h, page_number) != 0) {
+      return -1;
+    }
+  }
+  return write_hash_meta(h);
+}
+
+/**
+ * Reads the meta page and the directory of an existing file
+ * \param h the hash index
+ * \param path the path of the file for messages
+ * \return 0 on success, -1 on error
+ */
+static int read_hash_index(struct hash_index * h, const char * path) {
+  char * page = pin_buffer_page(h->pool, h->file, HASH_INDEX_META_PAGE);
+  if(page == NULL) {
+    return -1;
+  }
+  struct hash_index_meta meta;
+  memcpy(&meta, page, sizeof(struct hash_index_meta));
+  unpin_buffer_page(h->pool, page, false);
+  if(memcmp(meta.magic, HASH_INDEX_MAGIC, sizeof(meta.magic)) != 0) {
+    LOG_ERROR("%s is not a hash index file", path);
+    return -1;
+  }
+  if(meta.byte_order != HASH_INDEX_BYTE_ORDER || meta.version != HASH_INDEX_FORMAT_VERSION) {
+    LOG_ERROR("hash index file %s has an unsupported byte order or version", path);
+    return -1;
+  }
+  h->level = meta.level;
+  h->split = meta.split;
+  h->entry_count = meta.entry_count;
+  h->entry_bytes = meta.entry_bytes;
+  h->free_page = meta.free_page;
+  h->directory = meta.directory;
+
+  uint64_t page_count = get_buffer_page_count(h->pool, h->file);
+  uint64_t page_number = h->directory;
+  while(page_number != NO_HASH_INDEX_PAGE) {
+    if(page_number >= page_count || (page = pin_buffer_page(h->pool, h->file, page_number)) == NULL) {
+      LOG_ERROR("hash index file %s has a broken directory", path);
+      return -1;
+    }
+    struct hash_page_header * header = get_hash_page_header(page);
+    int result = header->type == HASH_PAGE_DIRECTORY && header->count <= HASH_DIRECTORY_CAPACITY ? 0 : -1;
+    for(uint32_t i = 0; i < header->count && result == 0; ++i) {
+      if(h->bucket_count == h->buckets_size) {
+	size_t size = h->buckets_size != 0 ? h->buckets_size * 2 : 64;
+	uint64_t * buckets = (uint64_t *) realloc(h->buckets, size * sizeof(uint64_t));
+	if(buckets == NULL) {
+	  result = -1;
+	  break;
+	}
+	h->buckets = buckets;
+	h->buckets_size = size;
+      }
+      memcpy(&h->buckets[h->bucket_count++], get_hash_page_data(page) + i * sizeof(uint64_t), sizeof(uint64_t));
+    }
+    h->directory_tail = page_number;
+    page_number = header->next;
+    unpin_buffer_page(h->pool, page, false);
+    if(result != 0) {
+      LOG_ERROR("could not read the directory of hash index file %s", path);
+      return -1;
+    }
+  }
+  uint64_t buckets = (uint64_t) HASH_INDEX_INITIAL_BUCKETS << h->level;
+  if(h->bucket_count != meta.bucket_count || h->bucket_count != buckets + h->split) {
+    LOG_ERROR("hash index file %s is corrupt", path);
+    return -1;
+  }
+  return 0;
+}
+
+int open_hash_index(struct hash_index * h, struct buffer_pool * pool, const char * path) {
+  assert(h != NULL);
+  assert(pool != NULL);
+  assert(path != NULL);
+
+  memset(h, 0, sizeof(struct hash_index));
+  h->pool = pool;
+  h->free_page = NO_HASH_INDEX_PAGE;
+  h->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, HASH_INDEX_FILE_MODE);
+  if(h->fd < 0) {
+    LOG_ERROR("could not open hash index file %s: %s", path, strerror(errno));
+    return -1;
+  }
+  int file = add_buffer_file(pool, h->fd);
+  if(file < 0) {
+    close(h->fd);
+    return -1;
+  }
+  h->file = (uint32_t) file;
+  int result = pthread_mutex_init(&h->mutex, NULL);
+  if(result != 0) {
+    LOG_ERROR("could not initialize hash index mutex: %s", strerror(result));
+    remove_buffer_file(pool, h->file);
+    close(h->fd);
+    return -1;
+  }
+  if(get_buffer_page_count(pool, h->file) == 0) {
+    result = create_hash_index(h);
+  } else {
+    result = read_hash_index(h, path);
+  }
+  if(result != 0) {
+    close_hash_index(h);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Appends an entry to the chain of a writer, moving to the next page when the current one is full
+ * \param w the writer
+ * \param entry the bytes of the entry
+ * \param size the number of bytes
+ * \return 0 on success, -1 on error
+ */
+static int append_hash_chain_entry(struct hash_chain_writer * w, const char * entry, size_t size) {
+  struct hash_page_header * header = get_hash_page_header(w->page);
+  if(header->used + size > HASH_PAGE_CAPACITY) {
+    uint64_t next_number;
+    char * next;
+    if(w->reuse_count > 0) {
+      next_number = *w->reuse++;
+      --w->reuse_count;
+      next = pin_buffer_page(w->h->pool, w->h->file, next_number);
+      if(next != NULL) {
+	init_hash_page(next, HASH_PAGE_BUCKET);
+      }
+    } else {
+      next = take_hash_page(w->h, HASH_PAGE_BUCKET, &next_number);
+    }
+    if(next == NULL) {
+      return -1;
+    }
+    header->next = next_number;
+    unpin_buffer_page(w->h->pool, w->page, true);
+    w->page = next;
+    header = get_hash_page_header(next);
+  }
+  memcpy(get_hash_page_data(w->page) + header->used, entry, size);
+  header->used = (uint16_t) (header->used + size);
+  ++header->count;
+  return 0;
+}
+
+/**
+ * Splits the next bucket, moving the entries whose hash has the next bit set to a new bucket
+ * \param h the hash index
+ * \return 0 on success, -1 on error
+ */
+static int split_hash_bucket(struct hash_index * h) {
+  uint64_t buckets = (uint64_t) HASH_INDEX_INITIAL_BUCKETS << h->level;
+  uint64_t bucket = h->split;
+
+  // The entries of the chain are copied out so that its pages can be rewritten in place
+  size_t pages_size = 8;
+  size_t page_count = 0;
+  uint64_t * pages = (uint64_t *) malloc(pages_size * sizeof(uint64_t));
+  char * entries = (char *) malloc(pages_size * HASH_PAGE_CAPACITY);
+  size_t entries_len = 0;
+  if(pages == NULL || entries == NULL) {
+    LOG_ERROR("could not allocate the entries of a bucket split");
+    free(pages);
+    free(entries);
+    return -1;
+  }
+  int result = 0;
+  uint64_t page_number = h->buckets[bucket];
+  while(page_number != NO_HASH_INDEX_PAGE && result == 0) {
+    if(page_count == pages_size) {
+      pages_size *= 2;
+      uint64_t * new_pages = (uint64_t *) realloc(pages, pages_size * sizeof(uint64_t));
+      char * new_entries = new_pages != NULL ? (char *) realloc(entries, pages_size * HASH_PAGE_CAPACITY) : NULL;
+      if(new_pages != NULL) {
+	pages = new_pages;
+      }
+      if(new_entries == NULL) {
+	LOG_ERROR("could not allocate the entries of a bucket split");
+	result = -1;
+	break;
+      }
+      entries = new_entries;
+    }
+    char * page = pin_buffer_page(h->pool, h->file, page_number);
+    if(page == NULL) {
+      result = -1;
+      break;
+    }
+    struct hash_page_header * header = get_hash_page_header(page);
+    memcpy(entries + entries_len, get_hash_page_data(page), header->used);
+    entries_len += header->used;
+    pages[page_count++] = page_number;
+    page_number = header->next;
+    unpin_buffer_page(h->pool, page, false);
+  }
+
+  struct hash_chain_writer stay = {h, NULL, pages + 1, page_count > 0 ? page_count - 1 : 0};
+  struct hash_chain_writer move = {h, NULL, NULL, 0};
+  uint64_t new_page;
+  if(result == 0) {
+    move.page = take_hash_page(h, HASH_PAGE_BUCKET, &new_page);
+    result = move.page != NULL ? 0 : -1;
+  }
+  if(result == 0) {
+    stay.page = pin_buffer_page(h->pool, h->file, pages[0]);
+    result = stay.page != NULL ? 0 : -1;
+  }
+  if(result == 0) {
+    init_hash_page(stay.page, HASH_PAGE_BUCKET);
+    for(size_t offset = 0; offset < entries_len && result == 0;) {
+      uint32_t hash;
+      uint16_t len;
+      memcpy(&hash, entries + offset, sizeof(uint32_t));
+      memcpy(&len, entries + offset + sizeof(uint32_t), sizeof(uint16_t));
+      size_t size = HASH_ENTRY_OVERHEAD + len;
+      struct hash_chain_writer * w = (hash & (2 * buckets - 1)) == bucket ? &stay : &move;
+      result = append_hash_chain_entry(w, entries + offset, size);
+      offset += size;
+    }
+  }
+  if(stay.page != NULL) {
+    unpin_buffer_page(h->pool, stay.page, true);
+  }
+  if(move.page != NULL) {
+    unpin_buffer_page(h->pool, move.page, true);
+  }
+  for(size_t i = 0; i < stay.reuse_count && result == 0; ++i) {
+    result = release_hash_page(h, stay.reuse[i]);
+  }
+  if(result == 0) {
+    result = add_hash_bucket(h, new_page);
+  }
+  if(result == 0) {
+    if(++h->split == buckets) {
+      ++h->level;
+      h->split = 0;
+    }
+  }
+  free(pages);
+  free(entries);
+  return result;
+}
+
+int insert_hash_entry(struct hash_index * h, const char * key, size_t len, uint64_t value) {
+  assert(h != NULL);
+  assert(key != NULL || len == 0);
+
+  if(len > MAX_HASH_INDEX_KEY_LENGTH) {
+    LOG_ERROR("hash index key of %zu bytes too long", len);
+    return -1;
+  }
+  char entry[HASH_ENTRY_OVERHEAD + MAX_HASH_INDEX_KEY_LENGTH];
+  uint32_t hash = (uint32_t) hash_index_key(key, len);
+  uint16_t key_len = (uint16_t) len;
+  memcpy(entry, &hash, sizeof(uint32_t));
+  memcpy(entry + sizeof(uint32_t), &key_len, sizeof(uint16_t));
+  memcpy(entry + sizeof(uint32_t) + sizeof(uint16_t), key, len);
+  memcpy(entry + sizeof(uint32_t) + sizeof(uint16_t) + len, &value, sizeof(uint64_t));
+  size_t size = HASH_ENTRY_OVERHEAD + len;
+
+  if(pthread_mutex_lock(&h->mutex) != 0) {
+    LOG_ERROR("could not lock hash index");
+    return -1;
+  }
+  // The entry goes to the first page of the chain with room, or to a new overflow page at its end
+  int result = 0;
+  uint64_t page_number = h->buckets[get_hash_bucket(h, hash)];
+  while(result == 0) {
+    char * page = pin_buffer_page(h->pool, h->file, page_number);
+    if(page == NULL) {
+      result = -1;
+      break;
+    }
+    struct hash_page_header * header = get_hash_page_header(page);
+    if(header->used + size <= HASH_PAGE_CAPACITY || header->next == NO_HASH_INDEX_PAGE) {
+      struct hash_chain_writer w = {h, page, NULL, 0};
+      result = append_hash_chain_entry(&w, entry, size);
+      unpin_buffer_page(h->pool, w.page, true);
+      break;
+    }
+    page_number = header->next;
+    unpin_buffer_page(h->pool, page, false);
+  }
+  if(result == 0) {
+    ++h->entry_count;
+    h->entry_bytes += size;
+    if(h->entry_bytes * 100 > (uint64_t) h->bucket_count * HASH_PAGE_CAPACITY * HASH_INDEX_FILL_PERCENT) {
+      result = split_hash_bucket(h);
+    }
+  }
+  if(result == 0) {
+    result = write_hash_meta(h);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return result;
+}
+
+int find_hash_entries(struct hash_index * h, const char * key, size_t len, struct hash_index_cursor * cursor) {
+  assert(h != NULL);
+  assert(key != NULL || len == 0);
+  assert(cursor != NULL);
+
+  if(pthread_mutex_lock(&h->mutex) != 0) {
+    LOG_ERROR("could not lock hash index");
+    return -1;
+  }
+  cursor->index = h;
+  cursor->key = key;
+  cursor->len = len;
+  cursor->hash = (uint32_t) hash_index_key(key, len);
+  cursor->page = h->buckets[get_hash_bucket(h, cursor->hash)];
+  cursor->offset = 0;
+  pthread_mutex_unlock(&h->mutex);
+  return 0;
+}
+
+int next_hash_value(struct hash_index_cursor * cursor, uint64_t * value) {
+  assert(cursor != NULL);
+  assert(value != NULL);
+
+  struct hash_index * h = cursor->index;
+  if(pthread_mutex_lock(&h->mutex) != 0) {
+    LOG_ERROR("could not lock hash index");
+    return -1;
+  }
+  int result = 0;
+  while(cursor->page != NO_HASH_INDEX_PAGE && result == 0) {
+    char * page = pin_buffer_page(h->pool, h->file, cursor->page);
+    if(page == NULL) {
+      result = -1;
+      break;
+    }
+    struct hash_page_header * header = get_hash_page_header(page);
+    const char * data = get_hash_page_data(page);
+    while(cursor->offset < header->used) {
+      uint32_t hash;
+      uint16_t len;
+      const char * entry = data + cursor->offset;
+      memcpy(&hash, entry, sizeof(uint32_t));
+      memcpy(&len, entry + sizeof(uint32_t), sizeof(uint16_t));
+      cursor->offset += HASH_ENTRY_OVERHEAD + len;
+      const char * key = entry + sizeof(uint32_t) + sizeof(uint16_t);
+      if(hash == cursor->hash && len == cursor->len && memcmp(key, cursor->key, len) == 0) {
+	memcpy(value, key + len, sizeof(uint64_t));
+	result = 1;
+	break;
+      }
+    }
+    if(result == 0) {
+      cursor->page = header->next;
+      cursor->offset = 0;
+    }
+    unpin_buffer_page(h->pool, page, false);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return result;
+}
+
+int close_hash_index(struct hash_index * h) {
+  assert(h != NULL);
+
+  int result = flush_buffer_file(h->pool, h->file);
+  if(remove_buffer_file(h->pool, h->file) != 0) {
+    result = -1;
+  }
+  if(close(h->fd) != 0) {
+    LOG_ERROR("could not close hash index file: %s", strerror(errno));
+    result = -1;
+  }
+  pthread_mutex_destroy(&h->mutex);
+  free(h->buckets);
+  h->buckets = NULL;
+  return result;
+}
+
+int init_memory_hash_index(struct memory_hash_index * m, size_t count) {
+  assert(m != NULL);
+
+  memset(m, 0, sizeof(struct memory_hash_index));
+  size_t capacity = 16;
+  while(capacity * MEMORY_HASH_INDEX_FILL_PERCENT / 100 < count) {
+    capacity *= 2;
+  }
+  m->slots = (struct memory_hash_entry *) calloc(capacity, sizeof(struct memory_hash_entry));
+  if(m->slots == NULL) {
+    LOG_ERROR("could not allocate %zu hash index slots", capacity);
+    return -1;
+  }
+  m->capacity = capacity;
+  return 0;
+}
+
+/**
+ * Puts an entry in the first free slot from the slot of its hash
+ * \param slots the slots
+ * \param capacity the number of slots
+ * \param entry the entry
+ */
+static void place_memory_hash_entry(struct memory_hash_entry * slots, size_t capacity, const struct memory_hash_entry * entry) {
+  size_t slot = (size_t) entry->hash & (capacity - 1);
+  while(slots[slot].used) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  slots[slot] = *entry;
+}
+
+int insert_memory_hash_entry(struct memory_hash_index * m, const char * key, size_t len, uint64_t value) {
+  assert(m != NULL);
+  assert(key != NULL || len == 0);
+
+  if(len > UINT32_MAX) {
+    LOG_ERROR("hash index key of %zu bytes too long", len);
+    return -1;
+  }
+  if((m->count + 1) * 100 > m->capacity * MEMORY_HASH_INDEX_FILL_PERCENT) {
+    size_t capacity = m->capacity * 2;
+    struct memory_hash_entry * slots = (struct memory_hash_entry *) calloc(capacity, sizeof(struct memory_hash_entry));
+    if(slots == NULL) {
+      LOG_ERROR("could not allocate %zu hash index slots", capacity);
+      return -1;
+    }
+    for(size_t i = 0; i < m->capacity; ++i) {
+      if(m->slots[i].used) {
+	place_memory_hash_entry(slots, capacity, &m->slots[i]);
+      }
+    }
+    free(m->slots);
+    m->slots = slots;
+    m->capacity = capacity;
+  }
+  if(m->keys_len + len > m->keys_size) {
+    size_t size = m->keys_size != 0 ? m->keys_size : 4096;
+    while(size < m->keys_len + len) {
+      size *= 2;
+    }
+    char * keys = (char *) realloc(m->keys, size);
+    if(keys == NULL) {
+      LOG_ERROR("could not grow hash index keys to %zu bytes", size);
+      return -1;
+    }
+    m->keys = keys;
+    m->keys_size = size;
+  }
+  if(len > 0) {
+    memcpy(m->keys + m->keys_len, key, len);
+  }
+  struct memory_hash_entry entry = {hash_index_key(key, len), m->keys_len, (uint32_t) len, true, value};
+  place_memory_hash_entry(m->slots, m->capacity, &entry);
+  m->keys_len += len;
+  ++m->count;
+  return 0;
+}
+
+void find_memory_hash_entries(const struct memory_hash_index * m, const char * key, size_t len, struct memory_hash_cursor * cursor) {
+  assert(m != NULL);
+  assert(key != NULL || len == 0);
+  assert(cursor != NULL);
+
+  cursor->index = m;
+  cursor->key = key;
+  cursor->len = len;
+  cursor->hash = hash_index_key(key, len);
+  cursor->slot = (size_t) cursor->hash & (m->capacity - 1);
+}
+
+int next_memory_hash_value(struct memory_hash_cursor * cursor, uint64_t * value) {
+  assert(cursor != NULL);
+  assert(value != NULL);
+
+  // Entries with the same hash are in the run of used slots starting at the slot of the hash
+  const struct memory_hash_index * m = cursor->index;
+  while(m->slots[cursor->slot].used) {
+    const struct memory_hash_entry * entry = &m->slots[cursor->slot];
+    cursor->slot = (cursor->slot + 1) & (m->capacity - 1);
+    if(entry->hash == cursor->hash && entry->len == cursor->len && memcmp(m->keys + entry->key, cursor->key, cursor->len) == 0) {
+      *value = entry->value;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void dispose_memory_hash_index(struct memory_hash_index * m) {
+  assert(m != NULL);
+
+  free(m->slots);
+  free(m->keys);
+  memset(m, 0, sizeof(struct memory_hash_index));
+}
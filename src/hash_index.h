@@ -0,0 +1,348 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include "buffer_pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The magic number at the start of a hash index file
+ */
+#define HASH_INDEX_MAGIC "DBHASHX\1"
+
+/**
+ * The maximum length of a key
+ */
+#define MAX_HASH_INDEX_KEY_LENGTH 1024
+
+/**
+ * The number of buckets of a new hash index, a power of two
+ */
+#define HASH_INDEX_INITIAL_BUCKETS 4
+
+/**
+ * The percentage of the bucket pages filled before the next bucket is split
+ */
+#define HASH_INDEX_FILL_PERCENT 75
+
+/**
+ * The percentage of the slots of an in-memory hash index filled before it grows
+ */
+#define MEMORY_HASH_INDEX_FILL_PERCENT 50
+
+/**
+ * A linear hash index of page sized buckets in a file cached by a buffer pool
+ * Buckets are split one at a time in order as the index fills, so inserts never wait for a full rehash,
+ * and a lookup reads the bucket page and only reads overflow pages for buckets not split yet
+ */
+struct hash_index {
+  /**
+   * The buffer pool caching the pages
+   */
+  struct buffer_pool * pool;
+
+  /**
+   * The ID of the file in the buffer pool
+   */
+  uint32_t file;
+
+  /**
+   * The file descriptor
+   */
+  int fd;
+
+  /**
+   * The mutex serializing the operations on the index
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * The number of times the buckets doubled
+   */
+  uint32_t level;
+
+  /**
+   * The next bucket to split
+   */
+  uint64_t split;
+
+  /**
+   * The number of entries
+   */
+  uint64_t entry_count;
+
+  /**
+   * The number of bytes of the entries in the buckets
+   */
+  uint64_t entry_bytes;
+
+  /**
+   * The first unused page, or UINT64_MAX
+   */
+  uint64_t free_page;
+
+  /**
+   * The first page of the bucket directory
+   */
+  uint64_t directory;
+
+  /**
+   * The last page of the bucket directory
+   */
+  uint64_t directory_tail;
+
+  /**
+   * The first page of each bucket, loaded from the directory
+   */
+  uint64_t * buckets;
+
+  /**
+   * The number of buckets
+   */
+  size_t bucket_count;
+
+  /**
+   * The number of entries the bucket array has room for
+   */
+  size_t buckets_size;
+};
+
+/**
+ * A lookup of the values of a key in a hash index, invalidated by inserts
+ */
+struct hash_index_cursor {
+  /**
+   * The hash index
+   */
+  struct hash_index * index;
+
+  /**
+   * The key, which must stay valid during the lookup
+   */
+  const char * key;
+
+  /**
+   * The length of the key
+   */
+  size_t len;
+
+  /**
+   * The hash of the key
+   */
+  uint32_t hash;
+
+  /**
+   * The page of the next entry to examine, or UINT64_MAX
+   */
+  uint64_t page;
+
+  /**
+   * The offset of the next entry to examine in the page
+   */
+  size_t offset;
+};
+
+/**
+ * An entry of an in-memory hash index
+ */
+struct memory_hash_entry {
+  /**
+   * The hash of the key
+   */
+  uint64_t hash;
+
+  /**
+   * The offset of the key in the key bytes
+   */
+  uint64_t key;
+
+  /**
+   * The length of the key
+   */
+  uint32_t len;
+
+  /**
+   * Whether the slot holds an entry
+   */
+  bool used;
+
+  /**
+   * The value
+   */
+  uint64_t value;
+};
+
+/**
+ * An in-memory hash index with open addressing and linear probing, for the columns of hot tables
+ */
+struct memory_hash_index {
+  /**
+   * The slots, a power of two
+   */
+  struct memory_hash_entry * slots;
+
+  /**
+   * The number of slots
+   */
+  size_t capacity;
+
+  /**
+   * The number of entries
+   */
+  size_t count;
+
+  /**
+   * The bytes of the keys
+   */
+  char * keys;
+
+  /**
+   * The number of bytes used
+   */
+  size_t keys_len;
+
+  /**
+   * The number of bytes allocated
+   */
+  size_t keys_size;
+};
+
+/**
+ * A lookup of the values of a key in an in-memory hash index
+ */
+struct memory_hash_cursor {
+  /**
+   * The hash index
+   */
+  const struct memory_hash_index * index;
+
+  /**
+   * The key, which must stay valid during the lookup
+   */
+  const char * key;
+
+  /**
+   * The length of the key
+   */
+  size_t len;
+
+  /**
+   * The hash of the key
+   */
+  uint64_t hash;
+
+  /**
+   * The next slot to examine
+   */
+  size_t slot;
+};
+
+/**
+ * Hashes a key
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \return the hash
+ */
+uint64_t hash_index_key(const char * key, size_t len);
+
+/**
+ * Opens a hash index, creating an empty one if the file does not exist or is empty
+ * \param h the hash index
+ * \param pool the buffer pool to cache the pages in
+ * \param path the path of the file
+ * \return 0 on success, -1 on error
+ */
+int open_hash_index(struct hash_index * h, struct buffer_pool * pool, const char * path);
+
+/**
+ * Inserts an entry, splitting the next bucket if the index is full
+ * \param h the hash index
+ * \param key the bytes of the key
+ * \param len the length of the key, at most MAX_HASH_INDEX_KEY_LENGTH
+ * \param value the value
+ * \return 0 on success, -1 on error
+ */
+int insert_hash_entry(struct hash_index * h, const char * key, size_t len, uint64_t value);
+
+/**
+ * Starts a lookup of the values of a key
+ * \param h the hash index
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param cursor the cursor
+ * \return 0 on success, -1 on error
+ */
+int find_hash_entries(struct hash_index * h, const char * key, size_t len, struct hash_index_cursor * cursor);
+
+/**
+ * Finds the next value of the key of a lookup
+ * \param cursor the cursor
+ * \param value the destination for the value
+ * \return 1 if there was a value, 0 at the end, -1 on error
+ */
+int next_hash_value(struct hash_index_cursor * cursor, uint64_t * value);
+
+/**
+ * Writes back the pages of a hash index, syncs it and closes it
+ * \param h the hash index
+ * \return 0 on success, -1 on error
+ */
+int close_hash_index(struct hash_index * h);
+
+/**
+ * Initializes an empty in-memory hash index
+ * \param m the hash index
+ * \param count the expected number of entries
+ * \return 0 on success, -1 on error
+ */
+int init_memory_hash_index(struct memory_hash_index * m, size_t count);
+
+/**
+ * Inserts an entry in an in-memory hash index, growing it if it is full
+ * \param m the hash index
+ * \param key the bytes of the key, copied
+ * \param len the length of the key
+ * \param value the value
+ * \return 0 on success, -1 on error
+ */
+int insert_memory_hash_entry(struct memory_hash_index * m, const char * key, size_t len, uint64_t value);
+
+/**
+ * Starts a lookup of the values of a key in an in-memory hash index
+ * \param m the hash index
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param cursor the cursor
+ */
+void find_memory_hash_entries(const struct memory_hash_index * m, const char * key, size_t len, struct memory_hash_cursor * cursor);
+
+/**
+ * Finds the next value of the key of a lookup in an in-memory hash index
+ * \param cursor the cursor
+ * \param value the destination for the value
+ * \return 1 if there was a value, 0 at the end
+ */
+int next_memory_hash_value(struct memory_hash_cursor * cursor, uint64_t * value);
+
+/**
+ * Releases the memory of an in-memory hash index
+ * \param m the hash index
+ */
+void dispose_memory_hash_index(struct memory_hash_index * m);
+
+#endif
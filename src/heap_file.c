@@ -0,0 +1,844 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "heap_file"
+
+#include "heap_file.h"
+#include "logger.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * The permissions of newly created heap files
+ */
+#define HEAP_FILE_MODE 0644
+
+/**
+ * Marks a slot whose record continues in overflow pages, in the length of the slot
+ */
+#define HEAP_SLOT_OVERFLOW 0x8000u
+
+/**
+ * The mask of the length of the bytes in the page, in the length of a slot
+ */
+#define HEAP_SLOT_LENGTH_MASK 0x7fffu
+
+/**
+ * The length of the head of a record continued in overflow pages: the total length and the first overflow page
+ */
+#define HEAP_OVERFLOW_HEAD_LENGTH 12
+
+/**
+ * The minimum space taken by a record in a page, so that an update can always turn it into an overflow head
+ */
+#define HEAP_MIN_RECORD_SPACE HEAP_OVERFLOW_HEAD_LENGTH
+
+_Static_assert(BUFFER_PAGE_SIZE <= HEAP_SLOT_LENGTH_MASK, "slot offsets and lengths must fit in 15 bits");
+
+/**
+ * The type of a page
+ */
+enum heap_page_type {
+  /**
+   * A page not in use, new pages are zeroed and so start out free
+   */
+  HEAP_PAGE_FREE,
+
+  /**
+   * A page with a slot directory and records
+   */
+  HEAP_PAGE_DATA,
+
+  /**
+   * A page holding part of a long record
+   */
+  HEAP_PAGE_OVERFLOW
+};
+
+/**
+ * The header at the start of every page
+ */
+struct heap_page_header {
+  /**
+   * The type of the page
+   */
+  uint8_t type;
+
+  /**
+   * Unused
+   */
+  uint8_t reserved;
+
+  /**
+   * The number of slots of a data page
+   */
+  uint16_t slot_count;
+
+  /**
+   * The offset of the first record byte of a data page, or the number of bytes of an overflow page
+   */
+  uint16_t free_end;
+
+  /**
+   * The number of bytes between the records of a data page freed by deletes and updates
+   */
+  uint16_t fragmented;
+
+  /**
+   * The next page of an overflow chain
+   */
+  uint64_t next;
+};
+
+/**
+ * An entry of the slot directory
+ */
+struct heap_slot {
+  /**
+   * The offset of the record in the page, 0 for a tombstone
+   */
+  uint16_t offset;
+
+  /**
+   * The number of record bytes in the page, with HEAP_SLOT_OVERFLOW for the head of a long record
+   */
+  uint16_t length;
+};
+
+/**
+ * The number of data bytes of an overflow page
+ */
+#define HEAP_OVERFLOW_CAPACITY (BUFFER_PAGE_SIZE - sizeof(struct heap_page_header))
+
+/**
+ * Gets the header of a page
+ * \param page the bytes of the page
+ * \return the header
+ */
+static struct heap_page_header * get_heap_page_header(char * page) {
+  return (struct heap_page_header *) page;
+}
+
+/**
+ * Gets the slot directory of a page
+ * \param page the bytes of the page
+ * \return the slots
+ */
+static struct heap_slot * get_heap_slots(char * page) {
+  return (struct heap_slot *) (page + sizeof(struct heap_page_header));
+}
+
+/**
+ * Computes the space taken by a record in a page
+ * \param len the number of record bytes in the page
+ * \return the space
+ */
+static size_t get_heap_record_space(size_t len) {
+  return len < HEAP_MIN_RECORD_SPACE ? HEAP_MIN_RECORD_SPACE : len;
+}
+
+/**
+ * Computes the space between the slot directory and the records of a data page
+ * \param page the bytes of the page
+ * \return the contiguous free space
+ */
+static size_t get_heap_contiguous_space(char * page) {
+  struct heap_page_header * header = get_heap_page_header(page);
+  return header->free_end - sizeof(struct heap_page_header) - header->slot_count * sizeof(struct heap_slot);
+}
+
+/**
+ * Computes the space of a data page available after compaction
+ * \param page the bytes of the page
+ * \return the reclaimable space
+ */
+static size_t get_heap_reclaimable_space(char * page) {
+  return get_heap_contiguous_space(page) + get_heap_page_header(page)->fragmented;
+}
+
+/**
+ * Turns a page into an empty data page
+ * \param page the bytes of the page
+ */
+static void init_heap_data_page(char * page) {
+  struct heap_page_header * header = get_heap_page_header(page);
+  memset(header, 0, sizeof(struct heap_page_header));
+  header->type = HEAP_PAGE_DATA;
+  header->free_end = BUFFER_PAGE_SIZE;
+}
+
+/**
+ * Moves the records of a data page together at its end, reclaiming the fragmented space
+ * \param page the bytes of the page
+ */
+static void compact_heap_page(char * page) {
+  char copy[BUFFER_PAGE_SIZE];
+  struct heap_page_header * header = get_heap_page_header(page);
+  struct heap_slot * slots = get_heap_slots(page);
+  size_t end = BUFFER_PAGE_SIZE;
+  for(uint16_t i = 0; i < header->slot_count; ++i) {
+    if(slots[i].offset == 0) {
+      continue;
+    }
+    size_t len = slots[i].length & HEAP_SLOT_LENGTH_MASK;
+    end -= get_heap_record_space(len);
+    memcpy(copy + end, page + slots[i].offset, len);
+    slots[i].offset = (uint16_t) end;
+  }
+  memcpy(page + end, copy + end, BUFFER_PAGE_SIZE - end);
+  header->free_end = (uint16_t) end;
+  header->fragmented = 0;
+}
+
+/**
+ * Makes sure the free space array covers a page
+ * \param h the heap file
+ * \param page the number of the page
+ * \return 0 on success, -1 on error
+ */
+static int reserve_heap_free_space(struct heap_file * h, uint64_t page) {
+  if(page < h->free_space_size) {
+    return 0;
+  }
+  size_t size = h->free_space_size != 0 ? h->free_space_size : 64;
+  while(size <= page) {
+    size *= 2;
+  }
+  uint16_t * free_space = (uint16_t *) realloc(h->free_space, size * sizeof(uint16_t));
+  if(free_space == NULL) {
+    LOG_ERROR("could not grow the free space map");
+    return -1;
+  }
+  memset(free_space + h->free_space_size, 0, (size - h->free_space_size) * sizeof(uint16_t));
+  h->free_space = free_space;
+  h->free_space_size = size;
+  return 0;
+}
+
+/**
+ * Records the free space of a page after it was modified
+ * \param h the heap file
+ * \param page_number the number of the page
+ * \param page the bytes of the page
+ */
+static void update_heap_free_space(struct heap_file * h, uint64_t page_number, char * page) {
+  if(reserve_heap_free_space(h, page_number) != 0) {
+    return;
+  }
+  bool data = get_heap_page_header(page)->type == HEAP_PAGE_DATA;
+  h->free_space[page_number] = data ? (uint16_t) get_heap_reclaimable_space(page) : 0;
+  if(data && page_number < h->insert_hint) {
+    h->insert_hint = page_number;
+  }
+}
+
+/**
+ * Adds a page to the unused pages
+ * \param h the heap file
+ * \param page the number of the page
+ * \return 0 on success, -1 on error
+ */
+static int push_heap_free_page(struct heap_file * h, uint64_t page) {
+  if(h->free_page_count == h->free_pages_size) {
+    size_t size = h->free_pages_size != 0 ? h->free_pages_size * 2 : 16;
+    uint64_t * pages = (uint64_t *) realloc(h->free_pages, size * sizeof(uint64_t));
+    if(pages == NULL) {
+      LOG_ERROR("could not grow the unused page list");
+      return -1;
+    }
+    h->free_pages = pages;
+    h->free_pages_size = size;
+  }
+  h->free_pages[h->free_page_count++] = page;
+  return 0;
+}
+
+/**
+ * Pins an unused page, growing the file if there is none
+ * \param h the heap file
+ * \param page the destination for the number of the page
+ * \return the bytes of the page or NULL on error
+ */
+static char * take_heap_page(struct heap_file * h, uint64_t * page) {
+  if(h->free_page_count != 0) {
+    *page = h->free_pages[--h->free_page_count];
+    char * data = pin_buffer_page(h->pool, h->file, *page);
+    if(data == NULL) {
+      ++h->free_page_count;
+    }
+    return data;
+  }
+  return allocate_buffer_page(h->pool, h->file, page);
+}
+
+/**
+ * Writes the bytes of a long record into a chain of overflow pages
+ * \param h the heap file
+ * \param data the bytes
+ * \param len the number of bytes
+ * \param first the destination for the first page of the chain
+ * \return 0 on success, -1 on error
+ */
+static int write_heap_overflow(struct heap_file * h, const char * data, size_t len, uint64_t * first) {
+  char * previous = NULL;
+  uint64_t page_number;
+  while(len > 0) {
+    char * page = take_heap_page(h, &page_number);
+    if(page == NULL) {
+      if(previous != NULL) {
+	unpin_buffer_page(h->pool, previous, true);
+      }
+      return -1;
+    }
+    if(previous == NULL) {
+      *first = page_number;
+    } else {
+      get_heap_page_header(previous)->next = page_number;
+      unpin_buffer_page(h->pool, previous, true);
+    }
+    size_t part = len < HEAP_OVERFLOW_CAPACITY ? len : HEAP_OVERFLOW_CAPACITY;
+    struct heap_page_header * header = get_heap_page_header(page);
+    memset(header, 0, sizeof(struct heap_page_header));
+    header->type = HEAP_PAGE_OVERFLOW;
+    header->free_end = (uint16_t) part;
+    memcpy(page + sizeof(struct heap_page_header), data, part);
+    update_heap_free_space(h, page_number, page);
+    data += part;
+    len -= part;
+    previous = page;
+  }
+  if(previous != NULL) {
+    unpin_buffer_page(h->pool, previous, true);
+  }
+  return 0;
+}
+
+/**
+ * Returns the pages of an overflow chain to the unused pages
+ * \param h the heap file
+ * \param first the first page of the chain
+ * \param len the number of bytes in the chain
+ * \return 0 on success, -1 on error
+ */
+static int free_heap_overflow(struct heap_file * h, uint64_t first, size_t len) {
+  uint64_t page_number = first;
+  while(len > 0) {
+    char * page = pin_buffer_page(h->pool, h->file, page_number);
+    if(page == NULL) {
+      return -1;
+    }
+    struct heap_page_header * header = get_heap_page_header(page);
+    uint64_t next = header->next;
+    size_t part = header->free_end;
+    if(header->type != HEAP_PAGE_OVERFLOW || part == 0 || part > len) {
+      LOG_ERROR("broken overflow chain at page %lu", (unsigned long) page_number);
+      unpin_buffer_page(h->pool, page, false);
+      return -1;
+    }
+    header->type = HEAP_PAGE_FREE;
+    unpin_buffer_page(h->pool, page, true);
+    if(push_heap_free_page(h, page_number) != 0) {
+      return -1;
+    }
+    len -= part;
+    page_number = next;
+  }
+  return 0;
+}
+
+/**
+ * Reads the overflow head of a record
+ * \param record the bytes of the record in the page
+ * \param total the destination for the length of the whole record
+ * \param first the destination for the first overflow page
+ */
+static void read_heap_overflow_head(const char * record, size_t * total, uint64_t * first) {
+  uint32_t len;
+  memcpy(&len, record, 4);
+  memcpy(first, record + 4, 8);
+  *total = len;
+}
+
+/**
+ * Builds the bytes of a record as stored in a page, writing the tail of a long record to overflow pages
+ * \param h the heap file
+ * \param data the bytes of the record
+ * \param len the length of the record
+ * \param max_len the maximum number of bytes stored in the page, at least HEAP_OVERFLOW_HEAD_LENGTH
+ * \param head the buffer for the head of a long record, of MAX_HEAP_INLINE_RECORD_LENGTH bytes
+ * \param stored the destination for the bytes to store in the page
+ * \param stored_len the destination for the number of bytes to store, with HEAP_SLOT_OVERFLOW for a long record
+ * \return 0 on success, -1 on error
+ */
+static int prepare_heap_record(struct heap_file * h, const char * data, size_t len, size_t max_len, char * head, const char ** stored, uint16_t * stored_len) {
+  if(max_len > MAX_HEAP_INLINE_RECORD_LENGTH) {
+    max_len = MAX_HEAP_INLINE_RECORD_LENGTH;
+  }
+  if(len <= max_len) {
+    *stored = data;
+    *stored_len = (uint16_t) len;
+    return 0;
+  }
+  if(len > UINT32_MAX) {
+    LOG_ERROR("record of %zu bytes too long", len);
+    return -1;
+  }
+  size_t prefix = max_len - HEAP_OVERFLOW_HEAD_LENGTH;
+  uint32_t total = (uint32_t) len;
+  uint64_t first = 0;
+  if(write_heap_overflow(h, data + prefix, len - prefix, &first) != 0) {
+    return -1;
+  }
+  memcpy(head, &total, 4);
+  memcpy(head + 4, &first, 8);
+  memcpy(head + HEAP_OVERFLOW_HEAD_LENGTH, data, prefix);
+  *stored = head;
+  *stored_len = (uint16_t) (max_len | HEAP_SLOT_OVERFLOW);
+  return 0;
+}
+
+/**
+ * Stores the bytes of a record at the end of the free space of a data page, compacting the page if needed
+ * The page must have enough reclaimable space
+ * \param page the bytes of the page
+ * \param slot the slot of the record
+ * \param stored the bytes to store
+ * \param stored_len the number of bytes with the overflow flag
+ */
+static void place_heap_record(char * page, uint16_t slot, const char * stored, uint16_t stored_len) {
+  struct heap_page_header * header = get_heap_page_header(page);
+  size_t len = stored_len & HEAP_SLOT_LENGTH_MASK;
+  size_t space = get_heap_record_space(len);
+  if(get_heap_contiguous_space(page) < space) {
+    compact_heap_page(page);
+  }
+  header->free_end = (uint16_t) (header->free_end - space);
+  memcpy(page + header->free_end, stored, len);
+  struct heap_slot * slots = get_heap_slots(page);
+  slots[slot].offset = header->free_end;
+  slots[slot].length = stored_len;
+}
+
+/**
+ * Finds a data page with room for a record, taking an unused page if there is none
+ * \param h the heap file
+ * \param space the space needed, including a new slot
+ * \param page_number the destination for the number of the page
+ * \return the bytes of the page or NULL on error
+ */
+static char * find_heap_page(struct heap_file * h, size_t space, uint64_t * page_number) {
+  uint64_t page_count = get_buffer_page_count(h->pool, h->file);
+  for(uint64_t i = h->insert_hint; i < page_count && i < h->free_space_size; ++i) {
+    if(h->free_space[i] >= space) {
+      h->insert_hint = i;
+      *page_number = i;
+      return pin_buffer_page(h->pool, h->file, i);
+    }
+  }
+  h->insert_hint = page_count;
+  char * page = take_heap_page(h, page_number);
+  if(page != NULL) {
+    init_heap_data_page(page);
+  }
+  return page;
+}
+
+int open_heap_file(struct heap_file * h, struct buffer_pool * pool, const char * path) {
+  assert(h != NULL);
+  assert(pool != NULL);
+  assert(path != NULL);
+
+  memset(h, 0, sizeof(struct heap_file));
+  h->pool = pool;
+  h->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, HEAP_FILE_MODE);
+  if(h->fd < 0) {
+    LOG_ERROR("could not open heap file %s: %s", path, strerror(errno));
+    return -1;
+  }
+  int file = add_buffer_file(pool, h->fd);
+  if(file < 0) {
+    close(h->fd);
+    return -1;
+  }
+  h->file = (uint32_t) file;
+  int result = pthread_mutex_init(&h->mutex, NULL);
+  if(result != 0) {
+    LOG_ERROR("could not initialize heap file mutex: %s", strerror(result));
+    remove_buffer_file(pool, h->file);
+    close(h->fd);
+    return -1;
+  }
+
+  // The free space map is rebuilt from the page headers
+  uint64_t page_count = get_buffer_page_count(pool, h->file);
+  for(uint64_t i = 0; i < page_count; ++i) {
+    char * page = pin_buffer_page(pool, h->file, i);
+    if(page == NULL) {
+      close_heap_file(h);
+      return -1;
+    }
+    int status = 0;
+    if(get_heap_page_header(page)->type == HEAP_PAGE_FREE) {
+      status = push_heap_free_page(h, i);
+    } else {
+      update_heap_free_space(h, i, page);
+    }
+    unpin_buffer_page(pool, page, false);
+    if(status != 0) {
+      close_heap_file(h);
+      return -1;
+    }
+  }
+  h->insert_hint = 0;
+  return 0;
+}
+
+int insert_heap_record(struct heap_file * h, const char * data, size_t len, struct heap_rid * rid) {
+  assert(h != NULL);
+  assert(data != NULL || len == 0);
+  assert(rid != NULL);
+
+  if(pthread_mutex_lock(&h->mutex) != 0) {
+    LOG_ERROR("could not lock heap file");
+    return -1;
+  }
+  char head[MAX_HEAP_INLINE_RECORD_LENGTH];
+  const char * stored;
+  uint16_t stored_len;
+  int result = prepare_heap_record(h, data, len, MAX_HEAP_INLINE_RECORD_LENGTH, head, &stored, &stored_len);
+  char * page = NULL;
+  uint64_t page_number = 0;
+  if(result == 0) {
+    size_t space = get_heap_record_space(stored_len & HEAP_SLOT_LENGTH_MASK) + sizeof(struct heap_slot);
+    page = find_heap_page(h, space, &page_number);
+    result = page != NULL ? 0 : -1;
+  }
+  if(result == 0) {
+    struct heap_page_header * header = get_heap_page_header(page);
+    struct heap_slot * slots = get_heap_slots(page);
+    uint16_t slot = 0;
+    while(slot < header->slot_count && slots[slot].offset != 0) {
+      ++slot;
+    }
+    if(slot == header->slot_count) {
+      // The new slot takes contiguous space, the records may have to make room for it
+      if(get_heap_contiguous_space(page) < sizeof(struct heap_slot)) {
+	compact_heap_page(page);
+      }
+      ++header->slot_count;
+      slots[slot].offset = 0;
+    }
+    place_heap_record(page, slot, stored, stored_len);
+    update_heap_free_space(h, page_number, page);
+    unpin_buffer_page(h->pool, page, true);
+    rid->page = page_number;
+    rid->slot = slot;
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return result;
+}
+
+/**
+ * Pins the data page of a record and finds its slot
+ * \param h the heap file
+ * \param rid the location of the record
+ * \param slot the destination for the slot
+ * \return the bytes of the page or NULL if there is no such record or on error
+ */
+static char * pin_heap_record(struct heap_file * h, struct heap_rid rid, struct heap_slot ** slot) {
+  if(rid.page >= get_buffer_page_count(h->pool, h->file)) {
+    LOG_ERROR("no record at page %lu", (unsigned long) rid.page);
+    return NULL;
+  }
+  char * page = pin_buffer_page(h->pool, h->file, rid.page);
+  if(page == NULL) {
+    return NULL;
+  }
+  struct heap_page_header * header = get_heap_page_header(page);
+  if(header->type != HEAP_PAGE_DATA || rid.slot >= header->slot_count || get_heap_slots(page)[rid.slot].offset == 0) {
+    LOG_ERROR("no record at page %lu slot %u", (unsigned long) rid.page, rid.slot);
+    unpin_buffer_page(h->pool, page, false);
+    return NULL;
+  }
+  *slot = &get_heap_slots(page)[rid.slot];
+  return page;
+}
+
+int read_heap_record(struct heap_file * h, struct heap_rid rid, char * dest, size_t size, size_t * len) {
+  assert(h != NULL);
+  assert(dest != NULL || size == 0);
+  assert(len != NULL);
+
+  if(pthread_mutex_lock(&h->mutex) != 0) {
+    LOG_ERROR("could not lock heap file");
+    return -1;
+  }
+  struct heap_slot * slot;
+  char * page = pin_heap_record(h, rid, &slot);
+  if(page == NULL) {
+    pthread_mutex_unlock(&h->mutex);
+    return -1;
+  }
+  const char * record = page + slot->offset;
+  size_t stored_len = slot->length & HEAP_SLOT_LENGTH_MASK;
+  if((slot->length & HEAP_SLOT_OVERFLOW) == 0) {
+    memcpy(dest, record, stored_len < size ? stored_len : size);
+    *len = stored_len;
+    unpin_buffer_page(h->pool, page, false);
+    pthread_mutex_unlock(&h->mutex);
+    return 0;
+  }
+
+  size_t total;
+  uint64_t page_number;
+  read_heap_overflow_head(record, &total, &page_number);
+  size_t done = stored_len - HEAP_OVERFLOW_HEAD_LENGTH;
+  memcpy(dest, record + HEAP_OVERFLOW_HEAD_LENGTH, done < size ? done : size);
+  unpin_buffer_page(h->pool, page, false);
+  int result = 0;
+  while(done < total && done < size && result == 0) {
+    char * overflow = pin_buffer_page(h->pool, h->file, page_number);
+    if(overflow == NULL) {
+      result = -1;
+      break;
+    }
+    struct heap_page_header * header = get_heap_page_header(overflow);
+    size_t part = header->free_end;
+    if(header->type != HEAP_PAGE_OVERFLOW || part == 0 || part > total - done) {
+      LOG_ERROR("broken overflow chain at page %lu", (unsigned long) page_number);
+      result = -1;
+    } else {
+      memcpy(dest + done, overflow + sizeof(struct heap_page_header), part < size - done ? part : size - done);
+      done += part;
+      page_number = header->next;
+    }
+    unpin_buffer_page(h->pool, overflow, false);
+  }
+  *len = total;
+  pthread_mutex_unlock(&h->mutex);
+  return result;
+}
+
+int update_heap_record(struct heap_file * h, struct heap_rid rid, const char * data, size_t len) {
+  assert(h != NULL);
+  assert(data != NULL || len == 0);
+
+  if(pthread_mutex_lock(&h->mutex) != 0) {
+    LOG_ERROR("could not lock heap file");
+    return -1;
+  }
+  struct heap_slot * slot;
+  char * page = pin_heap_record(h, rid, &slot);
+  if(page == NULL) {
+    pthread_mutex_unlock(&h->mutex);
+    return -1;
+  }
+  struct heap_page_header * header = get_heap_page_header(page);
+  size_t old_len = slot->length & HEAP_SLOT_LENGTH_MASK;
+  size_t old_space = get_heap_record_space(old_len);
+  bool old_overflow = (slot->length & HEAP_SLOT_OVERFLOW) != 0;
+  size_t old_total = 0;
+  uint64_t old_first = 0;
+  if(old_overflow) {
+    read_heap_overflow_head(page + slot->offset, &old_total, &old_first);
+    old_total -= old_len - HEAP_OVERFLOW_HEAD_LENGTH;
+  }
+
+  // The old space counts as free, the record stays on its page and keeps its slot
+  size_t max_len = get_heap_reclaimable_space(page) + old_space;
+  char head[MAX_HEAP_INLINE_RECORD_LENGTH];
+  const char * stored;
+  uint16_t stored_len;
+  int result = prepare_heap_record(h, data, len, max_len, head, &stored, &stored_len);
+  if(result == 0) {
+    size_t new_space = get_heap_record_space(stored_len & HEAP_SLOT_LENGTH_MASK);
+    if(new_space <= old_space) {
+      memcpy(page + slot->offset, stored, stored_len & HEAP_SLOT_LENGTH_MASK);
+      slot->length = stored_len;
+      header->fragmented = (uint16_t) (header->fragmented + old_space - new_space);
+    } else {
+      slot->offset = 0;
+      header->fragmented = (uint16_t) (header->fragmented + old_space);
+      place_heap_record(page, rid.slot, stored, stored_len);
+    }
+    update_heap_free_space(h, rid.page, page);
+  }
+  unpin_buffer_page(h->pool, page, result == 0);
+  if(result == 0 && old_overflow) {
+    result = free_heap_overflow(h, old_first, old_total);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return result;
+}
+
+int delete_heap_record(struct heap_file * h, struct heap_rid rid) {
+  assert(h != NULL);
+
+  if(pthread_mutex_lock(&h->mutex) != 0) {
+    LOG_ERROR("could not lock heap file");
+    return -1;
+  }
+  struct heap_slot * slot;
+  char * page = pin_heap_record(h, rid, &slot);
+  if(page == NULL) {
+    pthread_mutex_unlock(&h->mutex);
+    return -1;
+  }
+  struct heap_page_header * header = get_heap_page_header(page);
+  size_t old_len = slot->length & HEAP_SLOT_LENGTH_MASK;
+  bool old_overflow = (slot->length & HEAP_SLOT_OVERFLOW) != 0;
+  size_t old_total = 0;
+  uint64_t old_first = 0;
+  if(old_overflow) {
+    read_heap_overflow_head(page + slot->offset, &old_total, &old_first);
+    old_total -= old_len - HEAP_OVERFLOW_HEAD_LENGTH;
+  }
+  header->fragmented = (uint16_t) (header->fragmented + get_heap_record_space(old_len));
+  slot->offset = 0;
+  slot->length = 0;
+  // Tombstones at the end of the directory are not referenced by any record and can go
+  struct heap_slot * slots = get_heap_slots(page);
+  while(header->slot_count > 0 && slots[header->slot_count - 1].offset == 0) {
+    --header->slot_count;
+  }
+  update_heap_free_space(h, rid.page, page);
+  unpin_buffer_page(h->pool, page, true);
+  int result = 0;
+  if(old_overflow) {
+    result = free_heap_overflow(h, old_first, old_total);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return result;
+}
+
+int next_heap_record(struct heap_file * h, struct heap_cursor * cursor, struct heap_rid * rid) {
+  assert(h != NULL);
+  assert(cursor != NULL);
+  assert(rid != NULL);
+
+  if(pthread_mutex_lock(&h->mutex) != 0) {
+    LOG_ERROR("could not lock heap file");
+    return -1;
+  }
+  int result = 0;
+  uint64_t page_count = get_buffer_page_count(h->pool, h->file);
+  while(cursor->page < page_count && result == 0) {
+    char * page = pin_buffer_page(h->pool, h->file, cursor->page);
+    if(page == NULL) {
+      result = -1;
+      break;
+    }
+    struct heap_page_header * header = get_heap_page_header(page);
+    struct heap_slot * slots = get_heap_slots(page);
+    if(header->type == HEAP_PAGE_DATA) {
+      while(cursor->slot < header->slot_count && slots[cursor->slot].offset == 0) {
+	++cursor->slot;
+      }
+      if(cursor->slot < header->slot_count) {
+	rid->page = cursor->page;
+	rid->slot = (uint16_t) cursor->slot++;
+	result = 1;
+      }
+    }
+    unpin_buffer_page(h->pool, page, false);
+    if(result == 0) {
+      ++cursor->page;
+      cursor->slot = 0;
+    }
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return result;
+}
+
+int close_heap_file(struct heap_file * h) {
+  assert(h != NULL);
+
+  int result = flush_buffer_file(h->pool, h->file);
+  if(remove_buffer_file(h->pool, h->file) != 0) {
+    result = -1;
+  }
+  if(close(h->fd) != 0) {
+    LOG_ERROR("could not close heap file: %s", strerror(errno));
+    result = -1;
+  }
+  pthread_mutex_destroy(&h->mutex);
+  free(h->free_space);
+  free(h->free_pages);
+  h->free_space = NULL;
+  h->free_pages = NULL;
+  return result;
+}
+
+size_t encode_heap_row(const struct table_schema * schema, const struct table_value * values, char * dest, size_t size) {
+  assert(schema != NULL);
+  assert(values != NULL);
+
+  size_t len = 0;
+  for(size_t i = 0; i < schema->column_count; ++i) {
+    if(schema->columns[i].type == TABLE_COLUMN_STRING) {
+      uint32_t text_len = (uint32_t) values[i].len;
+      if(len + 4 + text_len <= size) {
+	memcpy(dest + len, &text_len, 4);
+	memcpy(dest + len + 4, values[i].text, text_len);
+      }
+      len += 4 + text_len;
+    } else {
+      if(len + 8 <= size) {
+	memcpy(dest + len, &values[i].integer, 8);
+      }
+      len += 8;
+    }
+  }
+  return len;
+}
+
+int decode_heap_row(const struct table_schema * schema, const char * data, size_t len, struct table_value * values) {
+  assert(schema != NULL);
+  assert(data != NULL || len == 0);
+  assert(values != NULL);
+
+  size_t offset = 0;
+  for(size_t i = 0; i < schema->column_count; ++i) {
+    values[i].integer = 0;
+    values[i].text = NULL;
+    values[i].len = 0;
+    if(schema->columns[i].type == TABLE_COLUMN_STRING) {
+      uint32_t text_len;
+      if(len - offset < 4) {
+	return -1;
+      }
+      memcpy(&text_len, data + offset, 4);
+      offset += 4;
+      if(len - offset < text_len) {
+	return -1;
+      }
+      values[i].text = data + offset;
+      values[i].len = text_len;
+      offset += text_len;
+    } else {
+      if(len - offset < 8) {
+	return -1;
+      }
+      memcpy(&values[i].integer, data + offset, 8);
+      offset += 8;
+    }
+  }
+  return offset == len ? 0 : -1;
+}
@@ -0,0 +1,200 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef HEAP_FILE_H
+#define HEAP_FILE_H
+
+#include "buffer_pool.h"
+#include "table.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Records longer than this are stored with their head in the page and the rest in a chain of overflow pages
+ */
+#define MAX_HEAP_INLINE_RECORD_LENGTH 2048
+
+/**
+ * The location of a record, stable for the life of the record
+ */
+struct heap_rid {
+  /**
+   * The page holding the slot of the record
+   */
+  uint64_t page;
+
+  /**
+   * The slot in the page
+   */
+  uint16_t slot;
+};
+
+/**
+ * A position in a scan of a heap file
+ */
+struct heap_cursor {
+  /**
+   * The page of the next slot to examine
+   */
+  uint64_t page;
+
+  /**
+   * The next slot to examine
+   */
+  uint32_t slot;
+};
+
+/**
+ * A file of slotted pages holding variable length records, cached in a buffer pool
+ * Each page has a directory of slots growing from the front and records growing from the back,
+ * deleted records leave a tombstone slot and their space is reclaimed by compacting the page
+ */
+struct heap_file {
+  /**
+   * The buffer pool caching the pages
+   */
+  struct buffer_pool * pool;
+
+  /**
+   * The ID of the file in the buffer pool
+   */
+  uint32_t file;
+
+  /**
+   * The file descriptor
+   */
+  int fd;
+
+  /**
+   * The mutex serializing the operations on the file
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * The number of reclaimable bytes per page, 0 for overflow pages
+   */
+  uint16_t * free_space;
+
+  /**
+   * The number of entries the free space array has room for
+   */
+  size_t free_space_size;
+
+  /**
+   * The pages no longer in use, reused before the file grows
+   */
+  uint64_t * free_pages;
+
+  /**
+   * The number of unused pages
+   */
+  size_t free_page_count;
+
+  /**
+   * The number of entries the unused page array has room for
+   */
+  size_t free_pages_size;
+
+  /**
+   * The first page that may have room for a new record
+   */
+  uint64_t insert_hint;
+};
+
+/**
+ * Opens a heap file, creating it if it does not exist
+ * \param h the heap file
+ * \param pool the buffer pool to cache the pages in
+ * \param path the path of the file
+ * \return 0 on success, -1 on error
+ */
+int open_heap_file(struct heap_file * h, struct buffer_pool * pool, const char * path);
+
+/**
+ * Inserts a record
+ * \param h the heap file
+ * \param data the bytes of the record
+ * \param len the number of bytes
+ * \param rid the destination for the location of the record
+ * \return 0 on success, -1 on error
+ */
+int insert_heap_record(struct heap_file * h, const char * data, size_t len, struct heap_rid * rid);
+
+/**
+ * Reads a record
+ * \param h the heap file
+ * \param rid the location of the record
+ * \param dest the destination buffer
+ * \param size the size of the destination buffer, the record is truncated if it is too small
+ * \param len the destination for the length of the record
+ * \return 0 on success, -1 if there is no such record or on error
+ */
+int read_heap_record(struct heap_file * h, struct heap_rid rid, char * dest, size_t size, size_t * len);
+
+/**
+ * Replaces a record in place, the location of the record does not change
+ * \param h the heap file
+ * \param rid the location of the record
+ * \param data the new bytes of the record
+ * \param len the number of bytes
+ * \return 0 on success, -1 if there is no such record or on error
+ */
+int update_heap_record(struct heap_file * h, struct heap_rid rid, const char * data, size_t len);
+
+/**
+ * Deletes a record, leaving a tombstone for its slot
+ * \param h the heap file
+ * \param rid the location of the record
+ * \return 0 on success, -1 if there is no such record or on error
+ */
+int delete_heap_record(struct heap_file * h, struct heap_rid rid);
+
+/**
+ * Finds the next record of a scan
+ * \param h the heap file
+ * \param cursor the position of the scan, zeroed to start at the beginning
+ * \param rid the destination for the location of the record
+ * \return 1 if a record was found, 0 at the end of the file, -1 on error
+ */
+int next_heap_record(struct heap_file * h, struct heap_cursor * cursor, struct heap_rid * rid);
+
+/**
+ * Writes back the pages of a heap file, syncs it and closes it
+ * \param h the heap file
+ * \return 0 on success, -1 on error
+ */
+int close_heap_file(struct heap_file * h);
+
+/**
+ * Encodes a row as a record, integers as 8 bytes and strings as a 4 byte length followed by the bytes
+ * \param schema the columns of the row
+ * \param values the values of the row
+ * \param dest the destination buffer
+ * \param size the size of the destination buffer
+ * \return the length of the record, which may exceed the size of the buffer
+ */
+size_t encode_heap_row(const struct table_schema * schema, const struct table_value * values, char * dest, size_t size);
+
+/**
+ * Decodes a row from a record, the strings point into the record
+ * \param schema the columns of the row
+ * \param data the bytes of the record
+ * \param len the length of the record
+ * \param values the destination for the values
+ * \return 0 on success, -1 if the record does not match the schema
+ */
+int decode_heap_row(const struct table_schema * schema, const char * data, size_t len, struct table_value * values);
+
+#endif
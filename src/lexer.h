@@ -47,7 +47,12 @@ enum lexer_token_type {
   /**
    * A string literal
    */
-  LEXER_TOKEN_TYPE_STRING_LITERAL
+  LEXER_TOKEN_TYPE_STRING_LITERAL,
+
+  /**
+   * The limit keyword
+   */
+  LEXER_TOKEN_TYPE_LIMIT
 };
 
 /**
@@ -0,0 +1,165 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#include "log_clock.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define LOG_CLOCK_HAS_TSC 1
+#else
+#define LOG_CLOCK_HAS_TSC 0
+#endif
+
+/**
+ * The minimum time in nanoseconds between two samples for the tick rate to be updated
+ */
+#define LOG_CLOCK_MIN_SAMPLE_NS 1000000L
+
+/**
+ * The time in nanoseconds to sample the time stamp counter for the initial calibration
+ */
+#define LOG_CLOCK_INITIAL_SAMPLE_NS 5000000L
+
+/**
+ * Whether the time stamp counter is used as raw clock, set once by init_log_clock
+ */
+static bool use_tsc;
+
+/**
+ * Reads a clock in nanoseconds
+ * \param id the clock ID
+ * \param dest the destination for the time
+ * \return 0 on success, -1 on error
+ */
+static int read_clock_ns(clockid_t id, int64_t * dest) {
+  assert(dest != NULL);
+
+  struct timespec t;
+  if(clock_gettime(id, &t) != 0) {
+    return -1;
+  }
+  *dest = (int64_t) t.tv_sec * 1000000000L + t.tv_nsec;
+  return 0;
+}
+
+/**
+ * Whether the processor has a time stamp counter that runs at a constant rate in all power states
+ * \return true if the time stamp counter is invariant, false otherwise
+ */
+static bool has_invariant_tsc() {
+#if LOG_CLOCK_HAS_TSC
+  unsigned int eax, ebx, ecx, edx;
+  if(__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) {
+    return false;
+  }
+  if(__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+    return false;
+  }
+  return (edx & (1 << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Takes a reference point for the calibration
+ * \param c the calibration
+ * \return 0 on success, -1 on error
+ */
+static int sample_log_clock(struct log_calibration * c) {
+  assert(c != NULL);
+
+  if(read_clock_ns(CLOCK_MONOTONIC, &c->monotonic) != 0) {
+    return -1;
+  }
+  c->ticks = read_log_clock();
+  if(read_clock_ns(CLOCK_REALTIME, &c->wall) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int init_log_clock(struct log_calibration * c) {
+  assert(c != NULL);
+
+  use_tsc = has_invariant_tsc();
+  if(sample_log_clock(c) != 0) {
+    return -1;
+  }
+  if(use_tsc) {
+    c->ns_per_tick = 0.0;
+    struct timespec pause = { 0, LOG_CLOCK_INITIAL_SAMPLE_NS };
+    while(nanosleep(&pause, &pause) != 0) {
+    }
+    return calibrate_log_clock(c);
+  } else {
+    c->ns_per_tick = 1.0;
+    return 0;
+  }
+}
+
+bool log_clock_uses_tsc() {
+  return use_tsc;
+}
+
+log_ticks read_log_clock() {
+#if LOG_CLOCK_HAS_TSC
+  if(use_tsc) {
+    return __rdtsc();
+  }
+#endif
+  int64_t ns;
+  if(read_clock_ns(CLOCK_MONOTONIC_COARSE, &ns) != 0) {
+    return 0;
+  }
+  return (log_ticks) ns;
+}
+
+int calibrate_log_clock(struct log_calibration * c) {
+  assert(c != NULL);
+
+  struct log_calibration next;
+  if(sample_log_clock(&next) != 0) {
+    return -1;
+  }
+  next.ns_per_tick = c->ns_per_tick;
+  if(use_tsc) {
+    int64_t elapsed = next.monotonic - c->monotonic;
+    if(elapsed < LOG_CLOCK_MIN_SAMPLE_NS || next.ticks <= c->ticks) {
+      return 0;
+    }
+    next.ns_per_tick = (double) elapsed / (double) (next.ticks - c->ticks);
+  }
+  *c = next;
+  return 0;
+}
+
+void log_ticks_to_wall(const struct log_calibration * c, log_ticks ticks, struct timespec * wall) {
+  assert(c != NULL);
+  assert(wall != NULL);
+
+  // Records may have been stamped before the reference point
+  int64_t delta = (int64_t) (ticks - c->ticks);
+  int64_t ns = c->wall + (int64_t) ((double) delta * c->ns_per_tick);
+  wall->tv_sec = (time_t) (ns / 1000000000L);
+  wall->tv_nsec = (long) (ns % 1000000000L);
+  if(wall->tv_nsec < 0) {
+    wall->tv_nsec += 1000000000L;
+    --wall->tv_sec;
+  }
+}
@@ -0,0 +1,90 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef LOG_CLOCK_H
+#define LOG_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Time in milliseconds between two calibrations of the log clock
+ */
+#define LOG_CLOCK_CALIBRATION_INTERVAL_MS 1000
+
+/**
+ * A raw timestamp, either a time stamp counter value or nanoseconds of the coarse monotonic clock
+ */
+typedef uint64_t log_ticks;
+
+/**
+ * Maps raw timestamps to wall clock time
+ */
+struct log_calibration {
+  /**
+   * The raw timestamp of the reference point
+   */
+  log_ticks ticks;
+
+  /**
+   * The monotonic time of the reference point in nanoseconds
+   */
+  int64_t monotonic;
+
+  /**
+   * The wall clock time of the reference point in nanoseconds since the epoch
+   */
+  int64_t wall;
+
+  /**
+   * The number of nanoseconds per raw tick
+   */
+  double ns_per_tick;
+};
+
+/**
+ * Selects the raw clock source and performs the initial calibration
+ * The time stamp counter is used when the processor reports it as invariant, the coarse monotonic clock otherwise
+ * \param c the calibration
+ * \return 0 on success, -1 on error
+ */
+int init_log_clock(struct log_calibration * c);
+
+/**
+ * Whether the raw clock is the time stamp counter
+ * \return true if the time stamp counter is used, false if the coarse monotonic clock is used
+ */
+bool log_clock_uses_tsc();
+
+/**
+ * Reads the raw clock
+ * \return the raw timestamp
+ */
+log_ticks read_log_clock();
+
+/**
+ * Recalibrates the mapping of raw timestamps to wall clock time against the current time
+ * \param c the calibration
+ * \return 0 on success, -1 on error
+ */
+int calibrate_log_clock(struct log_calibration * c);
+
+/**
+ * Converts a raw timestamp to wall clock time
+ * \param c the calibration
+ * \param ticks the raw timestamp
+ * \param wall the destination for the wall clock time
+ */
+void log_ticks_to_wall(const struct log_calibration * c, log_ticks ticks, struct timespec * wall);
+
+#endif
@@ -0,0 +1,669 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+/*
+ * Renders binary log files written with LOG_FORMAT_BINARY as text lines or JSON objects
+ * Usage: log_decode [-j] FILE...
+ */
+
+#include "log_format.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Size of the buffer for a rendered time
+ */
+#define LOG_DECODE_TIME_BUFFER_SIZE 32
+
+/**
+ * A log statement described in a binary log file
+ */
+struct log_decode_site {
+  /**
+   * Whether the statement has been described
+   */
+  bool described;
+
+  /**
+   * The log level of the statement
+   */
+  uint8_t level;
+
+  /**
+   * The line of the statement
+   */
+  int32_t line;
+
+  /**
+   * The file of the statement, NUL terminated
+   */
+  char * file;
+
+  /**
+   * The format string of the statement, NUL terminated
+   */
+  char * format;
+
+  /**
+   * The argument types
+   */
+  unsigned char types[MAX_LOG_ARGS];
+
+  /**
+   * The number of arguments
+   */
+  size_t arg_count;
+};
+
+/**
+ * A decoded message
+ */
+struct log_decode_msg {
+  /**
+   * The log level of the message
+   */
+  uint8_t level;
+
+  /**
+   * The wall clock time of the message in nanoseconds since the epoch
+   */
+  int64_t time;
+
+  /**
+   * The ID of the thread that logged the message
+   */
+  uint32_t thread;
+
+  /**
+   * The number of messages of the same statement suppressed before this one
+   */
+  uint32_t suppressed;
+
+  /**
+   * The file where the message originates or NULL
+   */
+  const char * file;
+
+  /**
+   * The line where the message originates
+   */
+  int32_t line;
+
+  /**
+   * The formatted text, NUL terminated
+   */
+  char * text;
+
+  /**
+   * The arguments rendered as a JSON array or NULL if the message was stored as text
+   */
+  char * args;
+};
+
+/**
+ * The state of decoding a file
+ */
+struct log_decoder {
+  /**
+   * The described log statements, indexed by ID
+   */
+  struct log_decode_site * sites;
+
+  /**
+   * The number of entries in the site table
+   */
+  size_t site_count;
+
+  /**
+   * Whether to write JSON objects instead of text lines
+   */
+  bool json;
+};
+
+static const char * log_decode_level_labels[] = {
+  "DEBUG:  ",
+  "INFO:   ",
+  "WARNING:",
+  "ERROR:  "
+};
+
+static const char * log_decode_level_names[] = {
+  "DEBUG",
+  "INFO",
+  "WARNING",
+  "ERROR"
+};
+
+/**
+ * Reads a whole file into memory
+ * \param path the path of the file
+ * \param len the destination for the length of the file
+ * \return the contents, to be freed by the caller, or NULL on error
+ */
+static char * read_log_decode_file(const char * path, size_t * len) {
+  FILE * file = fopen(path, "rb");
+  if(file == NULL) {
+    return NULL;
+  }
+  size_t size = 65536;
+  size_t used = 0;
+  char * buffer = (char *) malloc(size);
+  while(buffer != NULL) {
+    used += fread(buffer + used, 1, size - used, file);
+    if(used < size) {
+      break;
+    }
+    size *= 2;
+    char * grown = (char *) realloc(buffer, size);
+    if(grown == NULL) {
+      free(buffer);
+    }
+    buffer = grown;
+  }
+  if(buffer != NULL && ferror(file)) {
+    free(buffer);
+    buffer = NULL;
+  }
+  fclose(file);
+  *len = used;
+  return buffer;
+}
+
+/**
+ * Copies a length prefixed string out of a record
+ * \param p the position in the record, advanced past the string
+ * \param end the end of the record
+ * \param len_size the size of the length prefix, 2 or 4
+ * \return the NUL terminated string, to be freed by the caller, or NULL if the record is too short
+ */
+static char * get_log_decode_string(const char ** p, const char * end, size_t len_size) {
+  size_t len;
+  if((size_t) (end - *p) < len_size) {
+    return NULL;
+  }
+  if(len_size == 2) {
+    uint16_t len16;
+    *p = get_log_bytes(*p, &len16, sizeof(len16));
+    len = len16;
+  } else {
+    uint32_t len32;
+    *p = get_log_bytes(*p, &len32, sizeof(len32));
+    len = len32;
+  }
+  if((size_t) (end - *p) < len) {
+    return NULL;
+  }
+  char * str = (char *) malloc(len + 1);
+  if(str != NULL) {
+    *p = get_log_bytes(*p, str, len);
+    str[len] = '\0';
+  }
+  return str;
+}
+
+/**
+ * Renders a time in nanoseconds since the epoch the way the logger does
+ * \param time the time
+ * \param dest the destination buffer, LOG_DECODE_TIME_BUFFER_SIZE long
+ */
+static void render_log_decode_time(int64_t time, char * dest) {
+  time_t seconds = (time_t) (time / 1000000000);
+  long micros = (long) (time % 1000000000) / 1000;
+  struct tm tm;
+  if(gmtime_r(&seconds, &tm) == NULL || strftime(dest, LOG_DECODE_TIME_BUFFER_SIZE - 9, "%Y-%m-%dT%H:%M:%S", &tm) == 0) {
+    strcpy(dest, "0000-00-00T00:00:00");
+  }
+  sprintf(dest + strlen(dest), ".%06ldZ", micros);
+}
+
+/**
+ * Writes a string as a JSON string literal
+ * \param out the output stream
+ * \param str the string
+ * \param len the length of the string
+ */
+static void print_log_decode_json_string(FILE * out, const char * str, size_t len) {
+  fputc('"', out);
+  for(size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char) str[i];
+    if(c == '"' || c == '\\') {
+      fputc('\\', out);
+      fputc(c, out);
+    } else if(c == '\n') {
+      fputs("\\n", out);
+    } else if(c == '\t') {
+      fputs("\\t", out);
+    } else if(c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+/**
+ * Renders stored arguments as a JSON array
+ * \param site the log statement
+ * \param p the start of the arguments
+ * \param end the end of the arguments
+ * \return the array, to be freed by the caller, or NULL on error
+ */
+static char * render_log_decode_json_args(const struct log_decode_site * site, const char * p, const char * end) {
+  char * args = NULL;
+  size_t args_len = 0;
+  FILE * json = open_memstream(&args, &args_len);
+  if(json == NULL) {
+    return NULL;
+  }
+  fputc('[', json);
+
+  int result = 0;
+  size_t arg = 0;
+  size_t json_count = 0;
+  const char * f = site->format;
+  while(result == 0 && (f = strchr(f, '%')) != NULL) {
+    struct log_conversion c;
+    if(parse_log_conversion(f, &c) != 0) {
+      result = -1;
+      break;
+    }
+    f += c.len;
+    if(c.conversion == '%') {
+      continue;
+    }
+    // The width and precision are not part of the data
+    size_t stars = (c.width_arg ? 1 : 0) + (c.precision_arg ? 1 : 0);
+    if(arg + stars >= site->arg_count || (size_t) (end - p) < stars * sizeof(int32_t)) {
+      result = -1;
+      break;
+    }
+    arg += stars + 1;
+    p += stars * sizeof(int32_t);
+
+    if(json_count++ != 0) {
+      fputc(',', json);
+    }
+    bool is_signed = c.conversion == 'd' || c.conversion == 'i';
+    switch(c.type) {
+    case LOG_ARG_INT: {
+      int32_t value;
+      if((size_t) (end - p) < sizeof(value)) {
+	result = -1;
+	break;
+      }
+      p = get_log_bytes(p, &value, sizeof(value));
+      if(is_signed) {
+	fprintf(json, "%ld", (long) value);
+      } else {
+	fprintf(json, "%lu", (unsigned long) (uint32_t) value);
+      }
+      break;
+    }
+    case LOG_ARG_LONG: {
+      int64_t value;
+      if((size_t) (end - p) < sizeof(value)) {
+	result = -1;
+	break;
+      }
+      p = get_log_bytes(p, &value, sizeof(value));
+      if(is_signed) {
+	fprintf(json, "%lld", (long long) value);
+      } else {
+	fprintf(json, "%llu", (unsigned long long) value);
+      }
+      break;
+    }
+    case LOG_ARG_DOUBLE: {
+      double value;
+      if((size_t) (end - p) < sizeof(value)) {
+	result = -1;
+	break;
+      }
+      p = get_log_bytes(p, &value, sizeof(value));
+      if(isfinite(value)) {
+	fprintf(json, "%.17g", value);
+      } else {
+	fputs("null", json);
+      }
+      break;
+    }
+    case LOG_ARG_STRING: {
+      char * value = get_log_decode_string(&p, end, sizeof(uint32_t));
+      if(value == NULL) {
+	result = -1;
+	break;
+      }
+      print_log_decode_json_string(json, value, strlen(value));
+      free(value);
+      break;
+    }
+    default: {
+      uint64_t value;
+      if((size_t) (end - p) < sizeof(value)) {
+	result = -1;
+	break;
+      }
+      p = get_log_bytes(p, &value, sizeof(value));
+      fprintf(json, "\"0x%llx\"", (unsigned long long) value);
+      break;
+    }
+    }
+  }
+  fputc(']', json);
+  fclose(json);
+  if(result != 0) {
+    free(args);
+    return NULL;
+  }
+  return args;
+}
+
+/**
+ * Renders the arguments of a message by applying the format string of its log statement
+ * \param site the log statement
+ * \param p the start of the arguments
+ * \param end the end of the arguments
+ * \param msg the message to receive the text and the arguments as a JSON array
+ * \return 0 on success, -1 on error
+ */
+static int format_log_decode_args(const struct log_decode_site * site, const char * p, const char * end, struct log_decode_msg * msg) {
+  size_t len = (size_t) (end - p);
+  int text_len = format_log_args(NULL, 0, site->format, site->types, site->arg_count, p, len);
+  if(text_len < 0) {
+    return -1;
+  }
+  msg->text = (char *) malloc((size_t) text_len + 1);
+  if(msg->text == NULL) {
+    return -1;
+  }
+  format_log_args(msg->text, (size_t) text_len + 1, site->format, site->types, site->arg_count, p, len);
+  msg->args = render_log_decode_json_args(site, p, end);
+  if(msg->args == NULL) {
+    free(msg->text);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Writes a decoded message
+ * \param d the decoder
+ * \param msg the message
+ */
+static void print_log_decode_msg(const struct log_decoder * d, const struct log_decode_msg * msg) {
+  char time[LOG_DECODE_TIME_BUFFER_SIZE];
+  render_log_decode_time(msg->time, time);
+  uint8_t level = msg->level <= 3 ? msg->level : 3;
+
+  if(d->json) {
+    printf("{\"time\":\"%s\",\"level\":\"%s\",\"thread\":%lu,", time, log_decode_level_names[level], (unsigned long) msg->thread);
+    if(msg->file != NULL) {
+      fputs("\"file\":", stdout);
+      print_log_decode_json_string(stdout, msg->file, strlen(msg->file));
+      printf(",\"line\":%ld,", (long) msg->line);
+    }
+    fputs("\"message\":", stdout);
+    print_log_decode_json_string(stdout, msg->text, strlen(msg->text));
+    if(msg->args != NULL) {
+      printf(",\"args\":%s", msg->args);
+    }
+    if(msg->suppressed != 0) {
+      printf(",\"suppressed\":%lu", (unsigned long) msg->suppressed);
+    }
+    fputs("}\n", stdout);
+  } else {
+    if(msg->file != NULL) {
+      printf("%s %s%s:%ld\t%s", time, log_decode_level_labels[level], msg->file, (long) msg->line, msg->text);
+    } else {
+      printf("%s %s:\t%s", time, log_decode_level_labels[level], msg->text);
+    }
+    if(msg->suppressed != 0) {
+      printf(" (%lu similar messages suppressed)", (unsigned long) msg->suppressed);
+    }
+    fputc('\n', stdout);
+  }
+}
+
+/**
+ * Decodes a record describing a log statement
+ * \param d the decoder
+ * \param p the payload
+ * \param end the end of the payload
+ * \return 0 on success, -1 on error
+ */
+static int decode_log_site_record(struct log_decoder * d, const char * p, const char * end) {
+  uint32_t id;
+  if((size_t) (end - p) < sizeof(id) + 1 + sizeof(int32_t)) {
+    return -1;
+  }
+  p = get_log_bytes(p, &id, sizeof(id));
+  if(id == 0) {
+    return -1;
+  }
+  if(id >= d->site_count) {
+    size_t count = (size_t) id + 1;
+    struct log_decode_site * sites = (struct log_decode_site *) realloc(d->sites, count * sizeof(struct log_decode_site));
+    if(sites == NULL) {
+      return -1;
+    }
+    memset(sites + d->site_count, 0, (count - d->site_count) * sizeof(struct log_decode_site));
+    d->sites = sites;
+    d->site_count = count;
+  }
+
+  // A statement is described again in every file and by every process appending to a file
+  struct log_decode_site * site = &d->sites[id];
+  free(site->file);
+  free(site->format);
+  site->file = NULL;
+  site->format = NULL;
+  site->described = false;
+  p = get_log_bytes(p, &site->level, sizeof(site->level));
+  p = get_log_bytes(p, &site->line, sizeof(site->line));
+  site->file = get_log_decode_string(&p, end, sizeof(uint16_t));
+  if(site->file == NULL) {
+    return -1;
+  }
+  site->format = get_log_decode_string(&p, end, sizeof(uint16_t));
+  if(site->format == NULL) {
+    return -1;
+  }
+  uint8_t arg_count;
+  if(end - p < 1) {
+    return -1;
+  }
+  p = get_log_bytes(p, &arg_count, sizeof(arg_count));
+  if(arg_count > MAX_LOG_ARGS || (size_t) (end - p) < arg_count) {
+    return -1;
+  }
+  get_log_bytes(p, site->types, arg_count);
+  site->arg_count = arg_count;
+  site->described = true;
+  return 0;
+}
+
+/**
+ * Decodes and writes a message of a described log statement
+ * \param d the decoder
+ * \param p the payload
+ * \param end the end of the payload
+ * \return 0 on success, -1 on error
+ */
+static int decode_log_message_record(struct log_decoder * d, const char * p, const char * end) {
+  uint32_t id;
+  struct log_decode_msg msg;
+  if((size_t) (end - p) < sizeof(id) + sizeof(msg.time) + sizeof(msg.thread) + sizeof(msg.suppressed)) {
+    return -1;
+  }
+  p = get_log_bytes(p, &id, sizeof(id));
+  p = get_log_bytes(p, &msg.time, sizeof(msg.time));
+  p = get_log_bytes(p, &msg.thread, sizeof(msg.thread));
+  p = get_log_bytes(p, &msg.suppressed, sizeof(msg.suppressed));
+  if(id >= d->site_count || !d->sites[id].described) {
+    fprintf(stderr, "message of undescribed log statement %lu\n", (unsigned long) id);
+    return -1;
+  }
+  const struct log_decode_site * site = &d->sites[id];
+  msg.level = site->level;
+  msg.file = site->file;
+  msg.line = site->line;
+  if(format_log_decode_args(site, p, end, &msg) != 0) {
+    return -1;
+  }
+  print_log_decode_msg(d, &msg);
+  free(msg.text);
+  free(msg.args);
+  return 0;
+}
+
+/**
+ * Decodes and writes a preformatted message
+ * \param d the decoder
+ * \param p the payload
+ * \param end the end of the payload
+ * \return 0 on success, -1 on error
+ */
+static int decode_log_text_record(struct log_decoder * d, const char * p, const char * end) {
+  struct log_decode_msg msg;
+  if((size_t) (end - p) < sizeof(msg.level) + sizeof(msg.time) + sizeof(msg.thread) + sizeof(msg.suppressed) + sizeof(msg.line)) {
+    return -1;
+  }
+  p = get_log_bytes(p, &msg.level, sizeof(msg.level));
+  p = get_log_bytes(p, &msg.time, sizeof(msg.time));
+  p = get_log_bytes(p, &msg.thread, sizeof(msg.thread));
+  p = get_log_bytes(p, &msg.suppressed, sizeof(msg.suppressed));
+  p = get_log_bytes(p, &msg.line, sizeof(msg.line));
+  char * file = get_log_decode_string(&p, end, sizeof(uint16_t));
+  if(file == NULL) {
+    return -1;
+  }
+  msg.text = get_log_decode_string(&p, end, sizeof(uint32_t));
+  if(msg.text == NULL) {
+    free(file);
+    return -1;
+  }
+  // Notices of the logger itself have no file
+  msg.file = *file != '\0' ? file : NULL;
+  msg.args = NULL;
+  print_log_decode_msg(d, &msg);
+  free(file);
+  free(msg.text);
+  return 0;
+}
+
+/**
+ * Decodes a binary log file and writes its messages to stdout
+ * \param path the path of the file
+ * \param json whether to write JSON objects instead of text lines
+ * \return 0 on success, -1 on error
+ */
+static int decode_log_file(const char * path, bool json) {
+  size_t len;
+  char * contents = read_log_decode_file(path, &len);
+  if(contents == NULL) {
+    fprintf(stderr, "could not read %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  uint32_t order;
+  if(len < LOG_BINARY_HEADER_LENGTH || memcmp(contents, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LENGTH) != 0) {
+    fprintf(stderr, "%s is not a binary log file\n", path);
+    free(contents);
+    return -1;
+  }
+  get_log_bytes(contents + LOG_BINARY_MAGIC_LENGTH, &order, sizeof(order));
+  if(order != LOG_BINARY_BYTE_ORDER) {
+    fprintf(stderr, "%s was written on a machine with another byte order\n", path);
+    free(contents);
+    return -1;
+  }
+
+  struct log_decoder d = { NULL, 0, json };
+  int result = 0;
+  const char * p = contents + LOG_BINARY_HEADER_LENGTH;
+  const char * end = contents + len;
+  while(p < end && result == 0) {
+    uint8_t type;
+    uint32_t payload_len;
+    if((size_t) (end - p) < LOG_RECORD_HEADER_LENGTH) {
+      fprintf(stderr, "%s ends with a partial record\n", path);
+      result = -1;
+      break;
+    }
+    p = get_log_bytes(p, &type, sizeof(type));
+    p = get_log_bytes(p, &payload_len, sizeof(payload_len));
+    if((size_t) (end - p) < payload_len) {
+      fprintf(stderr, "%s ends with a partial record\n", path);
+      result = -1;
+      break;
+    }
+    switch(type) {
+    case LOG_RECORD_SITE:
+      result = decode_log_site_record(&d, p, p + payload_len);
+      break;
+    case LOG_RECORD_MESSAGE:
+      result = decode_log_message_record(&d, p, p + payload_len);
+      break;
+    case LOG_RECORD_TEXT:
+      result = decode_log_text_record(&d, p, p + payload_len);
+      break;
+    default:
+      // Records of unknown types are skipped so that newer files remain readable
+      break;
+    }
+    if(result != 0) {
+      fprintf(stderr, "%s has an invalid record at offset %lu\n", path, (unsigned long) (p - contents - LOG_RECORD_HEADER_LENGTH));
+    }
+    p += payload_len;
+  }
+
+  for(size_t i = 0; i < d.site_count; ++i) {
+    free(d.sites[i].file);
+    free(d.sites[i].format);
+  }
+  free(d.sites);
+  free(contents);
+  return result;
+}
+
+/**
+ * The main entry point of the decoder
+ */
+int main(int arg_count, const char * args[]) {
+  bool json = false;
+  int first = 1;
+  if(arg_count > 1 && strcmp(args[1], "-j") == 0) {
+    json = true;
+    first = 2;
+  }
+  if(first >= arg_count) {
+    fprintf(stderr, "usage: %s [-j] FILE...\n", args[0]);
+    return EXIT_FAILURE;
+  }
+
+  int result = EXIT_SUCCESS;
+  for(int i = first; i < arg_count; ++i) {
+    if(decode_log_file(args[i], json) != 0) {
+      result = EXIT_FAILURE;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,298 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#include "log_file.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * The permissions of newly created log files
+ */
+#define LOG_FILE_MODE 0644
+
+/**
+ * The maximum length of the suffix of a rotated file
+ */
+#define LOG_FILE_SUFFIX_LENGTH 16
+
+void init_log_file_options(struct log_file_options * options, const char * path) {
+  assert(options != NULL);
+
+  options->path = path;
+  options->max_size = DEFAULT_LOG_FILE_MAX_SIZE;
+  options->max_age = DEFAULT_LOG_FILE_MAX_AGE;
+  options->max_files = DEFAULT_LOG_FILE_MAX_FILES;
+  options->durability = LOG_DURABILITY_NONE;
+  options->sync_interval_ms = DEFAULT_LOG_FILE_SYNC_INTERVAL_MS;
+  options->format = LOG_FORMAT_TEXT;
+}
+
+/**
+ * Opens the file at the log file path for appending
+ * \param f the log file
+ * \param size the destination for the current size of the file
+ * \return the file descriptor or -1 on error
+ */
+static int open_log_file_fd(struct log_file * f, size_t * size) {
+  assert(f != NULL);
+  assert(size != NULL);
+
+  int fd = open(f->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, LOG_FILE_MODE);
+  if(fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  *size = (size_t) st.st_size;
+  return fd;
+}
+
+int open_log_file(struct log_file * f, const struct log_file_options * options) {
+  assert(f != NULL);
+  assert(options != NULL);
+
+  if(options->path == NULL || strlen(options->path) >= MAX_LOG_FILE_PATH_LENGTH) {
+    return -1;
+  }
+  f->options = *options;
+  strcpy(f->path, options->path);
+  f->options.path = f->path;
+  f->dirty = false;
+  f->rotation_failures = 0;
+  f->generation = 1;
+
+  f->fd = open_log_file_fd(f, &f->size);
+  if(f->fd < 0) {
+    return -1;
+  }
+  f->rotate_at = options->max_size;
+  f->opened = time(NULL);
+  return 0;
+}
+
+/**
+ * Builds the path of a rotated file
+ * \param dest the destination buffer of MAX_LOG_FILE_PATH_LENGTH + LOG_FILE_SUFFIX_LENGTH bytes
+ * \param path the path of the log file
+ * \param index the index of the rotated file
+ */
+static void rotated_log_file_path(char * dest, const char * path, unsigned int index) {
+  assert(dest != NULL);
+  assert(path != NULL);
+
+  snprintf(dest, MAX_LOG_FILE_PATH_LENGTH + LOG_FILE_SUFFIX_LENGTH, "%s.%u", path, index);
+}
+
+/**
+ * Syncs the current file
+ * \param f the log file
+ * \return 0 on success, -1 on error
+ */
+static int sync_log_file(struct log_file * f) {
+  assert(f != NULL);
+
+  f->dirty = false;
+  return fdatasync(f->fd);
+}
+
+/**
+ * Moves the current file out of the way and starts a new one
+ * If no new file can be created, writing continues in the old one
+ * \param f the log file
+ * \return 0 on success, -1 on error
+ */
+static int rotate_log_file(struct log_file * f) {
+  assert(f != NULL);
+
+  char from[MAX_LOG_FILE_PATH_LENGTH + LOG_FILE_SUFFIX_LENGTH];
+  char to[MAX_LOG_FILE_PATH_LENGTH + LOG_FILE_SUFFIX_LENGTH];
+
+  if(f->options.max_files == 0) {
+    if(unlink(f->path) != 0 && errno != ENOENT) {
+      return -1;
+    }
+  } else {
+    for(unsigned int i = f->options.max_files - 1; i > 0; --i) {
+      rotated_log_file_path(from, f->path, i);
+      rotated_log_file_path(to, f->path, i + 1);
+      if(rename(from, to) != 0 && errno != ENOENT) {
+	return -1;
+      }
+    }
+    rotated_log_file_path(to, f->path, 1);
+    if(rename(f->path, to) != 0) {
+      return -1;
+    }
+  }
+
+  // The open descriptor still refers to the rotated file
+  size_t size;
+  int fd = open_log_file_fd(f, &size);
+  if(fd < 0) {
+    return -1;
+  }
+  int result = 0;
+  if(f->options.durability != LOG_DURABILITY_NONE && f->dirty) {
+    result = sync_log_file(f);
+  }
+  if(close(f->fd) != 0) {
+    result = -1;
+  }
+  f->fd = fd;
+  f->size = size;
+  f->rotate_at = f->options.max_size;
+  f->opened = time(NULL);
+  f->dirty = false;
+  ++f->generation;
+  return result;
+}
+
+/**
+ * Whether the log file should be rotated before writing
+ * \param f the log file
+ * \param len the number of bytes about to be written
+ * \return true if the file should be rotated, false otherwise
+ */
+static bool should_rotate_log_file(const struct log_file * f, size_t len) {
+  assert(f != NULL);
+
+  if(f->size == 0) {
+    return false;
+  }
+  if(f->options.max_size != 0 && f->size + len > f->rotate_at) {
+    return true;
+  }
+  return f->options.max_age != 0 && time(NULL) - f->opened >= (time_t) f->options.max_age;
+}
+
+void prepare_log_file(struct log_file * f, size_t len) {
+  assert(f != NULL);
+
+  // A failed rotation should not lose messages, they go to the current file instead
+  // and the next attempt is postponed until the file has grown or aged by another rotation interval
+  if(should_rotate_log_file(f, len) && rotate_log_file(f) != 0) {
+    ++f->rotation_failures;
+    f->rotate_at = f->size + f->options.max_size;
+    f->opened = time(NULL);
+  }
+}
+
+int write_log_file(struct log_file * f, struct iovec * iov, int count, bool error) {
+  assert(f != NULL);
+  assert(iov != NULL);
+
+  size_t len = 0;
+  for(int i = 0; i < count; ++i) {
+    len += iov[i].iov_len;
+  }
+
+  if(write_log_iovec(f->fd, iov, count) != 0) {
+    return -1;
+  }
+  f->size += len;
+  
+  if(!f->dirty && f->options.durability == LOG_DURABILITY_PERIODIC) {
+    if(clock_gettime(CLOCK_MONOTONIC, &f->next_sync) != 0) {
+      return -1;
+    }
+    f->next_sync.tv_sec += f->options.sync_interval_ms / 1000;
+    f->next_sync.tv_nsec += (long) (f->options.sync_interval_ms % 1000) * 1000000L;
+    if(f->next_sync.tv_nsec >= 1000000000L) {
+      ++f->next_sync.tv_sec;
+      f->next_sync.tv_nsec -= 1000000000L;
+    }
+  }
+  f->dirty = true;
+  
+  if(error && f->options.durability == LOG_DURABILITY_ERROR && sync_log_file(f) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+bool get_log_file_sync_deadline(const struct log_file * f, struct timespec * deadline) {
+  assert(f != NULL);
+  assert(deadline != NULL);
+
+  if(f->dirty && f->options.durability == LOG_DURABILITY_PERIODIC) {
+    *deadline = f->next_sync;
+    return true;
+  }
+  return false;
+}
+
+int sync_log_file_if_due(struct log_file * f, const struct timespec * now) {
+  assert(f != NULL);
+  assert(now != NULL);
+
+  struct timespec deadline;
+  if(!get_log_file_sync_deadline(f, &deadline)) {
+    return 0;
+  }
+  if(deadline.tv_sec > now->tv_sec || (deadline.tv_sec == now->tv_sec && deadline.tv_nsec > now->tv_nsec)) {
+    return 0;
+  }
+  return sync_log_file(f);
+}
+
+int close_log_file(struct log_file * f) {
+  assert(f != NULL);
+
+  int result = 0;
+  if(f->options.durability != LOG_DURABILITY_NONE && f->dirty && sync_log_file(f) != 0) {
+    result = -1;
+  }
+  if(close(f->fd) != 0) {
+    result = -1;
+  }
+  f->fd = -1;
+  return result;
+}
+
+int write_log_iovec(int fd, struct iovec * iov, int count) {
+  assert(iov != NULL);
+
+  while(count > 0) {
+    ssize_t written = writev(fd, iov, count);
+    if(written < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    size_t left = (size_t) written;
+    while(count > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if(count > 0) {
+      iov->iov_base = (char *) iov->iov_base + left;
+      iov->iov_len -= left;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,229 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef LOG_FILE_H
+#define LOG_FILE_H
+
+#include "log_format.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/uio.h>
+
+/**
+ * The maximum length of a log file path
+ */
+#define MAX_LOG_FILE_PATH_LENGTH 4096
+
+/**
+ * The default size in bytes at which a log file is rotated
+ */
+#define DEFAULT_LOG_FILE_MAX_SIZE (64 * 1024 * 1024)
+
+/**
+ * The default age in seconds at which a log file is rotated
+ */
+#define DEFAULT_LOG_FILE_MAX_AGE (24 * 60 * 60)
+
+/**
+ * The default number of rotated log files to keep
+ */
+#define DEFAULT_LOG_FILE_MAX_FILES 5
+
+/**
+ * The default time in milliseconds between two syncs for LOG_DURABILITY_PERIODIC
+ */
+#define DEFAULT_LOG_FILE_SYNC_INTERVAL_MS 1000
+
+/**
+ * When written log messages are synced to disk
+ */
+enum log_durability {
+  /**
+   * Leave it to the operating system
+   */
+  LOG_DURABILITY_NONE,
+
+  /**
+   * Sync periodically
+   */
+  LOG_DURABILITY_PERIODIC,
+
+  /**
+   * Sync whenever an error message is written
+   */
+  LOG_DURABILITY_ERROR
+};
+
+/**
+ * Options of a rotating log file
+ */
+struct log_file_options {
+  /**
+   * The path of the log file, rotated files get the suffix .1, .2, ... with .1 the most recent
+   */
+  const char * path;
+
+  /**
+   * The size in bytes at which the file is rotated, or 0 to disable rotation by size
+   */
+  size_t max_size;
+
+  /**
+   * The age in seconds at which the file is rotated, or 0 to disable rotation by age
+   */
+  unsigned int max_age;
+
+  /**
+   * The number of rotated files to keep
+   */
+  unsigned int max_files;
+
+  /**
+   * When written messages are synced to disk
+   */
+  enum log_durability durability;
+
+  /**
+   * The time in milliseconds between two syncs for LOG_DURABILITY_PERIODIC
+   */
+  unsigned int sync_interval_ms;
+
+  /**
+   * The format of the written messages
+   */
+  enum log_output_format format;
+};
+
+/**
+ * A log file that is rotated by size and age
+ */
+struct log_file {
+  /**
+   * The options, the path pointing to the path buffer
+   */
+  struct log_file_options options;
+
+  /**
+   * The path buffer
+   */
+  char path[MAX_LOG_FILE_PATH_LENGTH];
+
+  /**
+   * The file descriptor of the current file
+   */
+  int fd;
+
+  /**
+   * The size of the current file in bytes
+   */
+  size_t size;
+
+  /**
+   * The size at which the current file is rotated, postponed after a failed rotation
+   */
+  size_t rotate_at;
+
+  /**
+   * The wall clock time at which the current file was opened
+   */
+  time_t opened;
+
+  /**
+   * Whether data was written since the last sync
+   */
+  bool dirty;
+
+  /**
+   * The monotonic time of the next periodic sync, only valid when dirty
+   */
+  struct timespec next_sync;
+
+  /**
+   * The number of failed rotations
+   */
+  unsigned long rotation_failures;
+
+  /**
+   * Incremented whenever a new file is opened, starting at 1
+   */
+  unsigned long generation;
+};
+
+/**
+ * Initializes log file options with the defaults
+ * \param options the options
+ * \param path the path of the log file
+ */
+void init_log_file_options(struct log_file_options * options, const char * path);
+
+/**
+ * Opens a log file for appending
+ * \param f the log file
+ * \param options the options, which are copied
+ * \return 0 on success, -1 on error
+ */
+int open_log_file(struct log_file * f, const struct log_file_options * options);
+
+/**
+ * Rotates the log file if it is too large or too old to append the given number of bytes
+ * When rotation fails writing continues in the current file and rotation_failures is incremented
+ * \param f the log file
+ * \param len the number of bytes about to be written
+ */
+void prepare_log_file(struct log_file * f, size_t len);
+
+/**
+ * Writes buffers to the log file
+ * \param f the log file
+ * \param iov the buffers, modified in place
+ * \param count the number of buffers
+ * \param error whether the buffers contain an error message
+ * \return 0 on success, -1 on error
+ */
+int write_log_file(struct log_file * f, struct iovec * iov, int count, bool error);
+
+/**
+ * Fetches the time of the next periodic sync
+ * \param f the log file
+ * \param deadline the destination for the monotonic time of the next sync
+ * \return true if a sync is pending, false otherwise
+ */
+bool get_log_file_sync_deadline(const struct log_file * f, struct timespec * deadline);
+
+/**
+ * Syncs the log file if a periodic sync is due
+ * \param f the log file
+ * \param now the current monotonic time
+ * \return 0 on success, -1 on error
+ */
+int sync_log_file_if_due(struct log_file * f, const struct timespec * now);
+
+/**
+ * Closes the log file, syncing it unless the durability is LOG_DURABILITY_NONE
+ * \param f the log file
+ * \return 0 on success, -1 on error
+ */
+int close_log_file(struct log_file * f);
+
+/**
+ * Writes all buffers to a file descriptor, retrying on partial writes and interrupts
+ * \param fd the file descriptor
+ * \param iov the buffers, modified in place
+ * \param count the number of buffers
+ * \return 0 on success, -1 on error
+ */
+int write_log_iovec(int fd, struct iovec * iov, int count);
+
+#endif
@@ -0,0 +1,473 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#include "log_format.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The text stored for a NULL string argument
+ */
+#define LOG_NULL_STRING "(null)"
+
+/**
+ * Whether a character is a conversion flag
+ * \param c the character
+ * \return true if the character is a flag, false otherwise
+ */
+static bool is_log_conversion_flag(char c) {
+  return c == '-' || c == '+' || c == ' ' || c == '#' || c == '0' || c == '\'';
+}
+
+/**
+ * Whether a character is a decimal digit
+ * \param c the character
+ * \return true if the character is a digit, false otherwise
+ */
+static bool is_log_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+int parse_log_conversion(const char * spec, struct log_conversion * c) {
+  assert(spec != NULL);
+  assert(c != NULL);
+  assert(*spec == '%');
+
+  const char * p = spec + 1;
+  c->width_arg = false;
+  c->precision_arg = false;
+  c->type = LOG_ARG_INT;
+  
+  if(*p == '%') {
+    c->len = 2;
+    c->conversion = '%';
+    c->length_offset = 1;
+    c->length_len = 0;
+    return 0;
+  }
+  
+  while(is_log_conversion_flag(*p)) {
+    ++p;
+  }
+  if(*p == '*') {
+    c->width_arg = true;
+    ++p;
+  } else {
+    while(is_log_digit(*p)) {
+      ++p;
+    }
+  }
+  if(*p == '.') {
+    ++p;
+    if(*p == '*') {
+      c->precision_arg = true;
+      ++p;
+    } else {
+      while(is_log_digit(*p)) {
+	++p;
+      }
+    }
+  }
+
+  c->length_offset = (size_t) (p - spec);
+  bool wide = false;
+  if(p[0] == 'h' && p[1] == 'h') {
+    p += 2;
+  } else if(p[0] == 'l' && p[1] == 'l') {
+    wide = true;
+    p += 2;
+  } else if(*p == 'h') {
+    ++p;
+  } else if(*p == 'l' || *p == 'j' || *p == 'z' || *p == 't') {
+    wide = true;
+    ++p;
+  } else if(*p == 'L' || *p == 'q') {
+    // Long doubles and quads have no portable fixed size representation
+    return -1;
+  }
+  c->length_len = (size_t) (p - spec) - c->length_offset;
+
+  c->conversion = *p;
+  switch(*p) {
+  case 'd':
+  case 'i':
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+    c->type = wide ? LOG_ARG_LONG : LOG_ARG_INT;
+    break;
+  case 'c':
+    if(wide) {
+      return -1;
+    }
+    c->type = LOG_ARG_INT;
+    break;
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    c->type = LOG_ARG_DOUBLE;
+    break;
+  case 's':
+    if(wide) {
+      return -1;
+    }
+    c->type = LOG_ARG_STRING;
+    break;
+  case 'p':
+    c->type = LOG_ARG_POINTER;
+    break;
+  default:
+    // Includes %n, which has no place in a log message, and the end of the string
+    return -1;
+  }
+  c->len = (size_t) (p - spec) + 1;
+  return 0;
+}
+
+int get_log_arg_types(const char * format, unsigned char * types, size_t * count) {
+  assert(format != NULL);
+  assert(types != NULL);
+  assert(count != NULL);
+
+  size_t n = 0;
+  const char * p = format;
+  while((p = strchr(p, '%')) != NULL) {
+    struct log_conversion c;
+    if(parse_log_conversion(p, &c) != 0) {
+      return -1;
+    }
+    if(c.conversion != '%') {
+      if(n + (c.width_arg ? 1 : 0) + (c.precision_arg ? 1 : 0) + 1 > MAX_LOG_ARGS) {
+	return -1;
+      }
+      if(c.width_arg) {
+	types[n++] = LOG_ARG_INT;
+      }
+      if(c.precision_arg) {
+	types[n++] = LOG_ARG_INT;
+      }
+      types[n++] = c.type;
+    }
+    p += c.len;
+  }
+  *count = n;
+  return 0;
+}
+
+size_t measure_log_args(const unsigned char * types, size_t count, va_list args) {
+  assert(types != NULL);
+
+  va_list a;
+  va_copy(a, args);
+  size_t len = 0;
+  for(size_t i = 0; i < count; ++i) {
+    switch(types[i]) {
+    case LOG_ARG_INT:
+      va_arg(a, int);
+      len += sizeof(int32_t);
+      break;
+    case LOG_ARG_LONG:
+      va_arg(a, long long);
+      len += sizeof(int64_t);
+      break;
+    case LOG_ARG_DOUBLE:
+      va_arg(a, double);
+      len += sizeof(double);
+      break;
+    case LOG_ARG_STRING: {
+      const char * str = va_arg(a, const char *);
+      // A NULL string is stored as its text, like printf prints it
+      len += sizeof(uint32_t) + strlen(str != NULL ? str : LOG_NULL_STRING);
+      break;
+    }
+    default:
+      va_arg(a, void *);
+      len += sizeof(uint64_t);
+      break;
+    }
+  }
+  va_end(a);
+  return len;
+}
+
+int encode_log_args(char * dest, size_t size, const unsigned char * types, size_t count, va_list args, size_t * len) {
+  assert(dest != NULL);
+  assert(types != NULL);
+  assert(len != NULL);
+
+  char * p = dest;
+  char * end = dest + size;
+  int result = 0;
+  for(size_t i = 0; i < count && result == 0; ++i) {
+    switch(types[i]) {
+    case LOG_ARG_INT: {
+      int32_t value = (int32_t) va_arg(args, int);
+      if((size_t) (end - p) < sizeof(value)) {
+	result = -1;
+      } else {
+	p = put_log_bytes(p, &value, sizeof(value));
+      }
+      break;
+    }
+    case LOG_ARG_LONG: {
+      int64_t value = (int64_t) va_arg(args, long long);
+      if((size_t) (end - p) < sizeof(value)) {
+	result = -1;
+      } else {
+	p = put_log_bytes(p, &value, sizeof(value));
+      }
+      break;
+    }
+    case LOG_ARG_DOUBLE: {
+      double value = va_arg(args, double);
+      if((size_t) (end - p) < sizeof(value)) {
+	result = -1;
+      } else {
+	p = put_log_bytes(p, &value, sizeof(value));
+      }
+      break;
+    }
+    case LOG_ARG_STRING: {
+      const char * str = va_arg(args, const char *);
+      if(str == NULL) {
+	str = LOG_NULL_STRING;
+      }
+      size_t str_len = strlen(str);
+      if((size_t) (end - p) < sizeof(uint32_t) || (size_t) (end - p) - sizeof(uint32_t) < str_len) {
+	result = -1;
+      } else {
+	uint32_t value = (uint32_t) str_len;
+	p = put_log_bytes(p, &value, sizeof(value));
+	p = put_log_bytes(p, str, str_len);
+      }
+      break;
+    }
+    default: {
+      uint64_t value = (uint64_t) (uintptr_t) va_arg(args, void *);
+      if((size_t) (end - p) < sizeof(value)) {
+	result = -1;
+      } else {
+	p = put_log_bytes(p, &value, sizeof(value));
+      }
+      break;
+    }
+    }
+  }
+  *len = (size_t) (p - dest);
+  return result;
+}
+
+/**
+ * Formats a single converted argument at a position in a destination buffer
+ * \param dest the destination buffer
+ * \param size the size of the destination buffer
+ * \param pos the position in the destination buffer, may be past its end
+ * \param spec the NUL terminated conversion specification
+ * \param stars the width and precision arguments
+ * \param star_count the number of width and precision arguments
+ * \param type the type of the argument
+ * \param value the argument, an int32_t, int64_t, double, NUL terminated string or uint64_t
+ * \return the number of characters the conversion produces or -1 on error
+ */
+static int format_log_arg(char * dest, size_t size, size_t pos, const char * spec, const int * stars, int star_count, enum log_arg_type type, const void * value) {
+  char * d = pos < size ? dest + pos : NULL;
+  size_t n = pos < size ? size - pos : 0;
+  switch(type) {
+  case LOG_ARG_INT: {
+    int v = (int) *(const int32_t *) value;
+    return star_count == 2 ? snprintf(d, n, spec, stars[0], stars[1], v) : star_count == 1 ? snprintf(d, n, spec, stars[0], v) : snprintf(d, n, spec, v);
+  }
+  case LOG_ARG_LONG: {
+    long long v = (long long) *(const int64_t *) value;
+    return star_count == 2 ? snprintf(d, n, spec, stars[0], stars[1], v) : star_count == 1 ? snprintf(d, n, spec, stars[0], v) : snprintf(d, n, spec, v);
+  }
+  case LOG_ARG_DOUBLE: {
+    double v = *(const double *) value;
+    return star_count == 2 ? snprintf(d, n, spec, stars[0], stars[1], v) : star_count == 1 ? snprintf(d, n, spec, stars[0], v) : snprintf(d, n, spec, v);
+  }
+  case LOG_ARG_STRING: {
+    const char * v = (const char *) value;
+    return star_count == 2 ? snprintf(d, n, spec, stars[0], stars[1], v) : star_count == 1 ? snprintf(d, n, spec, stars[0], v) : snprintf(d, n, spec, v);
+  }
+  default: {
+    // Only the address is printed, the pointer is never dereferenced
+    void * v = (void *) (uintptr_t) *(const uint64_t *) value;
+    return star_count == 2 ? snprintf(d, n, spec, stars[0], stars[1], v) : star_count == 1 ? snprintf(d, n, spec, stars[0], v) : snprintf(d, n, spec, v);
+  }
+  }
+}
+
+int format_log_args(char * dest, size_t size, const char * format, const unsigned char * types, size_t count, const char * args, size_t len) {
+  assert(format != NULL);
+  assert(types != NULL);
+  assert(dest != NULL || size == 0);
+
+  const char * p = args;
+  const char * end = args + len;
+  size_t arg = 0;
+  size_t pos = 0;
+  const char * f = format;
+  while(*f != '\0') {
+    const char * percent = strchr(f, '%');
+    size_t literal = percent != NULL ? (size_t) (percent - f) : strlen(f);
+    if(pos < size) {
+      memcpy(dest + pos, f, pos + literal < size ? literal : size - pos);
+    }
+    pos += literal;
+    if(percent == NULL) {
+      break;
+    }
+
+    struct log_conversion c;
+    if(parse_log_conversion(percent, &c) != 0 || c.len + 2 >= LOG_SPEC_BUFFER_SIZE) {
+      return -1;
+    }
+    f = percent + c.len;
+    if(c.conversion == '%') {
+      if(pos < size) {
+	dest[pos] = '%';
+      }
+      ++pos;
+      continue;
+    }
+
+    // The width and precision precede the converted argument
+    int stars[2];
+    int star_count = 0;
+    for(int i = 0; i < (c.width_arg ? 1 : 0) + (c.precision_arg ? 1 : 0); ++i) {
+      int32_t value;
+      if(arg >= count || types[arg] != LOG_ARG_INT || (size_t) (end - p) < sizeof(value)) {
+	return -1;
+      }
+      p = get_log_bytes(p, &value, sizeof(value));
+      stars[star_count++] = value;
+      ++arg;
+    }
+    if(arg >= count || types[arg] != c.type) {
+      return -1;
+    }
+    ++arg;
+
+    // Integers stored in 8 bytes are printed with the ll length modifier
+    char spec[LOG_SPEC_BUFFER_SIZE];
+    memcpy(spec, percent, c.length_offset);
+    size_t spec_len = c.length_offset;
+    if(c.type == LOG_ARG_LONG) {
+      spec[spec_len++] = 'l';
+      spec[spec_len++] = 'l';
+    } else {
+      memcpy(spec + spec_len, percent + c.length_offset, c.length_len);
+      spec_len += c.length_len;
+    }
+    spec[spec_len++] = c.conversion;
+    spec[spec_len] = '\0';
+
+    int result;
+    if(c.type == LOG_ARG_STRING) {
+      uint32_t str_len;
+      if((size_t) (end - p) < sizeof(str_len)) {
+	return -1;
+      }
+      p = get_log_bytes(p, &str_len, sizeof(str_len));
+      if((size_t) (end - p) < str_len) {
+	return -1;
+      }
+      // Stored strings are not NUL terminated, the precision limits the conversion to the stored length
+      char str_spec[LOG_SPEC_BUFFER_SIZE];
+      const char * str = p;
+      p += str_len;
+      int precision = (int) str_len;
+      if(c.precision_arg) {
+	if(stars[star_count - 1] >= 0 && stars[star_count - 1] < precision) {
+	  precision = stars[star_count - 1];
+	}
+	--star_count;
+      } else if(memchr(spec, '.', spec_len) != NULL) {
+	int limit = atoi((const char *) memchr(spec, '.', spec_len) + 1);
+	if(limit < precision) {
+	  precision = limit;
+	}
+      }
+      const char * dot = memchr(spec, '.', spec_len);
+      size_t prefix_len = dot != NULL ? (size_t) (dot - spec) : spec_len - 1;
+      memcpy(str_spec, spec, prefix_len);
+      memcpy(str_spec + prefix_len, ".*s", 4);
+      char * d = pos < size ? dest + pos : NULL;
+      size_t n = pos < size ? size - pos : 0;
+      if(star_count == 1) {
+	result = snprintf(d, n, str_spec, stars[0], precision, str);
+      } else {
+	result = snprintf(d, n, str_spec, precision, str);
+      }
+    } else {
+      size_t value_len = c.type == LOG_ARG_INT ? sizeof(int32_t) : sizeof(int64_t);
+      char value[sizeof(int64_t)];
+      if((size_t) (end - p) < value_len) {
+	return -1;
+      }
+      p = get_log_bytes(p, value, value_len);
+      result = format_log_arg(dest, size, pos, spec, stars, star_count, c.type, value);
+    }
+    if(result < 0) {
+      return -1;
+    }
+    pos += (size_t) result;
+  }
+  if(size != 0) {
+    dest[pos < size ? pos : size - 1] = '\0';
+  }
+  return pos > INT_MAX ? -1 : (int) pos;
+}
+
+void encode_log_record_header(char * dest, enum log_record_type type, uint32_t len) {
+  assert(dest != NULL);
+
+  uint8_t t = (uint8_t) type;
+  dest = put_log_bytes(dest, &t, sizeof(t));
+  put_log_bytes(dest, &len, sizeof(len));
+}
+
+void encode_log_file_header(char * dest) {
+  assert(dest != NULL);
+
+  uint32_t order = LOG_BINARY_BYTE_ORDER;
+  dest = put_log_bytes(dest, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LENGTH);
+  put_log_bytes(dest, &order, sizeof(order));
+}
+
+char * put_log_bytes(char * dest, const void * value, size_t len) {
+  assert(dest != NULL);
+
+  memcpy(dest, value, len);
+  return dest + len;
+}
+
+const char * get_log_bytes(const char * src, void * value, size_t len) {
+  assert(src != NULL);
+
+  memcpy(value, src, len);
+  return src + len;
+}
@@ -0,0 +1,244 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The magic bytes at the start of a binary log file
+ */
+#define LOG_BINARY_MAGIC "DBLOG\0\0\1"
+
+/**
+ * The length of the magic bytes
+ */
+#define LOG_BINARY_MAGIC_LENGTH 8
+
+/**
+ * Written after the magic bytes in native byte order, to detect files written on a machine with another byte order
+ */
+#define LOG_BINARY_BYTE_ORDER 0x01020304u
+
+/**
+ * The length of the binary log file header
+ */
+#define LOG_BINARY_HEADER_LENGTH (LOG_BINARY_MAGIC_LENGTH + 4)
+
+/**
+ * The length of a record header: a one byte type and a four byte payload length
+ */
+#define LOG_RECORD_HEADER_LENGTH 5
+
+/**
+ * The maximum number of arguments of a log statement written in binary form
+ */
+#define MAX_LOG_ARGS 32
+
+/**
+ * Size of the buffer for a conversion specification rewritten for a stored argument type
+ */
+#define LOG_SPEC_BUFFER_SIZE 64
+
+/**
+ * The format of written log messages
+ */
+enum log_output_format {
+  /**
+   * Human readable lines
+   */
+  LOG_FORMAT_TEXT,
+
+  /**
+   * Binary records with unformatted arguments, rendered offline by log_decode
+   */
+  LOG_FORMAT_BINARY
+};
+
+/**
+ * The type of a record in a binary log file
+ */
+enum log_record_type {
+  /**
+   * Describes a log statement: ID, level, file, line, format and argument types
+   */
+  LOG_RECORD_SITE = 1,
+
+  /**
+   * A message of a described log statement: site ID, time, thread, suppressed count and arguments
+   */
+  LOG_RECORD_MESSAGE = 2,
+
+  /**
+   * A preformatted message: level, time, thread, suppressed count, file, line and text
+   */
+  LOG_RECORD_TEXT = 3
+};
+
+/**
+ * The type of an argument as stored in a binary log record
+ */
+enum log_arg_type {
+  /**
+   * Anything promoted to int, stored in 4 bytes
+   */
+  LOG_ARG_INT,
+
+  /**
+   * A long, long long, size_t, ptrdiff_t or intmax_t, stored in 8 bytes
+   */
+  LOG_ARG_LONG,
+
+  /**
+   * A double, stored in 8 bytes
+   */
+  LOG_ARG_DOUBLE,
+
+  /**
+   * A string, stored as a 4 byte length followed by the characters
+   */
+  LOG_ARG_STRING,
+
+  /**
+   * A pointer, stored in 8 bytes
+   */
+  LOG_ARG_POINTER
+};
+
+/**
+ * A conversion specification in a format string
+ */
+struct log_conversion {
+  /**
+   * The length of the specification, including the leading '%'
+   */
+  size_t len;
+
+  /**
+   * The conversion character, '%' for a literal percent sign
+   */
+  char conversion;
+
+  /**
+   * Whether the width is passed as an int argument
+   */
+  bool width_arg;
+
+  /**
+   * Whether the precision is passed as an int argument
+   */
+  bool precision_arg;
+
+  /**
+   * The offset of the length modifier within the specification
+   */
+  size_t length_offset;
+
+  /**
+   * The length of the length modifier
+   */
+  size_t length_len;
+
+  /**
+   * The type of the converted argument, not valid for '%'
+   */
+  enum log_arg_type type;
+};
+
+/**
+ * Parses a conversion specification
+ * \param spec the specification, starting at the '%'
+ * \param c the destination for the parsed specification
+ * \return 0 on success, -1 if the specification is invalid or can not be stored in binary form
+ */
+int parse_log_conversion(const char * spec, struct log_conversion * c);
+
+/**
+ * Determines the types of the arguments of a format string
+ * \param format the format string
+ * \param types the destination for the argument types, MAX_LOG_ARGS long
+ * \param count the destination for the number of arguments
+ * \return 0 on success, -1 if the arguments can not be stored in binary form
+ */
+int get_log_arg_types(const char * format, unsigned char * types, size_t * count);
+
+/**
+ * Computes the number of bytes needed to store arguments in binary form
+ * \param types the argument types
+ * \param count the number of arguments
+ * \param args the arguments
+ * \return the number of bytes
+ */
+size_t measure_log_args(const unsigned char * types, size_t count, va_list args);
+
+/**
+ * Stores arguments in binary form
+ * \param dest the destination buffer
+ * \param size the size of the destination buffer, the arguments fit if it is at least what measure_log_args computes
+ * \param types the argument types
+ * \param count the number of arguments
+ * \param args the arguments
+ * \param len the destination for the number of bytes written
+ * \return 0 on success, -1 if the arguments do not fit
+ */
+int encode_log_args(char * dest, size_t size, const unsigned char * types, size_t count, va_list args, size_t * len);
+
+/**
+ * Formats arguments stored in binary form, like snprintf
+ * \param dest the destination buffer, may be NULL if size is 0
+ * \param size the size of the destination buffer, the output is truncated and NUL terminated to fit
+ * \param format the format string the arguments were stored for
+ * \param types the argument types
+ * \param count the number of arguments
+ * \param args the stored arguments
+ * \param len the length of the stored arguments
+ * \return the length of the untruncated output or -1 if the arguments do not match the format
+ */
+int format_log_args(char * dest, size_t size, const char * format, const unsigned char * types, size_t count, const char * args, size_t len);
+
+/**
+ * Writes a record header
+ * \param dest the destination buffer, at least LOG_RECORD_HEADER_LENGTH long
+ * \param type the record type
+ * \param len the length of the payload
+ */
+void encode_log_record_header(char * dest, enum log_record_type type, uint32_t len);
+
+/**
+ * Writes the binary log file header
+ * \param dest the destination buffer, at least LOG_BINARY_HEADER_LENGTH long
+ */
+void encode_log_file_header(char * dest);
+
+/**
+ * Appends a value to a buffer
+ * \param dest the destination buffer
+ * \param value the value
+ * \param len the length of the value
+ * \return a pointer just past the appended value
+ */
+char * put_log_bytes(char * dest, const void * value, size_t len);
+
+/**
+ * Reads a value from a buffer
+ * \param src the source buffer
+ * \param value the destination for the value
+ * \param len the length of the value
+ * \return a pointer just past the read value
+ */
+const char * get_log_bytes(const char * src, void * value, size_t len);
+
+#endif
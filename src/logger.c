@@ -11,6 +11,9 @@
  */
 
 #include "logger.h"
+#include "log_clock.h"
+#include "log_file.h"
+#include "log_format.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -19,14 +22,121 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define log_cpu_relax() _mm_pause()
+#else
+#define log_cpu_relax() ((void) 0)
+#endif
 
 /**
  * Buffer size for the API error messages
  */
 #define ERROR_BUFFER_SIZE 128
 
+/**
+ * Size of the buffer the worker renders log messages into before writing them to the output
+ */
+#define LOG_WRITE_BUFFER_SIZE 65536
+
+/**
+ * Maximum size of the rendered message header, i.e. everything but the message content
+ */
+#define LOG_HEADER_BUFFER_SIZE 512
+
+/**
+ * Maximum size of the rendered message trailer, i.e. the suppressed message count and the newline
+ */
+#define LOG_TRAILER_BUFFER_SIZE 64
+
+/**
+ * Size of the buffer holding the rendered date and time up to the second
+ */
+#define LOG_TIME_BUFFER_SIZE 32
+
+/**
+ * Minimum time in milliseconds between two reports of dropped messages
+ */
+#define LOG_DROP_REPORT_INTERVAL_MS 1000
+
+/**
+ * The number of log levels
+ */
+#define LOG_LEVEL_COUNT (LOG_LEVEL_ERROR + 1)
+
+/**
+ * Size of the buffer for the records describing log statements in binary output
+ */
+#define LOG_PREFIX_BUFFER_SIZE 16384
+
+/**
+ * The maximum number of log statements with an ID in binary output
+ */
+#define MAX_LOG_SITES 4096
+
+/**
+ * File names and formats longer than this are truncated in binary output
+ */
+#define MAX_LOG_SITE_TEXT_LENGTH 4096
+
+/**
+ * The length of the fixed part of a binary message record payload: site ID, time, thread and suppressed count
+ */
+#define LOG_MESSAGE_RECORD_LENGTH 20
+
+/**
+ * The number of bytes of arguments or text kept per flight recorder slot, longer messages are truncated
+ */
+#define LOG_RECORDER_DATA_SIZE 224
+
+/**
+ * Size of the buffer for a flight recorder message formatted in a signal handler
+ */
+#define LOG_CRASH_BUFFER_SIZE 1024
+
+/**
+ * The number of times the worker polls for new messages before it goes to sleep, on machines with more than one CPU
+ */
+#define LOG_WORKER_SPIN_COUNT 2000
+
+/**
+ * The number of message buffer size classes in the message pool
+ */
+#define LOG_MSG_SIZE_CLASS_COUNT 4
+
+/**
+ * Each size class in the message pool has 1 / 2^LOG_MSG_POOL_SHIFT as many messages as the previous one
+ */
+#define LOG_MSG_POOL_SHIFT 3
+
+/**
+ * The number of output formats
+ */
+#define LOG_FORMAT_COUNT (LOG_FORMAT_BINARY + 1)
+
+/**
+ * The initial number of messages a batch has room for
+ */
+#define LOG_BATCH_INITIAL_CAPACITY 256
+
+/**
+ * The size of the buffer for formatting arguments stored in binary form for text output
+ */
+#define LOG_SCRATCH_BUFFER_SIZE 16384
+
+/**
+ * Appended to the format string of a message whose stored arguments do not match it, in place of the arguments
+ */
+#define LOG_TRUNCATED_ARGS "<truncated arguments>"
+
 /**
  * A log message
  */
@@ -46,16 +156,51 @@ struct log_msg {
    */
   int line;
 
+  /**
+   * The raw timestamp taken when the message was logged
+   */
+  log_ticks ticks;
+
+  /**
+   * The number of messages of the same log statement suppressed before this one
+   */
+  unsigned int suppressed;
+
+  /**
+   * The ID of the log statement if the content holds its arguments in binary form, 0 if the content is text
+   */
+  unsigned int site_id;
+
+  /**
+   * The ID of the thread that logged the message
+   */
+  uint32_t thread;
+
+  /**
+   * Whether the message comes from a flight recorder and is written to every sink regardless of its log level
+   */
+  bool recorded;
+
   /**
    * The content buffer
    */
   char * buffer;
 
+  /**
+   * Length of the content in bytes, not including the terminating 0
+   */
+  size_t len;
+
   /**
    * Content buffer size in bytes
    */
   size_t size;
 
+  /**
+   * The size class of the content buffer in the message pool
+   */
+  int size_class;
+
   /**
    * A pointer to the previous message in the queue
    */
@@ -80,6 +225,11 @@ struct log_queue {
    * The tail of the queue
    */
   struct log_msg * tail;
+
+  /**
+   * The number of messages in the queue
+   */
+  size_t len;
 };
 
 /**
@@ -119,7 +269,17 @@ enum log_status {
   /**
    * The worker failed to print a log message
    */
-  LOG_STATUS_PRINT
+  LOG_STATUS_PRINT,
+
+  /**
+   * The worker failed to read the clock
+   */
+  LOG_STATUS_CLOCK,
+
+  /**
+   * The worker failed to sync the log file
+   */
+  LOG_STATUS_SYNC
 };
 
 static const char * log_status_labels[] = {
@@ -129,380 +289,3133 @@ static const char * log_status_labels[] = {
   "failed to unlock waiting log queue mutex",
   "failed to lock ready log queue mutex",
   "failed to unlock ready log queue mutex",
-  "failed to print log message"
+  "failed to print log message",
+  "failed to read the clock",
+  "failed to sync log file"
 };
 
 /**
- * Whether the system is running, protected by the waiting mutex
+ * Buffers rendered log messages until they are written to the output in a single system call
  */
-static bool running;
+struct log_writer {
+  /**
+   * The file descriptor of the output
+   */
+  int fd;
 
-/**
- * The minimum log level, protected by the waiting queue mutex
- */
-static enum log_level min_log_level;
+  /**
+   * The rotating log file of the output or NULL if the output is not a log file
+   */
+  struct log_file * file;
 
-/**
- * The queue for messages waiting to be written, protected by a mutex
- */
-static struct log_queue waiting;
+  /**
+   * The format of the output, binary output requires a log file
+   */
+  enum log_output_format format;
 
-/**
- * The mutex protecting the waiting queue, the min_log_level and the running flag
- */
-static pthread_mutex_t waiting_mutex = PTHREAD_MUTEX_INITIALIZER;
+  /**
+   * The buffer for the file header and the records describing log statements, written before the write buffer
+   */
+  char * prefix;
 
-/**
- * The condition variable used to signal new messages or that the worker may stop
- */
-static pthread_cond_t waiting_cond = PTHREAD_COND_INITIALIZER;
+  /**
+   * The number of bytes in the prefix buffer
+   */
+  size_t prefix_len;
 
-/**
- * The queue for messages ready to be reused, protected by a mutex
- */
-static struct log_queue ready;
+  /**
+   * The IDs of the log statements with messages in the write buffer
+   */
+  unsigned int pending[MAX_LOG_SITES];
 
-/**
- * The mutex protecting the ready queue
- */
-static pthread_mutex_t ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+  /**
+   * The number of log statements with messages in the write buffer
+   */
+  size_t pending_count;
 
-/**
- * The worker thread handle
- */
-static pthread_t worker;
+  /**
+   * The number of times the write buffer was flushed, starting at 1
+   */
+  unsigned long flushes;
 
-/**
- * The output file
- */
-static FILE * output;
+  /**
+   * The write buffer
+   */
+  char * buffer;
 
-/**
- * Log level labels
- */
-static const char * log_level_labels[] =  {
-  "DEBUG:  ",
-  "INFO:   ",
-  "WARNING:",
-  "ERROR:  "
+  /**
+   * The number of rendered bytes in the buffer
+   */
+  size_t len;
+
+  /**
+   * The size of the buffer
+   */
+  size_t size;
+
+  /**
+   * Whether the buffer contains a message that should be written out immediately
+   */
+  bool urgent;
+
+  /**
+   * The time at which the buffer must be flushed, only valid when the buffer is not empty
+   */
+  struct timespec deadline;
+
+  /**
+   * How long rendered messages may be held in the buffer, in milliseconds
+   */
+  unsigned int flush_interval_ms;
 };
 
 /**
- * Creates a new log message
- * \return a newly allocated message on the stack
+ * The state for rendering messages, owned by the worker thread
  */
-static struct log_msg * create_log_msg() {
-  struct log_msg * msg = (struct log_msg *) malloc(sizeof(struct log_msg));
-  if(msg != NULL) {
-    msg->level = LOG_LEVEL_DEBUG;
-    msg->file = NULL;
-    msg->line = 0;
-    msg->buffer = NULL;
-    msg->size = 0;
-    msg->prev = NULL;
-    msg->next = NULL;
-  }
-  return msg;
-}
+struct log_renderer {
+  /**
+   * The second of the last rendered timestamp
+   */
+  time_t second;
 
-/**
- * Destroys a log message
- * \param msg the message
- */
-static void destroy_log_msg(struct log_msg * msg) {
-  assert(msg != NULL);
+  /**
+   * The rendered date and time of the last rendered timestamp, up to the second
+   */
+  char second_text[LOG_TIME_BUFFER_SIZE];
 
-  free(msg->buffer);
-  free(msg);
-}
+  /**
+   * The buffer for formatting the arguments of messages stored in binary form for text output
+   */
+  char scratch[LOG_SCRATCH_BUFFER_SIZE];
+};
 
 /**
- * Initializes a log queue
- * \param q the queue
+ * A message rendered into a batch
  */
-static void init_log_queue(struct log_queue * q) {
-  assert(q != NULL);
+struct log_batch_entry {
+  /**
+   * The log level of the message
+   */
+  enum log_level level;
 
-  q->head = NULL;
-  q->tail = NULL;
-}
+  /**
+   * The ID of the log statement of the message if it is a binary record holding arguments, 0 otherwise
+   */
+  unsigned int site_id;
+
+  /**
+   * Whether the message comes from a flight recorder and is written regardless of the sink level
+   */
+  bool recorded;
+
+  /**
+   * The offset of the rendered message in the batch data
+   */
+  size_t offset;
+
+  /**
+   * The length of the rendered message
+   */
+  size_t len;
+};
 
 /**
- * Pushes a log message onto the queue
- * \param q the queue
- * \param msg the message
+ * Messages rendered once in one format and shared by all sinks using the format
  */
-static void push_log_msg(struct log_queue * q, struct log_msg * msg) {
-  assert(q != NULL);
-  assert(msg != NULL);
+struct log_batch {
+  /**
+   * The format of the rendered messages
+   */
+  enum log_output_format format;
 
-  if(q->tail == NULL) {
-    q->head = msg;
-  } else {
-    q->tail->next = msg;
-  }
-  msg->prev = q->tail;
-  msg->next = NULL;
-  q->tail = msg;
-}
+  /**
+   * The number of references from the worker and the sink queues
+   */
+  atomic_uint refs;
+
+  /**
+   * The rendered messages
+   */
+  char * data;
+
+  /**
+   * The number of bytes of rendered messages
+   */
+  size_t len;
+
+  /**
+   * The size of the data buffer
+   */
+  size_t size;
+
+  /**
+   * The rendered messages
+   */
+  struct log_batch_entry * entries;
+
+  /**
+   * The number of rendered messages
+   */
+  size_t count;
+
+  /**
+   * The number of entries that fit in the entry array
+   */
+  size_t capacity;
+
+  /**
+   * The highest log level of the rendered messages, flight recorder messages count as errors
+   */
+  enum log_level max_level;
+
+  /**
+   * The next free batch
+   */
+  struct log_batch * next;
+};
 
 /**
- * Pops a message off the queue
- * \param q the queue
- * \return the message or NULL if the queue was empty
+ * An output of the logger with its own log level, format, queue and thread
  */
-static struct log_msg * pop_log_msg(struct log_queue * q) {
-  assert(q != NULL);
+struct log_sink {
+  /**
+   * The options the sink was added with
+   */
+  struct log_sink_options options;
 
-  if(q->head == NULL) {
-    return NULL;
-  } else {
-    struct log_msg * msg = q->head;
-    q->head = q->head->next;
-    if(q->head == NULL) {
-      q->tail = NULL;
-    }
-    msg->next = NULL;
+  /**
+   * The format of the messages written to the sink
+   */
+  enum log_output_format format;
+
+  /**
+   * The rotating log file of a file sink
+   */
+  struct log_file file;
+
+  /**
+   * The writer of a stream or file sink
+   */
+  struct log_writer writer;
+
+  /**
+   * The memory of a ring sink
+   */
+  char * ring;
+
+  /**
+   * The offset of the oldest byte in the ring
+   */
+  size_t ring_start;
+
+  /**
+   * The number of bytes in the ring
+   */
+  size_t ring_len;
+
+  /**
+   * The mutex protecting the sink queue and the ring
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signals the sink thread that batches are available or that it should stop
+   */
+  pthread_cond_t cond;
+
+  /**
+   * Signals the worker that there is space in the sink queue
+   */
+  pthread_cond_t space_cond;
+
+  /**
+   * The queued batches, a ring of options.queue_capacity entries
+   */
+  struct log_batch ** batches;
+
+  /**
+   * The index of the oldest queued batch
+   */
+  size_t head;
+
+  /**
+   * The number of queued batches
+   */
+  size_t count;
+
+  /**
+   * The batches taken by the sink thread, options.queue_capacity entries
+   */
+  struct log_batch ** taken;
+
+  /**
+   * Whether the sink thread should stop after writing the queued batches
+   */
+  bool stopping;
+
+  /**
+   * Whether the sink thread waits for batches and has not been signalled yet
+   */
+  bool sleeping;
+
+  /**
+   * Whether the sink thread has exited, batches queued from then on are dropped
+   */
+  bool stopped;
+
+  /**
+   * The number of messages dropped because the sink fell behind, owned by the worker
+   */
+  unsigned long dropped;
+
+  /**
+   * The number of dropped messages already reported, owned by the worker
+   */
+  unsigned long reported;
+
+  /**
+   * The number of failed rotations of the log file of a file sink, counted by the sink thread
+   */
+  atomic_ulong rotation_failures;
+
+  /**
+   * The number of failed rotations already reported, owned by the worker
+   */
+  unsigned long rotations_reported;
+
+  /**
+   * The sink thread
+   */
+  pthread_t thread;
+};
+
+/**
+ * Whether the arguments of a log statement can be stored in binary form
+ */
+enum log_site_description {
+  /**
+   * The arguments have not been examined yet
+   */
+  LOG_SITE_UNDESCRIBED,
+
+  /**
+   * The arguments can be stored in binary form
+   */
+  LOG_SITE_BINARY,
+
+  /**
+   * The arguments can not be stored in binary form, messages are stored as text
+   */
+  LOG_SITE_TEXT
+};
+
+/**
+ * The description of a log statement with an ID for binary output
+ */
+struct log_site_entry {
+  /**
+   * The log statement
+   */
+  const struct log_site * site;
+
+  /**
+   * The format string, set when the statement is described
+   */
+  const char * format;
+
+  /**
+   * The argument types, set when the statement is described
+   */
+  unsigned char types[MAX_LOG_ARGS];
+
+  /**
+   * The number of arguments, set when the statement is described
+   */
+  size_t arg_count;
+
+  /**
+   * Whether the statement has been described and how
+   */
+  atomic_int description;
+
+  /**
+   * The generation of the log file the description was last written to, owned by the worker
+   */
+  unsigned long written_generation;
+
+  /**
+   * The flush of the write buffer the statement is pending for, owned by the worker
+   */
+  unsigned long pending_flush;
+};
+
+/**
+ * A message kept in the flight recorder
+ */
+struct log_recorder_slot {
+  /**
+   * The log statement
+   */
+  const struct log_site * site;
+
+  /**
+   * The description of the log statement if the data holds its arguments in binary form, NULL if the data is text
+   */
+  const struct log_site_entry * entry;
+
+  /**
+   * The raw timestamp of the message
+   */
+  log_ticks ticks;
+
+  /**
+   * The number of bytes in the data
+   */
+  size_t len;
+
+  /**
+   * The arguments or the formatted text
+   */
+  char data[LOG_RECORDER_DATA_SIZE];
+};
+
+/**
+ * The flight recorder of a thread, a ring of the most recent messages below the log level
+ */
+struct log_recorder {
+  /**
+   * The number of slots
+   */
+  size_t slot_count;
+
+  /**
+   * The number of messages ever recorded, the next message goes to this slot modulo the slot count
+   */
+  size_t next;
+
+  /**
+   * The number of messages in the ring
+   */
+  size_t used;
+
+  /**
+   * The slots
+   */
+  struct log_recorder_slot slots[];
+};
+
+/**
+ * Whether the system is running, protected by the waiting mutex
+ */
+static bool running;
+
+/**
+ * The minimum log level, protected by the waiting queue mutex
+ */
+static enum log_level min_log_level;
+
+/**
+ * The queue for messages waiting to be written, protected by a mutex
+ */
+static struct log_queue waiting;
+
+/**
+ * The mutex protecting the waiting queue, the min_log_level and the running flag
+ */
+static pthread_mutex_t waiting_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The maximum number of waiting messages, protected by the waiting mutex
+ */
+static size_t capacity = DEFAULT_LOG_QUEUE_CAPACITY;
+
+/**
+ * What to do with messages when the waiting queue is full, protected by the waiting mutex
+ */
+static enum log_overflow_policy overflow_policy = LOG_OVERFLOW_DROP_NEWEST;
+
+/**
+ * The level below which messages are dropped first, protected by the waiting mutex
+ */
+static enum log_level drop_level = LOG_LEVEL_WARNING;
+
+/**
+ * The number of dropped messages per level since the last report, protected by the waiting mutex
+ */
+static unsigned long dropped[LOG_LEVEL_COUNT];
+
+/**
+ * Whether the worker has stopped handling messages, protected by the waiting mutex
+ */
+static bool worker_stopped;
+
+/**
+ * Whether the worker waits on the waiting condition and nobody has signalled it yet, protected by the waiting mutex
+ */
+static bool worker_sleeping;
+
+/**
+ * A hint for the spinning worker that messages were queued since it last took the waiting queue
+ */
+static atomic_bool work_available;
+
+/**
+ * The number of times the worker polls for new messages before it goes to sleep
+ */
+static int worker_spin_count;
+
+/**
+ * The condition variable used to signal blocked threads that the waiting queue has room
+ */
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * The condition variable used to signal new messages or that the worker may stop
+ * Initialized by start_logger to use the monotonic clock for timed waits
+ */
+static pthread_cond_t waiting_cond;
+
+/**
+ * A pool of preallocated messages, with a queue of messages ready to be reused for each size class
+ */
+struct log_msg_pool {
+  /**
+   * The memory backing all messages and their content buffers
+   */
+  char * slab;
+
+  /**
+   * The messages ready to be reused, per size class
+   */
+  struct log_queue ready[LOG_MSG_SIZE_CLASS_COUNT];
+
+  /**
+   * Whether the worker has stopped returning messages to the pool
+   */
+  bool closed;
+};
+
+/**
+ * Content buffer sizes of the message pool size classes
+ */
+static const size_t log_msg_size_classes[LOG_MSG_SIZE_CLASS_COUNT] = {
+  256,
+  1024,
+  4096,
+  16384
+};
+
+/**
+ * The message pool, protected by the ready mutex
+ */
+static struct log_msg_pool pool;
+
+/**
+ * The mutex protecting the message pool
+ */
+static pthread_mutex_t ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The condition variable used to signal blocked threads that messages were returned to the pool
+ */
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * The worker thread handle
+ */
+static pthread_t worker;
+
+/**
+ * The sinks, added before the logger is started
+ */
+static struct log_sink log_sinks[MAX_LOG_SINKS];
+
+/**
+ * The number of sinks
+ */
+static size_t log_sink_count;
+
+/**
+ * The number of messages whose stored arguments could not be formatted since the last report, owned by the worker
+ */
+static unsigned long malformed_log_msgs;
+
+/**
+ * The rendering state of the worker
+ */
+static struct log_renderer renderer;
+
+/**
+ * The batches ready to be reused, protected by the batch mutex
+ */
+static struct log_batch * free_batches;
+
+/**
+ * The mutex protecting the free batches
+ */
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * A module with its own log level
+ */
+struct log_module {
+  /**
+   * The module name
+   */
+  char name[MAX_LOG_MODULE_NAME_LENGTH];
+
+  /**
+   * The minimum log level of the module
+   */
+  enum log_level level;
+};
+
+/**
+ * The modules with their own log level, protected by the sites mutex
+ */
+static struct log_module modules[MAX_LOG_MODULES];
+
+/**
+ * The number of modules with their own log level, protected by the sites mutex
+ */
+static size_t module_count;
+
+/**
+ * The registered log statements, protected by the sites mutex
+ */
+static struct log_site * sites;
+
+/**
+ * The descriptions of the log statements with an ID, indexed by ID - 1, protected by the sites mutex
+ */
+static struct log_site_entry site_entries[MAX_LOG_SITES];
+
+/**
+ * The number of log statements with an ID, protected by the sites mutex
+ */
+static unsigned int site_count;
+
+/**
+ * The mutex protecting the module log levels and the registered log statements
+ */
+static pthread_mutex_t sites_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Whether producers store the arguments of log statements in binary form
+ */
+static atomic_bool binary_capture;
+
+/**
+ * The ID of the current thread, 0 until it is first needed
+ */
+static _Thread_local uint32_t thread_id;
+
+/**
+ * The number of flight recorder slots per thread, 0 if the recorder is disabled, written under the sites mutex
+ */
+static atomic_size_t recorder_slots;
+
+/**
+ * The flight recorder of the current thread, NULL until it is first needed
+ */
+static _Thread_local struct log_recorder * recorder;
+
+/**
+ * The key releasing flight recorders when their threads exit
+ */
+static pthread_key_t recorder_key;
+
+/**
+ * Creates the recorder key once
+ */
+static pthread_once_t recorder_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * The mapping of raw timestamps to wall clock time, owned by the worker thread while it is running
+ */
+static struct log_calibration calibration;
+
+/**
+ * Log level labels
+ */
+static const char * log_level_labels[] =  {
+  "DEBUG:  ",
+  "INFO:   ",
+  "WARNING:",
+  "ERROR:  "
+};
+
+/**
+ * Initializes a log queue
+ * \param q the queue
+ */
+static void init_log_queue(struct log_queue * q) {
+  assert(q != NULL);
+
+  q->head = NULL;
+  q->tail = NULL;
+  q->len = 0;
+}
+
+/**
+ * Pushes a log message onto the queue
+ * \param q the queue
+ * \param msg the message
+ */
+static void push_log_msg(struct log_queue * q, struct log_msg * msg) {
+  assert(q != NULL);
+  assert(msg != NULL);
+
+  if(q->tail == NULL) {
+    q->head = msg;
+  } else {
+    q->tail->next = msg;
+  }
+  msg->prev = q->tail;
+  msg->next = NULL;
+  q->tail = msg;
+  ++q->len;
+}
+
+/**
+ * Pops a message off the queue
+ * \param q the queue
+ * \return the message or NULL if the queue was empty
+ */
+static struct log_msg * pop_log_msg(struct log_queue * q) {
+  assert(q != NULL);
+
+  if(q->head == NULL) {
+    return NULL;
+  } else {
+    struct log_msg * msg = q->head;
+    q->head = q->head->next;
+    if(q->head == NULL) {
+      q->tail = NULL;
+    } else {
+      q->head->prev = NULL;
+    }
+    msg->next = NULL;
+    --q->len;
     return msg;
   }
 }
 
 /**
- * Moves all messages from one queue to the other
- * \param dest the destination queue
- * \param src the source queue
+ * Removes a message from anywhere in the queue
+ * \param q the queue
+ * \param msg the message, which should be part of the queue
+ */
+static void remove_log_msg(struct log_queue * q, struct log_msg * msg) {
+  assert(q != NULL);
+  assert(msg != NULL);
+
+  if(msg->prev == NULL) {
+    q->head = msg->next;
+  } else {
+    msg->prev->next = msg->next;
+  }
+  if(msg->next == NULL) {
+    q->tail = msg->prev;
+  } else {
+    msg->next->prev = msg->prev;
+  }
+  msg->prev = NULL;
+  msg->next = NULL;
+  --q->len;
+}
+
+/**
+ * Moves all messages from one queue to the other
+ * \param dest the destination queue
+ * \param src the source queue
+ */
+static void move_log_msgs(struct log_queue * dest, struct log_queue * src) {
+  assert(dest != NULL);
+  assert(src != NULL);
+
+  if(src->head != NULL) {
+    if(dest->head == NULL) {
+      dest->head = src->head;
+    } else {
+      dest->tail->next = src->head;
+      src->head->prev = dest->tail;
+    }
+    dest->tail = src->tail;
+    dest->len += src->len;
+    src->head = NULL;
+    src->tail = NULL;
+    src->len = 0;
+  }
+}
+
+/**
+ * Attempts to print an error log to stderr
+ * \param message the message
+ * \param error the error code
+ */
+static void log_errno(const char * message, int error) {
+  assert(message != NULL);
+
+  fputs(message, stderr);
+  fputs(": ", stderr);
+    
+  char buffer[ERROR_BUFFER_SIZE];
+  if(strerror_r(error, buffer, ERROR_BUFFER_SIZE) == 0) {
+    fputs(buffer, stderr);
+  } else {
+    fputs("unknown error", stderr);
+  }
+  fputc('\n', stderr);
+}
+
+/**
+ * Allocates the message pool
+ * Each size class holds 2^LOG_MSG_POOL_SHIFT times fewer messages than the previous one,
+ * the smallest holds twice the queue capacity so producers can fill the queue while the worker drains a full batch
+ * \param capacity the capacity of the waiting queue
+ * \return 0 on success, -1 on error
+ */
+static int init_log_msg_pool(size_t capacity) {
+  size_t counts[LOG_MSG_SIZE_CLASS_COUNT];
+  size_t msg_count = 0;
+  size_t buffer_size = 0;
+  for(int i = 0; i < LOG_MSG_SIZE_CLASS_COUNT; ++i) {
+    counts[i] = (2 * capacity) >> (LOG_MSG_POOL_SHIFT * i);
+    if(counts[i] == 0) {
+      counts[i] = 1;
+    }
+    msg_count += counts[i];
+    buffer_size += counts[i] * log_msg_size_classes[i];
+  }
+
+  pool.slab = (char *) malloc(msg_count * sizeof(struct log_msg) + buffer_size);
+  if(pool.slab == NULL) {
+    return -1;
+  }
+  pool.closed = false;
+  
+  struct log_msg * msg = (struct log_msg *) pool.slab;
+  char * buffer = pool.slab + msg_count * sizeof(struct log_msg);
+  for(int i = 0; i < LOG_MSG_SIZE_CLASS_COUNT; ++i) {
+    init_log_queue(&pool.ready[i]);
+    for(size_t j = 0; j < counts[i]; ++j) {
+      msg->level = LOG_LEVEL_DEBUG;
+      msg->file = NULL;
+      msg->line = 0;
+      msg->ticks = 0;
+      msg->suppressed = 0;
+      msg->site_id = 0;
+      msg->recorded = false;
+      msg->thread = 0;
+      msg->buffer = buffer;
+      msg->len = 0;
+      msg->size = log_msg_size_classes[i];
+      msg->size_class = i;
+      push_log_msg(&pool.ready[i], msg);
+      buffer += log_msg_size_classes[i];
+      ++msg;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Frees the message pool, all messages become invalid
+ */
+static void dispose_log_msg_pool() {
+  free(pool.slab);
+  pool.slab = NULL;
+  for(int i = 0; i < LOG_MSG_SIZE_CLASS_COUNT; ++i) {
+    init_log_queue(&pool.ready[i]);
+  }
+}
+
+/**
+ * Takes a message from the pool, preferring the smallest size class that fits
+ * If all fitting size classes are exhausted, the largest smaller buffer is used and the content is truncated
+ * The ready mutex should be held by the caller
+ * \param min_size the minimum buffer size
+ * \return the message or NULL if the pool is empty
+ */
+static struct log_msg * take_pooled_log_msg(size_t min_size) {
+  int fit = 0;
+  while(fit < LOG_MSG_SIZE_CLASS_COUNT - 1 && log_msg_size_classes[fit] < min_size) {
+    ++fit;
+  }
+  for(int i = fit; i < LOG_MSG_SIZE_CLASS_COUNT; ++i) {
+    if(pool.ready[i].head != NULL) {
+      return pop_log_msg(&pool.ready[i]);
+    }
+  }
+  for(int i = fit - 1; i >= 0; --i) {
+    if(pool.ready[i].head != NULL) {
+      return pop_log_msg(&pool.ready[i]);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Returns the messages on this queue to the pool
+ * \param q the queue
+ * \return LOG_STATUS_OK or error code
+ */
+static enum log_status recycle_log_msgs(struct log_queue * q) {
+  assert(q != NULL);
+
+  if(q->head == NULL) {
+    return LOG_STATUS_OK;
+  }
+  
+  if(pthread_mutex_lock(&ready_mutex) != 0) {
+    return LOG_STATUS_READY_LOCK;
+  }
+
+  struct log_msg * msg;
+  while((msg = pop_log_msg(q)) != NULL) {
+    push_log_msg(&pool.ready[msg->size_class], msg);
+  }
+  pthread_cond_broadcast(&ready_cond);
+
+  if(pthread_mutex_unlock(&ready_mutex) != 0) {
+    return LOG_STATUS_READY_UNLOCK;
+  }
+  
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Returns a single message to the pool
+ * \param msg the message
+ */
+static void recycle_log_msg(struct log_msg * msg) {
+  assert(msg != NULL);
+
+  if(pthread_mutex_lock(&ready_mutex) != 0) {
+    return;
+  }
+  push_log_msg(&pool.ready[msg->size_class], msg);
+  pthread_cond_signal(&ready_cond);
+  pthread_mutex_unlock(&ready_mutex);
+}
+
+/**
+ * Closes the pool, releasing threads waiting for messages
+ */
+static void close_log_msg_pool() {
+  if(pthread_mutex_lock(&ready_mutex) == 0) {
+    pool.closed = true;
+    pthread_cond_broadcast(&ready_cond);
+    pthread_mutex_unlock(&ready_mutex);
+  }
+}
+
+/**
+ * Takes a message from the pool
+ * \param min_size the buffer size needed for the message content
+ * \param block whether to wait for a message when the pool is empty
+ * \return the message or NULL if the pool is empty or closed
+ */
+static struct log_msg * get_log_msg(size_t min_size, bool block) {
+  if(pthread_mutex_lock(&ready_mutex) != 0) {
+    return NULL;
+  }
+
+  struct log_msg * msg = NULL;
+  while(pool.slab != NULL && !pool.closed) {
+    msg = take_pooled_log_msg(min_size);
+    if(msg != NULL || !block) {
+      break;
+    }
+    if(pthread_cond_wait(&ready_cond, &ready_mutex) != 0) {
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&ready_mutex);
+  return msg;
+}
+
+/**
+ * Initializes the writer
+ * \param w the writer
+ * \param fd the file descriptor of the output
+ * \param f the rotating log file of the output or NULL
+ * \param format the format of the output, LOG_FORMAT_BINARY requires a log file
+ * \param flush_interval_ms how long rendered messages may be held in the buffer, in milliseconds
+ * \return 0 on success, -1 on error
+ */
+static int init_log_writer(struct log_writer * w, int fd, struct log_file * f, enum log_output_format format, unsigned int flush_interval_ms) {
+  assert(w != NULL);
+  assert(f != NULL || format == LOG_FORMAT_TEXT);
+
+  w->buffer = (char *) malloc(LOG_WRITE_BUFFER_SIZE);
+  if(w->buffer == NULL) {
+    return -1;
+  }
+  w->prefix = (char *) malloc(LOG_PREFIX_BUFFER_SIZE);
+  if(w->prefix == NULL) {
+    free(w->buffer);
+    return -1;
+  }
+  w->fd = fd;
+  w->file = f;
+  w->format = format;
+  w->prefix_len = 0;
+  w->pending_count = 0;
+  w->flushes = 1;
+  w->len = 0;
+  w->size = LOG_WRITE_BUFFER_SIZE;
+  w->urgent = false;
+  w->flush_interval_ms = flush_interval_ms;
+  return 0;
+}
+
+/**
+ * Disposes of all resources associated with the writer
+ * \param w the writer
+ */
+static void dispose_log_writer(struct log_writer * w) {
+  assert(w != NULL);
+
+  free(w->buffer);
+  free(w->prefix);
+  w->buffer = NULL;
+  w->prefix = NULL;
+  w->len = 0;
+  w->size = 0;
+}
+
+/**
+ * Writes buffers to the output
+ * \param w the writer
+ * \param iov the buffers, modified in place
+ * \param count the number of buffers
+ * \param error whether the buffers contain an error message
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status write_log_output(struct log_writer * w, struct iovec * iov, int count, bool error) {
+  assert(w != NULL);
+  assert(iov != NULL);
+
+  int result;
+  if(w->file != NULL) {
+    result = write_log_file(w->file, iov, count, error);
+  } else {
+    result = write_log_iovec(w->fd, iov, count);
+  }
+  if(result != 0) {
+    return LOG_STATUS_PRINT;
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Returns the ID of the current thread
+ * \return the thread ID
+ */
+static uint32_t get_log_thread_id() {
+  if(thread_id == 0) {
+    thread_id = (uint32_t) syscall(SYS_gettid);
+  }
+  return thread_id;
+}
+
+/**
+ * Appends the record describing a log statement to the prefix buffer, writing the prefix buffer out first if it is full
+ * \param w the writer
+ * \param id the ID of the log statement
+ * \param entry the description of the log statement
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status append_log_site_record(struct log_writer * w, uint32_t id, const struct log_site_entry * entry) {
+  assert(w != NULL);
+  assert(entry != NULL);
+
+  size_t file_len = strlen(entry->site->file);
+  if(file_len > MAX_LOG_SITE_TEXT_LENGTH) {
+    file_len = MAX_LOG_SITE_TEXT_LENGTH;
+  }
+  size_t format_len = strlen(entry->format);
+  if(format_len > MAX_LOG_SITE_TEXT_LENGTH) {
+    format_len = MAX_LOG_SITE_TEXT_LENGTH;
+  }
+  size_t payload_len = 4 + 1 + 4 + 2 + file_len + 2 + format_len + 1 + entry->arg_count;
+  if(w->prefix_len + LOG_RECORD_HEADER_LENGTH + payload_len > LOG_PREFIX_BUFFER_SIZE) {
+    struct iovec iov = { w->prefix, w->prefix_len };
+    enum log_status status = write_log_output(w, &iov, 1, false);
+    w->prefix_len = 0;
+    if(status != LOG_STATUS_OK) {
+      return status;
+    }
+  }
+
+  uint8_t level = (uint8_t) entry->site->level;
+  int32_t line = (int32_t) entry->site->line;
+  uint16_t file_len16 = (uint16_t) file_len;
+  uint16_t format_len16 = (uint16_t) format_len;
+  uint8_t arg_count = (uint8_t) entry->arg_count;
+  
+  char * p = w->prefix + w->prefix_len;
+  encode_log_record_header(p, LOG_RECORD_SITE, (uint32_t) payload_len);
+  p += LOG_RECORD_HEADER_LENGTH;
+  p = put_log_bytes(p, &id, sizeof(id));
+  p = put_log_bytes(p, &level, sizeof(level));
+  p = put_log_bytes(p, &line, sizeof(line));
+  p = put_log_bytes(p, &file_len16, sizeof(file_len16));
+  p = put_log_bytes(p, entry->site->file, file_len);
+  p = put_log_bytes(p, &format_len16, sizeof(format_len16));
+  p = put_log_bytes(p, entry->format, format_len);
+  p = put_log_bytes(p, &arg_count, sizeof(arg_count));
+  p = put_log_bytes(p, entry->types, entry->arg_count);
+  w->prefix_len = (size_t) (p - w->prefix);
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Renders the file header and the descriptions of the log statements referenced in the write buffer
+ * that have not been written to the current log file into the prefix buffer
+ * \param w the writer
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status prepare_log_prefix(struct log_writer * w) {
+  assert(w != NULL);
+
+  if(w->format != LOG_FORMAT_BINARY) {
+    return LOG_STATUS_OK;
+  }
+  if(w->file->size == 0) {
+    encode_log_file_header(w->prefix);
+    w->prefix_len = LOG_BINARY_HEADER_LENGTH;
+  }
+  for(size_t i = 0; i < w->pending_count; ++i) {
+    struct log_site_entry * entry = &site_entries[w->pending[i] - 1];
+    if(entry->written_generation != w->file->generation) {
+      enum log_status status = append_log_site_record(w, w->pending[i], entry);
+      if(status != LOG_STATUS_OK) {
+	return status;
+      }
+      entry->written_generation = w->file->generation;
+    }
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Writes the contents of the write buffer to the output, followed by additional buffers
+ * Log files are rotated first if needed, binary output is preceded by the records describing the log statements
+ * \param w the writer
+ * \param extra the additional buffers or NULL
+ * \param extra_count the number of additional buffers, at most 3
+ * \param error whether the additional buffers contain an error message
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status flush_log_writer_with(struct log_writer * w, struct iovec * extra, int extra_count, bool error) {
+  assert(w != NULL);
+  assert(extra_count <= 3);
+
+  struct iovec iov[5];
+  int count = 0;
+  size_t len = w->len;
+  for(int i = 0; i < extra_count; ++i) {
+    len += extra[i].iov_len;
+  }
+  
+  enum log_status status = LOG_STATUS_OK;
+  if(len != 0) {
+    if(w->file != NULL) {
+      prepare_log_file(w->file, len);
+    }
+    status = prepare_log_prefix(w);
+    if(status == LOG_STATUS_OK) {
+      if(w->prefix_len != 0) {
+	iov[count].iov_base = w->prefix;
+	iov[count++].iov_len = w->prefix_len;
+      }
+      if(w->len != 0) {
+	iov[count].iov_base = w->buffer;
+	iov[count++].iov_len = w->len;
+      }
+      for(int i = 0; i < extra_count; ++i) {
+	iov[count++] = extra[i];
+      }
+      status = write_log_output(w, iov, count, w->urgent || error);
+    }
+  }
+  w->len = 0;
+  w->urgent = false;
+  w->prefix_len = 0;
+  w->pending_count = 0;
+  ++w->flushes;
+  return status;
+}
+
+/**
+ * Writes the contents of the write buffer to the output
+ * \param w the writer
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status flush_log_writer(struct log_writer * w) {
+  return flush_log_writer_with(w, NULL, 0, false);
+}
+
+/**
+ * Marks a log statement as referenced by the write buffer, so it is described before the buffer is written
+ * \param w the writer
+ * \param site_id the ID of the log statement, or 0 for none
+ */
+static void mark_log_site_pending(struct log_writer * w, unsigned int site_id) {
+  assert(w != NULL);
+
+  if(site_id != 0) {
+    struct log_site_entry * entry = &site_entries[site_id - 1];
+    if(entry->pending_flush != w->flushes) {
+      entry->pending_flush = w->flushes;
+      w->pending[w->pending_count++] = site_id;
+    }
+  }
+}
+
+/**
+ * Adds a number of milliseconds to a point in time
+ * \param t the point in time
+ * \param ms the number of milliseconds
+ */
+static void add_log_millis(struct timespec * t, long ms) {
+  assert(t != NULL);
+
+  t->tv_sec += ms / 1000;
+  t->tv_nsec += (ms % 1000) * 1000000L;
+  if(t->tv_nsec >= 1000000000L) {
+    ++t->tv_sec;
+    t->tv_nsec -= 1000000000L;
+  }
+}
+
+/**
+ * Whether a point in time has passed
+ * \param t the point in time
+ * \param now the current time
+ * \return true if t is not after now, false otherwise
+ */
+static bool log_time_passed(const struct timespec * t, const struct timespec * now) {
+  assert(t != NULL);
+  assert(now != NULL);
+
+  return t->tv_sec < now->tv_sec || (t->tv_sec == now->tv_sec && t->tv_nsec <= now->tv_nsec);
+}
+
+/**
+ * Renders the UTC date and time of a message up to the second, reusing the previous result within the same second
+ * \param r the renderer
+ * \param second the second since the epoch
+ * \return the rendered date and time
+ */
+static const char * render_log_second(struct log_renderer * r, time_t second) {
+  assert(r != NULL);
+
+  if(second != r->second) {
+    struct tm tm;
+    if(gmtime_r(&second, &tm) == NULL || strftime(r->second_text, LOG_TIME_BUFFER_SIZE, "%Y-%m-%dT%H:%M:%S", &tm) == 0) {
+      strcpy(r->second_text, "0000-00-00T00:00:00");
+    }
+    r->second = second;
+  }
+  return r->second_text;
+}
+
+/**
+ * Renders the header of a message
+ * \param r the renderer
+ * \param dest the destination buffer
+ * \param size the size of the destination buffer
+ * \param msg the message
+ * \return the length of the header, or a negative value on error
+ */
+static int render_log_header(struct log_renderer * r, char * dest, size_t size, const struct log_msg * msg) {
+  assert(r != NULL);
+  assert(msg != NULL);
+
+  struct timespec wall;
+  log_ticks_to_wall(&calibration, msg->ticks, &wall);
+  const char * second = render_log_second(r, wall.tv_sec);
+  long micros = wall.tv_nsec / 1000;
+  
+  if(msg->file != NULL) {
+    return snprintf(dest, size, "%s.%06ldZ %s%s:%d\t", second, micros, log_level_labels[msg->level], msg->file, msg->line);
+  } else {
+    return snprintf(dest, size, "%s.%06ldZ %s:\t", second, micros, log_level_labels[msg->level]);
+  }
+}
+
+/**
+ * Appends buffers to the write buffer, flushing the write buffer first if they do not fit
+ * Buffers too large for the write buffer are written out directly
+ * \param w the writer
+ * \param iov the buffers
+ * \param count the number of buffers, at most 3
+ * \param site_id the ID of the log statement described by the buffers, or 0 for none
+ * \param error whether the buffers contain an error message
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status append_log_output(struct log_writer * w, struct iovec * iov, int count, unsigned int site_id, bool error) {
+  assert(w != NULL);
+  assert(iov != NULL);
+
+  size_t len = 0;
+  for(int i = 0; i < count; ++i) {
+    len += iov[i].iov_len;
+  }
+  
+  if(w->len + len > w->size) {
+    enum log_status status = flush_log_writer(w);
+    if(status != LOG_STATUS_OK) {
+      return status;
+    }
+  }
+  mark_log_site_pending(w, site_id);
+  
+  if(len > w->size) {
+    return flush_log_writer_with(w, iov, count, error);
+  }
+
+  if(w->len == 0) {
+    if(clock_gettime(CLOCK_MONOTONIC, &w->deadline) != 0) {
+      return LOG_STATUS_CLOCK;
+    }
+    add_log_millis(&w->deadline, (long) w->flush_interval_ms);
+  }
+  for(int i = 0; i < count; ++i) {
+    memcpy(w->buffer + w->len, iov[i].iov_base, iov[i].iov_len);
+    w->len += iov[i].iov_len;
+  }
+  if(error) {
+    w->urgent = true;
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Takes a batch for rendering messages, reusing a released batch if there is one
+ * \param format the format of the messages
+ * \return the batch or NULL on error
+ */
+static struct log_batch * take_log_batch(enum log_output_format format) {
+  struct log_batch * batch = NULL;
+  if(pthread_mutex_lock(&batch_mutex) == 0) {
+    batch = free_batches;
+    if(batch != NULL) {
+      free_batches = batch->next;
+    }
+    pthread_mutex_unlock(&batch_mutex);
+  }
+  if(batch == NULL) {
+    batch = (struct log_batch *) calloc(1, sizeof(struct log_batch));
+    if(batch == NULL) {
+      return NULL;
+    }
+  }
+  batch->format = format;
+  atomic_init(&batch->refs, 1);
+  batch->len = 0;
+  batch->count = 0;
+  batch->max_level = LOG_LEVEL_DEBUG;
+  batch->next = NULL;
+  return batch;
+}
+
+/**
+ * Releases a reference to a batch, the batch is kept for reuse when the last reference is released
+ * \param batch the batch
+ */
+static void release_log_batch(struct log_batch * batch) {
+  if(atomic_fetch_sub_explicit(&batch->refs, 1, memory_order_acq_rel) != 1) {
+    return;
+  }
+  if(pthread_mutex_lock(&batch_mutex) == 0) {
+    batch->next = free_batches;
+    free_batches = batch;
+    pthread_mutex_unlock(&batch_mutex);
+  } else {
+    free(batch->data);
+    free(batch->entries);
+    free(batch);
+  }
+}
+
+/**
+ * Frees the batches kept for reuse
+ */
+static void dispose_log_batches() {
+  if(pthread_mutex_lock(&batch_mutex) != 0) {
+    return;
+  }
+  while(free_batches != NULL) {
+    struct log_batch * batch = free_batches;
+    free_batches = batch->next;
+    free(batch->data);
+    free(batch->entries);
+    free(batch);
+  }
+  pthread_mutex_unlock(&batch_mutex);
+}
+
+/**
+ * Appends a rendered message to a batch, growing the batch as needed
+ * \param batch the batch
+ * \param iov the parts of the rendered message
+ * \param count the number of parts
+ * \param msg the message
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status append_log_batch(struct log_batch * batch, const struct iovec * iov, int count, const struct log_msg * msg) {
+  assert(batch != NULL);
+  assert(iov != NULL);
+
+  size_t len = 0;
+  for(int i = 0; i < count; ++i) {
+    len += iov[i].iov_len;
+  }
+  if(batch->len + len > batch->size) {
+    size_t size = batch->size != 0 ? batch->size : LOG_WRITE_BUFFER_SIZE;
+    while(batch->len + len > size) {
+      size *= 2;
+    }
+    char * data = (char *) realloc(batch->data, size);
+    if(data == NULL) {
+      return LOG_STATUS_PRINT;
+    }
+    batch->data = data;
+    batch->size = size;
+  }
+  if(batch->count == batch->capacity) {
+    size_t capacity = batch->capacity != 0 ? batch->capacity * 2 : LOG_BATCH_INITIAL_CAPACITY;
+    struct log_batch_entry * entries = (struct log_batch_entry *) realloc(batch->entries, capacity * sizeof(struct log_batch_entry));
+    if(entries == NULL) {
+      return LOG_STATUS_PRINT;
+    }
+    batch->entries = entries;
+    batch->capacity = capacity;
+  }
+
+  struct log_batch_entry * entry = &batch->entries[batch->count++];
+  entry->level = msg->level;
+  entry->site_id = msg->site_id;
+  entry->recorded = msg->recorded;
+  entry->offset = batch->len;
+  entry->len = len;
+  for(int i = 0; i < count; ++i) {
+    memcpy(batch->data + batch->len, iov[i].iov_base, iov[i].iov_len);
+    batch->len += iov[i].iov_len;
+  }
+  enum log_level level = msg->recorded ? LOG_LEVEL_ERROR : msg->level;
+  if(level > batch->max_level) {
+    batch->max_level = level;
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Renders a message as a line of text into a batch
+ * \param r the renderer
+ * \param batch the batch
+ * \param msg the message
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status render_log_line(struct log_renderer * r, struct log_batch * batch, const struct log_msg * msg) {
+  assert(r != NULL);
+  assert(msg != NULL);
+
+  char header[LOG_HEADER_BUFFER_SIZE];
+  int header_len = render_log_header(r, header, LOG_HEADER_BUFFER_SIZE, msg);
+  if(header_len < 0) {
+    return LOG_STATUS_PRINT;
+  }
+  if(header_len >= LOG_HEADER_BUFFER_SIZE) {
+    header_len = LOG_HEADER_BUFFER_SIZE - 1;
+  }
+  char trailer[LOG_TRAILER_BUFFER_SIZE];
+  int trailer_len = 1;
+  if(msg->suppressed == 0) {
+    trailer[0] = '\n';
+  } else {
+    trailer_len = snprintf(trailer, LOG_TRAILER_BUFFER_SIZE, " (%u similar messages suppressed)\n", msg->suppressed);
+    if(trailer_len < 0 || trailer_len >= LOG_TRAILER_BUFFER_SIZE) {
+      return LOG_STATUS_PRINT;
+    }
+  }
+  struct iovec iov[3] = {
+    { header, (size_t) header_len },
+    { msg->buffer, msg->len },
+    { trailer, (size_t) trailer_len }
+  };
+  return append_log_batch(batch, iov, 3, msg);
+}
+
+/**
+ * Renders the record header and the fixed part of the payload of a binary record, which is followed by the message content
+ * Messages of statements with an ID hold the arguments, other messages hold the formatted text
+ * \param header the destination buffer, LOG_HEADER_BUFFER_SIZE long
+ * \param msg the message
+ * \return the number of bytes rendered
+ */
+static size_t render_log_record_header(char * header, const struct log_msg * msg) {
+  assert(header != NULL);
+  assert(msg != NULL);
+
+  struct timespec wall;
+  log_ticks_to_wall(&calibration, msg->ticks, &wall);
+  int64_t time = (int64_t) wall.tv_sec * 1000000000 + wall.tv_nsec;
+  uint32_t suppressed = msg->suppressed;
+  
+  char * p = header + LOG_RECORD_HEADER_LENGTH;
+  if(msg->site_id != 0) {
+    uint32_t id = msg->site_id;
+    p = put_log_bytes(p, &id, sizeof(id));
+    p = put_log_bytes(p, &time, sizeof(time));
+    p = put_log_bytes(p, &msg->thread, sizeof(msg->thread));
+    p = put_log_bytes(p, &suppressed, sizeof(suppressed));
+    encode_log_record_header(header, LOG_RECORD_MESSAGE, (uint32_t) (LOG_MESSAGE_RECORD_LENGTH + msg->len));
+  } else {
+    size_t file_len = msg->file != NULL ? strlen(msg->file) : 0;
+    if(file_len > LOG_HEADER_BUFFER_SIZE / 2) {
+      file_len = LOG_HEADER_BUFFER_SIZE / 2;
+    }
+    uint8_t level = (uint8_t) msg->level;
+    int32_t line = (int32_t) msg->line;
+    uint16_t file_len16 = (uint16_t) file_len;
+    uint32_t text_len = (uint32_t) msg->len;
+    p = put_log_bytes(p, &level, sizeof(level));
+    p = put_log_bytes(p, &time, sizeof(time));
+    p = put_log_bytes(p, &msg->thread, sizeof(msg->thread));
+    p = put_log_bytes(p, &suppressed, sizeof(suppressed));
+    p = put_log_bytes(p, &line, sizeof(line));
+    p = put_log_bytes(p, &file_len16, sizeof(file_len16));
+    p = put_log_bytes(p, msg->file, file_len);
+    p = put_log_bytes(p, &text_len, sizeof(text_len));
+    encode_log_record_header(header, LOG_RECORD_TEXT, (uint32_t) ((size_t) (p - header) - LOG_RECORD_HEADER_LENGTH + msg->len));
+  }
+  return (size_t) (p - header);
+}
+
+/**
+ * Renders a message as a binary record into a batch
+ * \param batch the batch
+ * \param msg the message
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status render_log_record(struct log_batch * batch, const struct log_msg * msg) {
+  assert(msg != NULL);
+
+  char header[LOG_HEADER_BUFFER_SIZE];
+  struct iovec iov[2] = {
+    { header, render_log_record_header(header, msg) },
+    { msg->buffer, msg->len }
+  };
+  return append_log_batch(batch, iov, 2, msg);
+}
+
+/**
+ * Renders a message into a batch in the format of the batch
+ * Arguments stored in binary form are formatted for text batches
+ * \param r the renderer
+ * \param batch the batch
+ * \param msg the message
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status render_log_msg(struct log_renderer * r, struct log_batch * batch, const struct log_msg * msg) {
+  if(batch->format == LOG_FORMAT_BINARY) {
+    return render_log_record(batch, msg);
+  }
+  if(msg->site_id == 0) {
+    return render_log_line(r, batch, msg);
+  }
+  const struct log_site_entry * entry = &site_entries[msg->site_id - 1];
+  struct log_msg text = *msg;
+  int len = format_log_args(r->scratch, LOG_SCRATCH_BUFFER_SIZE, entry->format, entry->types, entry->arg_count, msg->buffer, msg->len);
+  if(len < 0) {
+    // A damaged record is written with its format string, it must not stop the worker and with it all logging
+    ++malformed_log_msgs;
+    len = snprintf(r->scratch, LOG_SCRATCH_BUFFER_SIZE, "%s " LOG_TRUNCATED_ARGS, entry->format);
+    if(len < 0) {
+      return LOG_STATUS_PRINT;
+    }
+  }
+  text.buffer = r->scratch;
+  text.len = (size_t) len < LOG_SCRATCH_BUFFER_SIZE ? (size_t) len : LOG_SCRATCH_BUFFER_SIZE - 1;
+  text.site_id = 0;
+  return render_log_line(r, batch, &text);
+}
+
+/**
+ * Renders the log messages into a batch per format in use
+ * \param r the renderer
+ * \param batches the batches, indexed by format, NULL for formats not in use
+ * \param q the queue
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status render_log_msgs(struct log_renderer * r, struct log_batch * batches[LOG_FORMAT_COUNT], struct log_queue * q) {
+  assert(r != NULL);
+  assert(q != NULL);
+
+  enum log_status status = LOG_STATUS_OK;
+  for(struct log_msg * msg = q->head; msg != NULL && status == LOG_STATUS_OK; msg = msg->next) {
+    for(int i = 0; i < LOG_FORMAT_COUNT && status == LOG_STATUS_OK; ++i) {
+      if(batches[i] != NULL) {
+	status = render_log_msg(r, batches[i], msg);
+      }
+    }
+  }
+  return status;
+}
+
+/**
+ * Flushes the write buffer if it contains an error or when its deadline has passed
+ * \param w the writer
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status flush_log_writer_if_due(struct log_writer * w) {
+  assert(w != NULL);
+
+  if(w->len == 0) {
+    return LOG_STATUS_OK;
+  }
+  if(w->urgent) {
+    return flush_log_writer(w);
+  }
+  struct timespec now;
+  if(clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+    return LOG_STATUS_CLOCK;
+  }
+  if(log_time_passed(&w->deadline, &now)) {
+    return flush_log_writer(w);
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Waits until messages are available, the worker should stop or dropped messages should be reported
+ * The waiting mutex should be held by the caller
+ * \param report the time at which dropped messages may be reported
+ * \param sinks_behind whether sinks dropped messages that have not been reported yet
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status wait_for_log_msgs(const struct timespec * report, bool sinks_behind) {
+  assert(report != NULL);
+
+  bool has_dropped = sinks_behind;
+  for(int i = 0; i < LOG_LEVEL_COUNT; ++i) {
+    has_dropped = has_dropped || dropped[i] != 0;
+  }
+  
+  // Producers only signal the condition while the worker sleeps
+  worker_sleeping = true;
+  int result;
+  if(!has_dropped) {
+    result = pthread_cond_wait(&waiting_cond, &waiting_mutex);
+  } else {
+    result = pthread_cond_timedwait(&waiting_cond, &waiting_mutex, report);
+  }
+  worker_sleeping = false;
+  if(result != 0 && result != ETIMEDOUT) {
+    return LOG_STATUS_WAIT;
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Takes the dropped message counts if there are any
+ * The waiting mutex should be held by the caller
+ * \param counts the destination for the counts
+ * \return true if messages were dropped, false otherwise
+ */
+static bool take_dropped_counts(unsigned long counts[LOG_LEVEL_COUNT]) {
+  bool has_dropped = false;
+  for(int i = 0; i < LOG_LEVEL_COUNT; ++i) {
+    counts[i] = dropped[i];
+    dropped[i] = 0;
+    has_dropped = has_dropped || counts[i] != 0;
+  }
+  return has_dropped;
+}
+
+/**
+ * Checks whether sinks dropped messages or failed to rotate their log file without it being reported yet
+ * \return true if there is something to report, false otherwise
+ */
+static bool log_sinks_behind() {
+  for(size_t i = 0; i < log_sink_count; ++i) {
+    struct log_sink * sink = &log_sinks[i];
+    if(sink->dropped != sink->reported
+       || atomic_load_explicit(&sink->rotation_failures, memory_order_relaxed) != sink->rotations_reported) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Renders a message of the logger itself into the batches
+ * \param batches the batches, indexed by format, NULL for formats not in use
+ * \param level the log level of the message
+ * \param line the line where the message originates
+ * \param format the format string
+ * \param ... the arguments
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status render_log_notice(struct log_batch * batches[LOG_FORMAT_COUNT], enum log_level level, int line, const char * format, ...) {
+  assert(format != NULL);
+
+  char buffer[LOG_HEADER_BUFFER_SIZE];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buffer, LOG_HEADER_BUFFER_SIZE, format, args);
+  va_end(args);
+  if(len < 0) {
+    return LOG_STATUS_PRINT;
+  }
+  
+  struct log_msg msg;
+  msg.level = level;
+  msg.file = __FILE__;
+  msg.line = line;
+  msg.ticks = read_log_clock();
+  msg.suppressed = 0;
+  msg.site_id = 0;
+  msg.thread = get_log_thread_id();
+  msg.recorded = false;
+  msg.buffer = buffer;
+  msg.len = (size_t) len < LOG_HEADER_BUFFER_SIZE ? (size_t) len : LOG_HEADER_BUFFER_SIZE - 1;
+  msg.size = LOG_HEADER_BUFFER_SIZE;
+  enum log_status status = LOG_STATUS_OK;
+  for(int i = 0; i < LOG_FORMAT_COUNT && status == LOG_STATUS_OK; ++i) {
+    if(batches[i] != NULL) {
+      status = render_log_msg(&renderer, batches[i], &msg);
+    }
+  }
+  return status;
+}
+
+/**
+ * Renders reports of dropped messages and failed log file rotations into the batches
+ * \param batches the batches, indexed by format, NULL for formats not in use
+ * \param counts the number of messages dropped from the waiting queue per level, or NULL
+ * \param report_sinks whether to report messages dropped by sinks that fell behind, failed rotations
+ * and messages whose arguments could not be formatted
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status render_dropped_counts(struct log_batch * batches[LOG_FORMAT_COUNT], const unsigned long * counts, bool report_sinks) {
+  enum log_status status = LOG_STATUS_OK;
+  if(counts != NULL) {
+    status = render_log_notice(batches, LOG_LEVEL_WARNING, __LINE__,
+			       "log queue full, dropped %lu debug, %lu info, %lu warning and %lu error messages",
+			       counts[LOG_LEVEL_DEBUG], counts[LOG_LEVEL_INFO], counts[LOG_LEVEL_WARNING], counts[LOG_LEVEL_ERROR]);
+  }
+  for(size_t i = 0; i < log_sink_count && report_sinks && status == LOG_STATUS_OK; ++i) {
+    struct log_sink * sink = &log_sinks[i];
+    if(sink->dropped != sink->reported) {
+      status = render_log_notice(batches, LOG_LEVEL_WARNING, __LINE__, "log sink %zu fell behind, dropped %lu messages", i, sink->dropped - sink->reported);
+      sink->reported = sink->dropped;
+    }
+    unsigned long rotation_failures = atomic_load_explicit(&sink->rotation_failures, memory_order_relaxed);
+    if(rotation_failures != sink->rotations_reported && status == LOG_STATUS_OK) {
+      status = render_log_notice(batches, LOG_LEVEL_ERROR, __LINE__, "could not rotate log file %s", sink->file.path);
+      sink->rotations_reported = rotation_failures;
+    }
+  }
+  if(report_sinks && malformed_log_msgs != 0 && status == LOG_STATUS_OK) {
+    status = render_log_notice(batches, LOG_LEVEL_WARNING, __LINE__, "could not format the arguments of %lu messages", malformed_log_msgs);
+    malformed_log_msgs = 0;
+  }
+  return status;
+}
+
+/**
+ * Queues a batch for a sink, the batch is dropped for this sink if its queue is full
+ * \param sink the sink
+ * \param batch the batch
+ * \param block whether to wait for room in the queue of the sink rather than dropping the batch
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status push_log_sink_batch(struct log_sink * sink, struct log_batch * batch, bool block) {
+  assert(sink != NULL);
+  assert(batch != NULL);
+
+  if(pthread_mutex_lock(&sink->mutex) != 0) {
+    return LOG_STATUS_WAITING_LOCK;
+  }
+  size_t sink_capacity = sink->options.queue_capacity;
+  while(block && sink->count == sink_capacity && !sink->stopped) {
+    if(pthread_cond_wait(&sink->space_cond, &sink->mutex) != 0) {
+      pthread_mutex_unlock(&sink->mutex);
+      return LOG_STATUS_WAIT;
+    }
+  }
+  if(sink->count == sink_capacity || sink->stopped) {
+    pthread_mutex_unlock(&sink->mutex);
+    for(size_t i = 0; i < batch->count; ++i) {
+      if(batch->entries[i].level >= sink->options.level || batch->entries[i].recorded) {
+	++sink->dropped;
+      }
+    }
+    return LOG_STATUS_OK;
+  }
+  
+  atomic_fetch_add_explicit(&batch->refs, 1, memory_order_relaxed);
+  sink->batches[(sink->head + sink->count) % sink_capacity] = batch;
+  ++sink->count;
+  // Like the worker, a sink thread is only signalled when it sleeps
+  bool wake = sink->sleeping;
+  sink->sleeping = false;
+  if(wake && pthread_cond_signal(&sink->cond) != 0) {
+    pthread_mutex_unlock(&sink->mutex);
+    return LOG_STATUS_WAIT;
+  }
+  if(pthread_mutex_unlock(&sink->mutex) != 0) {
+    return LOG_STATUS_WAITING_UNLOCK;
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Renders messages once for each format in use and queues the batches for the sinks interested in them
+ * \param q the messages
+ * \param counts the number of messages dropped from the waiting queue per level to report, or NULL
+ * \param report_sinks whether to report messages dropped by sinks that fell behind, failed rotations
+ * and messages whose arguments could not be formatted
+ * \param block whether to wait for room in the sink queues rather than dropping batches
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status dispatch_log_msgs(struct log_queue * q, const unsigned long * counts, bool report_sinks, bool block) {
+  assert(q != NULL);
+
+  struct log_batch * batches[LOG_FORMAT_COUNT] = { NULL };
+  enum log_status status = LOG_STATUS_OK;
+  for(size_t i = 0; i < log_sink_count && status == LOG_STATUS_OK; ++i) {
+    enum log_output_format format = log_sinks[i].format;
+    if(batches[format] == NULL) {
+      batches[format] = take_log_batch(format);
+      if(batches[format] == NULL) {
+	status = LOG_STATUS_PRINT;
+      }
+    }
+  }
+  if(status == LOG_STATUS_OK) {
+    status = render_log_msgs(&renderer, batches, q);
+  }
+  if(status == LOG_STATUS_OK) {
+    status = render_dropped_counts(batches, counts, report_sinks);
+  }
+
+  for(int i = 0; i < LOG_FORMAT_COUNT; ++i) {
+    struct log_batch * batch = batches[i];
+    if(batch == NULL) {
+      continue;
+    }
+    for(size_t j = 0; j < log_sink_count && batch->count != 0 && status == LOG_STATUS_OK; ++j) {
+      struct log_sink * sink = &log_sinks[j];
+      if(sink->format == batch->format && sink->options.level <= batch->max_level) {
+	status = push_log_sink_batch(sink, batch, block);
+      }
+    }
+    release_log_batch(batch);
+  }
+  return status;
+}
+
+/**
+ * Runs in the worker thread
+ * Messages are captured once, rendered once per format and handed to the sink threads in batches,
+ * the worker never waits for a sink
+ * \param arg always NULL
+ * \return the status of the worker thread, cast to void
+ */
+static void * run_worker(void * arg) {
+  enum log_status * status = malloc(sizeof(enum log_status));
+  if(status == NULL) {
+    return NULL;
+  }
+  
+  *status = LOG_STATUS_OK;
+  struct log_queue q;
+  init_log_queue(&q);
+
+  struct timespec report;
+  if(clock_gettime(CLOCK_MONOTONIC, &report) != 0) {
+    *status = LOG_STATUS_CLOCK;
+    return status;
+  }
+  struct timespec recalibrate = report;
+  add_log_millis(&recalibrate, LOG_CLOCK_CALIBRATION_INTERVAL_MS);
+  
+  if(pthread_mutex_lock(&waiting_mutex) != 0) {
+    *status = LOG_STATUS_WAITING_LOCK;
+    return status;
+  }
+  while(true) {
+    if(running && waiting.head == NULL) {
+      *status = wait_for_log_msgs(&report, log_sinks_behind() || malformed_log_msgs != 0);
+      if(*status != LOG_STATUS_OK) {
+	pthread_mutex_unlock(&waiting_mutex);
+	break;
+      }
+    }
+    
+    atomic_store_explicit(&work_available, false, memory_order_relaxed);
+    move_log_msgs(&q, &waiting);
+    bool stop = !running;
+    if(pthread_cond_broadcast(&space_cond) != 0) {
+      *status = LOG_STATUS_WAIT;
+      pthread_mutex_unlock(&waiting_mutex);
+      break;
+    }
+
+    struct timespec now;
+    if(clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+      *status = LOG_STATUS_CLOCK;
+      pthread_mutex_unlock(&waiting_mutex);
+      break;
+    }
+    unsigned long counts[LOG_LEVEL_COUNT];
+    bool report_due = stop || log_time_passed(&report, &now);
+    bool report_dropped = report_due && take_dropped_counts(counts);
+    
+    if(pthread_mutex_unlock(&waiting_mutex) != 0) {
+      *status = LOG_STATUS_WAITING_UNLOCK;
+      break;
+    }
+    if(log_time_passed(&recalibrate, &now)) {
+      if(calibrate_log_clock(&calibration) != 0) {
+	*status = LOG_STATUS_CLOCK;
+	break;
+      }
+      recalibrate = now;
+      add_log_millis(&recalibrate, LOG_CLOCK_CALIBRATION_INTERVAL_MS);
+    }
+    // The last batch reports everything left, including its own messages whose arguments could not be formatted
+    bool report_sinks = stop || (report_due && (log_sinks_behind() || malformed_log_msgs != 0));
+    if(report_dropped || report_sinks) {
+      report = now;
+      add_log_millis(&report, LOG_DROP_REPORT_INTERVAL_MS);
+    }
+    *status = dispatch_log_msgs(&q, report_dropped ? counts : NULL, report_sinks, stop);
+    if(*status != LOG_STATUS_OK) {
+      break;
+    }
+    *status = recycle_log_msgs(&q);
+    if(*status != LOG_STATUS_OK) {
+      break;
+    }
+    if(stop) {
+      break;
+    }
+
+    // Under sustained load messages arrive while the worker is busy, polling a little longer
+    // saves the producers from waking it up for every batch
+    for(int i = 0; i < worker_spin_count && !atomic_load_explicit(&work_available, memory_order_relaxed); ++i) {
+      log_cpu_relax();
+    }
+    
+    if(pthread_mutex_lock(&waiting_mutex) != 0) {
+      *status = LOG_STATUS_WAITING_LOCK;
+      break;
+    }
+  }
+
+  close_log_msg_pool();
+
+  // Release producers blocked on a full queue, from now on they drop their messages
+  if(pthread_mutex_lock(&waiting_mutex) == 0) {
+    worker_stopped = true;
+    pthread_cond_broadcast(&space_cond);
+    pthread_mutex_unlock(&waiting_mutex);
+  }
+  return status;
+}
+
+/**
+ * Waits until batches are available, the sink should stop, its write buffer is due or its log file should be synced
+ * The sink mutex should be held by the caller
+ * \param sink the sink
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status wait_for_log_batches(struct log_sink * sink) {
+  assert(sink != NULL);
+
+  struct log_writer * w = &sink->writer;
+  const struct timespec * deadline = NULL;
+  if(w->len != 0) {
+    deadline = &w->deadline;
+  }
+  struct timespec sync;
+  if(w->file != NULL && get_log_file_sync_deadline(w->file, &sync) && (deadline == NULL || log_time_passed(&sync, deadline))) {
+    deadline = &sync;
+  }
+  
+  sink->sleeping = true;
+  int result;
+  if(deadline == NULL) {
+    result = pthread_cond_wait(&sink->cond, &sink->mutex);
+  } else {
+    result = pthread_cond_timedwait(&sink->cond, &sink->mutex, deadline);
+  }
+  sink->sleeping = false;
+  if(result != 0 && result != ETIMEDOUT) {
+    return LOG_STATUS_WAIT;
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Appends text to the ring of a ring sink, overwriting the oldest text when the ring is full
+ * The sink mutex should be held by the caller
+ * \param sink the sink
+ * \param data the text
+ * \param len the length of the text
+ */
+static void append_log_ring(struct log_sink * sink, const char * data, size_t len) {
+  size_t size = sink->options.ring_size;
+  if(len >= size) {
+    data += len - size;
+    len = size;
+    sink->ring_start = 0;
+    sink->ring_len = 0;
+  }
+  size_t end = (sink->ring_start + sink->ring_len) % size;
+  size_t first = len < size - end ? len : size - end;
+  memcpy(sink->ring + end, data, first);
+  memcpy(sink->ring, data + first, len - first);
+  sink->ring_len += len;
+  if(sink->ring_len > size) {
+    sink->ring_start = (sink->ring_start + sink->ring_len - size) % size;
+    sink->ring_len = size;
+  }
+}
+
+/**
+ * Writes the messages of a batch at or above the log level of a sink to the sink
+ * \param sink the sink
+ * \param batch the batch
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status write_log_sink_batch(struct log_sink * sink, const struct log_batch * batch) {
+  assert(sink != NULL);
+  assert(batch != NULL);
+
+  bool ring = sink->options.type == LOG_SINK_RING;
+  if(ring && pthread_mutex_lock(&sink->mutex) != 0) {
+    return LOG_STATUS_WAITING_LOCK;
+  }
+  enum log_status status = LOG_STATUS_OK;
+  for(size_t i = 0; i < batch->count && status == LOG_STATUS_OK; ++i) {
+    const struct log_batch_entry * entry = &batch->entries[i];
+    if(entry->level < sink->options.level && !entry->recorded) {
+      continue;
+    }
+    if(ring) {
+      append_log_ring(sink, batch->data + entry->offset, entry->len);
+    } else {
+      struct iovec iov = { batch->data + entry->offset, entry->len };
+      status = append_log_output(&sink->writer, &iov, 1, entry->site_id, entry->level == LOG_LEVEL_ERROR);
+    }
+  }
+  if(ring && pthread_mutex_unlock(&sink->mutex) != 0) {
+    return LOG_STATUS_WAITING_UNLOCK;
+  }
+  return status;
+}
+
+/**
+ * Flushes the write buffer of a sink and syncs its log file when due, counting failed log file rotations
+ * \param sink the sink
+ * \return LOG_STATUS_OK or an error code
+ */
+static enum log_status maintain_log_sink(struct log_sink * sink) {
+  assert(sink != NULL);
+
+  struct log_writer * w = &sink->writer;
+  if(sink->options.type == LOG_SINK_RING) {
+    return LOG_STATUS_OK;
+  }
+  enum log_status status = flush_log_writer_if_due(w);
+  if(status != LOG_STATUS_OK || w->file == NULL) {
+    return status;
+  }
+  // The worker reports the failure to every sink, a sink thread never waits for the message pool it drains
+  atomic_store_explicit(&sink->rotation_failures, w->file->rotation_failures, memory_order_relaxed);
+  struct timespec now;
+  if(clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+    return LOG_STATUS_CLOCK;
+  }
+  if(sync_log_file_if_due(w->file, &now) != 0) {
+    return LOG_STATUS_SYNC;
+  }
+  return LOG_STATUS_OK;
+}
+
+/**
+ * Runs in the thread of a sink
+ * Batches are written to the write buffer as they arrive, the buffer is written out when it is full,
+ * when it contains an error message or when it has been held for the flush interval of the sink
+ * \param arg the sink
+ * \return the status of the sink thread, cast to void
+ */
+static void * run_log_sink(void * arg) {
+  struct log_sink * sink = (struct log_sink *) arg;
+  enum log_status * status = malloc(sizeof(enum log_status));
+  if(status == NULL) {
+    if(pthread_mutex_lock(&sink->mutex) == 0) {
+      sink->stopped = true;
+      pthread_cond_broadcast(&sink->space_cond);
+      pthread_mutex_unlock(&sink->mutex);
+    }
+    return NULL;
+  }
+  
+  *status = LOG_STATUS_OK;
+  size_t sink_capacity = sink->options.queue_capacity;
+  if(pthread_mutex_lock(&sink->mutex) != 0) {
+    *status = LOG_STATUS_WAITING_LOCK;
+    return status;
+  }
+  while(true) {
+    if(sink->count == 0 && !sink->stopping) {
+      *status = wait_for_log_batches(sink);
+      if(*status != LOG_STATUS_OK) {
+	pthread_mutex_unlock(&sink->mutex);
+	break;
+      }
+    }
+
+    // Batches are queued before the sink is told to stop, so none are left behind
+    bool stop = sink->stopping;
+    size_t count = sink->count;
+    for(size_t i = 0; i < count; ++i) {
+      sink->taken[i] = sink->batches[(sink->head + i) % sink_capacity];
+    }
+    sink->head = (sink->head + count) % sink_capacity;
+    sink->count = 0;
+    if(count != 0 && pthread_cond_broadcast(&sink->space_cond) != 0) {
+      *status = LOG_STATUS_WAIT;
+      pthread_mutex_unlock(&sink->mutex);
+      break;
+    }
+    if(pthread_mutex_unlock(&sink->mutex) != 0) {
+      *status = LOG_STATUS_WAITING_UNLOCK;
+      break;
+    }
+
+    for(size_t i = 0; i < count; ++i) {
+      if(*status == LOG_STATUS_OK) {
+	*status = write_log_sink_batch(sink, sink->taken[i]);
+      }
+      release_log_batch(sink->taken[i]);
+    }
+    if(*status == LOG_STATUS_OK) {
+      *status = maintain_log_sink(sink);
+    }
+    if(*status != LOG_STATUS_OK || stop) {
+      break;
+    }
+    
+    if(pthread_mutex_lock(&sink->mutex) != 0) {
+      *status = LOG_STATUS_WAITING_LOCK;
+      break;
+    }
+  }
+
+  if(sink->options.type != LOG_SINK_RING) {
+    enum log_status flush_status = flush_log_writer(&sink->writer);
+    if(*status == LOG_STATUS_OK) {
+      *status = flush_status;
+    }
+  }
+
+  // Release the worker if it waits for room, from now on batches for this sink are dropped
+  if(pthread_mutex_lock(&sink->mutex) == 0) {
+    sink->stopped = true;
+    for(size_t i = 0; i < sink->count; ++i) {
+      release_log_batch(sink->batches[(sink->head + i) % sink_capacity]);
+    }
+    sink->count = 0;
+    pthread_cond_broadcast(&sink->space_cond);
+    pthread_mutex_unlock(&sink->mutex);
+  }
+  return status;
+}
+
+/**
+ * Finds the log level of a module
+ * The sites mutex should be held by the caller
+ * \param module the module name
+ * \return the log level of the module, or the minimum log level if it has none of its own
+ */
+static enum log_level find_log_module_level(const char * module) {
+  if(module != NULL) {
+    for(size_t i = 0; i < module_count; ++i) {
+      if(strcmp(modules[i].name, module) == 0) {
+	return modules[i].level;
+      }
+    }
+  }
+  return min_log_level;
+}
+
+/**
+ * Computes the state of a log statement from the level of its module
+ * The sites mutex should be held by the caller
+ * \param site the log statement
+ * \return the state
+ */
+static enum log_site_state find_log_site_state(const struct log_site * site) {
+  assert(site != NULL);
+
+  if(find_log_module_level(site->module) <= site->level) {
+    return LOG_SITE_ENABLED;
+  } else if(site->level <= LOG_LEVEL_INFO && atomic_load_explicit(&recorder_slots, memory_order_relaxed) != 0) {
+    return LOG_SITE_RECORDED;
+  } else {
+    return LOG_SITE_DISABLED;
+  }
+}
+
+/**
+ * Updates the cached state of all registered log statements
+ * The sites mutex should be held by the caller
+ */
+static void update_log_sites() {
+  struct log_site * site = sites;
+  while(site != NULL) {
+    atomic_store_explicit(&site->state, find_log_site_state(site), memory_order_relaxed);
+    site = site->next;
+  }
+}
+
+int register_log_site(struct log_site * site) {
+  assert(site != NULL);
+
+  if(pthread_mutex_lock(&sites_mutex) != 0) {
+    return LOG_SITE_UNREGISTERED;
+  }
+  int state = atomic_load_explicit(&site->state, memory_order_relaxed);
+  if(state == LOG_SITE_UNREGISTERED) {
+    state = find_log_site_state(site);
+    site->next = sites;
+    sites = site;
+    if(site_count < MAX_LOG_SITES) {
+      site_entries[site_count].site = site;
+      atomic_store_explicit(&site->id, ++site_count, memory_order_relaxed);
+    }
+    atomic_store_explicit(&site->state, state, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&sites_mutex);
+  return state;
+}
+
+int set_log_module_level(const char * module, enum log_level level) {
+  if(module == NULL || level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR) {
+    return -1;
+  }
+  if(strlen(module) >= MAX_LOG_MODULE_NAME_LENGTH) {
+    return -1;
+  }
+  if(pthread_mutex_lock(&sites_mutex) != 0) {
+    return -1;
+  }
+  size_t i = 0;
+  while(i < module_count && strcmp(modules[i].name, module) != 0) {
+    ++i;
+  }
+  if(i == MAX_LOG_MODULES) {
+    pthread_mutex_unlock(&sites_mutex);
+    return -1;
+  }
+  if(i == module_count) {
+    strcpy(modules[i].name, module);
+    ++module_count;
+  }
+  modules[i].level = level;
+  update_log_sites();
+  pthread_mutex_unlock(&sites_mutex);
+  return 0;
+}
+
+int set_log_flight_recorder(size_t slots) {
+  if(pthread_mutex_lock(&sites_mutex) != 0) {
+    return -1;
+  }
+  atomic_store_explicit(&recorder_slots, slots, memory_order_relaxed);
+  update_log_sites();
+  pthread_mutex_unlock(&sites_mutex);
+  return 0;
+}
+
+int set_log_queue_policy(size_t capacity_, enum log_overflow_policy policy, enum log_level drop_level_) {
+  if(capacity_ == 0 || policy < LOG_OVERFLOW_BLOCK || policy > LOG_OVERFLOW_DROP_BELOW_LEVEL) {
+    return -1;
+  }
+  if(drop_level_ < LOG_LEVEL_DEBUG || drop_level_ > LOG_LEVEL_ERROR) {
+    return -1;
+  }
+  if(pthread_mutex_lock(&waiting_mutex) != 0) {
+    return -1;
+  }
+  capacity = capacity_;
+  overflow_policy = policy;
+  drop_level = drop_level_;
+  pthread_mutex_unlock(&waiting_mutex);
+  return 0;
+}
+
+/**
+ * Initializes a condition variable using the monotonic clock for timed waits
+ * \param cond the condition variable
+ * \return 0 on success, an error number otherwise
+ */
+static int init_log_cond(pthread_cond_t * cond) {
+  pthread_condattr_t cond_attr;
+  int result = pthread_condattr_init(&cond_attr);
+  if(result == 0) {
+    result = pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if(result == 0) {
+      result = pthread_cond_init(cond, &cond_attr);
+    }
+    pthread_condattr_destroy(&cond_attr);
+  }
+  return result;
+}
+
+void init_log_sink_options(struct log_sink_options * options, enum log_sink_type type, enum log_level level) {
+  assert(options != NULL);
+
+  memset(options, 0, sizeof(struct log_sink_options));
+  options->type = type;
+  options->level = level;
+  options->stream = stderr;
+  options->ring_size = DEFAULT_LOG_RING_SIZE;
+  options->flush_interval_ms = DEFAULT_LOG_SINK_FLUSH_INTERVAL_MS;
+  options->queue_capacity = DEFAULT_LOG_SINK_QUEUE_CAPACITY;
+}
+
+int add_log_sink(const struct log_sink_options * options) {
+  assert(options != NULL);
+
+  if(options->level < LOG_LEVEL_DEBUG || options->level > LOG_LEVEL_ERROR || options->queue_capacity == 0) {
+    fputs("invalid log sink options\n", stderr);
+    return -1;
+  }
+  if(pthread_mutex_lock(&waiting_mutex) != 0) {
+    fputs("could not lock the waiting log queue mutex\n", stderr);
+    return -1;
+  }
+  bool started = running;
+  pthread_mutex_unlock(&waiting_mutex);
+  if(started || log_sink_count == MAX_LOG_SINKS) {
+    fputs("could not add log sink\n", stderr);
+    return -1;
+  }
+  
+  struct log_sink * sink = &log_sinks[log_sink_count];
+  memset(sink, 0, sizeof(struct log_sink));
+  sink->options = *options;
+  sink->format = LOG_FORMAT_TEXT;
+  switch(options->type) {
+  case LOG_SINK_STREAM:
+    assert(options->stream != NULL);
+    // Anything the application wrote through stdio should precede the log
+    if(fflush(options->stream) != 0) {
+      log_errno("could not flush log output", errno);
+      return -1;
+    }
+    break;
+  case LOG_SINK_FILE:
+    sink->format = options->file.format;
+    // The statements described in a binary log file are tracked in the log statement table, which only serves one file
+    for(size_t i = 0; i < log_sink_count && sink->format == LOG_FORMAT_BINARY; ++i) {
+      if(log_sinks[i].format == LOG_FORMAT_BINARY) {
+	fputs("only one log sink can use the binary format\n", stderr);
+	return -1;
+      }
+    }
+    if(open_log_file(&sink->file, &options->file) != 0) {
+      log_errno("could not open log file", errno);
+      return -1;
+    }
+    break;
+  case LOG_SINK_RING:
+    if(options->ring_size == 0) {
+      fputs("invalid log sink options\n", stderr);
+      return -1;
+    }
+    sink->ring = (char *) malloc(options->ring_size);
+    if(sink->ring == NULL) {
+      fputs("could not allocate log ring\n", stderr);
+      return -1;
+    }
+    break;
+  }
+  return (int) log_sink_count++;
+}
+
+/**
+ * Releases the output of a sink, closing its log file
+ * \param sink the sink
+ */
+static void close_log_sink(struct log_sink * sink) {
+  if(sink->options.type == LOG_SINK_FILE && close_log_file(&sink->file) != 0) {
+    log_errno("could not close log file", errno);
+  }
+  free(sink->ring);
+  sink->ring = NULL;
+}
+
+/**
+ * Disposes of the writer, queue and synchronization of a started sink
+ * \param sink the sink
+ */
+static void dispose_log_sink(struct log_sink * sink) {
+  dispose_log_writer(&sink->writer);
+  free(sink->batches);
+  free(sink->taken);
+  sink->batches = NULL;
+  sink->taken = NULL;
+  pthread_cond_destroy(&sink->space_cond);
+  pthread_cond_destroy(&sink->cond);
+  pthread_mutex_destroy(&sink->mutex);
+}
+
+/**
+ * Starts the thread of a sink
+ * \param sink the sink
+ * \return 0 on success, -1 on error
+ */
+static int start_log_sink(struct log_sink * sink) {
+  if(sink->options.type != LOG_SINK_RING) {
+    int fd = sink->options.type == LOG_SINK_FILE ? sink->file.fd : fileno(sink->options.stream);
+    struct log_file * f = sink->options.type == LOG_SINK_FILE ? &sink->file : NULL;
+    if(init_log_writer(&sink->writer, fd, f, sink->format, sink->options.flush_interval_ms) != 0) {
+      fputs("could not allocate log write buffer\n", stderr);
+      return -1;
+    }
+  }
+  sink->batches = (struct log_batch **) calloc(sink->options.queue_capacity, sizeof(struct log_batch *));
+  sink->taken = (struct log_batch **) calloc(sink->options.queue_capacity, sizeof(struct log_batch *));
+  if(sink->batches == NULL || sink->taken == NULL) {
+    fputs("could not allocate log sink queue\n", stderr);
+    free(sink->batches);
+    free(sink->taken);
+    dispose_log_writer(&sink->writer);
+    return -1;
+  }
+  sink->head = 0;
+  sink->count = 0;
+  sink->ring_start = 0;
+  sink->ring_len = 0;
+  sink->stopping = false;
+  sink->sleeping = false;
+  sink->stopped = false;
+  sink->dropped = 0;
+  sink->reported = 0;
+  atomic_init(&sink->rotation_failures, 0);
+  sink->rotations_reported = 0;
+
+  int result = pthread_mutex_init(&sink->mutex, NULL);
+  if(result == 0) {
+    result = init_log_cond(&sink->cond);
+    if(result == 0) {
+      result = pthread_cond_init(&sink->space_cond, NULL);
+      if(result != 0) {
+	pthread_cond_destroy(&sink->cond);
+      }
+    }
+    if(result != 0) {
+      pthread_mutex_destroy(&sink->mutex);
+    }
+  }
+  if(result != 0) {
+    log_errno("could not initialize log sink", result);
+    free(sink->batches);
+    free(sink->taken);
+    dispose_log_writer(&sink->writer);
+    return -1;
+  }
+
+  result = pthread_create(&sink->thread, NULL, run_log_sink, sink);
+  if(result != 0) {
+    log_errno("could not start log sink thread", result);
+    dispose_log_sink(sink);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Stops the thread of a sink after it wrote the queued batches and reports messages the sink dropped and failed rotations
+ * \param index the index of the sink
+ */
+static void stop_log_sink(size_t index) {
+  struct log_sink * sink = &log_sinks[index];
+  int result = pthread_mutex_lock(&sink->mutex);
+  if(result != 0) {
+    log_errno("could not lock the log sink mutex to signal shutdown", result);
+    return;
+  }
+  sink->stopping = true;
+  result = pthread_cond_signal(&sink->cond);
+  pthread_mutex_unlock(&sink->mutex);
+  if(result != 0) {
+    log_errno("could not send signal to shut down log sink", result);
+    return;
+  }
+
+  enum log_status * sink_status = NULL;
+  result = pthread_join(sink->thread, (void **)&sink_status);
+  if(result != 0) {
+    log_errno("could not join log sink thread", result);
+    return;
+  }
+  if(sink_status == NULL) {
+    fputs("thread could not allocate result buffer\n", stderr);
+  } else if(*sink_status != LOG_STATUS_OK) {
+    fputs(log_status_labels[*sink_status], stderr);
+    fputc('\n', stderr);
+  }
+  free(sink_status);
+  
+  if(sink->dropped != sink->reported) {
+    fprintf(stderr, "log sink %zu fell behind, dropped %lu messages\n", index, sink->dropped - sink->reported);
+  }
+  if(atomic_load_explicit(&sink->rotation_failures, memory_order_relaxed) != sink->rotations_reported) {
+    fprintf(stderr, "could not rotate log file %s\n", sink->file.path);
+  }
+}
+
+/**
+ * Stops the started sinks and removes all sinks
+ * \param started the number of sinks that were started
+ */
+static void remove_log_sinks(size_t started) {
+  for(size_t i = 0; i < log_sink_count; ++i) {
+    if(i < started) {
+      stop_log_sink(i);
+      dispose_log_sink(&log_sinks[i]);
+    }
+    close_log_sink(&log_sinks[i]);
+  }
+  log_sink_count = 0;
+  dispose_log_batches();
+}
+
+int start_sink_logger() {
+  if(log_sink_count == 0) {
+    fputs("no log sinks were added\n", stderr);
+    return -1;
+  }
+  enum log_level min_log_level_ = LOG_LEVEL_ERROR;
+  bool binary = false;
+  for(size_t i = 0; i < log_sink_count; ++i) {
+    if(log_sinks[i].options.level < min_log_level_) {
+      min_log_level_ = log_sinks[i].options.level;
+    }
+    binary = binary || log_sinks[i].format == LOG_FORMAT_BINARY;
+  }
+  
+  if(pthread_mutex_lock(&sites_mutex) != 0) {
+    fputs("could not lock the log statement mutex\n", stderr);
+    remove_log_sinks(0);
+    return -1;
+  }
+  min_log_level = min_log_level_;
+  update_log_sites();
+  // Log statements have to be described again in a new output
+  for(unsigned int i = 0; i < site_count; ++i) {
+    site_entries[i].written_generation = 0;
+    site_entries[i].pending_flush = 0;
+  }
+  pthread_mutex_unlock(&sites_mutex);
+  
+  if(init_log_clock(&calibration) != 0) {
+    log_errno("could not initialize log clock", errno);
+    remove_log_sinks(0);
+    return -1;
+  }
+  
+  running = true;
+  worker_stopped = false;
+  worker_sleeping = false;
+  atomic_store_explicit(&work_available, false, memory_order_relaxed);
+  // Polling only pays off when producers run on other CPUs
+  worker_spin_count = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? LOG_WORKER_SPIN_COUNT : 0;
+  for(int i = 0; i < LOG_LEVEL_COUNT; ++i) {
+    dropped[i] = 0;
+  }
+  malformed_log_msgs = 0;
+  renderer.second = (time_t) -1;
+  
+  init_log_queue(&waiting);
+  if(init_log_msg_pool(capacity) != 0) {
+    fputs("could not allocate log message pool\n", stderr);
+    remove_log_sinks(0);
+    return -1;
+  }
+
+  int result = init_log_cond(&waiting_cond);
+  if(result != 0) {
+    log_errno("could not initialize log condition variable", result);
+    dispose_log_msg_pool();
+    remove_log_sinks(0);
+    return -1;
+  }
+
+  for(size_t i = 0; i < log_sink_count; ++i) {
+    if(start_log_sink(&log_sinks[i]) != 0) {
+      pthread_cond_destroy(&waiting_cond);
+      dispose_log_msg_pool();
+      remove_log_sinks(i);
+      return -1;
+    }
+  }
+  
+  result = pthread_create(&worker, NULL, run_worker, NULL);
+  if(result != 0) {
+    log_errno("could not start worker thread", result);
+    pthread_cond_destroy(&waiting_cond);
+    dispose_log_msg_pool();
+    remove_log_sinks(log_sink_count);
+    return -1;
+  }
+  atomic_store_explicit(&binary_capture, binary, memory_order_relaxed);
+  return 0;
+}
+
+int start_logger(FILE * output, enum log_level min_log_level_) {
+  assert(output != NULL);
+
+  struct log_sink_options options;
+  init_log_sink_options(&options, LOG_SINK_STREAM, min_log_level_);
+  options.stream = output;
+  if(add_log_sink(&options) < 0) {
+    return -1;
+  }
+  return start_sink_logger();
+}
+
+int start_file_logger(const struct log_file_options * options, enum log_level min_log_level_) {
+  assert(options != NULL);
+
+  struct log_sink_options sink_options;
+  init_log_sink_options(&sink_options, LOG_SINK_FILE, min_log_level_);
+  sink_options.file = *options;
+  if(add_log_sink(&sink_options) < 0) {
+    return -1;
+  }
+  return start_sink_logger();
+}
+
+size_t read_log_ring(int index, char * dest, size_t size) {
+  assert(dest != NULL || size == 0);
+
+  if(index < 0 || (size_t) index >= log_sink_count || log_sinks[index].options.type != LOG_SINK_RING || log_sinks[index].batches == NULL) {
+    return 0;
+  }
+  struct log_sink * sink = &log_sinks[index];
+  if(pthread_mutex_lock(&sink->mutex) != 0) {
+    return 0;
+  }
+  size_t len = sink->ring_len < size ? sink->ring_len : size;
+  size_t ring_size = sink->options.ring_size;
+  size_t start = (sink->ring_start + sink->ring_len - len) % ring_size;
+  size_t first = len < ring_size - start ? len : ring_size - start;
+  memcpy(dest, sink->ring + start, first);
+  memcpy(dest + first, sink->ring, len - first);
+  pthread_mutex_unlock(&sink->mutex);
+  return len;
+}
+
+/**
+ * Finds the oldest waiting message below the drop level
+ * The waiting mutex should be held by the caller
+ * \return the message or NULL if there is none
+ */
+static struct log_msg * find_droppable_log_msg() {
+  struct log_msg * msg = waiting.head;
+  while(msg != NULL && msg->level >= drop_level) {
+    msg = msg->next;
+  }
+  return msg;
+}
+
+/**
+ * Adds a message to the waiting queue, applying the overflow policy when the queue is full
+ * The waiting mutex should be held by the caller
+ * \param msg the message
+ * \return the message that was dropped, which may be the new message, or NULL if none was dropped
  */
-static void move_log_msgs(struct log_queue * dest, struct log_queue * src) {
-  assert(dest != NULL);
-  assert(src != NULL);
+static struct log_msg * enqueue_log_msg(struct log_msg * msg) {
+  assert(msg != NULL);
 
-  if(src->head != NULL) {
-    if(dest->head == NULL) {
-      dest->head = src->head;
-    } else {
-      dest->tail = src->head;
-      src->head->prev = dest->tail;
+  if(overflow_policy == LOG_OVERFLOW_BLOCK) {
+    while(waiting.len >= capacity && running && !worker_stopped) {
+      if(pthread_cond_wait(&space_cond, &waiting_mutex) != 0) {
+	break;
+      }
     }
-    dest->tail = src->tail;
-    src->head = NULL;
-    src->tail = NULL;
   }
-}
 
-/**
- * Disposes of all resources associated with this log queue
- * \param q the log queue
- */
-static void dispose_log_queue(struct log_queue * q) {
-  assert(q != NULL);
+  struct log_msg * evicted = NULL;
+  if(worker_stopped) {
+    evicted = msg;
+  } else if(waiting.len >= capacity && running) {
+    switch(overflow_policy) {
+    case LOG_OVERFLOW_DROP_OLDEST:
+      evicted = pop_log_msg(&waiting);
+      break;
+    case LOG_OVERFLOW_DROP_BELOW_LEVEL:
+      if(msg->level >= drop_level) {
+	evicted = find_droppable_log_msg();
+	if(evicted != NULL) {
+	  remove_log_msg(&waiting, evicted);
+	  break;
+	}
+      }
+      evicted = msg;
+      break;
+    default:
+      evicted = msg;
+      break;
+    }
+  }
 
-  struct log_msg * msg = q->head;
-  while(msg != NULL) {
-    struct log_msg * next = msg->next;
-    destroy_log_msg(msg);
-    msg = next;
+  if(evicted != NULL) {
+    ++dropped[evicted->level];
   }
+  if(evicted != msg) {
+    push_log_msg(&waiting, msg);
+  }
+  return evicted;
 }
 
 /**
- * Attempts to print an error log to stderr
- * \param message the message
- * \param error the error code
+ * Counts a message dropped because the message pool was exhausted
+ * \param level the log level of the message
  */
-static void log_errno(const char * message, int error) {
-  assert(message != NULL);
-
-  fputs(message, stderr);
-  fputs(": ", stderr);
-    
-  char buffer[ERROR_BUFFER_SIZE];
-  if(strerror_r(error, buffer, ERROR_BUFFER_SIZE) == 0) {
-    fputs(buffer, stderr);
-  } else {
-    fputs("unknown error", stderr);
+static void count_dropped_log_msg(enum log_level level) {
+  if(pthread_mutex_lock(&waiting_mutex) == 0) {
+    ++dropped[level];
+    pthread_mutex_unlock(&waiting_mutex);
   }
-  fputc('\n', stderr);
 }
 
 /**
- * Recycles the messages on this queue
- * \param q the queue
- * \return LOG_STATUS_OK or error code
+ * Adds a filled message to the waiting queue and wakes up the worker
+ * \param msg the message
+ * \return 0 on success, -1 on error
  */
-static enum log_status recycle_log_msgs(struct log_queue * q) {
-  assert(q != NULL);
-
-  if(pthread_mutex_lock(&ready_mutex) != 0) {
-    return LOG_STATUS_READY_LOCK;
+static int submit_log_msg(struct log_msg * msg) {
+  if(pthread_mutex_lock(&waiting_mutex) != 0) {
+    recycle_log_msg(msg);
+    return -1;
   }
-
-  move_log_msgs(&ready, q);
-
-  if(pthread_mutex_unlock(&ready_mutex) != 0) {
-    return LOG_STATUS_READY_UNLOCK;
+  struct log_msg * evicted = enqueue_log_msg(msg);
+  // Only the first producer after the worker went to sleep signals it, the worker is awake otherwise
+  bool wake = evicted != msg && worker_sleeping;
+  if(wake) {
+    worker_sleeping = false;
+  }
+  if(evicted != msg && !atomic_load_explicit(&work_available, memory_order_relaxed)) {
+    atomic_store_explicit(&work_available, true, memory_order_relaxed);
+  }
+  if(pthread_mutex_unlock(&waiting_mutex) != 0) {
+    return -1;
+  }
+  if(evicted != NULL) {
+    recycle_log_msg(evicted);
+  }
+  if(wake && pthread_cond_signal(&waiting_cond) != 0) {
+    return -1;
   }
   
-  return LOG_STATUS_OK;
+  return 0;
 }
 
 /**
- * Either recycles or creates a log message
+ * Formats a message and queues it for the worker
+ * \param level the log level of the message
+ * \param file the file where the message originates
+ * \param line the line where the message originates
+ * \param suppressed the number of messages of the same log statement suppressed before this one
+ * \param format the format string
+ * \param args the arguments
+ * \return 0 on success, -1 on error
  */
-static struct log_msg * get_log_msg(size_t min_size) {
-  struct log_msg * msg;
+static int vlog_message(enum log_level level, const char * file, int line, unsigned int suppressed, const char * format, va_list args) {
+  log_ticks ticks = read_log_clock();
+  
+  va_list args2;
+  va_copy(args2, args);
+  int min_size = vsnprintf(NULL, 0, format, args2);
+  va_end(args2);
+  
+  if(min_size < 0) {
+    return -1;
+  }
+  ++min_size;
 
-  if(pthread_mutex_lock(&ready_mutex) != 0) {
-    return NULL;
+  struct log_msg * msg = get_log_msg(min_size, overflow_policy == LOG_OVERFLOW_BLOCK);
+  if(msg == NULL) {
+    count_dropped_log_msg(level);
+    return 0;
   }
+  msg->level = level;
+  msg->file = file;
+  msg->line = line;
+  msg->ticks = ticks;
+  msg->suppressed = suppressed;
+  msg->site_id = 0;
+  msg->recorded = false;
+  msg->thread = get_log_thread_id();
 
-  msg = pop_log_msg(&ready);
+  int result = vsnprintf(msg->buffer, msg->size, format, args);
 
-  if(pthread_mutex_unlock(&ready_mutex) != 0) {
-    return NULL;
+  if(result < 0) {
+    recycle_log_msg(msg);
+    return -1;
   }
+  // Content that does not fit the largest available buffer is truncated
+  msg->len = (size_t) result < msg->size ? (size_t) result : msg->size - 1;
 
-  if(msg == NULL) {
-    msg = create_log_msg();
-    if(msg != NULL) {
-      char * nbuffer = malloc(min_size);
-      if(nbuffer == NULL) {
-	destroy_log_msg(msg);
-	return NULL;
-      }
-      msg->buffer = nbuffer;
-      msg->size = min_size;
+  return submit_log_msg(msg);
+}
+
+/**
+ * Describes a log statement for binary output on first use
+ * \param site the log statement
+ * \param format the format string of the statement
+ * \return the description or NULL if the messages of the statement have to be stored as text
+ */
+static const struct log_site_entry * describe_log_site(struct log_site * site, const char * format) {
+  unsigned int id = atomic_load_explicit(&site->id, memory_order_relaxed);
+  if(id == 0) {
+    return NULL;
+  }
+  struct log_site_entry * entry = &site_entries[id - 1];
+  int description = atomic_load_explicit(&entry->description, memory_order_acquire);
+  if(description == LOG_SITE_UNDESCRIBED) {
+    if(pthread_mutex_lock(&sites_mutex) != 0) {
+      return NULL;
     }
-  } else {
-    if(min_size > msg->size) {
-      char * nbuffer = realloc(msg->buffer, min_size);
-      if(nbuffer == NULL) {
-	destroy_log_msg(msg);
-	return NULL;
+    description = atomic_load_explicit(&entry->description, memory_order_relaxed);
+    if(description == LOG_SITE_UNDESCRIBED) {
+      entry->format = format;
+      if(get_log_arg_types(format, entry->types, &entry->arg_count) == 0) {
+	description = LOG_SITE_BINARY;
+      } else {
+	description = LOG_SITE_TEXT;
       }
-      msg->buffer = nbuffer;
-      msg->size = min_size;
+      atomic_store_explicit(&entry->description, description, memory_order_release);
     }
+    pthread_mutex_unlock(&sites_mutex);
   }
-  return msg;
+  return description == LOG_SITE_BINARY ? entry : NULL;
 }
 
 /**
- * Prints a message
- * \param msg the message
- * \return LOG_STATUS_OK or an error code
+ * Queues a message holding the arguments of a log statement in binary form for the worker
+ * \param site the log statement
+ * \param entry the description of the log statement
+ * \param suppressed the number of messages of the same log statement suppressed before this one
+ * \param args the arguments
+ * \return 0 on success, -1 on error, 1 if the arguments are too large and the message has to be stored as text
  */
-static enum log_status print_log_msg(struct log_msg * msg) {
-  int result;
-  if(msg->file != NULL) {
-    result = fprintf(stderr, "%s%s:%d\t%s\n", log_level_labels[msg->level], msg->file, msg->line, msg->buffer);
-  } else {
-    result = fprintf(stderr, "%s:\t%s\n", log_level_labels[msg->level], msg->buffer);
+static int capture_log_args(struct log_site * site, const struct log_site_entry * entry, unsigned int suppressed, va_list args) {
+  log_ticks ticks = read_log_clock();
+
+  va_list args2;
+  va_copy(args2, args);
+  size_t min_size = measure_log_args(entry->types, entry->arg_count, args2);
+  va_end(args2);
+
+  struct log_msg * msg = get_log_msg(min_size, overflow_policy == LOG_OVERFLOW_BLOCK);
+  if(msg == NULL) {
+    count_dropped_log_msg(site->level);
+    return 0;
   }
-  if(result < 0) {
-    return LOG_STATUS_PRINT;
-  } else {
-    return LOG_STATUS_OK;
+  if(msg->size < min_size) {
+    recycle_log_msg(msg);
+    return 1;
   }
+  msg->level = site->level;
+  msg->file = site->file;
+  msg->line = site->line;
+  msg->ticks = ticks;
+  msg->suppressed = suppressed;
+  msg->site_id = (unsigned int) (entry - site_entries) + 1;
+  msg->recorded = false;
+  msg->thread = get_log_thread_id();
+  // The arguments are read from a copy, the caller formats them as text if they do not fit
+  va_copy(args2, args);
+  int result = encode_log_args(msg->buffer, msg->size, entry->types, entry->arg_count, args2, &msg->len);
+  va_end(args2);
+  if(result != 0) {
+    recycle_log_msg(msg);
+    return 1;
+  }
+
+  return submit_log_msg(msg);
 }
 
 /**
- * Prints the log messages
- * \param q the queue
- * \return LOG_STATUS_OK or an error code
+ * Releases the flight recorder of an exiting thread
+ * \param r the recorder
  */
-static enum log_status print_log_msgs(struct log_queue * q) {
-  assert(q != NULL);
+static void release_log_recorder(void * r) {
+  free(r);
+}
 
-  enum log_status status = LOG_STATUS_OK;
-  struct log_msg * msg = q->head;
-  while(msg != NULL && status == LOG_STATUS_OK) {
-    if(min_log_level <= msg->level) {
-      status = print_log_msg(msg);
-    }
-    msg = msg->next;
+/**
+ * Creates the key releasing flight recorders
+ */
+static void create_log_recorder_key() {
+  if(pthread_key_create(&recorder_key, release_log_recorder) != 0) {
+    fputs("could not create flight recorder key\n", stderr);
   }
-  return LOG_STATUS_OK;
 }
 
 /**
- * Runs in the worker thread
- * \param arg always NULL
- * \return the status of the worker thread, cast to void
+ * Fetches the flight recorder of the calling thread, allocating it on first use or when the number of slots changed
+ * \return the recorder or NULL on error
  */
-static void * run_worker(void * arg) {
-  enum log_status * status = malloc(sizeof(enum log_status));
-  if(status == NULL) {
+static struct log_recorder * get_log_recorder() {
+  size_t slots = atomic_load_explicit(&recorder_slots, memory_order_relaxed);
+  if(recorder != NULL && recorder->slot_count == slots) {
+    return recorder;
+  }
+  if(slots == 0 || pthread_once(&recorder_key_once, create_log_recorder_key) != 0) {
     return NULL;
   }
-  
-  *status = LOG_STATUS_OK;
-  struct log_queue q;
-  init_log_queue(&q);
+  struct log_recorder * r = (struct log_recorder *) malloc(sizeof(struct log_recorder) + slots * sizeof(struct log_recorder_slot));
+  if(r == NULL) {
+    return NULL;
+  }
+  r->slot_count = slots;
+  r->next = 0;
+  r->used = 0;
+  if(pthread_setspecific(recorder_key, r) != 0) {
+    free(r);
+    return NULL;
+  }
+  free(recorder);
+  recorder = r;
+  return r;
+}
 
-  if(pthread_mutex_lock(&waiting_mutex) != 0) {
-    *status = LOG_STATUS_WAITING_LOCK;
-    return status;
+void record_log_site(struct log_site * site, const char * format, ...) {
+  assert(site != NULL);
+  assert(format != NULL);
+
+  struct log_recorder * r = get_log_recorder();
+  if(r == NULL) {
+    return;
   }
-  if(!running) {
+  struct log_recorder_slot * slot = &r->slots[r->next % r->slot_count];
+  slot->site = site;
+  slot->ticks = read_log_clock();
 
-    if(pthread_mutex_unlock(&waiting_mutex) != 0) {
-      *status = LOG_STATUS_WAITING_LOCK;
-    }
-    return status;
+  va_list args;
+  va_start(args, format);
+  // Arguments are kept in binary form when they fit, the message is formatted only if it is ever dumped
+  slot->entry = describe_log_site(site, format);
+  va_list binary;
+  va_copy(binary, args);
+  bool encoded = slot->entry != NULL && measure_log_args(slot->entry->types, slot->entry->arg_count, args) <= LOG_RECORDER_DATA_SIZE
+    && encode_log_args(slot->data, LOG_RECORDER_DATA_SIZE, slot->entry->types, slot->entry->arg_count, binary, &slot->len) == 0;
+  va_end(binary);
+  if(!encoded) {
+    slot->entry = NULL;
+    int len = vsnprintf(slot->data, LOG_RECORDER_DATA_SIZE, format, args);
+    slot->len = len < 0 ? 0 : (size_t) len < LOG_RECORDER_DATA_SIZE ? (size_t) len : LOG_RECORDER_DATA_SIZE - 1;
   }
-  while(true) {
-    if(pthread_cond_wait(&waiting_cond, &waiting_mutex) != 0) {
-      *status = LOG_STATUS_WAIT;
-      pthread_mutex_unlock(&waiting_mutex);
-      break;
+  va_end(args);
+
+  // A signal handler interrupting this thread only sees complete slots
+  atomic_signal_fence(memory_order_release);
+  ++r->next;
+  if(r->used < r->slot_count) {
+    ++r->used;
+  }
+}
+
+/**
+ * Formats a flight recorder slot as text
+ * \param slot the slot
+ * \param dest the destination buffer
+ * \param size the size of the destination buffer
+ * \return the length of the untruncated text or -1 on error
+ */
+static int format_log_recorder_slot(const struct log_recorder_slot * slot, char * dest, size_t size) {
+  if(slot->entry != NULL) {
+    return format_log_args(dest, size, slot->entry->format, slot->entry->types, slot->entry->arg_count, slot->data, slot->len);
+  }
+  if(size != 0) {
+    size_t len = slot->len < size ? slot->len : size - 1;
+    memcpy(dest, slot->data, len);
+    dest[len] = '\0';
+  }
+  return (int) slot->len;
+}
+
+/**
+ * Queues the messages in the flight recorder of the calling thread for the worker and empties the recorder
+ * The arguments are passed on unformatted to binary output
+ */
+static void dump_log_recorder() {
+  struct log_recorder * r = recorder;
+  if(r == NULL) {
+    return;
+  }
+  bool binary = atomic_load_explicit(&binary_capture, memory_order_relaxed);
+  for(size_t i = r->next - r->used; i != r->next; ++i) {
+    const struct log_recorder_slot * slot = &r->slots[i % r->slot_count];
+    bool raw = binary && slot->entry != NULL;
+    size_t min_size = slot->len;
+    if(!raw) {
+      int len = format_log_recorder_slot(slot, NULL, 0);
+      if(len < 0) {
+	continue;
+      }
+      min_size = (size_t) len + 1;
     }
-    
-    move_log_msgs(&q, &waiting);
-    if(pthread_mutex_unlock(&waiting_mutex) != 0) {
-      *status = LOG_STATUS_WAITING_LOCK;
-      break;
+    struct log_msg * msg = get_log_msg(min_size, overflow_policy == LOG_OVERFLOW_BLOCK);
+    if(msg == NULL) {
+      count_dropped_log_msg(slot->site->level);
+      continue;
     }
-    *status = print_log_msgs(&q);
-    if(*status != LOG_STATUS_OK) {
-      pthread_mutex_unlock(&waiting_mutex);
-      break;
+    msg->level = slot->site->level;
+    msg->file = slot->site->file;
+    msg->line = slot->site->line;
+    msg->ticks = slot->ticks;
+    msg->suppressed = 0;
+    msg->thread = get_log_thread_id();
+    msg->recorded = true;
+    if(raw && min_size <= msg->size) {
+      msg->site_id = (unsigned int) (slot->entry - site_entries) + 1;
+      memcpy(msg->buffer, slot->data, slot->len);
+      msg->len = slot->len;
+    } else {
+      msg->site_id = 0;
+      int len = format_log_recorder_slot(slot, msg->buffer, msg->size);
+      msg->len = len < 0 ? 0 : (size_t) len < msg->size ? (size_t) len : msg->size - 1;
     }
-    *status = recycle_log_msgs(&q);
-    if(*status != LOG_STATUS_OK) {
+    if(submit_log_msg(msg) != 0) {
       break;
     }
-    
-    if(pthread_mutex_lock(&waiting_mutex) != 0) {
-      *status = LOG_STATUS_WAITING_LOCK;
-      break;
+  }
+  r->used = 0;
+}
+
+/**
+ * Writes a message directly to the output of a sink from a signal handler, as a line or a text record
+ * \param w the writer of the sink
+ * \param msg the message, with the content in the buffer
+ */
+static void write_log_crash_msg(const struct log_writer * w, struct log_msg * msg) {
+  char header[LOG_HEADER_BUFFER_SIZE];
+  struct iovec iov[3];
+  int count = 0;
+  if(w->format == LOG_FORMAT_BINARY) {
+    iov[count].iov_base = header;
+    iov[count++].iov_len = render_log_record_header(header, msg);
+    iov[count].iov_base = msg->buffer;
+    iov[count++].iov_len = msg->len;
+  } else {
+    struct timespec wall;
+    log_ticks_to_wall(&calibration, msg->ticks, &wall);
+    struct tm tm;
+    char second[LOG_TIME_BUFFER_SIZE];
+    if(gmtime_r(&wall.tv_sec, &tm) == NULL || strftime(second, LOG_TIME_BUFFER_SIZE, "%Y-%m-%dT%H:%M:%S", &tm) == 0) {
+      strcpy(second, "0000-00-00T00:00:00");
     }
+    int len = snprintf(header, LOG_HEADER_BUFFER_SIZE, "%s.%06ldZ %s%s:%d\t", second, wall.tv_nsec / 1000, log_level_labels[msg->level], msg->file, msg->line);
+    if(len < 0) {
+      return;
+    }
+    iov[count].iov_base = header;
+    iov[count++].iov_len = (size_t) len < LOG_HEADER_BUFFER_SIZE ? (size_t) len : LOG_HEADER_BUFFER_SIZE - 1;
+    iov[count].iov_base = msg->buffer;
+    iov[count++].iov_len = msg->len;
+    iov[count].iov_base = "\n";
+    iov[count++].iov_len = 1;
+  }
+  write_log_iovec(w->fd, iov, count);
+}
+
+/**
+ * Writes a message directly to the outputs of the stream and file sinks from a signal handler
+ * \param msg the message, with the content in the buffer
+ */
+static void write_log_crash_msgs(struct log_msg * msg) {
+  for(size_t i = 0; i < log_sink_count; ++i) {
+    if(log_sinks[i].options.type != LOG_SINK_RING && log_sinks[i].writer.buffer != NULL) {
+      write_log_crash_msg(&log_sinks[i].writer, msg);
+    }
+  }
+}
+
+/**
+ * Writes out the flight recorder of the crashing thread and raises the signal again with its default action
+ * Formatting is not async signal safe in general, this is a best effort on a thread that is about to die
+ * \param signal the signal
+ */
+static void handle_log_crash(int signal) {
+  struct log_recorder * r = recorder;
+  if(r != NULL && log_sink_count != 0) {
+    char buffer[LOG_CRASH_BUFFER_SIZE];
+    struct log_msg msg;
+    msg.suppressed = 0;
+    msg.site_id = 0;
+    msg.recorded = false;
+    msg.thread = get_log_thread_id();
+    msg.buffer = buffer;
+    msg.size = LOG_CRASH_BUFFER_SIZE;
+    msg.level = LOG_LEVEL_ERROR;
+    msg.file = __FILE__;
+    msg.line = __LINE__;
+    msg.ticks = read_log_clock();
+    int len = snprintf(buffer, LOG_CRASH_BUFFER_SIZE, "received signal %d, last %lu messages below the log level follow", signal, (unsigned long) r->used);
+    msg.len = len < 0 ? 0 : (size_t) len;
+    write_log_crash_msgs(&msg);
     
-    if(!running) {
-      if(pthread_mutex_unlock(&waiting_mutex) != 0) {
-	*status = LOG_STATUS_WAITING_LOCK;
+    for(size_t i = r->next - r->used; i != r->next; ++i) {
+      const struct log_recorder_slot * slot = &r->slots[i % r->slot_count];
+      len = format_log_recorder_slot(slot, buffer, LOG_CRASH_BUFFER_SIZE);
+      if(len >= 0) {
+	msg.level = slot->site->level;
+	msg.file = slot->site->file;
+	msg.line = slot->site->line;
+	msg.ticks = slot->ticks;
+	msg.len = (size_t) len < LOG_CRASH_BUFFER_SIZE ? (size_t) len : LOG_CRASH_BUFFER_SIZE - 1;
+	write_log_crash_msgs(&msg);
       }
-      break;
     }
+    r->used = 0;
   }
-  
-  dispose_log_queue(&q);
-  return status;
+  raise(signal);
 }
 
-int start_logger(FILE * output_, enum log_level min_log_level_) {
-  assert(output_ != NULL);
-
-  min_log_level = min_log_level_;
-  output = output_;
-  running = true;
-  
-  init_log_queue(&waiting);
-  init_log_queue(&ready);
+int install_log_crash_handler() {
+  static const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
   
-  int result = pthread_create(&worker, NULL, run_worker, NULL);
-  if(result != 0) {
-    log_errno("could not start worker thread", result);
-    return -1;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_log_crash;
+  action.sa_flags = SA_RESETHAND | SA_NODEFER | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  for(size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i) {
+    if(sigaction(signals[i], &action, NULL) != 0) {
+      log_errno("could not install crash handler", errno);
+      return -1;
+    }
   }
   return 0;
 }
@@ -511,48 +3424,78 @@ int log_message(enum log_level level, const char * file, int line, const char *
   if(format == NULL || level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR) {
     return -1;
   }
+  if(level < min_log_level) {
+    return 0;
+  }
+  if(level == LOG_LEVEL_ERROR) {
+    dump_log_recorder();
+  }
 
   va_list args;
   va_start(args, format);
-  int min_size = vsnprintf(NULL, 0, format, args);
+  int result = vlog_message(level, file, line, 0, format, args);
   va_end(args);
-  
-  if(min_size < 0) {
+  return result;
+}
+
+int log_site_message(struct log_site * site, const char * format, ...) {
+  if(site == NULL || format == NULL) {
     return -1;
   }
-  ++min_size;
 
-  struct log_msg * msg = get_log_msg(min_size);
-  if(msg == NULL) {
-    return -1;
+  unsigned int suppressed = 0;
+  if(site->every > 1 || site->per_second != 0) {
+    suppressed = atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
   }
-  msg->level = level;
-  msg->file = file;
-  msg->line = line;
+  if(site->level == LOG_LEVEL_ERROR) {
+    dump_log_recorder();
+  }
+  
+  va_list args;
+  va_start(args, format);
+  int result = 1;
+  if(atomic_load_explicit(&binary_capture, memory_order_relaxed)) {
+    const struct log_site_entry * entry = describe_log_site(site, format);
+    if(entry != NULL) {
+      result = capture_log_args(site, entry, suppressed, args);
+    }
+  }
+  if(result == 1) {
+    result = vlog_message(site->level, site->file, site->line, suppressed, format, args);
+  }
+  va_end(args);
+  return result;
+}
 
-  va_list args2;
-  va_start(args2, format);
-  int result = vsnprintf(msg->buffer, msg->size, format, args2);
-  va_end(args2);
+bool sample_log_site(struct log_site * site, unsigned int every) {
+  assert(site != NULL);
+  assert(every > 0);
 
-  if(result < 0) {
-    destroy_log_msg(msg);
-    return -1;
+  if(atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) % every == 0) {
+    return true;
   }
+  atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+  return false;
+}
 
-  if(pthread_mutex_lock(&waiting_mutex) != 0) {
-    destroy_log_msg(msg);
-    return -1;
+bool limit_log_site(struct log_site * site, unsigned int per_second) {
+  assert(site != NULL);
+
+  struct timespec now;
+  if(clock_gettime(CLOCK_MONOTONIC_COARSE, &now) != 0) {
+    return true;
   }
-  push_log_msg(&waiting, msg);
-  if(pthread_mutex_unlock(&waiting_mutex) != 0) {
-    return -1;
+  long second = (long) now.tv_sec;
+  long window = atomic_load_explicit(&site->window, memory_order_relaxed);
+  // Only the thread that moves the window forward resets the count, a few messages may slip through in between
+  if(window != second && atomic_compare_exchange_strong_explicit(&site->window, &window, second, memory_order_relaxed, memory_order_relaxed)) {
+    atomic_store_explicit(&site->window_count, 0, memory_order_relaxed);
   }
-  if(pthread_cond_signal(&waiting_cond) != 0) {
-    return -1;
+  if(atomic_fetch_add_explicit(&site->window_count, 1, memory_order_relaxed) < per_second) {
+    return true;
   }
-  
-  return 0;
+  atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+  return false;
 }
 
 enum log_level get_min_log_level() {
@@ -560,7 +3503,7 @@ enum log_level get_min_log_level() {
 }
 
 int stop_logger() {
-  int result = pthread_mutex_unlock(&waiting_mutex);
+  int result = pthread_mutex_lock(&waiting_mutex);
   if(result != 0) {
     log_errno("could not lock the ready mutex to signal shutdown", result);
     return -1;
@@ -595,10 +3538,21 @@ int stop_logger() {
   free(worker_status);
 
   // In case there are messages that have not been handled by the worker thread
-  print_log_msgs(&waiting);
-  
-  dispose_log_queue(&waiting);
-  dispose_log_queue(&ready);
+  if(waiting.head != NULL && dispatch_log_msgs(&waiting, NULL, false, true) != LOG_STATUS_OK) {
+    fputs("could not print remaining log messages\n", stderr);
+  }
+
+  unsigned long counts[LOG_LEVEL_COUNT];
+  if(take_dropped_counts(counts)) {
+    fprintf(stderr, "log queue full, dropped %lu debug, %lu info, %lu warning and %lu error messages\n",
+	    counts[LOG_LEVEL_DEBUG], counts[LOG_LEVEL_INFO], counts[LOG_LEVEL_WARNING], counts[LOG_LEVEL_ERROR]);
+  }
+
+  atomic_store_explicit(&binary_capture, false, memory_order_relaxed);
+  remove_log_sinks(log_sink_count);
+  pthread_cond_destroy(&waiting_cond);
+  init_log_queue(&waiting);
+  dispose_log_msg_pool();
 
   return 0;
 }
@@ -13,8 +13,38 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include "log_file.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 
+/**
+ * The minimum log level compiled into the program, as the numeric value of enum log_level
+ * Log statements below this level are removed by the compiler, e.g. -DLOG_COMPILED_MIN_LEVEL=1 removes debug messages
+ */
+#ifndef LOG_COMPILED_MIN_LEVEL
+#define LOG_COMPILED_MIN_LEVEL 0
+#endif
+
+/**
+ * The module the log statements of a source file belong to
+ * Define before including any header to group the log statements of a file under a module name
+ */
+#ifndef LOG_MODULE
+#define LOG_MODULE __FILE__
+#endif
+
+/**
+ * The maximum number of modules with their own log level
+ */
+#define MAX_LOG_MODULES 64
+
+/**
+ * The maximum length of a module name
+ */
+#define MAX_LOG_MODULE_NAME_LENGTH 128
+
 /**
  * Log levels
  */
@@ -40,14 +70,280 @@ enum log_level {
   LOG_LEVEL_ERROR
 };
 
+/**
+ * The default maximum number of messages waiting to be written
+ */
+#define DEFAULT_LOG_QUEUE_CAPACITY 4096
+
+/**
+ * The maximum number of sinks
+ */
+#define MAX_LOG_SINKS 8
+
+/**
+ * The default maximum number of batches of messages waiting for a sink
+ */
+#define DEFAULT_LOG_SINK_QUEUE_CAPACITY 64
+
+/**
+ * The default time in milliseconds a sink may hold messages before writing them, errors are written immediately
+ */
+#define DEFAULT_LOG_SINK_FLUSH_INTERVAL_MS 100
+
+/**
+ * The default size in bytes of the memory of a ring sink
+ */
+#define DEFAULT_LOG_RING_SIZE (1024 * 1024)
+
+/**
+ * What to do with a message when the queue of waiting messages is full
+ */
+enum log_overflow_policy {
+  /**
+   * Block the thread logging the message until there is room
+   */
+  LOG_OVERFLOW_BLOCK,
+
+  /**
+   * Drop the new message
+   */
+  LOG_OVERFLOW_DROP_NEWEST,
+
+  /**
+   * Drop the oldest waiting message
+   */
+  LOG_OVERFLOW_DROP_OLDEST,
+
+  /**
+   * Drop the new message if it is below the drop level, otherwise the oldest waiting message below the drop level
+   * If no such message is waiting, the new message is dropped
+   */
+  LOG_OVERFLOW_DROP_BELOW_LEVEL
+};
+
+/**
+ * The state of a log statement
+ */
+enum log_site_state {
+  /**
+   * The statement has not been executed yet
+   */
+  LOG_SITE_UNREGISTERED,
+
+  /**
+   * The statement is below the log level of its module
+   */
+  LOG_SITE_DISABLED,
+
+  /**
+   * The statement is below the log level of its module, its messages are kept in the flight recorder
+   */
+  LOG_SITE_RECORDED,
+
+  /**
+   * The statement is at or above the log level of its module
+   */
+  LOG_SITE_ENABLED
+};
+
+/**
+ * A log statement, statically allocated by the log macros
+ */
+struct log_site {
+  /**
+   * The module of the statement
+   */
+  const char * module;
+
+  /**
+   * The file of the statement
+   */
+  const char * file;
+
+  /**
+   * The line of the statement
+   */
+  int line;
+
+  /**
+   * The log level of the statement
+   */
+  enum log_level level;
+
+  /**
+   * Only one in this many executions of the statement is logged, 0 or 1 to log all of them
+   */
+  unsigned int every;
+
+  /**
+   * The maximum number of messages logged per second, or 0 for no limit
+   */
+  unsigned int per_second;
+
+  /**
+   * The cached state of the statement, updated whenever module log levels change
+   */
+  atomic_int state;
+
+  /**
+   * The number of executions of the statement, used for sampling
+   */
+  atomic_uint count;
+
+  /**
+   * The second of the current rate limiting window
+   */
+  atomic_long window;
+
+  /**
+   * The number of executions of the statement in the current rate limiting window
+   */
+  atomic_uint window_count;
+
+  /**
+   * The number of messages suppressed since the last logged message
+   */
+  atomic_uint suppressed;
+
+  /**
+   * The ID of the statement in binary logs, assigned on registration, 0 if the statement has none
+   */
+  atomic_uint id;
+
+  /**
+   * The next registered statement
+   */
+  struct log_site * next;
+};
+
+/**
+ * Initializer for a log statement at the current line
+ */
+#define LOG_SITE_INITIALIZER(level, every, per_second) { LOG_MODULE, __FILE__, __LINE__, level, every, per_second, LOG_SITE_UNREGISTERED, 0, 0, 0, 0, 0, NULL }
+
+/**
+ * Where a sink writes its messages
+ */
+enum log_sink_type {
+  /**
+   * A stdio stream such as stderr, written through its file descriptor
+   */
+  LOG_SINK_STREAM,
+
+  /**
+   * A log file rotated by size and age
+   */
+  LOG_SINK_FILE,
+
+  /**
+   * A ring in memory keeping the most recent text, see read_log_ring
+   */
+  LOG_SINK_RING
+};
+
+/**
+ * The configuration of a sink
+ */
+struct log_sink_options {
+  /**
+   * Where the sink writes its messages
+   */
+  enum log_sink_type type;
+
+  /**
+   * The minimum log level of the messages written to the sink
+   */
+  enum log_level level;
+
+  /**
+   * The stream of a stream sink
+   */
+  FILE * stream;
+
+  /**
+   * The log file options of a file sink, which also select the format
+   */
+  struct log_file_options file;
+
+  /**
+   * The size in bytes of the memory of a ring sink
+   */
+  size_t ring_size;
+
+  /**
+   * How long the sink may hold messages before writing them, in milliseconds, 0 to write every batch immediately
+   */
+  unsigned int flush_interval_ms;
+
+  /**
+   * The maximum number of batches waiting for the sink, further batches are dropped for this sink only
+   */
+  size_t queue_capacity;
+};
+
+/**
+ * Initializes sink options with the defaults
+ * \param options the options
+ * \param type where the sink writes its messages
+ * \param level the minimum log level of the messages written to the sink
+ */
+void init_log_sink_options(struct log_sink_options * options, enum log_sink_type type, enum log_level level);
+
+/**
+ * Adds a sink, should be called before the logger is started
+ * Each sink has its own thread and queue, a sink that falls behind drops messages without holding back the others.
+ * Messages are captured once, rendered once per format and shared between the sinks, only one sink can use the binary format
+ * \param options the sink options
+ * \return the index of the sink or -1 on error
+ */
+int add_log_sink(const struct log_sink_options * options);
+
+/**
+ * Starts the logging subsystem writing to the added sinks
+ * \return 0 on success, -1 on error
+ */
+int start_sink_logger();
+
+/**
+ * Copies the contents of a ring sink while the logger is running, oldest first
+ * \param index the index of the sink
+ * \param dest the destination buffer
+ * \param size the size of the destination buffer
+ * \return the number of bytes copied, the most recent text is kept if the buffer is too small
+ */
+size_t read_log_ring(int index, char * dest, size_t size);
+
 /**
  * Starts the logging subsystem
+ * Adds a sink for the output to the sinks added before
  * \param output the output file
  * \param min_log_level the minimum log level of messages to display
  * \return 0 on success, -1 on error
  */
 int start_logger(FILE * output, enum log_level min_log_level);
 
+/**
+ * Starts the logging subsystem writing to a file that is rotated by size and age
+ * Adds a sink for the file to the sinks added before
+ * The file is written, rotated and synced by the sink thread, never by the threads logging messages
+ * With LOG_FORMAT_BINARY, the arguments of log statements are copied rather than formatted, see log_decode
+ * \param options the log file options
+ * \param min_log_level the minimum log level of messages to display
+ * \return 0 on success, -1 on error
+ */
+int start_file_logger(const struct log_file_options * options, enum log_level min_log_level);
+
+/**
+ * Configures the queue of messages waiting to be written, should be called before the logger is started
+ * By default the queue holds DEFAULT_LOG_QUEUE_CAPACITY messages and drops new messages when full
+ * Dropped messages are counted per log level and reported periodically
+ * \param capacity the maximum number of waiting messages, at least 1
+ * \param policy what to do with a message when the queue is full
+ * \param drop_level the level below which messages are dropped for LOG_OVERFLOW_DROP_BELOW_LEVEL
+ * \return 0 on success, -1 on error
+ */
+int set_log_queue_policy(size_t capacity, enum log_overflow_policy policy, enum log_level drop_level);
+
 /**
  * Logs a message
  * \param level the log level of the message
@@ -60,21 +356,111 @@ int start_logger(FILE * output, enum log_level min_log_level);
 int log_message(enum log_level level, const char * file, int line, const char * format, ...);
 
 /**
- * Fetches the minimum log level for messages to display
+ * Logs a message for a log statement that has been found to be enabled and admitted
+ * The number of messages suppressed by rate limiting or sampling since the last one is appended
+ * \param site the log statement
+ * \param format the format string
+ * \param ... the arguments
+ * \return 0 on success, -1 on error
+ */
+int log_site_message(struct log_site * site, const char * format, ...);
+
+/**
+ * Decides whether an execution of a sampled log statement is logged, counting it as suppressed otherwise
+ * \param site the log statement
+ * \param every only one in this many executions is logged
+ * \return true if the message should be logged, false otherwise
+ */
+bool sample_log_site(struct log_site * site, unsigned int every);
+
+/**
+ * Decides whether an execution of a rate limited log statement is logged, counting it as suppressed otherwise
+ * \param site the log statement
+ * \param per_second the maximum number of messages logged per second
+ * \return true if the message should be logged, false otherwise
+ */
+bool limit_log_site(struct log_site * site, unsigned int per_second);
+
+/**
+ * Registers a log statement on its first execution and caches whether it is enabled
+ * \param site the log statement
+ * \return the state of the statement, LOG_SITE_UNREGISTERED if it could not be registered
+ */
+int register_log_site(struct log_site * site);
+
+/**
+ * Keeps a message of a log statement below the log level in the flight recorder of the calling thread
+ * The arguments are stored unformatted, the message is only formatted if the recorder is dumped
+ * \param site the log statement
+ * \param format the format string
+ */
+void record_log_site(struct log_site * site, const char * format, ...);
+
+/**
+ * Enables or disables the flight recorder
+ * Each thread keeps its most recent debug and info messages that are below the log level in a ring of this many slots.
+ * The ring of a thread is written out, before the message itself, when the thread logs an error
+ * or when it receives a fatal signal, see install_log_crash_handler
+ * \param slots the number of slots per thread, 0 to disable the recorder
+ * \return 0 on success, -1 on error
+ */
+int set_log_flight_recorder(size_t slots);
+
+/**
+ * Installs handlers for fatal signals that write out the flight recorder of the crashing thread
+ * The handlers reset the default action and raise the signal again
+ * \return 0 on success, -1 on error
+ */
+int install_log_crash_handler();
+
+/**
+ * Fetches the minimum log level for messages to display, used for modules without their own log level
  * \return the minimum log level
  */
 enum log_level get_min_log_level();
 
+/**
+ * Sets the minimum log level for the messages of a module and updates the registered log statements
+ * \param module the module name
+ * \param level the minimum log level
+ * \return 0 on success, -1 on error
+ */
+int set_log_module_level(const char * module, enum log_level level);
+
 /**
  * Stops the logging subsystem
  * \return 0 on success, -1 on error
  */
 int stop_logger();
 
+/**
+ * A convenience macro to log a message on this line, sampled and rate limited
+ * Compiled out below LOG_COMPILED_MIN_LEVEL, otherwise checks the cached state of the statement
+ * Messages below the log level go to the flight recorder when it is enabled, without sampling
+ * The sampling and rate limiting checks are compiled out when every and per_second are constants of 1 and 0
+ */
+#define LOG_LIMITED_MESSAGE(level, every, per_second, ...)		\
+  do {									\
+    if((level) >= LOG_COMPILED_MIN_LEVEL) {				\
+      static struct log_site log_site_ = LOG_SITE_INITIALIZER(level, every, per_second); \
+      int log_site_state_ = atomic_load_explicit(&log_site_.state, memory_order_relaxed); \
+      if(log_site_state_ == LOG_SITE_UNREGISTERED) {			\
+	log_site_state_ = register_log_site(&log_site_);		\
+      }									\
+      if(log_site_state_ == LOG_SITE_ENABLED) {				\
+	if(((every) <= 1 || sample_log_site(&log_site_, every)) && ((per_second) == 0 || limit_log_site(&log_site_, per_second))) { \
+	  log_site_message(&log_site_, __VA_ARGS__);			\
+	}								\
+      } else if(log_site_state_ == LOG_SITE_RECORDED) {			\
+	record_log_site(&log_site_, __VA_ARGS__);			\
+      }									\
+    }									\
+  } while(0)
+
 /**
  * A convenience macro to log a message on this line
  */
-#define LOG_MESSAGE(level, ...) if(get_min_log_level() <= level) log_message(level, __FILE__, __LINE__, __VA_ARGS__)
+#define LOG_MESSAGE(level, ...) LOG_LIMITED_MESSAGE(level, 1, 0, __VA_ARGS__)
 
 /**
  * A convenience macro to log a debug message on this line
@@ -82,7 +468,7 @@ int stop_logger();
 #define LOG_DEBUG(...) LOG_MESSAGE(LOG_LEVEL_DEBUG, __VA_ARGS__)
 
 /**
- * A convenience macro to log a debug message on this line
+ * A convenience macro to log an info message on this line
  */
 #define LOG_INFO(...) LOG_MESSAGE(LOG_LEVEL_INFO, __VA_ARGS__)
 
@@ -96,5 +482,45 @@ int stop_logger();
  */
 #define LOG_ERROR(...) LOG_MESSAGE(LOG_LEVEL_ERROR, __VA_ARGS__)
 
+/**
+ * A convenience macro to log one in n executions of a debug message on this line
+ */
+#define LOG_DEBUG_EVERY_N(n, ...) LOG_LIMITED_MESSAGE(LOG_LEVEL_DEBUG, n, 0, __VA_ARGS__)
+
+/**
+ * A convenience macro to log one in n executions of an info message on this line
+ */
+#define LOG_INFO_EVERY_N(n, ...) LOG_LIMITED_MESSAGE(LOG_LEVEL_INFO, n, 0, __VA_ARGS__)
+
+/**
+ * A convenience macro to log one in n executions of a warning message on this line
+ */
+#define LOG_WARNING_EVERY_N(n, ...) LOG_LIMITED_MESSAGE(LOG_LEVEL_WARNING, n, 0, __VA_ARGS__)
+
+/**
+ * A convenience macro to log one in n executions of an error message on this line
+ */
+#define LOG_ERROR_EVERY_N(n, ...) LOG_LIMITED_MESSAGE(LOG_LEVEL_ERROR, n, 0, __VA_ARGS__)
+
+/**
+ * A convenience macro to log at most n debug messages per second on this line
+ */
+#define LOG_DEBUG_PER_SECOND(n, ...) LOG_LIMITED_MESSAGE(LOG_LEVEL_DEBUG, 1, n, __VA_ARGS__)
+
+/**
+ * A convenience macro to log at most n info messages per second on this line
+ */
+#define LOG_INFO_PER_SECOND(n, ...) LOG_LIMITED_MESSAGE(LOG_LEVEL_INFO, 1, n, __VA_ARGS__)
+
+/**
+ * A convenience macro to log at most n warning messages per second on this line
+ */
+#define LOG_WARNING_PER_SECOND(n, ...) LOG_LIMITED_MESSAGE(LOG_LEVEL_WARNING, 1, n, __VA_ARGS__)
+
+/**
+ * A convenience macro to log at most n error messages per second on this line
+ */
+#define LOG_ERROR_PER_SECOND(n, ...) LOG_LIMITED_MESSAGE(LOG_LEVEL_ERROR, 1, n, __VA_ARGS__)
+
 
 #endif
@@ -0,0 +1,442 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+/*
+ * Measures the cost of log_message under contention
+ * Usage: logger_bench [-t THREADS] [-n MESSAGES] [-o FILE] [-q CAPACITY] [-d]
+ * Each run starts the logger, lets the producer threads log their messages and stops the logger,
+ * once with the messages at the minimum log level and once with them filtered out
+ * Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc to count allocations
+ * Only start_logger, log_message and stop_logger are needed, so the benchmark also builds against the logger
+ * from before the waiting queue was bounded, -q and -d are only available with a bounded queue
+ */
+
+#include "logger.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/**
+ * The number of bits of the sub-bucket index of the latency histograms, which gives about two significant digits
+ */
+#define LATENCY_SUB_BUCKET_BITS 7
+
+/**
+ * The number of sub-buckets per power of two
+ */
+#define LATENCY_SUB_BUCKET_COUNT (1 << LATENCY_SUB_BUCKET_BITS)
+
+/**
+ * The number of buckets, enough for any 64 bit latency in nanoseconds
+ */
+#define LATENCY_BUCKET_COUNT (64 - LATENCY_SUB_BUCKET_BITS + 1)
+
+/**
+ * The default number of producer threads
+ */
+#define DEFAULT_BENCH_THREADS 4
+
+/**
+ * The default number of messages per producer thread
+ */
+#define DEFAULT_BENCH_MESSAGES 200000
+
+#ifdef DEFAULT_LOG_QUEUE_CAPACITY
+/**
+ * The options of the benchmark, with those of the bounded waiting queue
+ */
+#define BENCH_OPTIONS "t:n:o:q:d"
+
+/**
+ * The usage of the benchmark, with the options of the bounded waiting queue
+ */
+#define BENCH_USAGE "[-t THREADS] [-n MESSAGES] [-o FILE] [-q CAPACITY] [-d]"
+#else
+/**
+ * The options of the benchmark
+ */
+#define BENCH_OPTIONS "t:n:o:"
+
+/**
+ * The usage of the benchmark
+ */
+#define BENCH_USAGE "[-t THREADS] [-n MESSAGES] [-o FILE]"
+#endif
+
+/**
+ * A histogram of latencies in nanoseconds with logarithmic buckets and linear sub-buckets
+ */
+struct latency_histogram {
+  /**
+   * The number of values per sub-bucket, the first bucket holds the values below LATENCY_SUB_BUCKET_COUNT
+   */
+  uint64_t counts[LATENCY_BUCKET_COUNT][LATENCY_SUB_BUCKET_COUNT];
+
+  /**
+   * The number of values
+   */
+  uint64_t total;
+
+  /**
+   * The largest value
+   */
+  uint64_t max;
+};
+
+/**
+ * The configuration of a benchmark run
+ */
+struct bench_options {
+  /**
+   * The number of producer threads
+   */
+  int threads;
+
+  /**
+   * The number of messages per producer thread
+   */
+  long messages;
+
+  /**
+   * The log file or NULL to write to /dev/null
+   */
+  const char * path;
+
+#ifdef DEFAULT_LOG_QUEUE_CAPACITY
+  /**
+   * The capacity of the waiting queue
+   */
+  size_t capacity;
+
+  /**
+   * The overflow policy of the waiting queue
+   */
+  enum log_overflow_policy policy;
+#endif
+};
+
+/**
+ * The state of a producer thread
+ */
+struct bench_producer {
+  /**
+   * The index of the thread
+   */
+  long index;
+
+  /**
+   * The number of messages to log
+   */
+  long messages;
+
+  /**
+   * The log level of the messages
+   */
+  enum log_level level;
+
+  /**
+   * The call latencies
+   */
+  struct latency_histogram * histogram;
+};
+
+/**
+ * The number of allocations made by the process
+ */
+static atomic_ulong allocations;
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t count, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+
+void * __wrap_malloc(size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t count, size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __real_calloc(count, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __real_realloc(ptr, size);
+}
+
+/**
+ * Reads the monotonic clock
+ * \return the time in nanoseconds
+ */
+static uint64_t read_bench_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Records a latency in a histogram
+ * \param h the histogram
+ * \param value the latency in nanoseconds
+ */
+static void record_latency(struct latency_histogram * h, uint64_t value) {
+  if(value < LATENCY_SUB_BUCKET_COUNT) {
+    ++h->counts[0][value];
+  } else {
+    int bucket = 63 - __builtin_clzll(value) - (LATENCY_SUB_BUCKET_BITS - 1);
+    ++h->counts[bucket][value >> bucket];
+  }
+  ++h->total;
+  if(value > h->max) {
+    h->max = value;
+  }
+}
+
+/**
+ * Adds the values of a histogram to another
+ * \param dest the destination histogram
+ * \param src the source histogram
+ */
+static void merge_latency_histogram(struct latency_histogram * dest, const struct latency_histogram * src) {
+  for(int i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+    for(int j = 0; j < LATENCY_SUB_BUCKET_COUNT; ++j) {
+      dest->counts[i][j] += src->counts[i][j];
+    }
+  }
+  dest->total += src->total;
+  if(src->max > dest->max) {
+    dest->max = src->max;
+  }
+}
+
+/**
+ * Finds the latency at a percentile
+ * \param h the histogram
+ * \param percentile the percentile, between 0 and 100
+ * \return the upper bound of the sub-bucket holding the percentile
+ */
+static uint64_t get_latency_percentile(const struct latency_histogram * h, double percentile) {
+  uint64_t rank = (uint64_t) (percentile / 100.0 * (double) h->total + 0.5);
+  if(rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for(int i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+    for(int j = 0; j < LATENCY_SUB_BUCKET_COUNT; ++j) {
+      seen += h->counts[i][j];
+      if(seen >= rank) {
+	uint64_t bound = ((uint64_t) (j + 1) << i) - 1;
+	return bound < h->max ? bound : h->max;
+      }
+    }
+  }
+  return h->max;
+}
+
+/**
+ * Logs messages with format strings and arguments typical for the application
+ * \param arg the producer state
+ * \return NULL
+ */
+static void * run_bench_producer(void * arg) {
+  struct bench_producer * p = (struct bench_producer *) arg;
+  static const char * hosts[] = { "10.0.0.1", "db-replica-2.internal", "localhost" };
+
+  for(long i = 0; i < p->messages; ++i) {
+    uint64_t start = read_bench_clock();
+    switch(i & 3) {
+    case 0:
+      log_message(p->level, __FILE__, __LINE__, "request %ld from %s took %.3f ms", i, hosts[i % 3], (double) (i % 1000) / 7.0);
+      break;
+    case 1:
+      log_message(p->level, __FILE__, __LINE__, "cache miss for key user:%ld:profile in shard %d", i * 31, (int) (i % 16));
+      break;
+    case 2:
+      log_message(p->level, __FILE__, __LINE__, "processed %zu rows in batch %ld of thread %ld", (size_t) (i % 4096), i, p->index);
+      break;
+    default:
+      log_message(p->level, __FILE__, __LINE__, "connection %s:%d closed after %ld bytes", hosts[i % 3], 5432, i * 1024);
+      break;
+    }
+    record_latency(p->histogram, read_bench_clock() - start);
+  }
+  return NULL;
+}
+
+/**
+ * Runs the producers against a freshly started logger and reports the results
+ * \param options the configuration
+ * \param name the name of the run
+ * \param min_log_level the minimum log level of the logger
+ * \param level the log level of the messages
+ * \return 0 on success, -1 on error
+ */
+static int run_bench(const struct bench_options * options, const char * name, enum log_level min_log_level, enum log_level level) {
+  struct bench_producer * producers = calloc((size_t) options->threads, sizeof(struct bench_producer));
+  pthread_t * threads = calloc((size_t) options->threads, sizeof(pthread_t));
+  struct latency_histogram * total = calloc(1, sizeof(struct latency_histogram));
+  if(producers == NULL || threads == NULL || total == NULL) {
+    fputs("could not allocate benchmark state\n", stderr);
+    free(producers);
+    free(threads);
+    free(total);
+    return -1;
+  }
+  int result = 0;
+  for(int i = 0; i < options->threads; ++i) {
+    producers[i].index = i;
+    producers[i].messages = options->messages;
+    producers[i].level = level;
+    producers[i].histogram = calloc(1, sizeof(struct latency_histogram));
+    if(producers[i].histogram == NULL) {
+      fputs("could not allocate histogram\n", stderr);
+      result = -1;
+    }
+  }
+
+  FILE * output = NULL;
+  if(result == 0) {
+    output = fopen(options->path != NULL ? options->path : "/dev/null", "w");
+    if(output == NULL) {
+      perror("could not open output");
+      result = -1;
+    }
+  }
+#ifdef DEFAULT_LOG_QUEUE_CAPACITY
+  if(result == 0 && set_log_queue_policy(options->capacity, options->policy, LOG_LEVEL_WARNING) != 0) {
+    fputs("invalid queue policy\n", stderr);
+    result = -1;
+  }
+#endif
+  if(result != 0 || start_logger(output, min_log_level) != 0) {
+    if(output != NULL) {
+      fclose(output);
+    }
+    for(int i = 0; i < options->threads; ++i) {
+      free(producers[i].histogram);
+    }
+    free(producers);
+    free(threads);
+    free(total);
+    return -1;
+  }
+
+  unsigned long allocations_before = atomic_load(&allocations);
+  uint64_t start = read_bench_clock();
+  int started = 0;
+  while(started < options->threads && pthread_create(&threads[started], NULL, run_bench_producer, &producers[started]) == 0) {
+    ++started;
+  }
+  for(int i = 0; i < started; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  uint64_t produced = read_bench_clock();
+  // Stopping the logger drains the queue, so the elapsed time covers writing every message
+  result = stop_logger();
+  uint64_t drained = read_bench_clock();
+  fclose(output);
+  unsigned long allocations_after = atomic_load(&allocations);
+
+  for(int i = 0; i < started; ++i) {
+    merge_latency_histogram(total, producers[i].histogram);
+  }
+  double messages = (double) options->messages * started;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("%s: %d threads, %.0f messages\n", name, started, messages);
+  printf("  call latency ns: p50 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+	 (unsigned long long) get_latency_percentile(total, 50.0),
+	 (unsigned long long) get_latency_percentile(total, 99.0),
+	 (unsigned long long) get_latency_percentile(total, 99.9),
+	 (unsigned long long) total->max);
+  printf("  produced %.0f messages/s, drained %.0f messages/s\n",
+	 messages / ((double) (produced - start) / 1e9), messages / ((double) (drained - start) / 1e9));
+  printf("  %.3f allocations per message, peak RSS %ld KiB\n",
+	 (double) (allocations_after - allocations_before) / messages, usage.ru_maxrss);
+
+  for(int i = 0; i < options->threads; ++i) {
+    free(producers[i].histogram);
+  }
+  free(producers);
+  free(threads);
+  free(total);
+  return started == options->threads && result == 0 ? 0 : -1;
+}
+
+/**
+ * The main entry point of the benchmark
+ */
+int main(int arg_count, char * args[]) {
+  struct bench_options options;
+  options.threads = DEFAULT_BENCH_THREADS;
+  options.messages = DEFAULT_BENCH_MESSAGES;
+  options.path = NULL;
+#ifdef DEFAULT_LOG_QUEUE_CAPACITY
+  options.capacity = DEFAULT_LOG_QUEUE_CAPACITY;
+  options.policy = LOG_OVERFLOW_BLOCK;
+#endif
+
+  int option;
+  while((option = getopt(arg_count, args, BENCH_OPTIONS)) != -1) {
+    switch(option) {
+    case 't':
+      options.threads = atoi(optarg);
+      break;
+    case 'n':
+      options.messages = atol(optarg);
+      break;
+    case 'o':
+      options.path = optarg;
+      break;
+#ifdef DEFAULT_LOG_QUEUE_CAPACITY
+    case 'q':
+      options.capacity = (size_t) atol(optarg);
+      break;
+    case 'd':
+      // Measures the producers alone, the worker drops what it can not keep up with
+      options.policy = LOG_OVERFLOW_DROP_NEWEST;
+      break;
+#endif
+    default:
+      fprintf(stderr, "usage: %s " BENCH_USAGE "\n", args[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if(options.threads <= 0 || options.messages <= 0) {
+    fputs("threads and messages must be positive\n", stderr);
+    return EXIT_FAILURE;
+  }
+#ifdef DEFAULT_LOG_QUEUE_CAPACITY
+  if(options.capacity == 0) {
+    fputs("capacity must be positive\n", stderr);
+    return EXIT_FAILURE;
+  }
+#endif
+
+  if(run_bench(&options, "enabled", LOG_LEVEL_DEBUG, LOG_LEVEL_INFO) != 0) {
+    return EXIT_FAILURE;
+  }
+  if(run_bench(&options, "filtered", LOG_LEVEL_WARNING, LOG_LEVEL_INFO) != 0) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,2168 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "lsm"
+
+#include "lsm.h"
+#include "bloom.h"
+#include "logger.h"
+#include "wal.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * The permissions of newly created files
+ */
+#define LSM_FILE_MODE 0644
+
+/**
+ * The permissions of a newly created directory
+ */
+#define LSM_DIRECTORY_MODE 0755
+
+/**
+ * The name of the file listing the runs of the levels
+ */
+#define LSM_MANIFEST_FILE_NAME "MANIFEST"
+
+/**
+ * The name of the manifest being written, renamed over the manifest once complete
+ */
+#define LSM_MANIFEST_TEMP_FILE_NAME "MANIFEST.tmp"
+
+/**
+ * The suffix of the run files
+ */
+#define LSM_RUN_FILE_SUFFIX ".run"
+
+/**
+ * The suffix of the write-ahead logs of the memtables
+ */
+#define LSM_LOG_FILE_SUFFIX ".wal"
+
+/**
+ * The magic number at the start of the manifest
+ */
+#define LSM_MANIFEST_MAGIC "DBLSMMF\1"
+
+/**
+ * The magic number at the end of a run
+ */
+#define LSM_RUN_MAGIC "DBLSMRN\1"
+
+/**
+ * The length of the magic numbers
+ */
+#define LSM_MAGIC_LENGTH 8
+
+/**
+ * The size of the chunks of memory the nodes of a memtable are allocated from
+ */
+#define LSM_ARENA_CHUNK_SIZE (256 * 1024)
+
+/**
+ * The maximum height of the skiplist of a memtable
+ */
+#define LSM_SKIPLIST_HEIGHT 12
+
+/**
+ * Marks a deleted key in the value length of an entry of a run
+ */
+#define LSM_TOMBSTONE 0x80000000u
+
+/**
+ * The size of the header of an entry of a run, its key and value lengths
+ */
+#define LSM_ENTRY_HEADER_SIZE (2 * sizeof(uint32_t))
+
+/**
+ * The size of the header of a write-ahead log record, the tombstone flag and the key length
+ */
+#define LSM_RECORD_HEADER_SIZE (1 + sizeof(uint32_t))
+
+/**
+ * The size of the records assembled on the stack, larger ones are allocated
+ */
+#define LSM_RECORD_STACK_SIZE 4096
+
+/**
+ * An entry of a memtable, in a skiplist ordered by key
+ */
+struct lsm_node {
+  /**
+   * The bytes of the key
+   */
+  const char * key;
+
+  /**
+   * The bytes of the latest value
+   */
+  const char * value;
+
+  /**
+   * The length of the key
+   */
+  uint32_t key_len;
+
+  /**
+   * The length of the value
+   */
+  uint32_t value_len;
+
+  /**
+   * Whether the key was deleted
+   */
+  bool tombstone;
+
+  /**
+   * The number of levels the node is linked in
+   */
+  uint8_t height;
+
+  /**
+   * The next node in each level
+   */
+  struct lsm_node * next[];
+};
+
+/**
+ * A chunk of memory of a memtable
+ */
+struct lsm_arena_chunk {
+  /**
+   * The previously allocated chunk
+   */
+  struct lsm_arena_chunk * next;
+
+  /**
+   * The number of bytes used
+   */
+  size_t used;
+
+  /**
+   * The number of bytes of the chunk
+   */
+  size_t size;
+
+  /**
+   * The bytes
+   */
+  char data[];
+};
+
+/**
+ * The sorted in-memory table receiving the writes, with the write-ahead log making them durable
+ */
+struct lsm_memtable {
+  /**
+   * The chunks the nodes are allocated from, the current one first
+   */
+  struct lsm_arena_chunk * chunks;
+
+  /**
+   * The sentinel node before the first key, of LSM_SKIPLIST_HEIGHT levels
+   */
+  struct lsm_node * head;
+
+  /**
+   * The height of the tallest node
+   */
+  int height;
+
+  /**
+   * The state of the generator of node heights
+   */
+  uint64_t random;
+
+  /**
+   * The number of bytes allocated for the entries
+   */
+  size_t size;
+
+  /**
+   * The number of keys
+   */
+  size_t count;
+
+  /**
+   * The number of the write-ahead log, or 0 without one
+   */
+  uint64_t number;
+
+  /**
+   * The write-ahead log
+   */
+  struct wal wal;
+
+  /**
+   * The number of writes waiting for the write-ahead log to sync
+   */
+  size_t writers;
+};
+
+/**
+ * A block of a run in the block index
+ */
+struct lsm_block {
+  /**
+   * The offset of the block in the file
+   */
+  uint64_t offset;
+
+  /**
+   * The length of the block
+   */
+  uint32_t len;
+
+  /**
+   * The length of the last key of the block
+   */
+  uint32_t key_len;
+
+  /**
+   * The last key of the block
+   */
+  const char * key;
+};
+
+/**
+ * An immutable sorted run of entries in a file
+ */
+struct lsm_run {
+  /**
+   * The number of the file
+   */
+  uint64_t number;
+
+  /**
+   * The path of the file
+   */
+  char path[MAX_LSM_PATH_LENGTH];
+
+  /**
+   * The file descriptor
+   */
+  int fd;
+
+  /**
+   * The size of the file
+   */
+  uint64_t size;
+
+  /**
+   * The number of entries
+   */
+  uint64_t entry_count;
+
+  /**
+   * The block index
+   */
+  struct lsm_block * blocks;
+
+  /**
+   * The number of blocks
+   */
+  size_t block_count;
+
+  /**
+   * The bytes of the block index, holding the last keys
+   */
+  char * index;
+
+  /**
+   * The Bloom filter of the keys
+   */
+  struct bloom_filter bloom;
+
+  /**
+   * The number of versions holding the run
+   */
+  size_t refs;
+
+  /**
+   * Whether the run was compacted away, its file is removed with the last reference
+   */
+  bool obsolete;
+};
+
+/**
+ * The runs of the levels at a point in time, kept alive by the readers using it
+ */
+struct lsm_version {
+  /**
+   * The number of references, from the tree and from readers
+   */
+  size_t refs;
+
+  /**
+   * The runs of level 0, newest first, whose keys overlap
+   */
+  struct lsm_run * level0[MAX_LSM_LEVEL0_RUNS];
+
+  /**
+   * The number of runs in level 0
+   */
+  size_t level0_count;
+
+  /**
+   * The run of each deeper level, or NULL, level 0 is unused
+   */
+  struct lsm_run * levels[LSM_LEVEL_COUNT];
+};
+
+/**
+ * The footer at the end of a run
+ */
+struct lsm_run_footer {
+  /**
+   * The offset of the block index
+   */
+  uint64_t index_offset;
+
+  /**
+   * The length of the block index
+   */
+  uint64_t index_len;
+
+  /**
+   * The offset of the bits of the Bloom filter
+   */
+  uint64_t bloom_offset;
+
+  /**
+   * The number of bytes of the bits of the Bloom filter
+   */
+  uint64_t bloom_size;
+
+  /**
+   * The number of entries
+   */
+  uint64_t entry_count;
+
+  /**
+   * The number of bits set per key in the Bloom filter
+   */
+  uint32_t hash_count;
+
+  /**
+   * The number of blocks
+   */
+  uint32_t block_count;
+
+  /**
+   * LSM_RUN_MAGIC
+   */
+  char magic[LSM_MAGIC_LENGTH];
+};
+
+/**
+ * An entry read from a memtable or a run
+ */
+struct lsm_entry {
+  /**
+   * The bytes of the key
+   */
+  const char * key;
+
+  /**
+   * The length of the key
+   */
+  size_t key_len;
+
+  /**
+   * The bytes of the value
+   */
+  const char * value;
+
+  /**
+   * The length of the value
+   */
+  size_t value_len;
+
+  /**
+   * Whether the key was deleted
+   */
+  bool tombstone;
+};
+
+/**
+ * The state of the writing of a run
+ */
+struct lsm_run_writer {
+  /**
+   * The path of the file
+   */
+  char path[MAX_LSM_PATH_LENGTH];
+
+  /**
+   * The file descriptor
+   */
+  int fd;
+
+  /**
+   * The block being filled
+   */
+  char * block;
+
+  /**
+   * The number of bytes in the block
+   */
+  size_t block_len;
+
+  /**
+   * The size of the block buffer
+   */
+  size_t block_size;
+
+  /**
+   * The number of bytes written to the file
+   */
+  uint64_t offset;
+
+  /**
+   * The block index being built
+   */
+  char * index;
+
+  /**
+   * The length of the block index
+   */
+  size_t index_len;
+
+  /**
+   * The size of the block index buffer
+   */
+  size_t index_size;
+
+  /**
+   * The number of blocks written
+   */
+  uint32_t block_count;
+
+  /**
+   * The Bloom filter of the keys
+   */
+  struct bloom_filter bloom;
+
+  /**
+   * The number of entries
+   */
+  uint64_t entry_count;
+
+  /**
+   * The last key added
+   */
+  char last_key[MAX_LSM_KEY_LENGTH];
+
+  /**
+   * The length of the last key added
+   */
+  size_t last_key_len;
+};
+
+/**
+ * A sequential reader of the entries of a run
+ */
+struct lsm_run_iterator {
+  /**
+   * The run
+   */
+  struct lsm_run * run;
+
+  /**
+   * The index of the next block to read
+   */
+  size_t block;
+
+  /**
+   * The bytes of the current block
+   */
+  char * data;
+
+  /**
+   * The size of the block buffer
+   */
+  size_t size;
+
+  /**
+   * The length of the current block
+   */
+  size_t len;
+
+  /**
+   * The offset of the next entry in the current block
+   */
+  size_t pos;
+
+  /**
+   * The current entry
+   */
+  struct lsm_entry entry;
+
+  /**
+   * Whether there is a current entry
+   */
+  bool valid;
+};
+
+/**
+ * The outcome of looking up a key in a memtable or a run
+ */
+enum lsm_lookup {
+  /**
+   * The key is not there, older data should be searched
+   */
+  LSM_LOOKUP_MISSING,
+
+  /**
+   * The key has a value
+   */
+  LSM_LOOKUP_FOUND,
+
+  /**
+   * The key was deleted
+   */
+  LSM_LOOKUP_DELETED,
+
+  /**
+   * The lookup failed
+   */
+  LSM_LOOKUP_ERROR
+};
+
+/**
+ * Compares two keys, shorter keys sorting before longer keys they are a prefix of
+ * \param a the first key
+ * \param a_len the length of the first key
+ * \param b the second key
+ * \param b_len the length of the second key
+ * \return a negative number, 0 or a positive number if a is before, equal to or after b
+ */
+static int compare_lsm_keys(const char * a, size_t a_len, const char * b, size_t b_len) {
+  size_t len = a_len < b_len ? a_len : b_len;
+  int result = len > 0 ? memcmp(a, b, len) : 0;
+  if(result != 0) {
+    return result;
+  }
+  return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+/**
+ * Builds the path of a file of an LSM tree
+ * \param dest the destination buffer of MAX_LSM_PATH_LENGTH bytes
+ * \param lsm the LSM tree
+ * \param number the number of the file
+ * \param suffix the suffix of the kind of file
+ * \return 0 on success, -1 if the path is too long
+ */
+static int get_lsm_file_path(char * dest, const struct lsm * lsm, uint64_t number, const char * suffix) {
+  int len = snprintf(dest, MAX_LSM_PATH_LENGTH, "%s/%06lu%s", lsm->path, (unsigned long) number, suffix);
+  if(len < 0 || len >= MAX_LSM_PATH_LENGTH) {
+    LOG_ERROR("path too long for file %lu of %s", (unsigned long) number, lsm->path);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Builds the path of a named file of an LSM tree
+ * \param dest the destination buffer of MAX_LSM_PATH_LENGTH bytes
+ * \param lsm the LSM tree
+ * \param name the name of the file
+ * \return 0 on success, -1 if the path is too long
+ */
+static int get_lsm_named_path(char * dest, const struct lsm * lsm, const char * name) {
+  int len = snprintf(dest, MAX_LSM_PATH_LENGTH, "%s/%s", lsm->path, name);
+  if(len < 0 || len >= MAX_LSM_PATH_LENGTH) {
+    LOG_ERROR("path too long for %s of %s", name, lsm->path);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Syncs the directory of an LSM tree, so created, renamed and removed files survive a crash
+ * \param lsm the LSM tree
+ * \return 0 on success, -1 on error
+ */
+static int sync_lsm_directory(const struct lsm * lsm) {
+  int fd = open(lsm->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(fd < 0) {
+    LOG_ERROR("could not open directory %s: %s", lsm->path, strerror(errno));
+    return -1;
+  }
+  int result = fsync(fd);
+  if(result != 0) {
+    LOG_ERROR("could not sync directory %s: %s", lsm->path, strerror(errno));
+  }
+  close(fd);
+  return result;
+}
+
+/**
+ * Allocates memory for a memtable entry
+ * \param m the memtable
+ * \param size the number of bytes
+ * \return the memory, aligned for pointers, or NULL on error
+ */
+static void * allocate_lsm_memory(struct lsm_memtable * m, size_t size) {
+  size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  struct lsm_arena_chunk * c = m->chunks;
+  if(c == NULL || c->size - c->used < size) {
+    size_t chunk_size = size > LSM_ARENA_CHUNK_SIZE ? size : LSM_ARENA_CHUNK_SIZE;
+    c = (struct lsm_arena_chunk *) malloc(sizeof(struct lsm_arena_chunk) + chunk_size);
+    if(c == NULL) {
+      LOG_ERROR("could not allocate memtable memory");
+      return NULL;
+    }
+    c->next = m->chunks;
+    c->used = 0;
+    c->size = chunk_size;
+    m->chunks = c;
+  }
+  void * p = c->data + c->used;
+  c->used += size;
+  m->size += size;
+  return p;
+}
+
+/**
+ * Releases a memtable, whose write-ahead log should be closed
+ * \param m the memtable
+ */
+static void dispose_lsm_memtable(struct lsm_memtable * m) {
+  struct lsm_arena_chunk * c = m->chunks;
+  while(c != NULL) {
+    struct lsm_arena_chunk * next = c->next;
+    free(c);
+    c = next;
+  }
+  free(m);
+}
+
+/**
+ * Creates an empty memtable
+ * \param number the number of the memtable
+ * \return the memtable, or NULL on error
+ */
+static struct lsm_memtable * create_lsm_memtable(uint64_t number) {
+  struct lsm_memtable * m = (struct lsm_memtable *) calloc(1, sizeof(struct lsm_memtable));
+  if(m == NULL) {
+    LOG_ERROR("could not allocate memtable");
+    return NULL;
+  }
+  m->head = (struct lsm_node *) allocate_lsm_memory(m, sizeof(struct lsm_node) + LSM_SKIPLIST_HEIGHT * sizeof(struct lsm_node *));
+  if(m->head == NULL) {
+    dispose_lsm_memtable(m);
+    return NULL;
+  }
+  memset(m->head, 0, sizeof(struct lsm_node) + LSM_SKIPLIST_HEIGHT * sizeof(struct lsm_node *));
+  m->head->height = LSM_SKIPLIST_HEIGHT;
+  m->height = 1;
+  m->random = 0x9e3779b97f4a7c15ull ^ number;
+  m->number = number;
+  return m;
+}
+
+/**
+ * Finds the first node of a memtable whose key is not before a key
+ * \param m the memtable
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param prev the destination for the last node before the key in each level, or NULL
+ * \return the node, or NULL if every key is before the key
+ */
+static struct lsm_node * seek_lsm_memtable(const struct lsm_memtable * m, const char * key, size_t len, struct lsm_node ** prev) {
+  struct lsm_node * node = m->head;
+  for(int level = m->height - 1; level >= 0; --level) {
+    struct lsm_node * next = node->next[level];
+    while(next != NULL && compare_lsm_keys(next->key, next->key_len, key, len) < 0) {
+      node = next;
+      next = node->next[level];
+    }
+    if(prev != NULL) {
+      prev[level] = node;
+    }
+  }
+  return node->next[0];
+}
+
+/**
+ * Sets the value of a key in a memtable
+ * \param m the memtable
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param value the bytes of the value
+ * \param value_len the length of the value
+ * \param tombstone whether the key is deleted
+ * \return 0 on success, -1 on error
+ */
+static int insert_lsm_memtable(struct lsm_memtable * m, const char * key, size_t len, const char * value, size_t value_len, bool tombstone) {
+  struct lsm_node * prev[LSM_SKIPLIST_HEIGHT];
+  struct lsm_node * node = seek_lsm_memtable(m, key, len, prev);
+
+  // Overwriting only replaces the value, the old bytes stay in the arena until the flush
+  if(node != NULL && compare_lsm_keys(node->key, node->key_len, key, len) == 0) {
+    char * copy = NULL;
+    if(value_len > 0) {
+      copy = (char *) allocate_lsm_memory(m, value_len);
+      if(copy == NULL) {
+	return -1;
+      }
+      memcpy(copy, value, value_len);
+    }
+    node->value = copy;
+    node->value_len = (uint32_t) value_len;
+    node->tombstone = tombstone;
+    return 0;
+  }
+
+  int height = 1;
+  while(height < LSM_SKIPLIST_HEIGHT) {
+    m->random ^= m->random << 13;
+    m->random ^= m->random >> 7;
+    m->random ^= m->random << 17;
+    if((m->random & 3) != 0) {
+      break;
+    }
+    ++height;
+  }
+  size_t node_size = sizeof(struct lsm_node) + (size_t) height * sizeof(struct lsm_node *);
+  node = (struct lsm_node *) allocate_lsm_memory(m, node_size + len + value_len);
+  if(node == NULL) {
+    return -1;
+  }
+  char * bytes = (char *) node + node_size;
+  if(len > 0) {
+    memcpy(bytes, key, len);
+  }
+  if(value_len > 0) {
+    memcpy(bytes + len, value, value_len);
+  }
+  node->key = bytes;
+  node->key_len = (uint32_t) len;
+  node->value = bytes + len;
+  node->value_len = (uint32_t) value_len;
+  node->tombstone = tombstone;
+  node->height = (uint8_t) height;
+  for(int level = m->height; level < height; ++level) {
+    prev[level] = m->head;
+  }
+  if(height > m->height) {
+    m->height = height;
+  }
+  for(int level = 0; level < height; ++level) {
+    node->next[level] = prev[level]->next[level];
+    prev[level]->next[level] = node;
+  }
+  ++m->count;
+  return 0;
+}
+
+/**
+ * Looks up a key in a memtable
+ * \param m the memtable
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param entry the destination for the entry
+ * \return LSM_LOOKUP_FOUND, LSM_LOOKUP_DELETED or LSM_LOOKUP_MISSING
+ */
+static enum lsm_lookup find_lsm_memtable_entry(const struct lsm_memtable * m, const char * key, size_t len, struct lsm_entry * entry) {
+  struct lsm_node * node = seek_lsm_memtable(m, key, len, NULL);
+  if(node == NULL || compare_lsm_keys(node->key, node->key_len, key, len) != 0) {
+    return LSM_LOOKUP_MISSING;
+  }
+  entry->key = node->key;
+  entry->key_len = node->key_len;
+  entry->value = node->value;
+  entry->value_len = node->value_len;
+  entry->tombstone = node->tombstone;
+  return node->tombstone ? LSM_LOOKUP_DELETED : LSM_LOOKUP_FOUND;
+}
+
+/**
+ * Applies a write-ahead log record to a memtable
+ * \param context the memtable
+ * \param lsn the LSN of the record
+ * \param data the bytes of the record
+ * \param len the length of the record
+ * \return 0 on success, -1 on error
+ */
+static int replay_lsm_record(void * context, uint64_t lsn, const char * data, size_t len) {
+  struct lsm_memtable * m = (struct lsm_memtable *) context;
+  uint32_t key_len;
+  if(len < LSM_RECORD_HEADER_SIZE) {
+    LOG_ERROR("invalid log record at %lu", (unsigned long) lsn);
+    return -1;
+  }
+  memcpy(&key_len, data + 1, sizeof(key_len));
+  if(key_len > MAX_LSM_KEY_LENGTH || key_len > len - LSM_RECORD_HEADER_SIZE) {
+    LOG_ERROR("invalid log record at %lu", (unsigned long) lsn);
+    return -1;
+  }
+  const char * key = data + LSM_RECORD_HEADER_SIZE;
+  return insert_lsm_memtable(m, key, key_len, key + key_len, len - LSM_RECORD_HEADER_SIZE - key_len, data[0] != 0);
+}
+
+/**
+ * Appends bytes to a growable buffer
+ * \param buffer the buffer
+ * \param len the number of bytes in the buffer
+ * \param size the size of the buffer
+ * \param data the bytes
+ * \param data_len the number of bytes
+ * \return 0 on success, -1 on error
+ */
+static int append_lsm_bytes(char ** buffer, size_t * len, size_t * size, const void * data, size_t data_len) {
+  if(*len + data_len > *size) {
+    size_t new_size = *size != 0 ? *size * 2 : LSM_BLOCK_SIZE;
+    while(new_size < *len + data_len) {
+      new_size *= 2;
+    }
+    char * bigger = (char *) realloc(*buffer, new_size);
+    if(bigger == NULL) {
+      LOG_ERROR("could not allocate %lu bytes", (unsigned long) new_size);
+      return -1;
+    }
+    *buffer = bigger;
+    *size = new_size;
+  }
+  if(data_len > 0) {
+    memcpy(*buffer + *len, data, data_len);
+  }
+  *len += data_len;
+  return 0;
+}
+
+/**
+ * Writes bytes at the end of a run
+ * \param w the run writer
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return 0 on success, -1 on error
+ */
+static int write_lsm_run_bytes(struct lsm_run_writer * w, const char * data, size_t len) {
+  size_t done = 0;
+  while(done < len) {
+    ssize_t n = write(w->fd, data + done, len - done);
+    if(n < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      LOG_ERROR("could not write run %s: %s", w->path, strerror(errno));
+      return -1;
+    }
+    done += (size_t) n;
+  }
+  w->offset += len;
+  return 0;
+}
+
+/**
+ * Starts writing a run
+ * \param w the run writer
+ * \param path the path of the file
+ * \param count the expected number of entries
+ * \param bits_per_key the number of Bloom filter bits per key
+ * \return 0 on success, -1 on error
+ */
+static int open_lsm_run_writer(struct lsm_run_writer * w, const char * path, uint64_t count, unsigned int bits_per_key) {
+  memset(w, 0, sizeof(struct lsm_run_writer));
+  snprintf(w->path, sizeof(w->path), "%s", path);
+  if(init_bloom_filter(&w->bloom, (size_t) count, bits_per_key) != 0) {
+    return -1;
+  }
+  w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, LSM_FILE_MODE);
+  if(w->fd < 0) {
+    LOG_ERROR("could not create run %s: %s", path, strerror(errno));
+    dispose_bloom_filter(&w->bloom);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Writes the current block of a run and adds it to the block index
+ * \param w the run writer
+ * \return 0 on success, -1 on error
+ */
+static int write_lsm_run_block(struct lsm_run_writer * w) {
+  uint64_t offset = w->offset;
+  uint32_t len = (uint32_t) w->block_len;
+  uint32_t key_len = (uint32_t) w->last_key_len;
+  if(write_lsm_run_bytes(w, w->block, w->block_len) != 0
+     || append_lsm_bytes(&w->index, &w->index_len, &w->index_size, &offset, sizeof(offset)) != 0
+     || append_lsm_bytes(&w->index, &w->index_len, &w->index_size, &len, sizeof(len)) != 0
+     || append_lsm_bytes(&w->index, &w->index_len, &w->index_size, &key_len, sizeof(key_len)) != 0
+     || append_lsm_bytes(&w->index, &w->index_len, &w->index_size, w->last_key, w->last_key_len) != 0) {
+    return -1;
+  }
+  w->block_len = 0;
+  ++w->block_count;
+  return 0;
+}
+
+/**
+ * Adds an entry to a run, entries should be added in key order
+ * \param w the run writer
+ * \param e the entry
+ * \return 0 on success, -1 on error
+ */
+static int add_lsm_run_entry(struct lsm_run_writer * w, const struct lsm_entry * e) {
+  assert(w->entry_count == 0 || compare_lsm_keys(w->last_key, w->last_key_len, e->key, e->key_len) < 0);
+
+  uint32_t key_len = (uint32_t) e->key_len;
+  uint32_t value_len = (uint32_t) e->value_len | (e->tombstone ? LSM_TOMBSTONE : 0);
+  if(append_lsm_bytes(&w->block, &w->block_len, &w->block_size, &key_len, sizeof(key_len)) != 0
+     || append_lsm_bytes(&w->block, &w->block_len, &w->block_size, &value_len, sizeof(value_len)) != 0
+     || append_lsm_bytes(&w->block, &w->block_len, &w->block_size, e->key, e->key_len) != 0
+     || append_lsm_bytes(&w->block, &w->block_len, &w->block_size, e->value, e->value_len) != 0) {
+    return -1;
+  }
+  add_bloom_key(&w->bloom, e->key, e->key_len);
+  memcpy(w->last_key, e->key, e->key_len);
+  w->last_key_len = e->key_len;
+  ++w->entry_count;
+  if(w->block_len >= LSM_BLOCK_SIZE) {
+    return write_lsm_run_block(w);
+  }
+  return 0;
+}
+
+/**
+ * Releases the memory of a run writer and closes its file
+ * \param w the run writer
+ * \param keep whether the file should be kept
+ * \return 0 on success, -1 on error
+ */
+static int dispose_lsm_run_writer(struct lsm_run_writer * w, bool keep) {
+  int result = 0;
+  if(w->fd >= 0 && close(w->fd) != 0) {
+    LOG_ERROR("could not close run %s: %s", w->path, strerror(errno));
+    result = -1;
+  }
+  if(!keep) {
+    unlink(w->path);
+  }
+  free(w->block);
+  free(w->index);
+  dispose_bloom_filter(&w->bloom);
+  return result;
+}
+
+/**
+ * Writes the last block, the block index, the Bloom filter and the footer of a run and syncs it
+ * \param w the run writer, disposed of
+ * \return 0 on success, -1 on error
+ */
+static int close_lsm_run_writer(struct lsm_run_writer * w) {
+  if(w->block_len > 0 && write_lsm_run_block(w) != 0) {
+    dispose_lsm_run_writer(w, false);
+    return -1;
+  }
+  struct lsm_run_footer footer;
+  memset(&footer, 0, sizeof(footer));
+  footer.index_offset = w->offset;
+  footer.index_len = w->index_len;
+  footer.bloom_offset = w->offset + w->index_len;
+  footer.bloom_size = w->bloom.size;
+  footer.entry_count = w->entry_count;
+  footer.hash_count = w->bloom.hash_count;
+  footer.block_count = w->block_count;
+  memcpy(footer.magic, LSM_RUN_MAGIC, LSM_MAGIC_LENGTH);
+  if(write_lsm_run_bytes(w, w->index, w->index_len) != 0
+     || write_lsm_run_bytes(w, (const char *) w->bloom.bits, w->bloom.size) != 0
+     || write_lsm_run_bytes(w, (const char *) &footer, sizeof(footer)) != 0) {
+    dispose_lsm_run_writer(w, false);
+    return -1;
+  }
+  if(fdatasync(w->fd) != 0) {
+    LOG_ERROR("could not sync run %s: %s", w->path, strerror(errno));
+    dispose_lsm_run_writer(w, false);
+    return -1;
+  }
+  return dispose_lsm_run_writer(w, true);
+}
+
+/**
+ * Reads bytes of a run
+ * \param run the run
+ * \param dest the destination buffer
+ * \param len the number of bytes
+ * \param offset the offset in the file
+ * \return 0 on success, -1 on error
+ */
+static int read_lsm_run_bytes(const struct lsm_run * run, char * dest, size_t len, uint64_t offset) {
+  size_t done = 0;
+  while(done < len) {
+    ssize_t n = pread(run->fd, dest + done, len - done, (off_t) (offset + done));
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      LOG_ERROR("could not read run %s: %s", run->path, n < 0 ? strerror(errno) : "unexpected end of file");
+      return -1;
+    }
+    done += (size_t) n;
+  }
+  return 0;
+}
+
+/**
+ * Releases the memory of a run and closes its file
+ * \param run the run
+ */
+static void dispose_lsm_run(struct lsm_run * run) {
+  if(run->fd >= 0) {
+    close(run->fd);
+  }
+  free(run->blocks);
+  free(run->index);
+  dispose_bloom_filter(&run->bloom);
+  free(run);
+}
+
+/**
+ * Opens a run, loading its block index and Bloom filter
+ * \param lsm the LSM tree
+ * \param number the number of the run
+ * \return the run with one reference, or NULL on error
+ */
+static struct lsm_run * open_lsm_run(const struct lsm * lsm, uint64_t number) {
+  struct lsm_run * run = (struct lsm_run *) calloc(1, sizeof(struct lsm_run));
+  if(run == NULL) {
+    LOG_ERROR("could not allocate run");
+    return NULL;
+  }
+  run->number = number;
+  run->refs = 1;
+  if(get_lsm_file_path(run->path, lsm, number, LSM_RUN_FILE_SUFFIX) != 0) {
+    free(run);
+    return NULL;
+  }
+  run->fd = open(run->path, O_RDONLY | O_CLOEXEC);
+  if(run->fd < 0) {
+    LOG_ERROR("could not open run %s: %s", run->path, strerror(errno));
+    free(run);
+    return NULL;
+  }
+  struct stat st;
+  struct lsm_run_footer footer;
+  if(fstat(run->fd, &st) != 0 || (uint64_t) st.st_size < sizeof(footer)) {
+    LOG_ERROR("invalid run %s", run->path);
+    dispose_lsm_run(run);
+    return NULL;
+  }
+  run->size = (uint64_t) st.st_size;
+  if(read_lsm_run_bytes(run, (char *) &footer, sizeof(footer), run->size - sizeof(footer)) != 0) {
+    dispose_lsm_run(run);
+    return NULL;
+  }
+  if(memcmp(footer.magic, LSM_RUN_MAGIC, LSM_MAGIC_LENGTH) != 0 || footer.bloom_offset != footer.index_offset + footer.index_len
+     || footer.bloom_offset + footer.bloom_size + sizeof(footer) != run->size) {
+    LOG_ERROR("invalid run %s", run->path);
+    dispose_lsm_run(run);
+    return NULL;
+  }
+  run->entry_count = footer.entry_count;
+  run->block_count = footer.block_count;
+  run->index = (char *) malloc(footer.index_len != 0 ? (size_t) footer.index_len : 1);
+  run->blocks = (struct lsm_block *) malloc((run->block_count != 0 ? run->block_count : 1) * sizeof(struct lsm_block));
+  if(run->index == NULL || run->blocks == NULL) {
+    LOG_ERROR("could not allocate the block index of run %s", run->path);
+    dispose_lsm_run(run);
+    return NULL;
+  }
+  if(read_lsm_run_bytes(run, run->index, (size_t) footer.index_len, footer.index_offset) != 0
+     || init_bloom_filter_bits(&run->bloom, (size_t) footer.bloom_size, footer.hash_count) != 0
+     || read_lsm_run_bytes(run, (char *) run->bloom.bits, run->bloom.size, footer.bloom_offset) != 0) {
+    dispose_lsm_run(run);
+    return NULL;
+  }
+
+  size_t pos = 0;
+  size_t header = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+  for(size_t i = 0; i < run->block_count; ++i) {
+    struct lsm_block * b = &run->blocks[i];
+    if(footer.index_len - pos < header) {
+      break;
+    }
+    memcpy(&b->offset, run->index + pos, sizeof(b->offset));
+    memcpy(&b->len, run->index + pos + sizeof(uint64_t), sizeof(b->len));
+    memcpy(&b->key_len, run->index + pos + sizeof(uint64_t) + sizeof(uint32_t), sizeof(b->key_len));
+    pos += header;
+    if(footer.index_len - pos < b->key_len || b->offset + b->len > footer.index_offset) {
+      pos = SIZE_MAX;
+      break;
+    }
+    b->key = run->index + pos;
+    pos += b->key_len;
+  }
+  if(pos != footer.index_len) {
+    LOG_ERROR("invalid block index in run %s", run->path);
+    dispose_lsm_run(run);
+    return NULL;
+  }
+  return run;
+}
+
+/**
+ * Drops a reference to a run, closing it and removing its file if it was compacted away with the last one
+ * \param run the run
+ */
+static void release_lsm_run(struct lsm_run * run) {
+  if(--run->refs > 0) {
+    return;
+  }
+  if(run->obsolete && unlink(run->path) != 0) {
+    LOG_WARNING("could not remove run %s: %s", run->path, strerror(errno));
+  }
+  dispose_lsm_run(run);
+}
+
+/**
+ * Reads a block of a run into a growable buffer
+ * \param run the run
+ * \param i the index of the block
+ * \param buffer the buffer
+ * \param size the size of the buffer
+ * \return 0 on success, -1 on error
+ */
+static int read_lsm_block(const struct lsm_run * run, size_t i, char ** buffer, size_t * size) {
+  const struct lsm_block * b = &run->blocks[i];
+  if(b->len > *size) {
+    char * bigger = (char *) realloc(*buffer, b->len);
+    if(bigger == NULL) {
+      LOG_ERROR("could not allocate a block of %lu bytes", (unsigned long) b->len);
+      return -1;
+    }
+    *buffer = bigger;
+    *size = b->len;
+  }
+  return read_lsm_run_bytes(run, *buffer, b->len, b->offset);
+}
+
+/**
+ * Parses an entry of a block
+ * \param data the bytes of the block
+ * \param len the length of the block
+ * \param pos the offset of the entry, moved past it
+ * \param e the destination for the entry, pointing into the block
+ * \return 0 on success, -1 if the block is corrupted
+ */
+static int parse_lsm_entry(const char * data, size_t len, size_t * pos, struct lsm_entry * e) {
+  uint32_t key_len;
+  uint32_t value_len;
+  if(len - *pos < LSM_ENTRY_HEADER_SIZE) {
+    return -1;
+  }
+  memcpy(&key_len, data + *pos, sizeof(key_len));
+  memcpy(&value_len, data + *pos + sizeof(key_len), sizeof(value_len));
+  e->tombstone = (value_len & LSM_TOMBSTONE) != 0;
+  value_len &= ~LSM_TOMBSTONE;
+  *pos += LSM_ENTRY_HEADER_SIZE;
+  if(len - *pos < (size_t) key_len + value_len) {
+    return -1;
+  }
+  e->key = data + *pos;
+  e->key_len = key_len;
+  e->value = data + *pos + key_len;
+  e->value_len = value_len;
+  *pos += (size_t) key_len + value_len;
+  return 0;
+}
+
+/**
+ * Looks up a key in a run, reading the one block that can hold it
+ * \param run the run
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param entry the destination for the entry, pointing into the buffer
+ * \param buffer the buffer for the block
+ * \param size the size of the buffer
+ * \return the outcome of the lookup
+ */
+static enum lsm_lookup find_lsm_run_entry(const struct lsm_run * run, const char * key, size_t len, struct lsm_entry * entry, char ** buffer, size_t * size) {
+  // The first block whose last key is not before the key
+  size_t low = 0;
+  size_t high = run->block_count;
+  while(low < high) {
+    size_t middle = low + (high - low) / 2;
+    const struct lsm_block * b = &run->blocks[middle];
+    if(compare_lsm_keys(b->key, b->key_len, key, len) < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if(low == run->block_count) {
+    return LSM_LOOKUP_MISSING;
+  }
+  if(read_lsm_block(run, low, buffer, size) != 0) {
+    return LSM_LOOKUP_ERROR;
+  }
+  size_t block_len = run->blocks[low].len;
+  size_t pos = 0;
+  while(pos < block_len) {
+    if(parse_lsm_entry(*buffer, block_len, &pos, entry) != 0) {
+      LOG_ERROR("corrupted block %lu in run %s", (unsigned long) low, run->path);
+      return LSM_LOOKUP_ERROR;
+    }
+    int order = compare_lsm_keys(entry->key, entry->key_len, key, len);
+    if(order == 0) {
+      return entry->tombstone ? LSM_LOOKUP_DELETED : LSM_LOOKUP_FOUND;
+    }
+    if(order > 0) {
+      break;
+    }
+  }
+  return LSM_LOOKUP_MISSING;
+}
+
+/**
+ * Moves a run iterator to the next entry
+ * \param it the iterator
+ * \return 0 on success, with valid false at the end, -1 on error
+ */
+static int next_lsm_run_iterator(struct lsm_run_iterator * it) {
+  while(it->pos >= it->len) {
+    if(it->block >= it->run->block_count) {
+      it->valid = false;
+      return 0;
+    }
+    if(read_lsm_block(it->run, it->block, &it->data, &it->size) != 0) {
+      return -1;
+    }
+    it->len = it->run->blocks[it->block].len;
+    it->pos = 0;
+    ++it->block;
+  }
+  if(parse_lsm_entry(it->data, it->len, &it->pos, &it->entry) != 0) {
+    LOG_ERROR("corrupted block %lu in run %s", (unsigned long) (it->block - 1), it->run->path);
+    return -1;
+  }
+  it->valid = true;
+  return 0;
+}
+
+/**
+ * Takes a reference to a version
+ * \param v the version
+ * \return the version
+ */
+static struct lsm_version * retain_lsm_version(struct lsm_version * v) {
+  ++v->refs;
+  return v;
+}
+
+/**
+ * Drops a reference to a version, releasing its runs with the last one
+ * The tree mutex should be held by the caller
+ * \param v the version
+ */
+static void release_lsm_version(struct lsm_version * v) {
+  if(--v->refs > 0) {
+    return;
+  }
+  for(size_t i = 0; i < v->level0_count; ++i) {
+    release_lsm_run(v->level0[i]);
+  }
+  for(size_t i = 1; i < LSM_LEVEL_COUNT; ++i) {
+    if(v->levels[i] != NULL) {
+      release_lsm_run(v->levels[i]);
+    }
+  }
+  free(v);
+}
+
+/**
+ * Copies a version, taking references to its runs
+ * The tree mutex should be held by the caller
+ * \param v the version
+ * \return the copy with one reference, or NULL on error
+ */
+static struct lsm_version * copy_lsm_version(const struct lsm_version * v) {
+  struct lsm_version * copy = (struct lsm_version *) malloc(sizeof(struct lsm_version));
+  if(copy == NULL) {
+    LOG_ERROR("could not allocate version");
+    return NULL;
+  }
+  *copy = *v;
+  copy->refs = 1;
+  for(size_t i = 0; i < copy->level0_count; ++i) {
+    ++copy->level0[i]->refs;
+  }
+  for(size_t i = 1; i < LSM_LEVEL_COUNT; ++i) {
+    if(copy->levels[i] != NULL) {
+      ++copy->levels[i]->refs;
+    }
+  }
+  return copy;
+}
+
+/**
+ * Writes the manifest listing the runs of a version, replacing the previous one atomically
+ * \param lsm the LSM tree
+ * \param v the version
+ * \param next_file the number of the next file
+ * \return 0 on success, -1 on error
+ */
+static int write_lsm_manifest(const struct lsm * lsm, const struct lsm_version * v, uint64_t next_file) {
+  char temp_path[MAX_LSM_PATH_LENGTH];
+  char path[MAX_LSM_PATH_LENGTH];
+  if(get_lsm_named_path(temp_path, lsm, LSM_MANIFEST_TEMP_FILE_NAME) != 0 || get_lsm_named_path(path, lsm, LSM_MANIFEST_FILE_NAME) != 0) {
+    return -1;
+  }
+  FILE * file = fopen(temp_path, "wb");
+  if(file == NULL) {
+    LOG_ERROR("could not create manifest %s: %s", temp_path, strerror(errno));
+    return -1;
+  }
+  uint32_t count = (uint32_t) v->level0_count;
+  for(size_t i = 1; i < LSM_LEVEL_COUNT; ++i) {
+    count += v->levels[i] != NULL;
+  }
+  bool ok = fwrite(LSM_MANIFEST_MAGIC, 1, LSM_MAGIC_LENGTH, file) == LSM_MAGIC_LENGTH
+    && fwrite(&next_file, sizeof(next_file), 1, file) == 1
+    && fwrite(&count, sizeof(count), 1, file) == 1;
+  for(size_t i = 0; i < v->level0_count && ok; ++i) {
+    uint32_t level = 0;
+    ok = fwrite(&level, sizeof(level), 1, file) == 1 && fwrite(&v->level0[i]->number, sizeof(uint64_t), 1, file) == 1;
+  }
+  for(uint32_t level = 1; level < LSM_LEVEL_COUNT && ok; ++level) {
+    if(v->levels[level] != NULL) {
+      ok = fwrite(&level, sizeof(level), 1, file) == 1 && fwrite(&v->levels[level]->number, sizeof(uint64_t), 1, file) == 1;
+    }
+  }
+  ok = ok && fflush(file) == 0 && fdatasync(fileno(file)) == 0;
+  if(fclose(file) != 0 || !ok) {
+    LOG_ERROR("could not write manifest %s", temp_path);
+    unlink(temp_path);
+    return -1;
+  }
+  if(rename(temp_path, path) != 0) {
+    LOG_ERROR("could not replace manifest %s: %s", path, strerror(errno));
+    unlink(temp_path);
+    return -1;
+  }
+  return sync_lsm_directory(lsm);
+}
+
+/**
+ * Reads the manifest and opens the runs it lists
+ * \param lsm the LSM tree, whose version and next file number are set
+ * \return 0 on success, -1 on error
+ */
+static int read_lsm_manifest(struct lsm * lsm) {
+  char path[MAX_LSM_PATH_LENGTH];
+  if(get_lsm_named_path(path, lsm, LSM_MANIFEST_FILE_NAME) != 0) {
+    return -1;
+  }
+  FILE * file = fopen(path, "rb");
+  if(file == NULL) {
+    if(errno == ENOENT) {
+      return 0;
+    }
+    LOG_ERROR("could not open manifest %s: %s", path, strerror(errno));
+    return -1;
+  }
+  char magic[LSM_MAGIC_LENGTH];
+  uint32_t count;
+  bool ok = fread(magic, 1, LSM_MAGIC_LENGTH, file) == LSM_MAGIC_LENGTH
+    && memcmp(magic, LSM_MANIFEST_MAGIC, LSM_MAGIC_LENGTH) == 0
+    && fread(&lsm->next_file, sizeof(lsm->next_file), 1, file) == 1
+    && fread(&count, sizeof(count), 1, file) == 1;
+  struct lsm_version * v = lsm->version;
+  for(uint32_t i = 0; i < count && ok; ++i) {
+    uint32_t level;
+    uint64_t number;
+    ok = fread(&level, sizeof(level), 1, file) == 1 && fread(&number, sizeof(number), 1, file) == 1 && level < LSM_LEVEL_COUNT
+      && (level != 0 || v->level0_count < MAX_LSM_LEVEL0_RUNS) && (level == 0 || v->levels[level] == NULL);
+    struct lsm_run * run = ok ? open_lsm_run(lsm, number) : NULL;
+    if(run == NULL) {
+      ok = false;
+    } else if(level == 0) {
+      v->level0[v->level0_count++] = run;
+    } else {
+      v->levels[level] = run;
+    }
+  }
+  fclose(file);
+  if(!ok) {
+    LOG_ERROR("invalid manifest %s", path);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Writes the entries of a frozen memtable to a run
+ * \param lsm the LSM tree
+ * \param m the memtable
+ * \param number the number of the run
+ * \return the run with one reference, or NULL on error
+ */
+static struct lsm_run * write_lsm_memtable_run(const struct lsm * lsm, const struct lsm_memtable * m, uint64_t number) {
+  char path[MAX_LSM_PATH_LENGTH];
+  struct lsm_run_writer w;
+  if(get_lsm_file_path(path, lsm, number, LSM_RUN_FILE_SUFFIX) != 0 || open_lsm_run_writer(&w, path, m->count, lsm->options.bloom_bits_per_key) != 0) {
+    return NULL;
+  }
+  for(const struct lsm_node * node = m->head->next[0]; node != NULL; node = node->next[0]) {
+    struct lsm_entry e = {node->key, node->key_len, node->value, node->value_len, node->tombstone};
+    if(add_lsm_run_entry(&w, &e) != 0) {
+      dispose_lsm_run_writer(&w, false);
+      return NULL;
+    }
+  }
+  if(close_lsm_run_writer(&w) != 0) {
+    return NULL;
+  }
+  return open_lsm_run(lsm, number);
+}
+
+/**
+ * Merges runs into one, keeping the newest entry of each key
+ * \param lsm the LSM tree
+ * \param inputs the runs, newest first
+ * \param count the number of runs
+ * \param drop_tombstones whether deleted keys can be left out, when no older run remains below the output
+ * \param number the number of the output run
+ * \param output the destination for the output run with one reference, NULL if every key was dropped
+ * \return 0 on success, -1 on error
+ */
+static int merge_lsm_runs(const struct lsm * lsm, struct lsm_run ** inputs, size_t count, bool drop_tombstones, uint64_t number, struct lsm_run ** output) {
+  char path[MAX_LSM_PATH_LENGTH];
+  struct lsm_run_iterator its[MAX_LSM_LEVEL0_RUNS + 1];
+  uint64_t entries = 0;
+  for(size_t i = 0; i < count; ++i) {
+    entries += inputs[i]->entry_count;
+  }
+  *output = NULL;
+  struct lsm_run_writer w;
+  if(get_lsm_file_path(path, lsm, number, LSM_RUN_FILE_SUFFIX) != 0 || open_lsm_run_writer(&w, path, entries, lsm->options.bloom_bits_per_key) != 0) {
+    return -1;
+  }
+  memset(its, 0, sizeof(its));
+  int result = 0;
+  for(size_t i = 0; i < count && result == 0; ++i) {
+    its[i].run = inputs[i];
+    result = next_lsm_run_iterator(&its[i]);
+  }
+
+  // The few inputs are scanned for the smallest key, the newest input wins among equal keys
+  while(result == 0) {
+    size_t smallest = count;
+    for(size_t i = 0; i < count; ++i) {
+      if(its[i].valid && (smallest == count || compare_lsm_keys(its[i].entry.key, its[i].entry.key_len, its[smallest].entry.key, its[smallest].entry.key_len) < 0)) {
+	smallest = i;
+      }
+    }
+    if(smallest == count) {
+      break;
+    }
+    struct lsm_entry e = its[smallest].entry;
+    if(!e.tombstone || !drop_tombstones) {
+      result = add_lsm_run_entry(&w, &e);
+    }
+    for(size_t i = 0; i < count && result == 0; ++i) {
+      if(i != smallest && its[i].valid && compare_lsm_keys(its[i].entry.key, its[i].entry.key_len, e.key, e.key_len) == 0) {
+	result = next_lsm_run_iterator(&its[i]);
+      }
+    }
+    if(result == 0) {
+      result = next_lsm_run_iterator(&its[smallest]);
+    }
+  }
+  for(size_t i = 0; i < count; ++i) {
+    free(its[i].data);
+  }
+  if(result != 0) {
+    dispose_lsm_run_writer(&w, false);
+    return -1;
+  }
+  if(w.entry_count == 0) {
+    return dispose_lsm_run_writer(&w, false);
+  }
+  if(close_lsm_run_writer(&w) != 0) {
+    return -1;
+  }
+  *output = open_lsm_run(lsm, number);
+  return *output != NULL ? 0 : -1;
+}
+
+/**
+ * Finds the level that most needs a compaction into the next level
+ * \param lsm the LSM tree
+ * \param v the version
+ * \return the level, or -1 if no level is over its size
+ */
+static int pick_lsm_compaction(const struct lsm * lsm, const struct lsm_version * v) {
+  if(v->level0_count >= lsm->options.level0_runs) {
+    return 0;
+  }
+  uint64_t limit = lsm->options.level_base_size;
+  for(int level = 1; level < LSM_LEVEL_COUNT - 1; ++level) {
+    if(v->levels[level] != NULL && v->levels[level]->size > limit) {
+      return level;
+    }
+    limit *= LSM_LEVEL_SIZE_RATIO;
+  }
+  return -1;
+}
+
+/**
+ * Installs a new version, writing the manifest first
+ * The tree mutex should be held by the caller, only the compaction thread or open_lsm change versions
+ * \param lsm the LSM tree
+ * \param v the version, whose reference is taken over
+ * \return 0 on success, -1 on error
+ */
+static int install_lsm_version(struct lsm * lsm, struct lsm_version * v) {
+  uint64_t next_file = lsm->next_file;
+  pthread_mutex_unlock(&lsm->mutex);
+  int result = write_lsm_manifest(lsm, v, next_file);
+  pthread_mutex_lock(&lsm->mutex);
+  if(result != 0) {
+    release_lsm_version(v);
+    return -1;
+  }
+  release_lsm_version(lsm->version);
+  lsm->version = v;
+  return 0;
+}
+
+/**
+ * Flushes the frozen memtable to a new run in level 0 and removes its write-ahead log
+ * The tree mutex should be held by the caller, it is released while writing
+ * \param lsm the LSM tree
+ * \return 0 on success, -1 on error
+ */
+static int flush_lsm_memtable(struct lsm * lsm) {
+  struct lsm_memtable * m = lsm->immutable;
+  uint64_t number = lsm->next_file++;
+  struct lsm_version * v = copy_lsm_version(lsm->version);
+  if(v == NULL) {
+    return -1;
+  }
+  pthread_mutex_unlock(&lsm->mutex);
+  struct lsm_run * run = m->count > 0 ? write_lsm_memtable_run(lsm, m, number) : NULL;
+  pthread_mutex_lock(&lsm->mutex);
+  if(m->count > 0 && run == NULL) {
+    release_lsm_version(v);
+    return -1;
+  }
+  if(run != NULL) {
+    memmove(v->level0 + 1, v->level0, v->level0_count * sizeof(struct lsm_run *));
+    v->level0[0] = run;
+    ++v->level0_count;
+  }
+  if(install_lsm_version(lsm, v) != 0) {
+    return -1;
+  }
+  lsm->immutable = NULL;
+  ++lsm->stats.flushes;
+  lsm->stats.bytes_written += run != NULL ? run->size : 0;
+  pthread_cond_broadcast(&lsm->done_cond);
+
+  // Writes still waiting for the log of the memtable are durable once it is closed
+  while(m->writers > 0) {
+    pthread_cond_wait(&lsm->done_cond, &lsm->mutex);
+  }
+  pthread_mutex_unlock(&lsm->mutex);
+  char path[MAX_LSM_PATH_LENGTH];
+  int result = close_wal(&m->wal);
+  if(result == 0 && get_lsm_file_path(path, lsm, m->number, LSM_LOG_FILE_SUFFIX) == 0 && unlink(path) != 0) {
+    LOG_WARNING("could not remove log %s: %s", path, strerror(errno));
+  }
+  dispose_lsm_memtable(m);
+  pthread_mutex_lock(&lsm->mutex);
+  return result;
+}
+
+/**
+ * Merges a level into the next one
+ * The tree mutex should be held by the caller, it is released while merging
+ * \param lsm the LSM tree
+ * \param level the level, every run of level 0 is merged into level 1
+ * \return 0 on success, -1 on error
+ */
+static int compact_lsm_level(struct lsm * lsm, int level) {
+  struct lsm_version * v = copy_lsm_version(lsm->version);
+  if(v == NULL) {
+    return -1;
+  }
+  int target = level + 1;
+  struct lsm_run * inputs[MAX_LSM_LEVEL0_RUNS + 1];
+  size_t count = 0;
+  if(level == 0) {
+    memcpy(inputs, v->level0, v->level0_count * sizeof(struct lsm_run *));
+    count = v->level0_count;
+  } else {
+    inputs[count++] = v->levels[level];
+  }
+  if(v->levels[target] != NULL) {
+    inputs[count++] = v->levels[target];
+  }
+  bool bottom = true;
+  for(int i = target + 1; i < LSM_LEVEL_COUNT; ++i) {
+    bottom = bottom && v->levels[i] == NULL;
+  }
+  uint64_t number = lsm->next_file++;
+  pthread_mutex_unlock(&lsm->mutex);
+  struct lsm_run * run;
+  int result = merge_lsm_runs(lsm, inputs, count, bottom, number, &run);
+  pthread_mutex_lock(&lsm->mutex);
+  if(result != 0) {
+    release_lsm_version(v);
+    return -1;
+  }
+
+  // The version holds its own references to the inputs until they are replaced
+  if(level == 0) {
+    for(size_t i = 0; i < v->level0_count; ++i) {
+      release_lsm_run(v->level0[i]);
+    }
+    v->level0_count = 0;
+  } else {
+    release_lsm_run(v->levels[level]);
+    v->levels[level] = NULL;
+  }
+  if(v->levels[target] != NULL) {
+    release_lsm_run(v->levels[target]);
+  }
+  v->levels[target] = run;
+  for(size_t i = 0; i < count; ++i) {
+    inputs[i]->obsolete = true;
+  }
+  if(install_lsm_version(lsm, v) != 0) {
+    for(size_t i = 0; i < count; ++i) {
+      inputs[i]->obsolete = false;
+    }
+    return -1;
+  }
+  ++lsm->stats.compactions;
+  lsm->stats.bytes_written += run != NULL ? run->size : 0;
+  return 0;
+}
+
+/**
+ * Runs in the compaction thread
+ * Frozen memtables are flushed first unless level 0 is full, then the levels over their size are compacted
+ * \param arg the LSM tree
+ * \return always NULL, failures are recorded in the tree
+ */
+static void * run_lsm_compactor(void * arg) {
+  struct lsm * lsm = (struct lsm *) arg;
+  if(pthread_mutex_lock(&lsm->mutex) != 0) {
+    LOG_ERROR("could not lock LSM tree");
+    lsm->failed = true;
+    return NULL;
+  }
+  while(!lsm->stopping && !lsm->failed) {
+    bool flush = lsm->immutable != NULL && lsm->version->level0_count < MAX_LSM_LEVEL0_RUNS;
+    int level = flush ? -1 : pick_lsm_compaction(lsm, lsm->version);
+    if(!flush && level < 0) {
+      pthread_cond_wait(&lsm->work_cond, &lsm->mutex);
+      continue;
+    }
+    int result = flush ? flush_lsm_memtable(lsm) : compact_lsm_level(lsm, level);
+    if(result != 0) {
+      LOG_ERROR("could not %s %s, refusing writes", flush ? "flush memtable of" : "compact", lsm->path);
+      lsm->failed = true;
+    }
+    pthread_cond_broadcast(&lsm->done_cond);
+  }
+  pthread_mutex_unlock(&lsm->mutex);
+  return NULL;
+}
+
+/**
+ * Compares two file numbers for sorting
+ * \param a the first number
+ * \param b the second number
+ * \return a negative number, 0 or a positive number if a is before, equal to or after b
+ */
+static int compare_lsm_numbers(const void * a, const void * b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * Tests whether a version lists a run
+ * \param v the version
+ * \param number the number of the run
+ * \return whether the run is listed
+ */
+static bool has_lsm_run(const struct lsm_version * v, uint64_t number) {
+  for(size_t i = 0; i < v->level0_count; ++i) {
+    if(v->level0[i]->number == number) {
+      return true;
+    }
+  }
+  for(size_t i = 1; i < LSM_LEVEL_COUNT; ++i) {
+    if(v->levels[i] != NULL && v->levels[i]->number == number) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Replays the write-ahead logs left by the previous opening into a run, and removes the logs and the runs of
+ * interrupted flushes and compactions
+ * The tree mutex should be held by the caller
+ * \param lsm the LSM tree, with its manifest read
+ * \return 0 on success, -1 on error
+ */
+static int recover_lsm(struct lsm * lsm) {
+  DIR * dir = opendir(lsm->path);
+  if(dir == NULL) {
+    LOG_ERROR("could not open directory %s: %s", lsm->path, strerror(errno));
+    return -1;
+  }
+  uint64_t * logs = NULL;
+  size_t log_count = 0;
+  size_t log_size = 0;
+  int result = 0;
+  struct dirent * d;
+  while(result == 0 && (d = readdir(dir)) != NULL) {
+    char * end;
+    unsigned long number = strtoul(d->d_name, &end, 10);
+    if(end == d->d_name) {
+      continue;
+    }
+    if(number >= lsm->next_file) {
+      lsm->next_file = number + 1;
+    }
+    if(strcmp(end, LSM_LOG_FILE_SUFFIX) == 0) {
+      if(log_count == log_size) {
+	log_size = log_size != 0 ? log_size * 2 : 8;
+	uint64_t * bigger = (uint64_t *) realloc(logs, log_size * sizeof(uint64_t));
+	if(bigger == NULL) {
+	  LOG_ERROR("could not allocate the list of logs");
+	  result = -1;
+	  continue;
+	}
+	logs = bigger;
+      }
+      logs[log_count++] = number;
+    } else if(strcmp(end, LSM_RUN_FILE_SUFFIX) == 0 && !has_lsm_run(lsm->version, number)) {
+      char path[MAX_LSM_PATH_LENGTH];
+      if(get_lsm_file_path(path, lsm, number, LSM_RUN_FILE_SUFFIX) == 0) {
+	unlink(path);
+      }
+    }
+  }
+  closedir(dir);
+  if(result != 0 || log_count == 0) {
+    free(logs);
+    return result;
+  }
+
+  // The logs are replayed oldest first into one memtable, flushed like any other
+  qsort(logs, log_count, sizeof(uint64_t), compare_lsm_numbers);
+  struct lsm_memtable * m = create_lsm_memtable(0);
+  for(size_t i = 0; i < log_count && m != NULL && result == 0; ++i) {
+    char path[MAX_LSM_PATH_LENGTH];
+    result = get_lsm_file_path(path, lsm, logs[i], LSM_LOG_FILE_SUFFIX);
+    if(result == 0) {
+      result = open_wal(&m->wal, path, replay_lsm_record, m);
+    }
+    if(result == 0) {
+      result = close_wal(&m->wal);
+    }
+  }
+  if(m == NULL || result != 0) {
+    if(m != NULL) {
+      dispose_lsm_memtable(m);
+    }
+    free(logs);
+    return -1;
+  }
+  while(result == 0 && lsm->version->level0_count >= MAX_LSM_LEVEL0_RUNS) {
+    result = compact_lsm_level(lsm, 0);
+  }
+  struct lsm_version * v = result == 0 ? copy_lsm_version(lsm->version) : NULL;
+  if(v != NULL && m->count > 0) {
+    struct lsm_run * run = write_lsm_memtable_run(lsm, m, lsm->next_file++);
+    if(run != NULL) {
+      memmove(v->level0 + 1, v->level0, v->level0_count * sizeof(struct lsm_run *));
+      v->level0[0] = run;
+      ++v->level0_count;
+    } else {
+      release_lsm_version(v);
+      v = NULL;
+    }
+  }
+  dispose_lsm_memtable(m);
+  result = v != NULL ? install_lsm_version(lsm, v) : -1;
+  for(size_t i = 0; i < log_count && result == 0; ++i) {
+    char path[MAX_LSM_PATH_LENGTH];
+    if(get_lsm_file_path(path, lsm, logs[i], LSM_LOG_FILE_SUFFIX) == 0 && unlink(path) != 0) {
+      LOG_WARNING("could not remove log %s: %s", path, strerror(errno));
+    }
+  }
+  free(logs);
+  return result;
+}
+
+/**
+ * Creates a memtable with a new write-ahead log
+ * The tree mutex should be held by the caller
+ * \param lsm the LSM tree
+ * \return the memtable, or NULL on error
+ */
+static struct lsm_memtable * open_lsm_memtable(struct lsm * lsm) {
+  uint64_t number = lsm->next_file++;
+  char path[MAX_LSM_PATH_LENGTH];
+  if(get_lsm_file_path(path, lsm, number, LSM_LOG_FILE_SUFFIX) != 0) {
+    return NULL;
+  }
+  struct lsm_memtable * m = create_lsm_memtable(number);
+  if(m == NULL) {
+    return NULL;
+  }
+  if(open_wal(&m->wal, path, NULL, NULL) != 0) {
+    dispose_lsm_memtable(m);
+    return NULL;
+  }
+  if(sync_lsm_directory(lsm) != 0) {
+    close_wal(&m->wal);
+    unlink(path);
+    dispose_lsm_memtable(m);
+    return NULL;
+  }
+  return m;
+}
+
+void init_lsm_options(struct lsm_options * options) {
+  assert(options != NULL);
+
+  options->memtable_size = DEFAULT_LSM_MEMTABLE_SIZE;
+  options->level0_runs = DEFAULT_LSM_LEVEL0_RUNS;
+  options->level_base_size = DEFAULT_LSM_LEVEL_BASE_SIZE;
+  options->bloom_bits_per_key = DEFAULT_BLOOM_BITS_PER_KEY;
+}
+
+int open_lsm(struct lsm * lsm, const char * path, const struct lsm_options * options) {
+  assert(lsm != NULL);
+  assert(path != NULL);
+
+  memset(lsm, 0, sizeof(struct lsm));
+  if(options != NULL) {
+    lsm->options = *options;
+  } else {
+    init_lsm_options(&lsm->options);
+  }
+  if(lsm->options.level0_runs < 1 || lsm->options.level0_runs > MAX_LSM_LEVEL0_RUNS || lsm->options.bloom_bits_per_key < 1) {
+    LOG_ERROR("invalid options for LSM tree %s", path);
+    return -1;
+  }
+  size_t len = strlen(path);
+  if(len >= MAX_LSM_PATH_LENGTH - 32) {
+    LOG_ERROR("LSM tree path too long: %s", path);
+    return -1;
+  }
+  memcpy(lsm->path, path, len + 1);
+  if(mkdir(path, LSM_DIRECTORY_MODE) != 0 && errno != EEXIST) {
+    LOG_ERROR("could not create directory %s: %s", path, strerror(errno));
+    return -1;
+  }
+  lsm->next_file = 1;
+  lsm->version = (struct lsm_version *) calloc(1, sizeof(struct lsm_version));
+  if(lsm->version == NULL) {
+    LOG_ERROR("could not allocate version");
+    return -1;
+  }
+  lsm->version->refs = 1;
+
+  int result = pthread_mutex_init(&lsm->mutex, NULL);
+  if(result == 0) {
+    result = pthread_cond_init(&lsm->work_cond, NULL);
+    if(result == 0) {
+      result = pthread_cond_init(&lsm->done_cond, NULL);
+      if(result != 0) {
+	pthread_cond_destroy(&lsm->work_cond);
+      }
+    }
+    if(result != 0) {
+      pthread_mutex_destroy(&lsm->mutex);
+    }
+  }
+  if(result != 0) {
+    LOG_ERROR("could not initialize LSM tree mutex: %s", strerror(result));
+    free(lsm->version);
+    return -1;
+  }
+
+  pthread_mutex_lock(&lsm->mutex);
+  if(read_lsm_manifest(lsm) != 0 || recover_lsm(lsm) != 0 || (lsm->memtable = open_lsm_memtable(lsm)) == NULL) {
+    result = -1;
+  } else {
+    result = pthread_create(&lsm->thread, NULL, run_lsm_compactor, lsm);
+    if(result != 0) {
+      LOG_ERROR("could not start compaction thread: %s", strerror(result));
+      close_wal(&lsm->memtable->wal);
+      dispose_lsm_memtable(lsm->memtable);
+    }
+  }
+  if(result != 0) {
+    release_lsm_version(lsm->version);
+    pthread_mutex_unlock(&lsm->mutex);
+    pthread_cond_destroy(&lsm->done_cond);
+    pthread_cond_destroy(&lsm->work_cond);
+    pthread_mutex_destroy(&lsm->mutex);
+    return -1;
+  }
+  pthread_mutex_unlock(&lsm->mutex);
+  return 0;
+}
+
+/**
+ * Writes an entry to the write-ahead log and the memtable and waits for the log to sync
+ * \param lsm the LSM tree
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param value the bytes of the value
+ * \param value_len the length of the value
+ * \param tombstone whether the key is deleted
+ * \return 0 on success, -1 on error
+ */
+static int write_lsm_entry(struct lsm * lsm, const char * key, size_t len, const char * value, size_t value_len, bool tombstone) {
+  if(len > MAX_LSM_KEY_LENGTH || value_len > MAX_LSM_VALUE_LENGTH) {
+    LOG_ERROR("entry too long for LSM tree %s", lsm->path);
+    return -1;
+  }
+  char stack_record[LSM_RECORD_STACK_SIZE];
+  size_t record_len = LSM_RECORD_HEADER_SIZE + len + value_len;
+  char * record = record_len <= sizeof(stack_record) ? stack_record : (char *) malloc(record_len);
+  if(record == NULL) {
+    LOG_ERROR("could not allocate a log record of %lu bytes", (unsigned long) record_len);
+    return -1;
+  }
+  uint32_t key_len = (uint32_t) len;
+  record[0] = tombstone;
+  memcpy(record + 1, &key_len, sizeof(key_len));
+  if(len > 0) {
+    memcpy(record + LSM_RECORD_HEADER_SIZE, key, len);
+  }
+  if(value_len > 0) {
+    memcpy(record + LSM_RECORD_HEADER_SIZE + len, value, value_len);
+  }
+
+  if(pthread_mutex_lock(&lsm->mutex) != 0) {
+    LOG_ERROR("could not lock LSM tree");
+    if(record != stack_record) {
+      free(record);
+    }
+    return -1;
+  }
+  // A full memtable is frozen for the compaction thread, writers wait while the previous one is still being flushed
+  while(!lsm->failed && lsm->memtable->size >= lsm->options.memtable_size) {
+    if(lsm->immutable == NULL) {
+      struct lsm_memtable * m = open_lsm_memtable(lsm);
+      if(m == NULL) {
+	break;
+      }
+      lsm->immutable = lsm->memtable;
+      lsm->memtable = m;
+      pthread_cond_signal(&lsm->work_cond);
+    } else {
+      pthread_cond_wait(&lsm->done_cond, &lsm->mutex);
+    }
+  }
+  struct lsm_memtable * m = lsm->memtable;
+  uint64_t lsn;
+  bool logged = !lsm->failed && m->size < lsm->options.memtable_size && append_wal_record(&m->wal, record, record_len, &lsn) == 0;
+  int result = -1;
+  if(logged) {
+    result = insert_lsm_memtable(m, key, len, value, value_len, tombstone);
+    ++m->writers;
+  }
+  pthread_mutex_unlock(&lsm->mutex);
+  if(record != stack_record) {
+    free(record);
+  }
+  if(!logged) {
+    return -1;
+  }
+
+  // Concurrent writers share the sync of the log
+  if(wait_for_wal(&m->wal, lsn) != 0) {
+    result = -1;
+  }
+  pthread_mutex_lock(&lsm->mutex);
+  if(--m->writers == 0 && m != lsm->memtable) {
+    pthread_cond_broadcast(&lsm->done_cond);
+  }
+  pthread_mutex_unlock(&lsm->mutex);
+  return result;
+}
+
+int put_lsm_entry(struct lsm * lsm, const char * key, size_t len, const char * value, size_t value_len) {
+  assert(lsm != NULL);
+  assert(key != NULL || len == 0);
+  assert(value != NULL || value_len == 0);
+
+  return write_lsm_entry(lsm, key, len, value, value_len, false);
+}
+
+int delete_lsm_entry(struct lsm * lsm, const char * key, size_t len) {
+  assert(lsm != NULL);
+  assert(key != NULL || len == 0);
+
+  return write_lsm_entry(lsm, key, len, NULL, 0, true);
+}
+
+/**
+ * Copies the value of a found entry
+ * \param e the entry
+ * \param value the destination buffer
+ * \param size the size of the destination buffer
+ * \param value_len the destination for the length of the value
+ * \return 1 on success, -1 if the buffer is too small
+ */
+static int copy_lsm_value(const struct lsm_entry * e, char * value, size_t size, size_t * value_len) {
+  if(e->value_len > size) {
+    LOG_ERROR("value of %lu bytes too long for the buffer", (unsigned long) e->value_len);
+    return -1;
+  }
+  if(e->value_len > 0) {
+    memcpy(value, e->value, e->value_len);
+  }
+  *value_len = e->value_len;
+  return 1;
+}
+
+int get_lsm_entry(struct lsm * lsm, const char * key, size_t len, char * value, size_t size, size_t * value_len) {
+  assert(lsm != NULL);
+  assert(key != NULL || len == 0);
+  assert(value != NULL || size == 0);
+  assert(value_len != NULL);
+
+  if(pthread_mutex_lock(&lsm->mutex) != 0) {
+    LOG_ERROR("could not lock LSM tree");
+    return -1;
+  }
+  struct lsm_entry e;
+  enum lsm_lookup lookup = find_lsm_memtable_entry(lsm->memtable, key, len, &e);
+  if(lookup == LSM_LOOKUP_MISSING && lsm->immutable != NULL) {
+    lookup = find_lsm_memtable_entry(lsm->immutable, key, len, &e);
+  }
+  if(lookup != LSM_LOOKUP_MISSING) {
+    int result = lookup == LSM_LOOKUP_FOUND ? copy_lsm_value(&e, value, size, value_len) : 0;
+    pthread_mutex_unlock(&lsm->mutex);
+    return result;
+  }
+  struct lsm_version * v = retain_lsm_version(lsm->version);
+  pthread_mutex_unlock(&lsm->mutex);
+
+  // Runs are searched newest first, the first one holding the key has its latest value
+  char * buffer = NULL;
+  size_t buffer_size = 0;
+  uint64_t block_reads = 0;
+  uint64_t bloom_skips = 0;
+  uint64_t hash = hash_bloom_key(key, len);
+  for(size_t i = 0; i < v->level0_count + LSM_LEVEL_COUNT - 1 && lookup == LSM_LOOKUP_MISSING; ++i) {
+    const struct lsm_run * run = i < v->level0_count ? v->level0[i] : v->levels[i - v->level0_count + 1];
+    if(run == NULL) {
+      continue;
+    }
+    if(!test_bloom_hash(&run->bloom, hash)) {
+      ++bloom_skips;
+      continue;
+    }
+    ++block_reads;
+    lookup = find_lsm_run_entry(run, key, len, &e, &buffer, &buffer_size);
+  }
+  int result = lookup == LSM_LOOKUP_FOUND ? copy_lsm_value(&e, value, size, value_len) : (lookup == LSM_LOOKUP_ERROR ? -1 : 0);
+  free(buffer);
+
+  pthread_mutex_lock(&lsm->mutex);
+  lsm->stats.block_reads += block_reads;
+  lsm->stats.bloom_skips += bloom_skips;
+  release_lsm_version(v);
+  pthread_mutex_unlock(&lsm->mutex);
+  return result;
+}
+
+void get_lsm_stats(struct lsm * lsm, struct lsm_stats * stats) {
+  assert(lsm != NULL);
+  assert(stats != NULL);
+
+  if(pthread_mutex_lock(&lsm->mutex) != 0) {
+    memset(stats, 0, sizeof(struct lsm_stats));
+    return;
+  }
+  *stats = lsm->stats;
+  pthread_mutex_unlock(&lsm->mutex);
+}
+
+int wait_for_lsm_compactions(struct lsm * lsm) {
+  assert(lsm != NULL);
+
+  if(pthread_mutex_lock(&lsm->mutex) != 0) {
+    LOG_ERROR("could not lock LSM tree");
+    return -1;
+  }
+  while(!lsm->failed && (lsm->immutable != NULL || pick_lsm_compaction(lsm, lsm->version) >= 0)) {
+    pthread_cond_wait(&lsm->done_cond, &lsm->mutex);
+  }
+  int result = lsm->failed ? -1 : 0;
+  pthread_mutex_unlock(&lsm->mutex);
+  return result;
+}
+
+int close_lsm(struct lsm * lsm) {
+  assert(lsm != NULL);
+
+  int result = 0;
+  if(pthread_mutex_lock(&lsm->mutex) != 0) {
+    LOG_ERROR("could not lock LSM tree");
+    return -1;
+  }
+  lsm->stopping = true;
+  pthread_cond_signal(&lsm->work_cond);
+  pthread_mutex_unlock(&lsm->mutex);
+  pthread_join(lsm->thread, NULL);
+  if(lsm->failed) {
+    result = -1;
+  }
+
+  // The logs of the memtables stay behind, they are replayed by the next opening
+  struct lsm_memtable * memtables[2] = {lsm->memtable, lsm->immutable};
+  for(size_t i = 0; i < 2; ++i) {
+    if(memtables[i] != NULL) {
+      if(close_wal(&memtables[i]->wal) != 0) {
+	result = -1;
+      }
+      dispose_lsm_memtable(memtables[i]);
+    }
+  }
+  release_lsm_version(lsm->version);
+  pthread_cond_destroy(&lsm->done_cond);
+  pthread_cond_destroy(&lsm->work_cond);
+  pthread_mutex_destroy(&lsm->mutex);
+  return result;
+}
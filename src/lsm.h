@@ -0,0 +1,271 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef LSM_H
+#define LSM_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The maximum length of a key
+ */
+#define MAX_LSM_KEY_LENGTH 1024
+
+/**
+ * The maximum length of a value
+ */
+#define MAX_LSM_VALUE_LENGTH (1024 * 1024)
+
+/**
+ * The maximum length of the path of an LSM tree directory and its files
+ */
+#define MAX_LSM_PATH_LENGTH 4096
+
+/**
+ * The number of levels, level 0 holds the flushed memtables and every other level a single sorted run
+ */
+#define LSM_LEVEL_COUNT 7
+
+/**
+ * The number of runs in level 0 at which writers wait for compaction
+ */
+#define MAX_LSM_LEVEL0_RUNS 12
+
+/**
+ * The size ratio between two consecutive levels
+ */
+#define LSM_LEVEL_SIZE_RATIO 10
+
+/**
+ * The size in bytes at which the blocks of a run are cut
+ */
+#define LSM_BLOCK_SIZE 4096
+
+/**
+ * The default size in bytes at which a memtable is flushed
+ */
+#define DEFAULT_LSM_MEMTABLE_SIZE (4 * 1024 * 1024)
+
+/**
+ * The default number of runs in level 0 that triggers a compaction into level 1
+ */
+#define DEFAULT_LSM_LEVEL0_RUNS 4
+
+/**
+ * The default size in bytes of level 1, each deeper level is LSM_LEVEL_SIZE_RATIO times larger
+ */
+#define DEFAULT_LSM_LEVEL_BASE_SIZE (32 * 1024 * 1024)
+
+/**
+ * Options of an LSM tree
+ */
+struct lsm_options {
+  /**
+   * The size in bytes at which the memtable is frozen and flushed to a run
+   */
+  size_t memtable_size;
+
+  /**
+   * The number of runs in level 0 that triggers a compaction, at most MAX_LSM_LEVEL0_RUNS
+   */
+  size_t level0_runs;
+
+  /**
+   * The size in bytes of level 1 above which it is compacted into level 2
+   */
+  uint64_t level_base_size;
+
+  /**
+   * The number of Bloom filter bits per key of a run
+   */
+  unsigned int bloom_bits_per_key;
+};
+
+/**
+ * Counters of an LSM tree
+ */
+struct lsm_stats {
+  /**
+   * The number of memtables flushed to runs
+   */
+  uint64_t flushes;
+
+  /**
+   * The number of compactions
+   */
+  uint64_t compactions;
+
+  /**
+   * The number of bytes of runs written
+   */
+  uint64_t bytes_written;
+
+  /**
+   * The number of blocks read by lookups
+   */
+  uint64_t block_reads;
+
+  /**
+   * The number of runs a lookup skipped thanks to their Bloom filter
+   */
+  uint64_t bloom_skips;
+};
+
+struct lsm_memtable;
+struct lsm_version;
+
+/**
+ * A log-structured merge tree of keys and values in a directory, for tables taking far more writes than reads
+ * Writes go to a sorted in-memory memtable and its write-ahead log, full memtables are flushed to immutable sorted runs
+ * and a background thread compacts the runs level by level, so the files are only ever written sequentially
+ * Each run has a block index and a Bloom filter, a lookup reads at most one block per run its Bloom filter admits
+ */
+struct lsm {
+  /**
+   * The path of the directory
+   */
+  char path[MAX_LSM_PATH_LENGTH];
+
+  /**
+   * The options
+   */
+  struct lsm_options options;
+
+  /**
+   * The mutex protecting the memtables, the current version and the counters
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signaled when there is a memtable to flush or the tree should stop
+   */
+  pthread_cond_t work_cond;
+
+  /**
+   * Signaled when a memtable is flushed, a compaction ends or a write to a frozen memtable completes
+   */
+  pthread_cond_t done_cond;
+
+  /**
+   * The compaction thread
+   */
+  pthread_t thread;
+
+  /**
+   * The memtable receiving the writes
+   */
+  struct lsm_memtable * memtable;
+
+  /**
+   * The frozen memtable being flushed, or NULL
+   */
+  struct lsm_memtable * immutable;
+
+  /**
+   * The runs of the levels
+   */
+  struct lsm_version * version;
+
+  /**
+   * The number of the next file
+   */
+  uint64_t next_file;
+
+  /**
+   * Whether the compaction thread should stop
+   */
+  bool stopping;
+
+  /**
+   * Whether a flush or a compaction failed, after which writes are refused
+   */
+  bool failed;
+
+  /**
+   * The counters
+   */
+  struct lsm_stats stats;
+};
+
+/**
+ * Initializes LSM tree options with the defaults
+ * \param options the options
+ */
+void init_lsm_options(struct lsm_options * options);
+
+/**
+ * Opens an LSM tree, creating its directory if it does not exist, and starts its compaction thread
+ * The write-ahead logs of memtables that were not flushed are replayed and flushed
+ * \param lsm the LSM tree
+ * \param path the path of the directory
+ * \param options the options, or NULL for the defaults
+ * \return 0 on success, -1 on error
+ */
+int open_lsm(struct lsm * lsm, const char * path, const struct lsm_options * options);
+
+/**
+ * Sets the value of a key, durably once the call returns
+ * \param lsm the LSM tree
+ * \param key the bytes of the key
+ * \param len the length of the key, at most MAX_LSM_KEY_LENGTH
+ * \param value the bytes of the value
+ * \param value_len the length of the value, at most MAX_LSM_VALUE_LENGTH
+ * \return 0 on success, -1 on error
+ */
+int put_lsm_entry(struct lsm * lsm, const char * key, size_t len, const char * value, size_t value_len);
+
+/**
+ * Deletes a key, durably once the call returns
+ * \param lsm the LSM tree
+ * \param key the bytes of the key
+ * \param len the length of the key, at most MAX_LSM_KEY_LENGTH
+ * \return 0 on success, -1 on error
+ */
+int delete_lsm_entry(struct lsm * lsm, const char * key, size_t len);
+
+/**
+ * Finds the value of a key
+ * \param lsm the LSM tree
+ * \param key the bytes of the key
+ * \param len the length of the key
+ * \param value the destination buffer for the value
+ * \param size the size of the destination buffer
+ * \param value_len the destination for the length of the value
+ * \return 1 if the key was found, 0 if not, -1 on error or if the buffer is too small
+ */
+int get_lsm_entry(struct lsm * lsm, const char * key, size_t len, char * value, size_t size, size_t * value_len);
+
+/**
+ * Copies the counters of an LSM tree
+ * \param lsm the LSM tree
+ * \param stats the destination for the counters
+ */
+void get_lsm_stats(struct lsm * lsm, struct lsm_stats * stats);
+
+/**
+ * Waits until no memtable is waiting to be flushed and no level needs a compaction
+ * \param lsm the LSM tree
+ * \return 0 on success, -1 if a flush or a compaction failed
+ */
+int wait_for_lsm_compactions(struct lsm * lsm);
+
+/**
+ * Stops the compaction thread and closes an LSM tree, the memtables stay in their write-ahead logs
+ * \param lsm the LSM tree
+ * \return 0 on success, -1 on error
+ */
+int close_lsm(struct lsm * lsm);
+
+#endif
@@ -0,0 +1,200 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#include "lz.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The number of bits of the hash of the next bytes, indexing the table of their last positions
+ */
+#define LZ_HASH_BITS 12
+
+/**
+ * The value of a length field continued by the following bytes
+ */
+#define LZ_LENGTH_MASK 15
+
+size_t get_lz_bound(size_t len) {
+  return len + len / 255 + 16;
+}
+
+/**
+ * Writes the continuation bytes of a length field
+ * \param dest the destination
+ * \param capacity the size of the destination
+ * \param pos the position in the destination, advanced
+ * \param len the length minus LZ_LENGTH_MASK
+ * \return true on success, false if the destination is too small
+ */
+static bool write_lz_length(char * dest, size_t capacity, size_t * pos, size_t len) {
+  while(len >= 255) {
+    if(*pos == capacity) {
+      return false;
+    }
+    dest[(*pos)++] = (char) 255;
+    len -= 255;
+  }
+  if(*pos == capacity) {
+    return false;
+  }
+  dest[(*pos)++] = (char) len;
+  return true;
+}
+
+/**
+ * Writes a sequence of a compressed block
+ * \param dest the destination
+ * \param capacity the size of the destination
+ * \param pos the position in the destination, advanced
+ * \param literals the literal bytes
+ * \param literal_len the number of literal bytes
+ * \param offset the distance back to the match
+ * \param match_len the length of the match, 0 for the last sequence
+ * \return true on success, false if the destination is too small
+ */
+static bool write_lz_sequence(char * dest, size_t capacity, size_t * pos, const char * literals, size_t literal_len, size_t offset, size_t match_len) {
+  if(*pos == capacity) {
+    return false;
+  }
+  size_t match_field = match_len != 0 ? match_len - LZ_MIN_MATCH : 0;
+  dest[(*pos)++] = (char) (((literal_len < LZ_LENGTH_MASK ? literal_len : LZ_LENGTH_MASK) << 4)
+			   | (match_field < LZ_LENGTH_MASK ? match_field : LZ_LENGTH_MASK));
+  if(literal_len >= LZ_LENGTH_MASK && !write_lz_length(dest, capacity, pos, literal_len - LZ_LENGTH_MASK)) {
+    return false;
+  }
+  if(capacity - *pos < literal_len) {
+    return false;
+  }
+  memcpy(dest + *pos, literals, literal_len);
+  *pos += literal_len;
+  if(match_len == 0) {
+    return true;
+  }
+  if(capacity - *pos < 2) {
+    return false;
+  }
+  dest[(*pos)++] = (char) (offset & 0xff);
+  dest[(*pos)++] = (char) (offset >> 8);
+  return match_field < LZ_LENGTH_MASK || write_lz_length(dest, capacity, pos, match_field - LZ_LENGTH_MASK);
+}
+
+size_t compress_lz_block(const char * src, size_t len, char * dest, size_t capacity) {
+  assert(src != NULL || len == 0);
+  assert(dest != NULL);
+  assert(len <= MAX_LZ_BLOCK_LENGTH);
+
+  // The table holds the last position of each hash, a stale or colliding one fails the comparison
+  uint32_t positions[1 << LZ_HASH_BITS];
+  memset(positions, 0, sizeof(positions));
+  size_t pos = 0;
+  size_t anchor = 0;
+  size_t i = 0;
+  while(len >= LZ_MIN_MATCH && i <= len - LZ_MIN_MATCH) {
+    uint32_t bytes;
+    memcpy(&bytes, src + i, 4);
+    uint32_t hash = (bytes * 2654435761u) >> (32 - LZ_HASH_BITS);
+    size_t candidate = positions[hash];
+    positions[hash] = (uint32_t) i;
+    if(candidate >= i || i - candidate > LZ_MAX_OFFSET || memcmp(src + candidate, src + i, LZ_MIN_MATCH) != 0) {
+      ++i;
+      continue;
+    }
+    size_t match_len = LZ_MIN_MATCH;
+    while(i + match_len < len && src[candidate + match_len] == src[i + match_len]) {
+      ++match_len;
+    }
+    if(!write_lz_sequence(dest, capacity, &pos, src + anchor, i - anchor, i - candidate, match_len)) {
+      return 0;
+    }
+    i += match_len;
+    anchor = i;
+  }
+  if(!write_lz_sequence(dest, capacity, &pos, src + anchor, len - anchor, 0, 0)) {
+    return 0;
+  }
+  return pos;
+}
+
+/**
+ * Reads the continuation bytes of a length field
+ * \param src the compressed block
+ * \param len the length of the compressed block
+ * \param pos the position in the compressed block, advanced
+ * \param value the length, increased by the continuation bytes
+ * \return true on success, false if the compressed block ends first
+ */
+static bool read_lz_length(const unsigned char * src, size_t len, size_t * pos, size_t * value) {
+  unsigned char byte;
+  do {
+    if(*pos == len) {
+      return false;
+    }
+    byte = src[(*pos)++];
+    *value += byte;
+  } while(byte == 255);
+  return true;
+}
+
+int decompress_lz_block(const char * src, size_t len, char * dest, size_t dest_len) {
+  assert(src != NULL || len == 0);
+  assert(dest != NULL || dest_len == 0);
+
+  const unsigned char * in = (const unsigned char *) src;
+  size_t pos = 0;
+  size_t out = 0;
+  while(pos < len) {
+    unsigned char token = in[pos++];
+    size_t literal_len = token >> 4;
+    if(literal_len == LZ_LENGTH_MASK && !read_lz_length(in, len, &pos, &literal_len)) {
+      return -1;
+    }
+    if(literal_len > len - pos || literal_len > dest_len - out) {
+      return -1;
+    }
+    memcpy(dest + out, in + pos, literal_len);
+    pos += literal_len;
+    out += literal_len;
+    if(pos == len) {
+      break;
+    }
+
+    if(len - pos < 2) {
+      return -1;
+    }
+    size_t offset = (size_t) in[pos] | ((size_t) in[pos + 1] << 8);
+    pos += 2;
+    size_t match_len = token & LZ_LENGTH_MASK;
+    if(match_len == LZ_LENGTH_MASK && !read_lz_length(in, len, &pos, &match_len)) {
+      return -1;
+    }
+    match_len += LZ_MIN_MATCH;
+    if(offset == 0 || offset > out || match_len > dest_len - out) {
+      return -1;
+    }
+    // A match may overlap the bytes it produces, repeating a short pattern
+    const char * from = dest + out - offset;
+    if(offset >= match_len) {
+      memcpy(dest + out, from, match_len);
+    } else {
+      for(size_t i = 0; i < match_len; ++i) {
+	dest[out + i] = from[i];
+      }
+    }
+    out += match_len;
+  }
+  return out == dest_len ? 0 : -1;
+}
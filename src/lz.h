@@ -0,0 +1,64 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The length of the shortest match a compressed block refers back to
+ */
+#define LZ_MIN_MATCH 4
+
+/**
+ * The largest distance of a match, which is stored in 2 bytes
+ */
+#define LZ_MAX_OFFSET 65535
+
+/**
+ * The largest block that can be compressed, positions being kept as 32 bit integers
+ */
+#define MAX_LZ_BLOCK_LENGTH UINT32_MAX
+
+/**
+ * Finds the largest compressed length of a block, when none of it matches
+ * \param len the length of the block
+ * \return the length of the compressed block at most
+ */
+size_t get_lz_bound(size_t len);
+
+/**
+ * Compresses a block as sequences of literal bytes each followed by a match with earlier bytes, in the manner of LZ4
+ * A sequence is a token holding the literal length in its high 4 bits and the match length minus LZ_MIN_MATCH in its low 4 bits,
+ * a length of 15 being continued by bytes added to it up to the first one below 255, then the literals,
+ * then the distance back to the match in 2 bytes, low byte first, the last sequence having no match
+ * \param src the block
+ * \param len the length of the block, at most MAX_LZ_BLOCK_LENGTH
+ * \param dest the destination for the compressed block
+ * \param capacity the size of the destination
+ * \return the length of the compressed block, 0 if it does not fit the destination
+ */
+size_t compress_lz_block(const char * src, size_t len, char * dest, size_t capacity);
+
+/**
+ * Decompresses a block, checking that every length and distance stays within the buffers
+ * \param src the compressed block
+ * \param len the length of the compressed block
+ * \param dest the destination for the block
+ * \param dest_len the length of the block
+ * \return 0 on success, -1 if the compressed block is invalid or does not decompress to dest_len bytes
+ */
+int decompress_lz_block(const char * src, size_t len, char * dest, size_t dest_len);
+
+#endif
@@ -10,6 +10,8 @@
  * If not, see <https://www.gnu.org/licenses/>. 
  */
 
+#define LOG_MODULE "main"
+
 #include "logger.h"
 #include "regex.h"
 
@@ -34,6 +36,23 @@ static int read_regex_file() {
   return 0;
 }
 
+/**
+ * Starts the logger, writing to the log file if one is passed as the first argument or to stdout otherwise
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return 0 on success, -1 on error
+ */
+static int start_main_logger(int arg_count, const char * args[]) {
+  if(arg_count > 1) {
+    struct log_file_options options;
+    init_log_file_options(&options, args[1]);
+    options.durability = LOG_DURABILITY_ERROR;
+    return start_file_logger(&options, LOG_LEVEL_DEBUG);
+  } else {
+    return start_logger(stdout, LOG_LEVEL_DEBUG);
+  }
+}
+
 /**
  * The main entry point of the application
  */
@@ -41,7 +60,7 @@ int main(int arg_count, const char * args[]) {
 
   int result;
   
-  if(start_logger(stdout, LOG_LEVEL_DEBUG) != 0) {
+  if(start_main_logger(arg_count, args) != 0) {
     fputs("could not start logger", stdout);
     return EXIT_FAILURE;
   }
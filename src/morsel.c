@@ -0,0 +1,220 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "morsel"
+
+#include "morsel.h"
+#include "logger.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+/**
+ * Takes a morsel of a job, from the queue of the worker first and then from the back of the queues of the others
+ * \param job the job
+ * \param worker the index of the worker
+ * \param worker_count the number of workers
+ * \param morsel the destination for the index of the morsel
+ * \return true if a morsel was taken, false if every morsel has been
+ */
+static bool take_morsel(struct morsel_job * job, size_t worker, size_t worker_count, size_t * morsel) {
+  struct morsel_queue * q = &job->queues[worker];
+  pthread_mutex_lock(&q->mutex);
+  bool taken = q->begin < q->end;
+  if(taken) {
+    *morsel = q->begin++;
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  // Stealing from the back leaves the victim the morsels next to the one it is working on
+  for(size_t i = 1; i < worker_count && !taken; ++i) {
+    q = &job->queues[(worker + i) % worker_count];
+    pthread_mutex_lock(&q->mutex);
+    taken = q->begin < q->end;
+    if(taken) {
+      *morsel = --q->end;
+    }
+    pthread_mutex_unlock(&q->mutex);
+  }
+  return taken;
+}
+
+/**
+ * Processes the morsels of the running jobs until the scheduler stops
+ * \param arg the worker
+ * \return NULL
+ */
+static void * run_morsel_worker(void * arg) {
+  struct morsel_worker * w = (struct morsel_worker *) arg;
+  struct morsel_scheduler * s = w->scheduler;
+  pthread_mutex_lock(&s->mutex);
+  while(true) {
+    struct morsel_job ** link = &s->jobs;
+    while(*link != NULL && (*link)->drained) {
+      link = &(*link)->next;
+    }
+    struct morsel_job * job = *link;
+    if(job == NULL) {
+      if(s->stopping) {
+	break;
+      }
+      pthread_cond_wait(&s->work_cond, &s->mutex);
+      continue;
+    }
+
+    // Moving the job to the back makes the next worker serve the next job, so the jobs get a morsel each in turn
+    *link = job->next;
+    job->next = NULL;
+    for(link = &s->jobs; *link != NULL; link = &(*link)->next) {
+    }
+    *link = job;
+    ++job->running;
+    pthread_mutex_unlock(&s->mutex);
+
+    size_t morsel;
+    int result = 0;
+    bool taken = take_morsel(job, w->index, s->worker_count, &morsel);
+    if(taken) {
+      result = job->function(job->context, w->index, morsel);
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    if(!taken || result != 0) {
+      job->drained = true;
+    }
+    if(result < 0) {
+      job->failed = true;
+    }
+    if(--job->running == 0 && job->drained) {
+      pthread_cond_broadcast(&s->done_cond);
+    }
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return NULL;
+}
+
+int start_morsel_scheduler(struct morsel_scheduler * s, size_t worker_count) {
+  assert(s != NULL);
+
+  memset(s, 0, sizeof(struct morsel_scheduler));
+  if(worker_count == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = online > 0 ? (size_t) online : 1;
+  }
+  s->worker_count = worker_count < MAX_MORSEL_WORKERS ? worker_count : MAX_MORSEL_WORKERS;
+
+  int result = pthread_mutex_init(&s->mutex, NULL);
+  if(result == 0) {
+    result = pthread_cond_init(&s->work_cond, NULL);
+    if(result == 0) {
+      result = pthread_cond_init(&s->done_cond, NULL);
+      if(result != 0) {
+	pthread_cond_destroy(&s->work_cond);
+      }
+    }
+    if(result != 0) {
+      pthread_mutex_destroy(&s->mutex);
+    }
+  }
+  if(result != 0) {
+    LOG_ERROR("could not initialize scheduler mutex: %s", strerror(result));
+    return -1;
+  }
+  for(size_t i = 0; i < s->worker_count; ++i) {
+    s->workers[i].scheduler = s;
+    s->workers[i].index = i;
+    result = pthread_create(&s->workers[i].thread, NULL, run_morsel_worker, &s->workers[i]);
+    if(result != 0) {
+      LOG_ERROR("could not start worker %zu: %s", i, strerror(result));
+      stop_morsel_scheduler(s);
+      return -1;
+    }
+    ++s->started;
+  }
+  return 0;
+}
+
+int run_morsel_job(struct morsel_scheduler * s, size_t count, morsel_function function, void * context) {
+  assert(s != NULL);
+  assert(function != NULL);
+
+  if(count == 0) {
+    return 0;
+  }
+  struct morsel_job * job = (struct morsel_job *) malloc(sizeof(struct morsel_job));
+  if(job == NULL) {
+    LOG_ERROR("could not allocate job");
+    return -1;
+  }
+  job->function = function;
+  job->context = context;
+  job->drained = false;
+  job->running = 0;
+  job->failed = false;
+  job->next = NULL;
+  for(size_t i = 0; i < s->worker_count; ++i) {
+    int result = pthread_mutex_init(&job->queues[i].mutex, NULL);
+    if(result != 0) {
+      LOG_ERROR("could not initialize queue mutex: %s", strerror(result));
+      while(i-- > 0) {
+	pthread_mutex_destroy(&job->queues[i].mutex);
+      }
+      free(job);
+      return -1;
+    }
+    // Consecutive ranges keep each worker on its own part of the table, and on the memory it touched first
+    job->queues[i].begin = i * count / s->worker_count;
+    job->queues[i].end = (i + 1) * count / s->worker_count;
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  struct morsel_job ** link = &s->jobs;
+  while(*link != NULL) {
+    link = &(*link)->next;
+  }
+  *link = job;
+  pthread_cond_broadcast(&s->work_cond);
+  while(!job->drained || job->running != 0) {
+    pthread_cond_wait(&s->done_cond, &s->mutex);
+  }
+  for(link = &s->jobs; *link != job; link = &(*link)->next) {
+  }
+  *link = job->next;
+  pthread_mutex_unlock(&s->mutex);
+
+  bool failed = job->failed;
+  for(size_t i = 0; i < s->worker_count; ++i) {
+    pthread_mutex_destroy(&job->queues[i].mutex);
+  }
+  free(job);
+  return failed ? -1 : 0;
+}
+
+void stop_morsel_scheduler(struct morsel_scheduler * s) {
+  assert(s != NULL);
+
+  pthread_mutex_lock(&s->mutex);
+  assert(s->jobs == NULL);
+  s->stopping = true;
+  pthread_cond_broadcast(&s->work_cond);
+  pthread_mutex_unlock(&s->mutex);
+  for(size_t i = 0; i < s->started; ++i) {
+    pthread_join(s->workers[i].thread, NULL);
+  }
+  pthread_cond_destroy(&s->done_cond);
+  pthread_cond_destroy(&s->work_cond);
+  pthread_mutex_destroy(&s->mutex);
+}
@@ -0,0 +1,187 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef MORSEL_H
+#define MORSEL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The maximum number of worker threads of a scheduler
+ */
+#define MAX_MORSEL_WORKERS 256
+
+/**
+ * A function processing one morsel of a job, called concurrently from the worker threads
+ * \param context the context given to run_morsel_job
+ * \param worker the index of the worker thread, for per-worker state
+ * \param morsel the index of the morsel
+ * \return 0 to continue, 1 if the job needs no more morsels, -1 to fail the job
+ */
+typedef int (*morsel_function)(void * context, size_t worker, size_t morsel);
+
+/**
+ * The morsels of a job assigned to a worker, consecutive so the worker keeps reading neighbouring data
+ * The worker takes them from the front and idle workers steal them from the back
+ */
+struct morsel_queue {
+  /**
+   * The mutex protecting the bounds
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * The next morsel the worker takes
+   */
+  size_t begin;
+
+  /**
+   * One past the last morsel, the next one stolen
+   */
+  size_t end;
+};
+
+/**
+ * A job of a scheduler, processing numbered morsels
+ */
+struct morsel_job {
+  /**
+   * The function processing a morsel
+   */
+  morsel_function function;
+
+  /**
+   * The context of the function
+   */
+  void * context;
+
+  /**
+   * The queues of the workers
+   */
+  struct morsel_queue queues[MAX_MORSEL_WORKERS];
+
+  /**
+   * Whether every morsel has been taken or the job was stopped, so the workers pass it over
+   */
+  bool drained;
+
+  /**
+   * The number of workers processing a morsel of the job
+   */
+  size_t running;
+
+  /**
+   * Whether a morsel failed
+   */
+  bool failed;
+
+  /**
+   * The next job the workers take morsels from
+   */
+  struct morsel_job * next;
+};
+
+/**
+ * A worker thread of a scheduler
+ */
+struct morsel_worker {
+  /**
+   * The scheduler
+   */
+  struct morsel_scheduler * scheduler;
+
+  /**
+   * The index of the worker
+   */
+  size_t index;
+
+  /**
+   * The thread
+   */
+  pthread_t thread;
+};
+
+/**
+ * A pool of worker threads executing jobs split into morsels
+ * The workers take turns between the running jobs a morsel at a time, so concurrent jobs share them evenly
+ */
+struct morsel_scheduler {
+  /**
+   * The mutex protecting the jobs
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signaled when a job is added or the scheduler should stop
+   */
+  pthread_cond_t work_cond;
+
+  /**
+   * Signaled when the last worker of a drained job leaves it
+   */
+  pthread_cond_t done_cond;
+
+  /**
+   * The worker threads
+   */
+  struct morsel_worker workers[MAX_MORSEL_WORKERS];
+
+  /**
+   * The number of worker threads
+   */
+  size_t worker_count;
+
+  /**
+   * The number of worker threads started, to be joined
+   */
+  size_t started;
+
+  /**
+   * The running jobs, the head being the next one a worker takes a morsel from
+   */
+  struct morsel_job * jobs;
+
+  /**
+   * Whether the workers should stop
+   */
+  bool stopping;
+};
+
+/**
+ * Starts the worker threads of a scheduler
+ * \param s the scheduler
+ * \param worker_count the number of worker threads, 0 for one per online processor
+ * \return 0 on success, -1 on error
+ */
+int start_morsel_scheduler(struct morsel_scheduler * s, size_t worker_count);
+
+/**
+ * Processes morsels on the worker threads of a scheduler and waits until they are done
+ * Worker w first takes the morsels from w * count / workers on, then steals from the others
+ * \param s the scheduler
+ * \param count the number of morsels
+ * \param function the function processing a morsel
+ * \param context the context of the function
+ * \return 0 on success, -1 if a morsel failed
+ */
+int run_morsel_job(struct morsel_scheduler * s, size_t count, morsel_function function, void * context);
+
+/**
+ * Stops the worker threads of a scheduler, which must have no running job
+ * \param s the scheduler
+ */
+void stop_morsel_scheduler(struct morsel_scheduler * s);
+
+#endif
@@ -0,0 +1,1260 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "query"
+
+#include "query.h"
+#include "bitpack.h"
+#include "filter.h"
+#include "logger.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+/**
+ * A value of an indexed column and its row, sorted before bulk loading the index
+ */
+struct query_index_entry {
+  /**
+   * The key of the value
+   */
+  const char * key;
+
+  /**
+   * The length of the key
+   */
+  size_t len;
+
+  /**
+   * The row
+   */
+  uint64_t row;
+};
+
+/**
+ * The sorted entries fed to the bulk load of an index
+ */
+struct query_index_source {
+  /**
+   * The entries
+   */
+  const struct query_index_entry * entries;
+
+  /**
+   * The number of entries
+   */
+  size_t count;
+
+  /**
+   * The next entry
+   */
+  size_t next;
+};
+
+/**
+ * Checks the type of a token
+ * \param tokens the tokens
+ * \param count the number of tokens
+ * \param index the index of the token
+ * \param type the expected type
+ * \param name the name of the expected token for messages
+ * \return 0 if the token has the type, -1 otherwise
+ */
+static int expect_query_token(const struct lexer_token * tokens, size_t count, size_t index, enum lexer_token_type type, const char * name) {
+  if(index >= count) {
+    LOG_ERROR("expected %s at the end of the query", name);
+    return -1;
+  }
+  if(tokens[index].type != type) {
+    LOG_ERROR("expected %s instead of %.*s", name, (int) tokens[index].len, tokens[index].text);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Removes the quotes around a literal
+ * \param literal the literal token
+ */
+static void strip_query_quotes(struct lexer_token * literal) {
+  if(literal->len >= 2 && literal->text[0] == '\'' && literal->text[literal->len - 1] == '\'') {
+    ++literal->text;
+    literal->len -= 2;
+  }
+}
+
+/**
+ * Parses the text of a literal as an integer
+ * \param literal the literal token, without quotes
+ * \param value the destination for the integer
+ * \return 0 on success, -1 if the literal is not an integer
+ */
+static int parse_query_integer(const struct lexer_token * literal, int64_t * value) {
+  char text[32];
+  if(literal->len == 0 || literal->len >= sizeof(text)) {
+    LOG_ERROR("invalid integer %.*s", (int) literal->len, literal->text);
+    return -1;
+  }
+  memcpy(text, literal->text, literal->len);
+  text[literal->len] = '\0';
+  char * end;
+  errno = 0;
+  long long result = strtoll(text, &end, 10);
+  if(errno != 0 || *end != '\0') {
+    LOG_ERROR("invalid integer %s", text);
+    return -1;
+  }
+  *value = (int64_t) result;
+  return 0;
+}
+
+int parse_query(struct query * q, const struct lexer_token * tokens, size_t count) {
+  assert(q != NULL);
+  assert(tokens != NULL || count == 0);
+
+  memset(q, 0, sizeof(struct query));
+  if(expect_query_token(tokens, count, 0, LEXER_TOKEN_TYPE_SELECT, "SELECT") != 0
+     || expect_query_token(tokens, count, 1, LEXER_TOKEN_TYPE_IDENTIFIER, "a column") != 0
+     || expect_query_token(tokens, count, 2, LEXER_TOKEN_TYPE_FROM, "FROM") != 0
+     || expect_query_token(tokens, count, 3, LEXER_TOKEN_TYPE_IDENTIFIER, "a table") != 0) {
+    return -1;
+  }
+  q->column = tokens[1];
+  q->table = tokens[3];
+  size_t index = 4;
+  if(index < count && tokens[index].type == LEXER_TOKEN_TYPE_WHERE) {
+    if(expect_query_token(tokens, count, index + 1, LEXER_TOKEN_TYPE_IDENTIFIER, "a column") != 0
+       || expect_query_token(tokens, count, index + 2, LEXER_TOKEN_TYPE_EQUALS, "=") != 0
+       || expect_query_token(tokens, count, index + 3, LEXER_TOKEN_TYPE_STRING_LITERAL, "a string") != 0) {
+      return -1;
+    }
+    q->filtered = true;
+    q->filter_column = tokens[index + 1];
+    q->literal = tokens[index + 3];
+    strip_query_quotes(&q->literal);
+    index += 4;
+  }
+  if(index < count && tokens[index].type == LEXER_TOKEN_TYPE_LIMIT) {
+    if(expect_query_token(tokens, count, index + 1, LEXER_TOKEN_TYPE_STRING_LITERAL, "a count") != 0) {
+      return -1;
+    }
+    struct lexer_token literal = tokens[index + 1];
+    strip_query_quotes(&literal);
+    int64_t limit;
+    if(parse_query_integer(&literal, &limit) != 0) {
+      return -1;
+    }
+    if(limit < 0) {
+      LOG_ERROR("negative limit %" PRId64, limit);
+      return -1;
+    }
+    q->limited = true;
+    q->limit = (uint64_t) limit;
+    index += 2;
+  }
+  if(index < count) {
+    LOG_ERROR("unexpected %.*s at the end of the query", (int) tokens[index].len, tokens[index].text);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Builds the path of an index file of a column
+ * \param dest the destination buffer of MAX_TABLE_PATH_LENGTH bytes
+ * \param t the table
+ * \param column the index of the column
+ * \param suffix the suffix of the kind of index
+ * \return 0 on success, -1 if the path is too long
+ */
+static int get_table_index_path(char * dest, const struct table * t, size_t column, const char * suffix) {
+  const char * name = t->schema.columns[column].name;
+  int len = snprintf(dest, MAX_TABLE_PATH_LENGTH, "%s/%s%s", t->path, name, suffix);
+  if(len < 0 || len >= MAX_TABLE_PATH_LENGTH) {
+    LOG_ERROR("index path too long for column %s", name);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Compares two index entries by key and then by row
+ * \param a the first entry
+ * \param b the second entry
+ * \return less than, equal to or greater than 0 if the first entry is less than, equal to or greater than the second
+ */
+static int compare_query_index_entries(const void * a, const void * b) {
+  const struct query_index_entry * x = (const struct query_index_entry *) a;
+  const struct query_index_entry * y = (const struct query_index_entry *) b;
+  int result = memcmp(x->key, y->key, x->len < y->len ? x->len : y->len);
+  if(result != 0) {
+    return result;
+  }
+  if(x->len != y->len) {
+    return x->len < y->len ? -1 : 1;
+  }
+  return x->row < y->row ? -1 : (x->row > y->row ? 1 : 0);
+}
+
+/**
+ * Returns the next sorted index entry for a bulk load
+ * \param context the query_index_source
+ * \param entry the destination for the entry
+ * \return 1 for an entry, 0 at the end
+ */
+static int next_query_index_entry(void * context, struct btree_entry * entry) {
+  struct query_index_source * source = (struct query_index_source *) context;
+  if(source->next == source->count) {
+    return 0;
+  }
+  const struct query_index_entry * e = &source->entries[source->next++];
+  entry->key = e->key;
+  entry->len = e->len;
+  entry->value = e->row;
+  return 1;
+}
+
+/**
+ * Reads the values of a column as index entries
+ * \param t the table
+ * \param column the index of the column
+ * \param entries the destination for the entries, to free
+ * \param keys the destination for the encoded integer keys, to free
+ * \param count the destination for the number of entries
+ * \return 0 on success, -1 on error
+ */
+static int read_query_index_entries(struct table * t, size_t column, struct query_index_entry ** entries, char ** keys, size_t * count) {
+  size_t rows = (size_t) t->row_count;
+  bool integers = t->schema.columns[column].type == TABLE_COLUMN_INT64;
+  *entries = (struct query_index_entry *) malloc((rows != 0 ? rows : 1) * sizeof(struct query_index_entry));
+  *keys = integers ? (char *) malloc((rows != 0 ? rows : 1) * BTREE_INTEGER_KEY_LENGTH) : NULL;
+  if(*entries == NULL || (integers && *keys == NULL)) {
+    LOG_ERROR("could not allocate index entries for column %s", t->schema.columns[column].name);
+    free(*entries);
+    free(*keys);
+    return -1;
+  }
+
+  // String keys point into the table, integers are decoded a batch at a time and encoded to sort as bytes
+  size_t n = 0;
+  int64_t values[QUERY_BATCH_SIZE];
+  for(size_t group = 0; group < t->row_group_count; ++group) {
+    struct table_chunk chunk;
+    if(read_table_chunk(t, column, group, &chunk) != 0) {
+      free(*entries);
+      free(*keys);
+      return -1;
+    }
+    for(size_t i = 0; i < chunk.rows && n < rows; ++i, ++n) {
+      struct query_index_entry * e = &(*entries)[n];
+      e->row = chunk.first_row + i;
+      if(integers) {
+	if(i % QUERY_BATCH_SIZE == 0) {
+	  decode_table_integers(&chunk, i, chunk.rows - i < QUERY_BATCH_SIZE ? chunk.rows - i : QUERY_BATCH_SIZE, values);
+	}
+	e->key = *keys + n * BTREE_INTEGER_KEY_LENGTH;
+	e->len = BTREE_INTEGER_KEY_LENGTH;
+	encode_btree_integer(values[i % QUERY_BATCH_SIZE], *keys + n * BTREE_INTEGER_KEY_LENGTH);
+      } else {
+	e->key = get_table_string(&chunk, i, &e->len);
+      }
+    }
+  }
+  *count = n;
+  return 0;
+}
+
+int create_table_index(struct table * t, size_t column, struct buffer_pool * pool) {
+  assert(t != NULL);
+  assert(column < t->schema.column_count);
+  assert(pool != NULL);
+
+  char path[MAX_TABLE_PATH_LENGTH];
+  struct query_index_entry * entries;
+  char * keys;
+  size_t count;
+  if(get_table_index_path(path, t, column, TABLE_INDEX_FILE_SUFFIX) != 0 || read_query_index_entries(t, column, &entries, &keys, &count) != 0) {
+    return -1;
+  }
+  qsort(entries, count, sizeof(struct query_index_entry), compare_query_index_entries);
+
+  int result = 0;
+  if(unlink(path) != 0 && errno != ENOENT) {
+    LOG_ERROR("could not remove index %s: %s", path, strerror(errno));
+    result = -1;
+  }
+  struct btree index;
+  if(result == 0 && (result = open_btree(&index, pool, path)) == 0) {
+    struct query_index_source source = {entries, count, 0};
+    result = load_btree(&index, next_query_index_entry, &source);
+    if(close_btree(&index) != 0) {
+      result = -1;
+    }
+    if(result != 0) {
+      unlink(path);
+    }
+  }
+  free(entries);
+  free(keys);
+  return result;
+}
+
+int create_table_hash_index(struct table * t, size_t column, struct buffer_pool * pool) {
+  assert(t != NULL);
+  assert(column < t->schema.column_count);
+  assert(pool != NULL);
+
+  char path[MAX_TABLE_PATH_LENGTH];
+  struct query_index_entry * entries;
+  char * keys;
+  size_t count;
+  if(get_table_index_path(path, t, column, TABLE_HASH_INDEX_FILE_SUFFIX) != 0 || read_query_index_entries(t, column, &entries, &keys, &count) != 0) {
+    return -1;
+  }
+  int result = 0;
+  if(unlink(path) != 0 && errno != ENOENT) {
+    LOG_ERROR("could not remove hash index %s: %s", path, strerror(errno));
+    result = -1;
+  }
+  struct hash_index index;
+  if(result == 0 && (result = open_hash_index(&index, pool, path)) == 0) {
+    for(size_t i = 0; i < count && result == 0; ++i) {
+      result = insert_hash_entry(&index, entries[i].key, entries[i].len, entries[i].row);
+    }
+    if(close_hash_index(&index) != 0) {
+      result = -1;
+    }
+    if(result != 0) {
+      unlink(path);
+    }
+  }
+  free(entries);
+  free(keys);
+  return result;
+}
+
+int create_hot_table_index(struct query_hot_index * hot, struct table * t, size_t column) {
+  assert(hot != NULL);
+  assert(t != NULL);
+  assert(column < t->schema.column_count);
+
+  memset(hot, 0, sizeof(struct query_hot_index));
+  memcpy(hot->path, t->path, sizeof(hot->path));
+  hot->column = column;
+  struct query_index_entry * entries;
+  char * keys;
+  size_t count;
+  if(read_query_index_entries(t, column, &entries, &keys, &count) != 0) {
+    return -1;
+  }
+  int result = init_memory_hash_index(&hot->index, count);
+  for(size_t i = 0; i < count && result == 0; ++i) {
+    result = insert_memory_hash_entry(&hot->index, entries[i].key, entries[i].len, entries[i].row);
+  }
+  if(result != 0) {
+    dispose_memory_hash_index(&hot->index);
+  }
+  free(entries);
+  free(keys);
+  return result;
+}
+
+void dispose_hot_table_index(struct query_hot_index * hot) {
+  assert(hot != NULL);
+
+  dispose_memory_hash_index(&hot->index);
+}
+
+/**
+ * Finds a column of the table of a plan by name
+ * \param plan the plan
+ * \param name the name token
+ * \param column the destination for the index of the column
+ * \return 0 on success, -1 if there is no such column
+ */
+static int find_query_column(struct query_plan * plan, const struct lexer_token * name, size_t * column) {
+  int index = name->len < MAX_TABLE_NAME_LENGTH ? find_table_column(&plan->table, name->text, name->len) : -1;
+  if(index < 0) {
+    LOG_ERROR("no column %.*s in table %s", (int) name->len, name->text, plan->table.path);
+    return -1;
+  }
+  *column = (size_t) index;
+  return 0;
+}
+
+/**
+ * Converts the literal of a query to the type of the filter column and, if it fits, to an index key
+ * \param plan the plan
+ * \param literal the literal token
+ * \return 0 on success, -1 if the literal does not fit the column
+ */
+static int convert_query_literal(struct query_plan * plan, const struct lexer_token * literal) {
+  if(plan->table.schema.columns[plan->filter_column].type == TABLE_COLUMN_STRING) {
+    plan->literal.text = literal->text;
+    plan->literal.len = literal->len;
+    if(literal->len <= MAX_BTREE_KEY_LENGTH) {
+      memcpy(plan->key, literal->text, literal->len);
+      plan->key_len = literal->len;
+    }
+    return 0;
+  }
+  if(parse_query_integer(literal, &plan->literal.integer) != 0) {
+    return -1;
+  }
+  encode_btree_integer(plan->literal.integer, plan->key);
+  plan->key_len = BTREE_INTEGER_KEY_LENGTH;
+  return 0;
+}
+
+int plan_query(struct query_plan * plan, const struct query * q, const char * dir, struct buffer_pool * pool, const struct query_hot_index * hot, size_t hot_count) {
+  assert(plan != NULL);
+  assert(q != NULL);
+  assert(dir != NULL);
+  assert(pool != NULL);
+  assert(hot != NULL || hot_count == 0);
+
+  memset(plan, 0, sizeof(struct query_plan));
+  plan->access = QUERY_ACCESS_SCAN;
+  plan->limit = q->limited ? q->limit : UINT64_MAX;
+  if(open_named_table(&plan->table, dir, q->table.text, q->table.len) != 0) {
+    return -1;
+  }
+  if(find_query_column(plan, &q->column, &plan->column) != 0) {
+    close_table(&plan->table);
+    return -1;
+  }
+  if(!q->filtered) {
+    return 0;
+  }
+  plan->filtered = true;
+  if(find_query_column(plan, &q->filter_column, &plan->filter_column) != 0 || convert_query_literal(plan, &q->literal) != 0) {
+    close_table(&plan->table);
+    return -1;
+  }
+
+  // A literal longer than an index key is only found by scanning, which has no limit on its length
+  if(plan->literal.len > MAX_BTREE_KEY_LENGTH) {
+    return 0;
+  }
+
+  // An equality on an indexed column reads a few pages of the index instead of the whole column,
+  // a hash index reads the bucket page where a B+tree reads a page per level
+  for(size_t i = 0; i < hot_count; ++i) {
+    if(hot[i].column == plan->filter_column && strcmp(hot[i].path, plan->table.path) == 0) {
+      plan->memory = &hot[i].index;
+      plan->access = QUERY_ACCESS_MEMORY_HASH;
+      return 0;
+    }
+  }
+  char path[MAX_TABLE_PATH_LENGTH];
+  if(get_table_index_path(path, &plan->table, plan->filter_column, TABLE_HASH_INDEX_FILE_SUFFIX) == 0 && access(path, F_OK) == 0) {
+    if(open_hash_index(&plan->hash, pool, path) == 0) {
+      plan->access = QUERY_ACCESS_HASH;
+      return 0;
+    }
+    LOG_WARNING("could not open hash index %s", path);
+  }
+  if(get_table_index_path(path, &plan->table, plan->filter_column, TABLE_INDEX_FILE_SUFFIX) == 0 && access(path, F_OK) == 0) {
+    if(open_btree(&plan->btree, pool, path) == 0) {
+      plan->access = QUERY_ACCESS_BTREE;
+      return 0;
+    }
+    LOG_WARNING("could not open index %s", path);
+  }
+  return 0;
+}
+
+/**
+ * Compares two rows
+ * \param a the first row
+ * \param b the second row
+ * \return a negative number, 0 or a positive number if a is before, at or after b
+ */
+static int compare_query_rows(const void * a, const void * b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * Looks up the literal in the hash index of a plan and sorts the rows found
+ * A hash index returns the rows in the order of its bucket chains, sorting them makes a LIMIT keep the first rows of the table
+ * like the other plans
+ * \param plan the plan
+ * \return 0 on success, -1 on error
+ */
+static int find_query_hash_rows(struct query_plan * plan) {
+  struct hash_index_cursor hash;
+  struct memory_hash_cursor memory;
+  if(plan->access == QUERY_ACCESS_HASH) {
+    if(find_hash_entries(&plan->hash, plan->key, plan->key_len, &hash) != 0) {
+      return -1;
+    }
+  } else {
+    find_memory_hash_entries(plan->memory, plan->key, plan->key_len, &memory);
+  }
+
+  size_t size = QUERY_BATCH_SIZE;
+  size_t count = 0;
+  uint64_t * rows = (uint64_t *) malloc(size * sizeof(uint64_t));
+  int result = rows != NULL ? 1 : -1;
+  while(result == 1) {
+    if(count == size) {
+      uint64_t * grown = (uint64_t *) realloc(rows, size * 2 * sizeof(uint64_t));
+      if(grown == NULL) {
+	result = -1;
+	break;
+      }
+      rows = grown;
+      size *= 2;
+    }
+    result = plan->access == QUERY_ACCESS_HASH ? next_hash_value(&hash, &rows[count]) : next_memory_hash_value(&memory, &rows[count]);
+    if(result == 1) {
+      ++count;
+    }
+  }
+  if(result < 0) {
+    LOG_ERROR("could not collect the rows of %s found in the hash index", plan->table.path);
+    free(rows);
+    return -1;
+  }
+  qsort(rows, count, sizeof(uint64_t), compare_query_rows);
+  plan->index_rows = rows;
+  plan->index_row_count = count;
+  return 0;
+}
+
+int open_query_cursor(struct query_cursor * cursor, struct query_plan * plan) {
+  assert(cursor != NULL);
+  assert(plan != NULL);
+
+  memset(cursor, 0, sizeof(struct query_cursor));
+  cursor->plan = plan;
+  cursor->end_row = plan->table.row_count;
+  cursor->group = SIZE_MAX;
+  switch(plan->access) {
+  case QUERY_ACCESS_BTREE:
+    return seek_btree(&plan->btree, plan->key, plan->key_len, &cursor->btree);
+  case QUERY_ACCESS_HASH:
+  case QUERY_ACCESS_MEMORY_HASH:
+    return plan->index_rows != NULL ? 0 : find_query_hash_rows(plan);
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Reads the chunks of the row group of a row if they are not the current ones
+ * \param cursor the cursor
+ * \param row the row
+ * \param filter whether the chunk of the filter column is needed
+ * \return 0 on success, -1 on error
+ */
+static int load_query_chunks(struct query_cursor * cursor, uint64_t row, bool filter) {
+  struct query_plan * plan = cursor->plan;
+  size_t group = (size_t) (row / plan->table.row_group_size);
+  if(group == cursor->group) {
+    return 0;
+  }
+  if(group >= plan->table.row_group_count) {
+    LOG_ERROR("row %" PRIu64 " out of range in table %s", row, plan->table.path);
+    return -1;
+  }
+  if(read_table_chunk(&plan->table, plan->column, group, &cursor->chunk) != 0) {
+    return -1;
+  }
+  if(filter && read_table_chunk(&plan->table, plan->filter_column, group, &cursor->filter_chunk) != 0) {
+    return -1;
+  }
+  const struct table_chunk * f = &cursor->filter_chunk;
+  if(filter && f->type == TABLE_COLUMN_STRING) {
+    // The literal is looked up once per row group, the rows are then matched on their codes
+    cursor->filter_present = find_table_code(f, plan->literal.text, plan->literal.len, &cursor->filter_code);
+  } else if(filter && f->encoding == TABLE_ENCODING_FRAME_OF_REFERENCE) {
+    // Likewise the literal is moved into the frame, the rows are then matched on their packed differences
+    uint64_t difference = (uint64_t) plan->literal.integer - (uint64_t) f->base;
+    cursor->filter_present = plan->literal.integer >= f->base && difference <= (UINT64_C(1) << f->code_bits) - 1;
+    cursor->filter_code = (uint32_t) difference;
+  }
+  cursor->group = group;
+  return 0;
+}
+
+/**
+ * Finds the next row matching the literal in the index of a plan
+ * \param cursor the cursor
+ * \param row the destination for the row
+ * \return 1 if there was a row, 0 at the end, -1 on error
+ */
+static int next_query_index_row(struct query_cursor * cursor, uint64_t * row) {
+  struct query_plan * plan = cursor->plan;
+  switch(plan->access) {
+  case QUERY_ACCESS_BTREE: {
+    char key[MAX_BTREE_KEY_LENGTH];
+    size_t len;
+    int result = next_btree_entry(&cursor->btree, key, sizeof(key), &len, row);
+    if(result == 1 && (len != plan->key_len || memcmp(key, plan->key, len) != 0)) {
+      return 0;
+    }
+    return result;
+  }
+  case QUERY_ACCESS_HASH:
+  case QUERY_ACCESS_MEMORY_HASH:
+    if(cursor->index_row == plan->index_row_count) {
+      return 0;
+    }
+    *row = plan->index_rows[cursor->index_row++];
+    return 1;
+  default:
+    return -1;
+  }
+}
+
+/**
+ * The scan operator, taking the next consecutive rows of a row group as the batch
+ * \param cursor the cursor
+ * \param max the maximum number of rows
+ * \return 1 if there were rows, 0 at the end, -1 on error
+ */
+static int scan_query_rows(struct query_cursor * cursor, size_t max) {
+  struct query_plan * plan = cursor->plan;
+  while(cursor->row < cursor->end_row && plan->filtered) {
+    size_t group = (size_t) (cursor->row / plan->table.row_group_size);
+    if(group == cursor->group) {
+      break;
+    }
+    int result = test_table_row_group(&plan->table, plan->filter_column, group, &plan->literal);
+    if(result < 0) {
+      return -1;
+    }
+    if(result == 1) {
+      break;
+    }
+    // The zone map rules the row group out, none of its values are read
+    ++cursor->skipped_groups;
+    cursor->row = (uint64_t) (group + 1) * plan->table.row_group_size;
+  }
+  if(cursor->row >= cursor->end_row) {
+    return 0;
+  }
+  if(load_query_chunks(cursor, cursor->row, plan->filtered) != 0) {
+    return -1;
+  }
+  // A batch never straddles two row groups, so its values are contiguous in the chunks
+  uint64_t end = cursor->chunk.first_row + cursor->chunk.rows;
+  if(end > cursor->end_row) {
+    end = cursor->end_row;
+  }
+  cursor->first_row = cursor->row;
+  cursor->count = end - cursor->row < max ? (size_t) (end - cursor->row) : max;
+  cursor->row += cursor->count;
+  cursor->dense = true;
+  cursor->selected = cursor->count;
+  return 1;
+}
+
+/**
+ * The scan operator of the plans with an index, taking the next rows the index finds as the batch
+ * \param cursor the cursor
+ * \param max the maximum number of rows
+ * \return 1 if there were rows, 0 at the end, -1 on error
+ */
+static int fetch_query_index_rows(struct query_cursor * cursor, size_t max) {
+  size_t count = 0;
+  while(count < max && !cursor->exhausted) {
+    int result = next_query_index_row(cursor, &cursor->rows[count]);
+    if(result < 0) {
+      return -1;
+    }
+    if(result == 0) {
+      cursor->exhausted = true;
+    } else {
+      ++count;
+    }
+  }
+  cursor->count = count;
+  cursor->dense = true;
+  cursor->selected = count;
+  return count > 0 ? 1 : 0;
+}
+
+/**
+ * The filter operator, selecting the rows of a scanned batch whose filter column equals the literal
+ * \param cursor the cursor
+ */
+static void filter_query_rows(struct query_cursor * cursor) {
+  const struct table_chunk * chunk = &cursor->filter_chunk;
+  const struct table_value * literal = &cursor->plan->literal;
+  size_t index = (size_t) (cursor->first_row - chunk->first_row);
+  bool strings = chunk->type == TABLE_COLUMN_STRING;
+  if((strings || chunk->encoding == TABLE_ENCODING_FRAME_OF_REFERENCE) && !cursor->filter_present) {
+    // No row of the row group can match, the scan resumes at the next one
+    cursor->dense = false;
+    cursor->selected = 0;
+    cursor->row = chunk->first_row + chunk->rows;
+    return;
+  }
+  switch(chunk->encoding) {
+  case TABLE_ENCODING_RUN_LENGTH: {
+    // The runs are compared rather than the rows they expand to
+    size_t run = find_table_run(chunk, index);
+    if(strings) {
+      cursor->selected = select_code_runs(chunk->run_codes, chunk->run_ends, run, index, cursor->count, FILTER_EQUALS, cursor->filter_code, cursor->selection);
+    } else {
+      cursor->selected = select_int64_runs(chunk->run_values, chunk->run_ends, run, index, cursor->count, FILTER_EQUALS, literal->integer, cursor->selection);
+    }
+    break;
+  }
+  case TABLE_ENCODING_DICTIONARY:
+  case TABLE_ENCODING_FRAME_OF_REFERENCE:
+    unpack_bits(cursor->codes, chunk->codes, chunk->code_bits, index, cursor->count);
+    cursor->selected = select_codes(cursor->codes, cursor->count, FILTER_EQUALS, cursor->filter_code, cursor->selection);
+    break;
+  case TABLE_ENCODING_DELTA:
+    decode_table_integers(chunk, index, cursor->count, cursor->values);
+    cursor->selected = select_int64(cursor->values, cursor->count, FILTER_EQUALS, literal->integer, cursor->selection);
+    break;
+  default:
+    cursor->selected = select_int64(chunk->integers + index, cursor->count, FILTER_EQUALS, literal->integer, cursor->selection);
+  }
+  // A batch whose rows all match is projected as a whole
+  cursor->dense = cursor->selected == cursor->count;
+}
+
+/**
+ * The project operator, copying the selected column of the selected rows of a scanned batch
+ * \param cursor the cursor
+ * \param batch the destination batch
+ */
+static void project_query_rows(struct query_cursor * cursor, struct query_batch * batch) {
+  const struct table_chunk * chunk = &cursor->chunk;
+  size_t index = (size_t) (cursor->first_row - chunk->first_row);
+  size_t count = cursor->selected;
+  const uint32_t * selection = cursor->selection;
+  batch->type = chunk->type;
+  batch->count = count;
+  if(chunk->type == TABLE_COLUMN_STRING) {
+    uint32_t * codes = cursor->codes;
+    if(cursor->dense) {
+      decode_table_codes(chunk, index, count, codes);
+    } else if(chunk->encoding == TABLE_ENCODING_DICTIONARY) {
+      for(size_t i = 0; i < count; ++i) {
+	codes[i] = get_packed_value(chunk->codes, chunk->code_bits, index + selection[i]);
+      }
+    } else {
+      // Runs are expanded up to the last selected row, then gathered in place as the selection only moves rows forward
+      decode_table_codes(chunk, index, selection[count - 1] + 1, codes);
+      for(size_t i = 0; i < count; ++i) {
+	codes[i] = codes[selection[i]];
+      }
+    }
+    for(size_t i = 0; i < count; ++i) {
+      batch->texts[i] = chunk->bytes + chunk->offsets[codes[i]];
+      batch->lens[i] = (size_t) (chunk->offsets[codes[i] + 1] - chunk->offsets[codes[i]]);
+    }
+  } else if(cursor->dense) {
+    decode_table_integers(chunk, index, count, batch->integers);
+  } else if(chunk->encoding == TABLE_ENCODING_PLAIN) {
+    const int64_t * integers = chunk->integers + index;
+    for(size_t i = 0; i < count; ++i) {
+      batch->integers[i] = integers[selection[i]];
+    }
+  } else {
+    decode_table_integers(chunk, index, selection[count - 1] + 1, cursor->values);
+    for(size_t i = 0; i < count; ++i) {
+      batch->integers[i] = cursor->values[selection[i]];
+    }
+  }
+}
+
+/**
+ * The project operator of the plans with an index, reading the selected column of the rows the index found
+ * \param cursor the cursor
+ * \param batch the destination batch
+ * \return 0 on success, -1 on error
+ */
+static int project_query_index_rows(struct query_cursor * cursor, struct query_batch * batch) {
+  struct query_plan * plan = cursor->plan;
+  batch->type = plan->table.schema.columns[plan->column].type;
+  batch->count = cursor->count;
+  for(size_t i = 0; i < cursor->count; ++i) {
+    if(load_query_chunks(cursor, cursor->rows[i], false) != 0) {
+      return -1;
+    }
+    size_t index = (size_t) (cursor->rows[i] - cursor->chunk.first_row);
+    if(batch->type == TABLE_COLUMN_STRING) {
+      batch->texts[i] = get_table_string(&cursor->chunk, index, &batch->lens[i]);
+    } else {
+      batch->integers[i] = get_table_integer(&cursor->chunk, index);
+    }
+  }
+  return 0;
+}
+
+/**
+ * The limit operator, truncating a batch to the rows left under the limit
+ * \param cursor the cursor
+ * \param batch the batch
+ */
+static void limit_query_batch(struct query_cursor * cursor, struct query_batch * batch) {
+  uint64_t remaining = cursor->plan->limit - cursor->produced;
+  if(batch->count > remaining) {
+    batch->count = (size_t) remaining;
+  }
+  cursor->produced += batch->count;
+}
+
+int next_query_batch(struct query_cursor * cursor, struct query_batch * batch) {
+  assert(cursor != NULL);
+  assert(batch != NULL);
+
+  // The operators form a fixed pipeline, interpreting the plan costs a few calls per batch and none per row
+  struct query_plan * plan = cursor->plan;
+  while(cursor->produced < plan->limit) {
+    uint64_t remaining = plan->limit - cursor->produced;
+    size_t max = remaining < QUERY_BATCH_SIZE ? (size_t) remaining : QUERY_BATCH_SIZE;
+    int result;
+    if(plan->access == QUERY_ACCESS_SCAN) {
+      result = scan_query_rows(cursor, plan->filtered ? QUERY_BATCH_SIZE : max);
+      if(result == 1 && plan->filtered) {
+	filter_query_rows(cursor);
+      }
+    } else {
+      result = fetch_query_index_rows(cursor, max);
+    }
+    if(result != 1) {
+      return result;
+    }
+    if(cursor->selected == 0) {
+      continue;
+    }
+    if(plan->access == QUERY_ACCESS_SCAN) {
+      project_query_rows(cursor, batch);
+    } else if(project_query_index_rows(cursor, batch) != 0) {
+      return -1;
+    }
+    limit_query_batch(cursor, batch);
+    return 1;
+  }
+  return 0;
+}
+
+int next_query_row(struct query_cursor * cursor, struct table_value * value) {
+  assert(cursor != NULL);
+  assert(value != NULL);
+
+  if(cursor->next == cursor->batch.count) {
+    int result = next_query_batch(cursor, &cursor->batch);
+    if(result != 1) {
+      return result;
+    }
+    cursor->next = 0;
+  }
+  size_t i = cursor->next++;
+  if(cursor->batch.type == TABLE_COLUMN_STRING) {
+    value->integer = 0;
+    value->text = cursor->batch.texts[i];
+    value->len = cursor->batch.lens[i];
+  } else {
+    value->integer = cursor->batch.integers[i];
+    value->text = NULL;
+    value->len = 0;
+  }
+  return 1;
+}
+
+/**
+ * The values a worker found in a morsel
+ */
+struct query_segment {
+  /**
+   * The morsel, the index of a row group
+   */
+  size_t morsel;
+
+  /**
+   * The worker
+   */
+  size_t worker;
+
+  /**
+   * The index of the first value in the partial result of the worker
+   */
+  size_t first;
+
+  /**
+   * The number of values
+   */
+  size_t count;
+};
+
+/**
+ * The partial result of a worker of a parallel query
+ */
+struct query_partial {
+  /**
+   * The cursor of the worker, allocated on its first morsel
+   */
+  struct query_cursor * cursor;
+
+  /**
+   * The batch the operators produce into
+   */
+  struct query_batch * batch;
+
+  /**
+   * The values found by the worker
+   */
+  struct query_result values;
+
+  /**
+   * The capacity of the values
+   */
+  size_t size;
+
+  /**
+   * The morsels the values came from
+   */
+  struct query_segment * segments;
+
+  /**
+   * The number of segments
+   */
+  size_t segment_count;
+
+  /**
+   * The capacity of the segments
+   */
+  size_t segments_size;
+};
+
+/**
+ * The shared state of a parallel query
+ */
+struct query_execution {
+  /**
+   * The plan
+   */
+  struct query_plan * plan;
+
+  /**
+   * The partial results, one per worker
+   */
+  struct query_partial * partials;
+
+  /**
+   * The number of rows found in each row group, UINT64_MAX until the row group is done
+   */
+  atomic_uint_least64_t * counts;
+
+  /**
+   * The last row group needed, once the row groups up to it are done and hold enough rows for the limit
+   */
+  atomic_size_t last_morsel;
+};
+
+/**
+ * Appends a batch to the values of a query
+ * \param result the values
+ * \param size the capacity of the values, updated when they grow
+ * \param batch the batch
+ * \return 0 on success, -1 on error
+ */
+static int append_query_result(struct query_result * result, size_t * size, const struct query_batch * batch) {
+  result->type = batch->type;
+  if(result->count + batch->count > *size) {
+    size_t new_size = *size != 0 ? *size * 2 : QUERY_BATCH_SIZE;
+    while(new_size < result->count + batch->count) {
+      new_size *= 2;
+    }
+    if(batch->type == TABLE_COLUMN_STRING) {
+      const char ** texts = (const char **) realloc(result->texts, new_size * sizeof(const char *));
+      if(texts != NULL) {
+	result->texts = texts;
+      }
+      size_t * lens = (size_t *) realloc(result->lens, new_size * sizeof(size_t));
+      if(lens != NULL) {
+	result->lens = lens;
+      }
+      if(texts == NULL || lens == NULL) {
+	LOG_ERROR("could not grow query result");
+	return -1;
+      }
+    } else {
+      int64_t * integers = (int64_t *) realloc(result->integers, new_size * sizeof(int64_t));
+      if(integers == NULL) {
+	LOG_ERROR("could not grow query result");
+	return -1;
+      }
+      result->integers = integers;
+    }
+    *size = new_size;
+  }
+  if(batch->type == TABLE_COLUMN_STRING) {
+    memcpy(result->texts + result->count, batch->texts, batch->count * sizeof(const char *));
+    memcpy(result->lens + result->count, batch->lens, batch->count * sizeof(size_t));
+  } else {
+    memcpy(result->integers + result->count, batch->integers, batch->count * sizeof(int64_t));
+  }
+  result->count += batch->count;
+  return 0;
+}
+
+/**
+ * Records the rows found in a row group and finds the row groups no longer needed for the limit
+ * The rows of a row group count only once every row group before it is done,
+ * as the result holds the first rows of the table
+ * \param e the execution
+ * \param morsel the index of the row group
+ * \param count the number of rows found in the row group
+ */
+static void finish_query_morsel(struct query_execution * e, size_t morsel, uint64_t count) {
+  atomic_store_explicit(&e->counts[morsel], count, memory_order_release);
+  if(e->plan->limit == UINT64_MAX) {
+    return;
+  }
+  uint64_t total = 0;
+  for(size_t i = 0; i < e->plan->table.row_group_count; ++i) {
+    uint64_t found = atomic_load_explicit(&e->counts[i], memory_order_acquire);
+    if(found == UINT64_MAX) {
+      return;
+    }
+    total += found;
+    if(total >= e->plan->limit) {
+      size_t last = atomic_load_explicit(&e->last_morsel, memory_order_relaxed);
+      while(i < last && !atomic_compare_exchange_weak_explicit(&e->last_morsel, &last, i, memory_order_relaxed, memory_order_relaxed)) {
+      }
+      return;
+    }
+  }
+}
+
+/**
+ * Runs the pipeline of a plan over one row group, a morsel_function
+ * \param context the execution
+ * \param worker the index of the worker
+ * \param morsel the index of the row group
+ * \return 0 to continue, 1 once the row groups before it hold enough rows for the limit, -1 on error
+ */
+static int run_query_morsel(void * context, size_t worker, size_t morsel) {
+  struct query_execution * e = (struct query_execution *) context;
+  struct query_plan * plan = e->plan;
+  struct query_partial * p = &e->partials[worker];
+  // Every row group up to the last one needed is done, so the row groups left to take all come after it
+  if(morsel > atomic_load_explicit(&e->last_morsel, memory_order_relaxed)) {
+    return 1;
+  }
+  if(p->cursor == NULL) {
+    p->cursor = (struct query_cursor *) malloc(sizeof(struct query_cursor));
+    p->batch = (struct query_batch *) malloc(sizeof(struct query_batch));
+    if(p->cursor == NULL || p->batch == NULL) {
+      LOG_ERROR("could not allocate query cursor");
+      return -1;
+    }
+  }
+  if(p->segment_count == p->segments_size) {
+    size_t size = p->segments_size != 0 ? p->segments_size * 2 : 16;
+    struct query_segment * segments = (struct query_segment *) realloc(p->segments, size * sizeof(struct query_segment));
+    if(segments == NULL) {
+      LOG_ERROR("could not grow query segments");
+      return -1;
+    }
+    p->segments = segments;
+    p->segments_size = size;
+  }
+
+  if(open_query_cursor(p->cursor, plan) != 0) {
+    return -1;
+  }
+  uint64_t first_row = (uint64_t) morsel * plan->table.row_group_size;
+  p->cursor->row = first_row;
+  p->cursor->end_row = plan->table.row_count - first_row < plan->table.row_group_size ? plan->table.row_count : first_row + plan->table.row_group_size;
+  struct query_segment * segment = &p->segments[p->segment_count++];
+  segment->morsel = morsel;
+  segment->worker = worker;
+  segment->first = p->values.count;
+  int result;
+  while((result = next_query_batch(p->cursor, p->batch)) == 1) {
+    if(append_query_result(&p->values, &p->size, p->batch) != 0) {
+      return -1;
+    }
+  }
+  segment->count = p->values.count - segment->first;
+  if(result == 0) {
+    finish_query_morsel(e, morsel, segment->count);
+  }
+  return result;
+}
+
+/**
+ * Compares the segments of two partial results by morsel
+ * \param a the first segment
+ * \param b the second segment
+ * \return a negative number, 0 or a positive number if a is before, at or after b
+ */
+static int compare_query_segments(const void * a, const void * b) {
+  const struct query_segment * x = (const struct query_segment *) a;
+  const struct query_segment * y = (const struct query_segment *) b;
+  return x->morsel < y->morsel ? -1 : (x->morsel > y->morsel ? 1 : 0);
+}
+
+/**
+ * Concatenates the partial results of the workers in row order, the pipeline breaker of a parallel query
+ * \param e the execution
+ * \param worker_count the number of workers
+ * \param result the destination for the values
+ * \return 0 on success, -1 on error
+ */
+static int merge_query_partials(struct query_execution * e, size_t worker_count, struct query_result * result) {
+  size_t segment_count = 0;
+  uint64_t total = 0;
+  for(size_t i = 0; i < worker_count; ++i) {
+    segment_count += e->partials[i].segment_count;
+    total += e->partials[i].values.count;
+  }
+  if(total > e->plan->limit) {
+    total = e->plan->limit;
+  }
+  struct query_segment * segments = (struct query_segment *) malloc((segment_count + 1) * sizeof(struct query_segment));
+  bool strings = result->type == TABLE_COLUMN_STRING;
+  if(strings) {
+    result->texts = (const char **) malloc((total + 1) * sizeof(const char *));
+    result->lens = (size_t *) malloc((total + 1) * sizeof(size_t));
+  } else {
+    result->integers = (int64_t *) malloc((total + 1) * sizeof(int64_t));
+  }
+  if(segments == NULL || (strings ? result->texts == NULL || result->lens == NULL : result->integers == NULL)) {
+    LOG_ERROR("could not allocate query result");
+    free(segments);
+    return -1;
+  }
+  size_t n = 0;
+  for(size_t i = 0; i < worker_count; ++i) {
+    for(size_t j = 0; j < e->partials[i].segment_count; ++j) {
+      segments[n++] = e->partials[i].segments[j];
+    }
+  }
+  qsort(segments, segment_count, sizeof(struct query_segment), compare_query_segments);
+  for(size_t i = 0; i < segment_count && result->count < total; ++i) {
+    const struct query_result * values = &e->partials[segments[i].worker].values;
+    size_t count = segments[i].count < total - result->count ? segments[i].count : (size_t) (total - result->count);
+    if(count == 0) {
+      continue;
+    }
+    if(strings) {
+      memcpy(result->texts + result->count, values->texts + segments[i].first, count * sizeof(const char *));
+      memcpy(result->lens + result->count, values->lens + segments[i].first, count * sizeof(size_t));
+    } else {
+      memcpy(result->integers + result->count, values->integers + segments[i].first, count * sizeof(int64_t));
+    }
+    result->count += count;
+  }
+  free(segments);
+  return 0;
+}
+
+int execute_query(struct query_plan * plan, struct morsel_scheduler * scheduler, struct query_result * result) {
+  assert(plan != NULL);
+  assert(result != NULL);
+
+  memset(result, 0, sizeof(struct query_result));
+  result->type = plan->table.schema.columns[plan->column].type;
+  if(scheduler == NULL || plan->access != QUERY_ACCESS_SCAN || plan->table.row_group_count < 2) {
+    struct query_cursor * cursor = (struct query_cursor *) malloc(sizeof(struct query_cursor));
+    struct query_batch * batch = (struct query_batch *) malloc(sizeof(struct query_batch));
+    int status = cursor != NULL && batch != NULL ? open_query_cursor(cursor, plan) : -1;
+    size_t size = 0;
+    int next = 0;
+    while(status == 0 && (next = next_query_batch(cursor, batch)) == 1) {
+      status = append_query_result(result, &size, batch);
+    }
+    free(cursor);
+    free(batch);
+    if(status != 0 || next < 0) {
+      dispose_query_result(result);
+      return -1;
+    }
+    return 0;
+  }
+
+  // The columns are mapped on their first read, which must not race between the workers
+  struct table_chunk chunk;
+  if(read_table_chunk(&plan->table, plan->column, 0, &chunk) != 0
+     || (plan->filtered && read_table_chunk(&plan->table, plan->filter_column, 0, &chunk) != 0)) {
+    return -1;
+  }
+  struct query_execution e;
+  e.plan = plan;
+  e.partials = (struct query_partial *) calloc(scheduler->worker_count, sizeof(struct query_partial));
+  e.counts = (atomic_uint_least64_t *) malloc(plan->table.row_group_count * sizeof(atomic_uint_least64_t));
+  if(e.partials == NULL || e.counts == NULL) {
+    LOG_ERROR("could not allocate partial results");
+    free(e.partials);
+    free(e.counts);
+    return -1;
+  }
+  for(size_t i = 0; i < plan->table.row_group_count; ++i) {
+    atomic_init(&e.counts[i], UINT64_MAX);
+  }
+  atomic_init(&e.last_morsel, SIZE_MAX);
+  int status = run_morsel_job(scheduler, plan->table.row_group_count, run_query_morsel, &e);
+  if(status == 0) {
+    status = merge_query_partials(&e, scheduler->worker_count, result);
+  }
+  for(size_t i = 0; i < scheduler->worker_count; ++i) {
+    free(e.partials[i].cursor);
+    free(e.partials[i].batch);
+    free(e.partials[i].segments);
+    dispose_query_result(&e.partials[i].values);
+  }
+  free(e.partials);
+  free(e.counts);
+  if(status != 0) {
+    dispose_query_result(result);
+    return -1;
+  }
+  return 0;
+}
+
+void dispose_query_result(struct query_result * result) {
+  assert(result != NULL);
+
+  free(result->integers);
+  free(result->texts);
+  free(result->lens);
+  result->integers = NULL;
+  result->texts = NULL;
+  result->lens = NULL;
+  result->count = 0;
+}
+
+int close_query_plan(struct query_plan * plan) {
+  assert(plan != NULL);
+
+  int result = 0;
+  if(plan->access == QUERY_ACCESS_BTREE && close_btree(&plan->btree) != 0) {
+    result = -1;
+  }
+  if(plan->access == QUERY_ACCESS_HASH && close_hash_index(&plan->hash) != 0) {
+    result = -1;
+  }
+  free(plan->index_rows);
+  plan->index_rows = NULL;
+  close_table(&plan->table);
+  return result;
+}
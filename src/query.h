@@ -0,0 +1,488 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "btree.h"
+#include "buffer_pool.h"
+#include "hash_index.h"
+#include "lexer.h"
+#include "morsel.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The suffix of the index file of a column, in the directory of the table
+ */
+#define TABLE_INDEX_FILE_SUFFIX ".idx"
+
+/**
+ * The suffix of the hash index file of a column, in the directory of the table
+ */
+#define TABLE_HASH_INDEX_FILE_SUFFIX ".hash"
+
+/**
+ * The number of rows the operators of a query exchange at a time
+ */
+#define QUERY_BATCH_SIZE 1024
+
+/**
+ * A query of the form SELECT column FROM table [WHERE column = 'literal'] [LIMIT 'count']
+ */
+struct query {
+  /**
+   * The name of the table
+   */
+  struct lexer_token table;
+
+  /**
+   * The name of the selected column
+   */
+  struct lexer_token column;
+
+  /**
+   * Whether the query has a WHERE clause
+   */
+  bool filtered;
+
+  /**
+   * The name of the column compared in the WHERE clause
+   */
+  struct lexer_token filter_column;
+
+  /**
+   * The literal compared in the WHERE clause, without quotes
+   */
+  struct lexer_token literal;
+
+  /**
+   * Whether the query has a LIMIT clause
+   */
+  bool limited;
+
+  /**
+   * The maximum number of rows
+   */
+  uint64_t limit;
+};
+
+/**
+ * The way a plan finds the rows of a query
+ */
+enum query_access {
+  /**
+   * Reading every row of the table
+   */
+  QUERY_ACCESS_SCAN,
+
+  /**
+   * Looking up the literal in the B+tree index of the filter column
+   */
+  QUERY_ACCESS_BTREE,
+
+  /**
+   * Looking up the literal in the hash index of the filter column
+   */
+  QUERY_ACCESS_HASH,
+
+  /**
+   * Looking up the literal in an in-memory hash index of the filter column
+   */
+  QUERY_ACCESS_MEMORY_HASH
+};
+
+/**
+ * An in-memory hash index of a column of a hot table, offered to the planner
+ */
+struct query_hot_index {
+  /**
+   * The path of the table
+   */
+  char path[MAX_TABLE_PATH_LENGTH];
+
+  /**
+   * The index of the column
+   */
+  size_t column;
+
+  /**
+   * The hash index
+   */
+  struct memory_hash_index index;
+};
+
+/**
+ * How a query is executed
+ */
+struct query_plan {
+  /**
+   * The table
+   */
+  struct table table;
+
+  /**
+   * The index of the selected column
+   */
+  size_t column;
+
+  /**
+   * Whether the rows are filtered
+   */
+  bool filtered;
+
+  /**
+   * The index of the filter column
+   */
+  size_t filter_column;
+
+  /**
+   * The literal as a value of the type of the filter column, strings point into the query
+   */
+  struct table_value literal;
+
+  /**
+   * The literal as an index key, unless the literal is too long for an index
+   */
+  char key[MAX_BTREE_KEY_LENGTH];
+
+  /**
+   * The length of the key
+   */
+  size_t key_len;
+
+  /**
+   * The way the rows are found
+   */
+  enum query_access access;
+
+  /**
+   * The B+tree index of the filter column for QUERY_ACCESS_BTREE
+   */
+  struct btree btree;
+
+  /**
+   * The hash index of the filter column for QUERY_ACCESS_HASH
+   */
+  struct hash_index hash;
+
+  /**
+   * The in-memory hash index of the filter column for QUERY_ACCESS_MEMORY_HASH
+   */
+  const struct memory_hash_index * memory;
+
+  /**
+   * The rows a hash index finds for the literal, in row order, read when the first cursor is opened
+   */
+  uint64_t * index_rows;
+
+  /**
+   * The number of rows a hash index finds for the literal
+   */
+  size_t index_row_count;
+
+  /**
+   * The maximum number of rows, UINT64_MAX without a LIMIT clause
+   */
+  uint64_t limit;
+};
+
+/**
+ * A batch of values of the selected column, stored column-wise
+ */
+struct query_batch {
+  /**
+   * The number of values
+   */
+  size_t count;
+
+  /**
+   * The type of the values
+   */
+  enum table_column_type type;
+
+  /**
+   * The values of an integer column
+   */
+  int64_t integers[QUERY_BATCH_SIZE];
+
+  /**
+   * The strings of a string column, pointing into the table
+   */
+  const char * texts[QUERY_BATCH_SIZE];
+
+  /**
+   * The lengths of the strings of a string column
+   */
+  size_t lens[QUERY_BATCH_SIZE];
+};
+
+/**
+ * The values of the selected column of all the rows of a query, stored column-wise
+ */
+struct query_result {
+  /**
+   * The type of the values
+   */
+  enum table_column_type type;
+
+  /**
+   * The number of values
+   */
+  size_t count;
+
+  /**
+   * The values of an integer column
+   */
+  int64_t * integers;
+
+  /**
+   * The strings of a string column, pointing into the table
+   */
+  const char ** texts;
+
+  /**
+   * The lengths of the strings of a string column
+   */
+  size_t * lens;
+};
+
+/**
+ * The state of the execution of a plan, whose operators scan, filter, project and limit a batch of rows at a time
+ */
+struct query_cursor {
+  /**
+   * The plan
+   */
+  struct query_plan * plan;
+
+  /**
+   * The next row to examine for QUERY_ACCESS_SCAN
+   */
+  uint64_t row;
+
+  /**
+   * The row at which the scan stops, the number of rows of the table unless the scan covers a morsel
+   */
+  uint64_t end_row;
+
+  /**
+   * Whether the index has no more rows
+   */
+  bool exhausted;
+
+  /**
+   * The number of rows produced
+   */
+  uint64_t produced;
+
+  /**
+   * The number of row groups the zone maps of the filter column ruled out
+   */
+  uint64_t skipped_groups;
+
+  /**
+   * The position in the B+tree index for QUERY_ACCESS_BTREE
+   */
+  struct btree_cursor btree;
+
+  /**
+   * The position in the rows the hash index found for QUERY_ACCESS_HASH and QUERY_ACCESS_MEMORY_HASH
+   */
+  size_t index_row;
+
+  /**
+   * The row group of the chunks, or SIZE_MAX before the first
+   */
+  size_t group;
+
+  /**
+   * The values of the selected column in the row group
+   */
+  struct table_chunk chunk;
+
+  /**
+   * The values of the filter column in the row group
+   */
+  struct table_chunk filter_chunk;
+
+  /**
+   * Whether the literal may be in the filter column in the row group: in the dictionary of a string column,
+   * within the frame of a frame of reference encoded integer column
+   */
+  bool filter_present;
+
+  /**
+   * The code of the string literal in the dictionary of the filter column in the row group,
+   * or the difference of the integer literal from the base of its frame
+   */
+  uint32_t filter_code;
+
+  /**
+   * The first row of the batch for QUERY_ACCESS_SCAN, the rows are consecutive and in a single row group
+   */
+  uint64_t first_row;
+
+  /**
+   * The number of rows of the batch
+   */
+  size_t count;
+
+  /**
+   * The rows of the batch found in an index
+   */
+  uint64_t rows[QUERY_BATCH_SIZE];
+
+  /**
+   * Whether every row of the batch is selected, the selection vector is then not filled
+   */
+  bool dense;
+
+  /**
+   * The positions in the batch of the rows passing the filter
+   */
+  uint32_t selection[QUERY_BATCH_SIZE];
+
+  /**
+   * The number of selected rows
+   */
+  size_t selected;
+
+  /**
+   * The unpacked dictionary codes or frame of reference differences of the batch
+   */
+  uint32_t codes[QUERY_BATCH_SIZE];
+
+  /**
+   * The decoded integers of the batch
+   */
+  int64_t values[QUERY_BATCH_SIZE];
+
+  /**
+   * The batch handed out by next_query_row
+   */
+  struct query_batch batch;
+
+  /**
+   * The next value of the batch handed out by next_query_row
+   */
+  size_t next;
+};
+
+/**
+ * Parses a query from its tokens
+ * \param q the destination for the query, pointing into the tokens
+ * \param tokens the tokens
+ * \param count the number of tokens
+ * \return 0 on success, -1 if the tokens do not form a query
+ */
+int parse_query(struct query * q, const struct lexer_token * tokens, size_t count);
+
+/**
+ * Builds the index of a column by bulk loading its sorted values, replacing any previous index
+ * \param t the table
+ * \param column the index of the column
+ * \param pool the buffer pool to build the index in
+ * \return 0 on success, -1 on error
+ */
+int create_table_index(struct table * t, size_t column, struct buffer_pool * pool);
+
+/**
+ * Builds the hash index of a column, replacing any previous hash index
+ * \param t the table
+ * \param column the index of the column
+ * \param pool the buffer pool to build the index in
+ * \return 0 on success, -1 on error
+ */
+int create_table_hash_index(struct table * t, size_t column, struct buffer_pool * pool);
+
+/**
+ * Builds an in-memory hash index of a column
+ * \param hot the destination for the index
+ * \param t the table
+ * \param column the index of the column
+ * \return 0 on success, -1 on error
+ */
+int create_hot_table_index(struct query_hot_index * hot, struct table * t, size_t column);
+
+/**
+ * Releases an in-memory hash index of a column
+ * \param hot the index
+ */
+void dispose_hot_table_index(struct query_hot_index * hot);
+
+/**
+ * Plans a query, looking up the literal in an index of the filter column if there is one,
+ * preferring an in-memory hash index, then a hash index, then a B+tree index,
+ * literals longer than MAX_BTREE_KEY_LENGTH are always scanned for
+ * \param plan the destination for the plan
+ * \param q the query, whose literal must outlive the plan
+ * \param dir the directory of the tables
+ * \param pool the buffer pool for the indexes
+ * \param hot the in-memory hash indexes of hot tables
+ * \param hot_count the number of in-memory hash indexes
+ * \return 0 on success, -1 on error
+ */
+int plan_query(struct query_plan * plan, const struct query * q, const char * dir, struct buffer_pool * pool, const struct query_hot_index * hot, size_t hot_count);
+
+/**
+ * Starts executing a plan
+ * \param cursor the cursor
+ * \param plan the plan
+ * \return 0 on success, -1 on error
+ */
+int open_query_cursor(struct query_cursor * cursor, struct query_plan * plan);
+
+/**
+ * Produces the next batch of rows of a query
+ * \param cursor the cursor
+ * \param batch the destination for the values of the selected column, strings point into the table
+ * \return 1 if there was a row, 0 at the end, -1 on error
+ */
+int next_query_batch(struct query_cursor * cursor, struct query_batch * batch);
+
+/**
+ * Produces the next row of a query, from the batches of next_query_batch
+ * \param cursor the cursor
+ * \param value the destination for the value of the selected column, strings point into the table
+ * \return 1 if there was a row, 0 at the end, -1 on error
+ */
+int next_query_row(struct query_cursor * cursor, struct table_value * value);
+
+/**
+ * Executes a plan to the end, scanning the row groups of the table in parallel on the workers of a scheduler
+ * Each worker collects the values of the row groups it scans, the partial results are concatenated in row order,
+ * with a LIMIT clause the workers stop taking row groups once the row groups before them hold enough rows
+ * \param plan the plan
+ * \param scheduler the scheduler, or NULL to execute on the calling thread
+ * \param result the destination for the values, to dispose of
+ * \return 0 on success, -1 on error
+ */
+int execute_query(struct query_plan * plan, struct morsel_scheduler * scheduler, struct query_result * result);
+
+/**
+ * Releases the values of a query
+ * \param result the values
+ */
+void dispose_query_result(struct query_result * result);
+
+/**
+ * Closes the table and the index of a plan
+ * \param plan the plan
+ * \return 0 on success, -1 on error
+ */
+int close_query_plan(struct query_plan * plan);
+
+#endif
@@ -10,6 +10,8 @@
  * If not, see <https://www.gnu.org/licenses/>. 
  */
 
+#define LOG_MODULE "regex"
+
 #include "logger.h"
 #include "regex.h"
 
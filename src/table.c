@@ -0,0 +1,1604 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "table"
+
+#include "bitpack.h"
+#include "bloom.h"
+#include "logger.h"
+#include "lz.h"
+#include "table.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * The permissions of newly created table directories
+ */
+#define TABLE_DIR_MODE 0755
+
+/**
+ * The permissions of newly created table files
+ */
+#define TABLE_FILE_MODE 0644
+
+/**
+ * The length of the header of a column file: magic, byte order and column type
+ */
+#define TABLE_COLUMN_HEADER_LENGTH (TABLE_MAGIC_LENGTH + 8)
+
+/**
+ * The length of the trailer of a column file: the number of row groups and the magic
+ */
+#define TABLE_COLUMN_TRAILER_LENGTH (8 + TABLE_MAGIC_LENGTH)
+
+/**
+ * Row groups start at multiples of this alignment so that mapped values are aligned
+ */
+#define TABLE_ALIGNMENT 8
+
+/**
+ * The version of the table metadata format
+ */
+#define TABLE_FORMAT_VERSION 4
+
+/**
+ * The number of values decoded at a time through a buffer on the stack
+ */
+#define TABLE_DECODE_BATCH 256
+
+/**
+ * A run-length encoding is chosen over a smaller one when its runs are this long on average, its kernels then work a run at a time
+ */
+#define TABLE_MIN_RUN_LENGTH 32
+
+/**
+ * The number of leading bytes of the strings of a dictionary compressed to decide whether compressing all of them pays
+ */
+#define TABLE_CODEC_SAMPLE_LENGTH 16384
+
+/**
+ * The maximum number of sections of an encoded row group
+ */
+#define TABLE_MAX_SECTIONS 4
+
+/**
+ * The header at the start of every row group, describing how its values are stored,
+ * it is followed by the sections of the encoding each padded to TABLE_ALIGNMENT:
+ * the values of TABLE_ENCODING_PLAIN,
+ * the run values and run ends of TABLE_ENCODING_RUN_LENGTH,
+ * the packed differences of TABLE_ENCODING_FRAME_OF_REFERENCE,
+ * the checkpoints and packed excess differences of TABLE_ENCODING_DELTA,
+ * for strings the dictionary offsets and strings, then the packed codes or the run codes and run ends
+ */
+struct table_group_header {
+  /**
+   * The encoding, an enum table_encoding
+   */
+  uint32_t encoding;
+
+  /**
+   * The width in bits of the packed values
+   */
+  uint32_t bits;
+
+  /**
+   * The number of distinct strings of a string column
+   */
+  uint64_t dictionary_size;
+
+  /**
+   * The number of runs of a run-length encoded row group
+   */
+  uint64_t run_count;
+
+  /**
+   * The smallest value of a frame of reference encoded row group, the smallest difference of a delta encoded one
+   */
+  int64_t base;
+
+  /**
+   * The number of bytes of the dictionary strings
+   */
+  uint64_t bytes_len;
+
+  /**
+   * The number of bytes of the dictionary strings once compressed, 0 if they are stored as they are
+   */
+  uint64_t compressed_len;
+};
+
+/**
+ * A string of a row group being dictionary encoded
+ */
+struct table_dictionary_entry {
+  /**
+   * The bytes of the string
+   */
+  const char * text;
+
+  /**
+   * The length of the string
+   */
+  size_t len;
+
+  /**
+   * The index of the row in the row group
+   */
+  uint32_t row;
+};
+
+/**
+ * The dictionary encoding of the strings of a row group
+ */
+struct table_dictionary {
+  /**
+   * The number of distinct strings
+   */
+  size_t count;
+
+  /**
+   * The offsets of the distinct strings into the bytes, count + 1 entries
+   */
+  uint64_t * offsets;
+
+  /**
+   * The distinct strings in byte order
+   */
+  char * bytes;
+
+  /**
+   * The number of bytes of the distinct strings
+   */
+  size_t bytes_len;
+
+  /**
+   * The width in bits of the codes
+   */
+  unsigned int bits;
+
+  /**
+   * The code of each row
+   */
+  uint32_t * codes;
+};
+
+/**
+ * A row group encoded for writing, as the header and the sections following it
+ */
+struct table_encoded_group {
+  /**
+   * The header
+   */
+  struct table_group_header header;
+
+  /**
+   * The header, the sections and their padding, and the Bloom filter written after them
+   */
+  struct iovec iov[2 * TABLE_MAX_SECTIONS + 3];
+
+  /**
+   * The number of buffers
+   */
+  int count;
+
+  /**
+   * The number of bytes of the buffers
+   */
+  size_t len;
+
+  /**
+   * The sections allocated by the encoding, to free
+   */
+  void * buffers[TABLE_MAX_SECTIONS];
+
+  /**
+   * The number of sections allocated
+   */
+  size_t buffer_count;
+};
+
+/**
+ * Checks whether a name is an identifier as defined by the syntax file
+ * \param name the name
+ * \param len the length of the name
+ * \return true if the name is an identifier, false otherwise
+ */
+static bool is_table_identifier(const char * name, size_t len) {
+  if(len == 0 || len >= MAX_TABLE_NAME_LENGTH || !(isalpha((unsigned char) name[0]) || name[0] == '_')) {
+    return false;
+  }
+  for(size_t i = 1; i < len; ++i) {
+    if(!(isalnum((unsigned char) name[i]) || name[i] == '_')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Builds the path of a file in a table directory
+ * \param dest the destination buffer of MAX_TABLE_PATH_LENGTH bytes
+ * \param dir the table directory
+ * \param name the file name
+ * \param suffix the suffix of the file name
+ * \return 0 on success, -1 if the path is too long
+ */
+static int table_file_path(char * dest, const char * dir, const char * name, const char * suffix) {
+  int len = snprintf(dest, MAX_TABLE_PATH_LENGTH, "%s/%s%s", dir, name, suffix);
+  if(len < 0 || len >= MAX_TABLE_PATH_LENGTH) {
+    LOG_ERROR("table file path too long for %s", name);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Writes all buffers to a file descriptor, retrying on partial writes and interrupts
+ * \param fd the file descriptor
+ * \param iov the buffers, modified in place
+ * \param count the number of buffers
+ * \return 0 on success, -1 on error
+ */
+static int write_table_iovec(int fd, struct iovec * iov, int count) {
+  while(count > 0) {
+    ssize_t written = writev(fd, iov, count);
+    if(written < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    while(count > 0 && (size_t) written >= iov->iov_len) {
+      written -= (ssize_t) iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if(count > 0) {
+      iov->iov_base = (char *) iov->iov_base + written;
+      iov->iov_len -= (size_t) written;
+    }
+  }
+  return 0;
+}
+
+void init_table_options(struct table_options * options) {
+  assert(options != NULL);
+
+  options->row_group_size = DEFAULT_TABLE_ROW_GROUP_SIZE;
+  options->bloom_bits_per_key = DEFAULT_BLOOM_BITS_PER_KEY;
+  options->compressed = true;
+}
+
+int add_table_column(struct table_schema * schema, const char * name, enum table_column_type type) {
+  assert(schema != NULL);
+  assert(name != NULL);
+
+  size_t len = strlen(name);
+  if(!is_table_identifier(name, len)) {
+    LOG_ERROR("invalid column name %s", name);
+    return -1;
+  }
+  if(schema->column_count == MAX_TABLE_COLUMNS) {
+    LOG_ERROR("too many columns");
+    return -1;
+  }
+  for(size_t i = 0; i < schema->column_count; ++i) {
+    if(strcmp(schema->columns[i].name, name) == 0) {
+      LOG_ERROR("duplicate column %s", name);
+      return -1;
+    }
+  }
+  struct table_column_def * def = &schema->columns[schema->column_count];
+  memcpy(def->name, name, len + 1);
+  def->type = type;
+  return (int) schema->column_count++;
+}
+
+/**
+ * Releases the buffers and closes the column files of a writer
+ * \param w the writer
+ * \return 0 on success, -1 if a column file could not be closed
+ */
+static int dispose_table_writer(struct table_writer * w) {
+  int result = 0;
+  for(size_t i = 0; i < w->schema.column_count; ++i) {
+    struct table_column_buffer * b = &w->buffers[i];
+    if(b->fd >= 0 && close(b->fd) != 0) {
+      result = -1;
+    }
+    b->fd = -1;
+    free(b->values);
+    free(b->bytes);
+    free(b->groups);
+    b->values = NULL;
+    b->bytes = NULL;
+    b->groups = NULL;
+  }
+  return result;
+}
+
+int create_table(struct table_writer * w, const char * path, const struct table_schema * schema, const struct table_options * options) {
+  assert(w != NULL);
+  assert(path != NULL);
+  assert(schema != NULL);
+  assert(options != NULL);
+
+  if(schema->column_count == 0 || options->row_group_size == 0) {
+    LOG_ERROR("a table needs columns and rows in a row group");
+    return -1;
+  }
+  if(strlen(path) >= MAX_TABLE_PATH_LENGTH) {
+    LOG_ERROR("table path too long");
+    return -1;
+  }
+  memset(w, 0, sizeof(struct table_writer));
+  strcpy(w->path, path);
+  w->schema = *schema;
+  w->options = *options;
+  for(size_t i = 0; i < schema->column_count; ++i) {
+    w->buffers[i].fd = -1;
+  }
+
+  if(mkdir(path, TABLE_DIR_MODE) != 0) {
+    LOG_ERROR("could not create table directory %s: %s", path, strerror(errno));
+    return -1;
+  }
+  for(size_t i = 0; i < schema->column_count; ++i) {
+    struct table_column_buffer * b = &w->buffers[i];
+    char file_path[MAX_TABLE_PATH_LENGTH];
+    if(table_file_path(file_path, path, schema->columns[i].name, TABLE_COLUMN_FILE_SUFFIX) != 0) {
+      dispose_table_writer(w);
+      return -1;
+    }
+    b->fd = open(file_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, TABLE_FILE_MODE);
+    if(b->fd < 0) {
+      LOG_ERROR("could not create column file %s: %s", file_path, strerror(errno));
+      dispose_table_writer(w);
+      return -1;
+    }
+
+    // Strings need one more offset for the end of the last string
+    size_t values = schema->columns[i].type == TABLE_COLUMN_STRING ? options->row_group_size + 1 : options->row_group_size;
+    b->values_size = values * sizeof(uint64_t);
+    b->values = (char *) malloc(b->values_size);
+    if(b->values == NULL) {
+      LOG_ERROR("could not allocate column buffer");
+      dispose_table_writer(w);
+      return -1;
+    }
+
+    char header[TABLE_COLUMN_HEADER_LENGTH];
+    uint32_t order = TABLE_BYTE_ORDER;
+    uint32_t type = (uint32_t) schema->columns[i].type;
+    memcpy(header, TABLE_COLUMN_MAGIC, TABLE_MAGIC_LENGTH);
+    memcpy(header + TABLE_MAGIC_LENGTH, &order, 4);
+    memcpy(header + TABLE_MAGIC_LENGTH + 4, &type, 4);
+    struct iovec iov = { header, TABLE_COLUMN_HEADER_LENGTH };
+    if(write_table_iovec(b->fd, &iov, 1) != 0) {
+      LOG_ERROR("could not write column file %s: %s", file_path, strerror(errno));
+      dispose_table_writer(w);
+      return -1;
+    }
+    b->offset = TABLE_COLUMN_HEADER_LENGTH;
+  }
+  return 0;
+}
+
+/**
+ * Appends a string to the buffer of a string column
+ * \param b the column buffer
+ * \param rows the number of strings already in the buffer
+ * \param text the bytes of the string
+ * \param len the number of bytes
+ * \return 0 on success, -1 on error
+ */
+static int append_table_string(struct table_column_buffer * b, size_t rows, const char * text, size_t len) {
+  uint64_t * offsets = (uint64_t *) b->values;
+  if(rows == 0) {
+    offsets[0] = 0;
+    b->bytes_len = 0;
+  }
+  if(b->bytes_len + len > b->bytes_size) {
+    size_t size = b->bytes_size != 0 ? b->bytes_size : 4096;
+    while(b->bytes_len + len > size) {
+      size *= 2;
+    }
+    char * bytes = (char *) realloc(b->bytes, size);
+    if(bytes == NULL) {
+      LOG_ERROR("could not grow string buffer");
+      return -1;
+    }
+    b->bytes = bytes;
+    b->bytes_size = size;
+  }
+  if(len != 0) {
+    memcpy(b->bytes + b->bytes_len, text, len);
+  }
+  b->bytes_len += len;
+  offsets[rows + 1] = b->bytes_len;
+  return 0;
+}
+
+/**
+ * Compares two strings in byte order, a prefix sorting first
+ * \param a the bytes of the first string
+ * \param a_len the length of the first string
+ * \param b the bytes of the second string
+ * \param b_len the length of the second string
+ * \return a negative number, 0 or a positive number if a is before, equal to or after b
+ */
+static int compare_table_strings(const char * a, size_t a_len, const char * b, size_t b_len) {
+  size_t len = a_len < b_len ? a_len : b_len;
+  int result = len > 0 ? memcmp(a, b, len) : 0;
+  if(result != 0) {
+    return result;
+  }
+  return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+/**
+ * Compares two strings of a row group in byte order, a prefix sorting first
+ * \param a the first entry
+ * \param b the second entry
+ * \return a negative number, 0 or a positive number if a is before, equal to or after b
+ */
+static int compare_table_dictionary_entries(const void * a, const void * b) {
+  const struct table_dictionary_entry * x = (const struct table_dictionary_entry *) a;
+  const struct table_dictionary_entry * y = (const struct table_dictionary_entry *) b;
+  return compare_table_strings(x->text, x->len, y->text, y->len);
+}
+
+/**
+ * Releases the buffers of a dictionary encoding
+ * \param d the dictionary encoding
+ */
+static void dispose_table_dictionary(struct table_dictionary * d) {
+  free(d->offsets);
+  free(d->bytes);
+  free(d->codes);
+}
+
+/**
+ * Builds the sorted dictionary of the buffered strings of a row group and the code of each row
+ * \param b the column buffer
+ * \param rows the number of strings in the buffer
+ * \param d the destination for the dictionary, to dispose of
+ * \return 0 on success, -1 on error
+ */
+static int build_table_dictionary(const struct table_column_buffer * b, size_t rows, struct table_dictionary * d) {
+  memset(d, 0, sizeof(struct table_dictionary));
+  const uint64_t * offsets = (const uint64_t *) b->values;
+  struct table_dictionary_entry * entries = (struct table_dictionary_entry *) malloc(rows * sizeof(struct table_dictionary_entry));
+  uint32_t * codes = (uint32_t *) malloc(rows * sizeof(uint32_t));
+  d->offsets = (uint64_t *) malloc((rows + 1) * sizeof(uint64_t));
+  d->bytes = (char *) malloc(b->bytes_len != 0 ? b->bytes_len : 1);
+  if(entries == NULL || codes == NULL || d->offsets == NULL || d->bytes == NULL) {
+    LOG_ERROR("could not allocate dictionary");
+    free(entries);
+    free(codes);
+    dispose_table_dictionary(d);
+    return -1;
+  }
+  for(size_t i = 0; i < rows; ++i) {
+    entries[i].text = b->bytes + offsets[i];
+    entries[i].len = (size_t) (offsets[i + 1] - offsets[i]);
+    entries[i].row = (uint32_t) i;
+  }
+  qsort(entries, rows, sizeof(struct table_dictionary_entry), compare_table_dictionary_entries);
+
+  // Equal strings are adjacent once sorted, each run of them gets the next code
+  d->offsets[0] = 0;
+  for(size_t i = 0; i < rows; ++i) {
+    if(i == 0 || compare_table_dictionary_entries(&entries[i - 1], &entries[i]) != 0) {
+      if(entries[i].len > 0) {
+	memcpy(d->bytes + d->bytes_len, entries[i].text, entries[i].len);
+      }
+      d->bytes_len += entries[i].len;
+      d->offsets[++d->count] = d->bytes_len;
+    }
+    codes[entries[i].row] = (uint32_t) (d->count - 1);
+  }
+  free(entries);
+  d->bits = get_bitpack_width(d->count > 1 ? (uint32_t) (d->count - 1) : 0);
+  d->codes = codes;
+  return 0;
+}
+
+/**
+ * Fills the zone map of a row group of a string column from its sorted dictionary and builds its Bloom filter
+ * \param w the writer
+ * \param d the dictionary, of at least one string
+ * \param group the row group
+ * \param bloom the destination for the Bloom filter, left without bits if the writer builds none
+ * \return 0 on success, -1 on error
+ */
+static int set_table_string_zone(const struct table_writer * w, const struct table_dictionary * d, struct table_row_group * group, struct bloom_filter * bloom) {
+  size_t min_len = (size_t) (d->offsets[1] - d->offsets[0]);
+  size_t max_len = (size_t) (d->offsets[d->count] - d->offsets[d->count - 1]);
+  group->min_len = (uint32_t) (min_len < TABLE_ZONE_PREFIX_LENGTH ? min_len : TABLE_ZONE_PREFIX_LENGTH);
+  group->max_len = (uint32_t) (max_len < TABLE_ZONE_PREFIX_LENGTH ? max_len : TABLE_ZONE_PREFIX_LENGTH);
+  memcpy(group->min_text, d->bytes + d->offsets[0], group->min_len);
+  memcpy(group->max_text, d->bytes + d->offsets[d->count - 1], group->max_len);
+  if(w->options.bloom_bits_per_key == 0) {
+    return 0;
+  }
+  if(init_bloom_filter(bloom, d->count, w->options.bloom_bits_per_key) != 0) {
+    return -1;
+  }
+  for(size_t i = 0; i < d->count; ++i) {
+    add_bloom_key(bloom, d->bytes + d->offsets[i], (size_t) (d->offsets[i + 1] - d->offsets[i]));
+  }
+  return 0;
+}
+
+/**
+ * Rounds a length up to a multiple of TABLE_ALIGNMENT
+ * \param len the length
+ * \return the padded length
+ */
+static uint64_t align_table_length(uint64_t len) {
+  return (len + TABLE_ALIGNMENT - 1) / TABLE_ALIGNMENT * TABLE_ALIGNMENT;
+}
+
+/**
+ * Starts an encoded row group with an empty header
+ * \param e the encoded row group
+ */
+static void init_table_encoded_group(struct table_encoded_group * e) {
+  memset(e, 0, sizeof(struct table_encoded_group));
+  e->iov[0].iov_base = &e->header;
+  e->iov[0].iov_len = sizeof(struct table_group_header);
+  e->count = 1;
+  e->len = sizeof(struct table_group_header);
+}
+
+/**
+ * Releases the sections allocated by the encoding of a row group
+ * \param e the encoded row group
+ */
+static void dispose_table_encoded_group(struct table_encoded_group * e) {
+  for(size_t i = 0; i < e->buffer_count; ++i) {
+    free(e->buffers[i]);
+  }
+  e->buffer_count = 0;
+}
+
+/**
+ * Appends a section to an encoded row group, padded to TABLE_ALIGNMENT
+ * \param e the encoded row group
+ * \param data the bytes of the section
+ * \param len the number of bytes
+ */
+static void add_table_section(struct table_encoded_group * e, const void * data, size_t len) {
+  static const char padding[TABLE_ALIGNMENT];
+
+  size_t padded = (size_t) align_table_length(len);
+  e->iov[e->count].iov_base = (void *) data;
+  e->iov[e->count++].iov_len = len;
+  e->iov[e->count].iov_base = (void *) padding;
+  e->iov[e->count++].iov_len = padded - len;
+  e->len += padded;
+}
+
+/**
+ * Allocates a section of an encoded row group, released with it
+ * \param e the encoded row group
+ * \param len the number of bytes
+ * \return the section or NULL on error
+ */
+static void * allocate_table_section(struct table_encoded_group * e, size_t len) {
+  void * section = malloc(len != 0 ? len : 1);
+  if(section == NULL) {
+    LOG_ERROR("could not allocate encoded row group");
+    return NULL;
+  }
+  e->buffers[e->buffer_count++] = section;
+  return section;
+}
+
+/**
+ * Appends a section of bit-packed values to an encoded row group
+ * \param e the encoded row group
+ * \param values the values
+ * \param count the number of values
+ * \param bits the width of the values
+ * \return 0 on success, -1 on error
+ */
+static int add_table_packed_section(struct table_encoded_group * e, const uint32_t * values, size_t count, unsigned int bits) {
+  size_t len = get_bitpack_words(count, bits) * sizeof(uint64_t);
+  uint64_t * words = (uint64_t *) allocate_table_section(e, len);
+  if(words == NULL) {
+    return -1;
+  }
+  pack_bits(words, values, count, bits);
+  add_table_section(e, words, len);
+  return 0;
+}
+
+/**
+ * Encodes the values of a row group of an integer column in the encoding taking the least space and fills its zone map
+ * \param w the writer
+ * \param values the values
+ * \param rows the number of values, at least 1
+ * \param group the row group
+ * \param e the encoded row group, started
+ * \return 0 on success, -1 on error
+ */
+static int encode_table_integers(const struct table_writer * w, const int64_t * values, size_t rows, struct table_row_group * group, struct table_encoded_group * e) {
+  // The statistics of one pass give the exact size of every encoding, no sample is needed to estimate them
+  int64_t min = values[0];
+  int64_t max = values[0];
+  int64_t delta_min = 0;
+  int64_t delta_max = 0;
+  size_t runs = 1;
+  for(size_t i = 1; i < rows; ++i) {
+    int64_t delta = (int64_t) ((uint64_t) values[i] - (uint64_t) values[i - 1]);
+    min = values[i] < min ? values[i] : min;
+    max = values[i] > max ? values[i] : max;
+    delta_min = i == 1 || delta < delta_min ? delta : delta_min;
+    delta_max = i == 1 || delta > delta_max ? delta : delta_max;
+    runs += values[i] != values[i - 1];
+  }
+  group->min = min;
+  group->max = max;
+
+  enum table_encoding encoding = TABLE_ENCODING_PLAIN;
+  size_t best = rows * sizeof(int64_t);
+  unsigned int frame_bits = 0;
+  unsigned int delta_bits = 0;
+  if(w->options.compressed) {
+    uint64_t range = (uint64_t) max - (uint64_t) min;
+    uint64_t delta_range = (uint64_t) delta_max - (uint64_t) delta_min;
+    if(range <= UINT32_MAX) {
+      frame_bits = get_bitpack_width((uint32_t) range);
+      size_t len = get_bitpack_words(rows, frame_bits) * sizeof(uint64_t);
+      if(len < best) {
+	encoding = TABLE_ENCODING_FRAME_OF_REFERENCE;
+	best = len;
+      }
+    }
+    if(rows > 1 && delta_range <= UINT32_MAX) {
+      delta_bits = get_bitpack_width((uint32_t) delta_range);
+      size_t checkpoints = (rows + TABLE_DELTA_BLOCK_ROWS - 1) / TABLE_DELTA_BLOCK_ROWS;
+      size_t len = checkpoints * sizeof(int64_t) + get_bitpack_words(rows, delta_bits) * sizeof(uint64_t);
+      if(len < best) {
+	encoding = TABLE_ENCODING_DELTA;
+	best = len;
+      }
+    }
+    size_t len = runs * sizeof(int64_t) + (size_t) align_table_length(runs * sizeof(uint32_t));
+    if(len < best || runs * TABLE_MIN_RUN_LENGTH <= rows) {
+      encoding = TABLE_ENCODING_RUN_LENGTH;
+    }
+  }
+
+  e->header.encoding = (uint32_t) encoding;
+  switch(encoding) {
+  case TABLE_ENCODING_RUN_LENGTH: {
+    int64_t * run_values = (int64_t *) allocate_table_section(e, runs * sizeof(int64_t));
+    uint32_t * run_ends = run_values != NULL ? (uint32_t *) allocate_table_section(e, runs * sizeof(uint32_t)) : NULL;
+    if(run_ends == NULL) {
+      return -1;
+    }
+    size_t run = 0;
+    for(size_t i = 0; i < rows; ++i) {
+      if(i > 0 && values[i] != values[i - 1]) {
+	run_ends[run++] = (uint32_t) i;
+      }
+      run_values[run] = values[i];
+    }
+    run_ends[run] = (uint32_t) rows;
+    e->header.run_count = runs;
+    add_table_section(e, run_values, runs * sizeof(int64_t));
+    add_table_section(e, run_ends, runs * sizeof(uint32_t));
+    return 0;
+  }
+  case TABLE_ENCODING_FRAME_OF_REFERENCE:
+  case TABLE_ENCODING_DELTA: {
+    bool delta = encoding == TABLE_ENCODING_DELTA;
+    int64_t * checkpoints = NULL;
+    if(delta) {
+      checkpoints = (int64_t *) allocate_table_section(e, (rows + TABLE_DELTA_BLOCK_ROWS - 1) / TABLE_DELTA_BLOCK_ROWS * sizeof(int64_t));
+      if(checkpoints == NULL) {
+	return -1;
+      }
+      add_table_section(e, checkpoints, (rows + TABLE_DELTA_BLOCK_ROWS - 1) / TABLE_DELTA_BLOCK_ROWS * sizeof(int64_t));
+    }
+    uint32_t * packed = (uint32_t *) malloc(rows * sizeof(uint32_t));
+    if(packed == NULL) {
+      LOG_ERROR("could not allocate encoded row group");
+      return -1;
+    }
+    // Differences are taken modulo 2^64, so they decode back to the values even when they overflow
+    e->header.base = delta ? delta_min : min;
+    e->header.bits = delta ? delta_bits : frame_bits;
+    for(size_t i = 0; i < rows; ++i) {
+      if(!delta) {
+	packed[i] = (uint32_t) ((uint64_t) values[i] - (uint64_t) min);
+      } else if(i % TABLE_DELTA_BLOCK_ROWS == 0) {
+	checkpoints[i / TABLE_DELTA_BLOCK_ROWS] = values[i];
+	packed[i] = 0;
+      } else {
+	packed[i] = (uint32_t) ((uint64_t) values[i] - (uint64_t) values[i - 1] - (uint64_t) delta_min);
+      }
+    }
+    int result = add_table_packed_section(e, packed, rows, e->header.bits);
+    free(packed);
+    return result;
+  }
+  default:
+    add_table_section(e, values, rows * sizeof(int64_t));
+    return 0;
+  }
+}
+
+/**
+ * Compresses the strings of a dictionary with the block codec if a sample of them shrinks enough
+ * \param e the encoded row group, which the compressed strings become a section of
+ * \param bytes the strings
+ * \param len the number of bytes of the strings
+ * \param compressed the destination for the compressed strings, NULL if they are better stored as they are
+ * \param compressed_len the destination for the number of bytes of the compressed strings
+ * \return 0 on success, -1 on error
+ */
+static int compress_table_strings(struct table_encoded_group * e, const char * bytes, size_t len, const char ** compressed, size_t * compressed_len) {
+  *compressed = NULL;
+  *compressed_len = 0;
+  if(len == 0 || len > MAX_LZ_BLOCK_LENGTH) {
+    return 0;
+  }
+  size_t capacity = get_lz_bound(len);
+  char * dest = (char *) malloc(capacity);
+  if(dest == NULL) {
+    LOG_ERROR("could not allocate compressed dictionary");
+    return -1;
+  }
+  // Most dictionaries either compress well throughout or not at all, their first bytes tell which
+  size_t sample = len < TABLE_CODEC_SAMPLE_LENGTH ? len : TABLE_CODEC_SAMPLE_LENGTH;
+  size_t n = compress_lz_block(bytes, sample, dest, capacity);
+  if(n != 0 && n <= sample / 8 * 7 && sample < len) {
+    n = compress_lz_block(bytes, len, dest, capacity);
+    sample = len;
+  }
+  if(n == 0 || n > sample / 8 * 7) {
+    free(dest);
+    return 0;
+  }
+  e->buffers[e->buffer_count++] = dest;
+  *compressed = dest;
+  *compressed_len = n;
+  return 0;
+}
+
+/**
+ * Encodes the codes of a row group of a string column as runs or bit-packed, whichever suits them, after the dictionary
+ * \param w the writer
+ * \param d the dictionary
+ * \param rows the number of rows, at least 1
+ * \param e the encoded row group, started
+ * \return 0 on success, -1 on error
+ */
+static int encode_table_strings(const struct table_writer * w, const struct table_dictionary * d, size_t rows, struct table_encoded_group * e) {
+  size_t runs = 1;
+  for(size_t i = 1; i < rows; ++i) {
+    runs += d->codes[i] != d->codes[i - 1];
+  }
+  size_t packed_len = get_bitpack_words(rows, d->bits) * sizeof(uint64_t);
+  size_t run_len = 2 * (size_t) align_table_length(runs * sizeof(uint32_t));
+  bool run_length = w->options.compressed && (run_len < packed_len || runs * TABLE_MIN_RUN_LENGTH <= rows);
+
+  e->header.encoding = (uint32_t) (run_length ? TABLE_ENCODING_RUN_LENGTH : TABLE_ENCODING_DICTIONARY);
+  e->header.bits = d->bits;
+  e->header.dictionary_size = d->count;
+  e->header.bytes_len = d->bytes_len;
+  add_table_section(e, d->offsets, (d->count + 1) * sizeof(uint64_t));
+  const char * compressed = NULL;
+  size_t compressed_len = 0;
+  if(w->options.compressed && compress_table_strings(e, d->bytes, d->bytes_len, &compressed, &compressed_len) != 0) {
+    return -1;
+  }
+  if(compressed != NULL) {
+    e->header.compressed_len = compressed_len;
+    add_table_section(e, compressed, compressed_len);
+  } else {
+    add_table_section(e, d->bytes, d->bytes_len);
+  }
+  if(!run_length) {
+    return add_table_packed_section(e, d->codes, rows, d->bits);
+  }
+
+  uint32_t * run_codes = (uint32_t *) allocate_table_section(e, runs * sizeof(uint32_t));
+  uint32_t * run_ends = run_codes != NULL ? (uint32_t *) allocate_table_section(e, runs * sizeof(uint32_t)) : NULL;
+  if(run_ends == NULL) {
+    return -1;
+  }
+  size_t run = 0;
+  for(size_t i = 0; i < rows; ++i) {
+    if(i > 0 && d->codes[i] != d->codes[i - 1]) {
+      run_ends[run++] = (uint32_t) i;
+    }
+    run_codes[run] = d->codes[i];
+  }
+  run_ends[run] = (uint32_t) rows;
+  e->header.run_count = runs;
+  add_table_section(e, run_codes, runs * sizeof(uint32_t));
+  add_table_section(e, run_ends, runs * sizeof(uint32_t));
+  return 0;
+}
+
+/**
+ * Writes the buffered row group of every column to the column files, followed by the Bloom filter of string columns
+ * \param w the writer
+ * \return 0 on success, -1 on error
+ */
+static int write_table_row_group(struct table_writer * w) {
+  size_t rows = w->group_rows;
+  for(size_t i = 0; i < w->schema.column_count; ++i) {
+    struct table_column_buffer * b = &w->buffers[i];
+    if(w->group_count == b->groups_size) {
+      size_t size = b->groups_size != 0 ? b->groups_size * 2 : 16;
+      struct table_row_group * groups = (struct table_row_group *) realloc(b->groups, size * sizeof(struct table_row_group));
+      if(groups == NULL) {
+	LOG_ERROR("could not grow row group directory");
+	return -1;
+      }
+      b->groups = groups;
+      b->groups_size = size;
+    }
+    struct table_row_group * group = &b->groups[w->group_count];
+    memset(group, 0, sizeof(struct table_row_group));
+    group->offset = b->offset;
+    group->rows = rows;
+
+    struct table_dictionary d;
+    struct bloom_filter bloom = { NULL, 0, 0 };
+    struct table_encoded_group e;
+    init_table_encoded_group(&e);
+    bool strings = w->schema.columns[i].type == TABLE_COLUMN_STRING;
+    int result;
+    if(strings) {
+      if(build_table_dictionary(b, rows, &d) != 0) {
+	return -1;
+      }
+      result = set_table_string_zone(w, &d, group, &bloom);
+      if(result == 0) {
+	result = encode_table_strings(w, &d, rows, &e);
+      }
+    } else {
+      result = encode_table_integers(w, (const int64_t *) b->values, rows, group, &e);
+    }
+    if(result == 0) {
+      group->len = e.len;
+      // The Bloom filter lies apart from the values, so testing it does not read them
+      if(bloom.size != 0) {
+	group->bloom_offset = b->offset + e.len;
+	group->bloom_size = (uint32_t) bloom.size;
+	group->bloom_hash_count = bloom.hash_count;
+	add_table_section(&e, bloom.bits, bloom.size);
+      }
+      result = write_table_iovec(b->fd, e.iov, e.count);
+      if(result != 0) {
+	LOG_ERROR("could not write column %s: %s", w->schema.columns[i].name, strerror(errno));
+      }
+      b->offset += e.len;
+    }
+    dispose_table_encoded_group(&e);
+    if(strings) {
+      dispose_table_dictionary(&d);
+    }
+    dispose_bloom_filter(&bloom);
+    if(result != 0) {
+      return -1;
+    }
+  }
+  ++w->group_count;
+  w->group_rows = 0;
+  return 0;
+}
+
+int append_table_row(struct table_writer * w, const struct table_value * values) {
+  assert(w != NULL);
+  assert(values != NULL);
+
+  size_t rows = w->group_rows;
+  for(size_t i = 0; i < w->schema.column_count; ++i) {
+    struct table_column_buffer * b = &w->buffers[i];
+    if(w->schema.columns[i].type == TABLE_COLUMN_STRING) {
+      if(append_table_string(b, rows, values[i].text, values[i].len) != 0) {
+	return -1;
+      }
+    } else {
+      ((int64_t *) b->values)[rows] = values[i].integer;
+    }
+  }
+  ++w->group_rows;
+  ++w->row_count;
+  if(w->group_rows == w->options.row_group_size) {
+    return write_table_row_group(w);
+  }
+  return 0;
+}
+
+/**
+ * Writes the row group directory and the trailer of a column file
+ * \param w the writer
+ * \param b the column buffer
+ * \return 0 on success, -1 on error
+ */
+static int write_table_column_trailer(struct table_writer * w, struct table_column_buffer * b) {
+  uint64_t count = w->group_count;
+  struct iovec iov[3] = {
+    { b->groups, w->group_count * sizeof(struct table_row_group) },
+    { &count, sizeof(count) },
+    { TABLE_COLUMN_MAGIC, TABLE_MAGIC_LENGTH }
+  };
+  return write_table_iovec(b->fd, iov, 3);
+}
+
+/**
+ * Writes the metadata file of a table, which makes the table visible to readers
+ * \param w the writer
+ * \return 0 on success, -1 on error
+ */
+static int write_table_meta(struct table_writer * w) {
+  char path[MAX_TABLE_PATH_LENGTH];
+  if(table_file_path(path, w->path, TABLE_META_FILE_NAME, "") != 0) {
+    return -1;
+  }
+  FILE * file = fopen(path, "wbx");
+  if(file == NULL) {
+    LOG_ERROR("could not create table metadata %s: %s", path, strerror(errno));
+    return -1;
+  }
+  uint32_t order = TABLE_BYTE_ORDER;
+  uint32_t version = TABLE_FORMAT_VERSION;
+  uint64_t row_group_size = w->options.row_group_size;
+  uint64_t row_count = w->row_count;
+  uint64_t group_count = w->group_count;
+  uint32_t column_count = (uint32_t) w->schema.column_count;
+  bool ok = fwrite(TABLE_MAGIC, 1, TABLE_MAGIC_LENGTH, file) == TABLE_MAGIC_LENGTH
+    && fwrite(&order, sizeof(order), 1, file) == 1
+    && fwrite(&version, sizeof(version), 1, file) == 1
+    && fwrite(&row_group_size, sizeof(row_group_size), 1, file) == 1
+    && fwrite(&row_count, sizeof(row_count), 1, file) == 1
+    && fwrite(&group_count, sizeof(group_count), 1, file) == 1
+    && fwrite(&column_count, sizeof(column_count), 1, file) == 1;
+  for(size_t i = 0; i < w->schema.column_count && ok; ++i) {
+    uint32_t type = (uint32_t) w->schema.columns[i].type;
+    uint32_t len = (uint32_t) strlen(w->schema.columns[i].name);
+    ok = fwrite(&type, sizeof(type), 1, file) == 1
+      && fwrite(&len, sizeof(len), 1, file) == 1
+      && fwrite(w->schema.columns[i].name, 1, len, file) == len;
+  }
+  if(fclose(file) != 0 || !ok) {
+    LOG_ERROR("could not write table metadata %s", path);
+    return -1;
+  }
+  return 0;
+}
+
+int close_table_writer(struct table_writer * w) {
+  assert(w != NULL);
+
+  int result = 0;
+  if(w->group_rows != 0 && write_table_row_group(w) != 0) {
+    result = -1;
+  }
+  for(size_t i = 0; i < w->schema.column_count && result == 0; ++i) {
+    struct table_column_buffer * b = &w->buffers[i];
+    if(write_table_column_trailer(w, b) != 0 || fdatasync(b->fd) != 0) {
+      LOG_ERROR("could not write column %s: %s", w->schema.columns[i].name, strerror(errno));
+      result = -1;
+    }
+  }
+  if(dispose_table_writer(w) != 0) {
+    LOG_ERROR("could not close column files of %s", w->path);
+    result = -1;
+  }
+  // The metadata is written last, a table that was not written completely can not be opened
+  if(result == 0) {
+    result = write_table_meta(w);
+  }
+  return result;
+}
+
+/**
+ * Reads the metadata file of a table
+ * \param t the table, with the path set
+ * \return 0 on success, -1 on error
+ */
+static int read_table_meta(struct table * t) {
+  char path[MAX_TABLE_PATH_LENGTH];
+  if(table_file_path(path, t->path, TABLE_META_FILE_NAME, "") != 0) {
+    return -1;
+  }
+  FILE * file = fopen(path, "rb");
+  if(file == NULL) {
+    LOG_ERROR("could not open table metadata %s: %s", path, strerror(errno));
+    return -1;
+  }
+  char magic[TABLE_MAGIC_LENGTH];
+  uint32_t order;
+  uint32_t version;
+  uint64_t row_group_size;
+  uint64_t row_count;
+  uint64_t group_count;
+  uint32_t column_count;
+  bool ok = fread(magic, 1, TABLE_MAGIC_LENGTH, file) == TABLE_MAGIC_LENGTH
+    && fread(&order, sizeof(order), 1, file) == 1
+    && fread(&version, sizeof(version), 1, file) == 1
+    && fread(&row_group_size, sizeof(row_group_size), 1, file) == 1
+    && fread(&row_count, sizeof(row_count), 1, file) == 1
+    && fread(&group_count, sizeof(group_count), 1, file) == 1
+    && fread(&column_count, sizeof(column_count), 1, file) == 1
+    && memcmp(magic, TABLE_MAGIC, TABLE_MAGIC_LENGTH) == 0
+    && order == TABLE_BYTE_ORDER
+    && version == TABLE_FORMAT_VERSION
+    && row_group_size != 0
+    && column_count != 0 && column_count <= MAX_TABLE_COLUMNS;
+  t->schema.column_count = 0;
+  for(uint32_t i = 0; i < column_count && ok; ++i) {
+    struct table_column_def * def = &t->schema.columns[i];
+    uint32_t type;
+    uint32_t len;
+    ok = fread(&type, sizeof(type), 1, file) == 1
+      && fread(&len, sizeof(len), 1, file) == 1
+      && type <= TABLE_COLUMN_STRING && len < MAX_TABLE_NAME_LENGTH
+      && fread(def->name, 1, len, file) == len;
+    if(ok) {
+      def->name[len] = '\0';
+      def->type = (enum table_column_type) type;
+      ++t->schema.column_count;
+    }
+  }
+  fclose(file);
+  if(!ok) {
+    LOG_ERROR("invalid table metadata %s", path);
+    return -1;
+  }
+  t->row_group_size = (size_t) row_group_size;
+  t->row_count = row_count;
+  t->row_group_count = (size_t) group_count;
+  return 0;
+}
+
+int open_table(struct table * t, const char * path) {
+  assert(t != NULL);
+  assert(path != NULL);
+
+  if(strlen(path) >= MAX_TABLE_PATH_LENGTH) {
+    LOG_ERROR("table path too long");
+    return -1;
+  }
+  memset(t, 0, sizeof(struct table));
+  strcpy(t->path, path);
+  if(read_table_meta(t) != 0) {
+    return -1;
+  }
+  for(size_t i = 0; i < t->schema.column_count; ++i) {
+    t->columns[i].fd = -1;
+  }
+  for(size_t i = 0; i < t->schema.column_count; ++i) {
+    char file_path[MAX_TABLE_PATH_LENGTH];
+    if(table_file_path(file_path, path, t->schema.columns[i].name, TABLE_COLUMN_FILE_SUFFIX) != 0) {
+      close_table(t);
+      return -1;
+    }
+    t->columns[i].fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if(t->columns[i].fd < 0) {
+      LOG_ERROR("could not open column file %s: %s", file_path, strerror(errno));
+      close_table(t);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int open_named_table(struct table * t, const char * dir, const char * name, size_t len) {
+  assert(dir != NULL);
+  assert(name != NULL);
+
+  if(!is_table_identifier(name, len)) {
+    LOG_ERROR("invalid table name %.*s", (int) len, name);
+    return -1;
+  }
+  char path[MAX_TABLE_PATH_LENGTH];
+  int path_len = snprintf(path, MAX_TABLE_PATH_LENGTH, "%s/%.*s", dir, (int) len, name);
+  if(path_len < 0 || path_len >= MAX_TABLE_PATH_LENGTH) {
+    LOG_ERROR("table path too long for %.*s", (int) len, name);
+    return -1;
+  }
+  return open_table(t, path);
+}
+
+int find_table_column(const struct table * t, const char * name, size_t len) {
+  assert(t != NULL);
+  assert(name != NULL);
+
+  for(size_t i = 0; i < t->schema.column_count; ++i) {
+    if(strncmp(t->schema.columns[i].name, name, len) == 0 && t->schema.columns[i].name[len] == '\0') {
+      return (int) i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Maps a column file into memory and validates its row group directory
+ * \param t the table
+ * \param column the index of the column
+ * \return 0 on success, -1 on error
+ */
+static int map_table_column(struct table * t, size_t column) {
+  struct table_column * c = &t->columns[column];
+  struct stat st;
+  if(fstat(c->fd, &st) != 0) {
+    LOG_ERROR("could not stat column %s: %s", t->schema.columns[column].name, strerror(errno));
+    return -1;
+  }
+  size_t len = (size_t) st.st_size;
+  size_t directory_len = t->row_group_count * sizeof(struct table_row_group);
+  if(len < TABLE_COLUMN_HEADER_LENGTH + directory_len + TABLE_COLUMN_TRAILER_LENGTH) {
+    LOG_ERROR("column file of %s is truncated", t->schema.columns[column].name);
+    return -1;
+  }
+  void * map = mmap(NULL, len, PROT_READ, MAP_SHARED, c->fd, 0);
+  if(map == MAP_FAILED) {
+    LOG_ERROR("could not map column %s: %s", t->schema.columns[column].name, strerror(errno));
+    return -1;
+  }
+  // Scans read row groups front to back
+  madvise(map, len, MADV_SEQUENTIAL);
+
+  const char * data = (const char *) map;
+  uint32_t order;
+  uint32_t type;
+  uint64_t group_count;
+  memcpy(&order, data + TABLE_MAGIC_LENGTH, 4);
+  memcpy(&type, data + TABLE_MAGIC_LENGTH + 4, 4);
+  memcpy(&group_count, data + len - TABLE_COLUMN_TRAILER_LENGTH, 8);
+  const struct table_row_group * groups = (const struct table_row_group *) (data + len - TABLE_COLUMN_TRAILER_LENGTH - directory_len);
+  bool ok = memcmp(data, TABLE_COLUMN_MAGIC, TABLE_MAGIC_LENGTH) == 0
+    && memcmp(data + len - TABLE_MAGIC_LENGTH, TABLE_COLUMN_MAGIC, TABLE_MAGIC_LENGTH) == 0
+    && order == TABLE_BYTE_ORDER
+    && type == (uint32_t) t->schema.columns[column].type
+    && group_count == t->row_group_count;
+  size_t data_end = len - TABLE_COLUMN_TRAILER_LENGTH - directory_len;
+  for(size_t i = 0; i < t->row_group_count && ok; ++i) {
+    size_t min_len = sizeof(struct table_group_header);
+    ok = groups[i].offset >= TABLE_COLUMN_HEADER_LENGTH && groups[i].offset % TABLE_ALIGNMENT == 0
+      && groups[i].len <= data_end && groups[i].offset <= data_end - groups[i].len
+      && groups[i].len >= min_len && groups[i].rows <= t->row_group_size
+      && groups[i].min_len <= TABLE_ZONE_PREFIX_LENGTH && groups[i].max_len <= TABLE_ZONE_PREFIX_LENGTH
+      && (groups[i].bloom_size == 0
+	  || (groups[i].bloom_offset >= TABLE_COLUMN_HEADER_LENGTH && groups[i].bloom_size <= data_end
+	      && groups[i].bloom_offset <= data_end - groups[i].bloom_size
+	      && groups[i].bloom_hash_count >= 1 && groups[i].bloom_hash_count <= MAX_BLOOM_HASH_COUNT));
+  }
+  if(!ok) {
+    LOG_ERROR("invalid column file of %s", t->schema.columns[column].name);
+    munmap(map, len);
+    return -1;
+  }
+  if(type == TABLE_COLUMN_STRING) {
+    c->dictionaries = (atomic_uintptr_t *) malloc((t->row_group_count != 0 ? t->row_group_count : 1) * sizeof(atomic_uintptr_t));
+    if(c->dictionaries == NULL) {
+      LOG_ERROR("could not allocate dictionaries of %s", t->schema.columns[column].name);
+      munmap(map, len);
+      return -1;
+    }
+    for(size_t i = 0; i < t->row_group_count; ++i) {
+      atomic_init(&c->dictionaries[i], 0);
+    }
+  }
+  c->map = data;
+  c->map_len = len;
+  c->groups = groups;
+  return 0;
+}
+
+/**
+ * Takes the next section of a row group, checking that it lies within the row group
+ * \param data the position of the section, advanced past it and its padding
+ * \param available the number of bytes left in the row group, decreased
+ * \param len the length of the section
+ * \return the section or NULL if the row group is too short
+ */
+static const void * take_table_section(const char ** data, uint64_t * available, uint64_t len) {
+  if(len > *available || align_table_length(len) > *available) {
+    return NULL;
+  }
+  const void * section = *data;
+  *data += align_table_length(len);
+  *available -= align_table_length(len);
+  return section;
+}
+
+/**
+ * Checks that the string offsets of a dictionary start at 0 and ascend to the length of the strings
+ * \param offsets the offsets, one more than the strings
+ * \param size the number of strings
+ * \param bytes_len the length of the strings
+ * \return true if the offsets are valid, false otherwise
+ */
+static bool check_table_offsets(const uint64_t * offsets, uint64_t size, uint64_t bytes_len) {
+  if(offsets[0] != 0) {
+    return false;
+  }
+  for(uint64_t i = 0; i < size; ++i) {
+    if(offsets[i + 1] < offsets[i]) {
+      return false;
+    }
+  }
+  return offsets[size] == bytes_len;
+}
+
+/**
+ * Reads the dictionary of a row group of a string column, decompressing its strings on first use
+ * \param t the table
+ * \param column the index of the column
+ * \param group the index of the row group
+ * \param h the header of the row group
+ * \param data the position of the dictionary, advanced past it
+ * \param available the number of bytes left in the row group, decreased
+ * \param chunk the chunk
+ * \return 0 on success, -1 on error
+ */
+static int read_table_dictionary(struct table * t, size_t column, size_t group, const struct table_group_header * h, const char ** data, uint64_t * available, struct table_chunk * chunk) {
+  uint64_t size = h->dictionary_size;
+  bool ok = h->bits <= MAX_BITPACK_WIDTH && size <= chunk->rows && (size != 0 || chunk->rows == 0) && (size == 0 || ((size - 1) >> h->bits) == 0)
+    && (chunk->offsets = (const uint64_t *) take_table_section(data, available, (size + 1) * sizeof(uint64_t))) != NULL
+    && check_table_offsets(chunk->offsets, size, h->bytes_len);
+  const char * bytes = NULL;
+  if(ok) {
+    bytes = (const char *) take_table_section(data, available, h->compressed_len != 0 ? h->compressed_len : h->bytes_len);
+    ok = bytes != NULL;
+  }
+  if(!ok) {
+    LOG_ERROR("invalid dictionary in column %s", t->schema.columns[column].name);
+    return -1;
+  }
+  chunk->dictionary_size = (size_t) size;
+  if(h->compressed_len == 0) {
+    chunk->bytes = bytes;
+    return 0;
+  }
+
+  atomic_uintptr_t * slot = &t->columns[column].dictionaries[group];
+  uintptr_t strings = atomic_load_explicit(slot, memory_order_acquire);
+  if(strings == 0) {
+    char * decompressed = (char *) malloc(h->bytes_len != 0 ? (size_t) h->bytes_len : 1);
+    if(decompressed == NULL) {
+      LOG_ERROR("could not allocate dictionary of column %s", t->schema.columns[column].name);
+      return -1;
+    }
+    if(decompress_lz_block(bytes, (size_t) h->compressed_len, decompressed, (size_t) h->bytes_len) != 0) {
+      LOG_ERROR("invalid compressed dictionary in column %s", t->schema.columns[column].name);
+      free(decompressed);
+      return -1;
+    }
+    // Workers reading the row group at the same time may each decompress it, the first to finish publishes its copy
+    uintptr_t expected = 0;
+    if(atomic_compare_exchange_strong_explicit(slot, &expected, (uintptr_t) decompressed, memory_order_acq_rel, memory_order_acquire)) {
+      strings = (uintptr_t) decompressed;
+    } else {
+      free(decompressed);
+      strings = expected;
+    }
+  }
+  chunk->bytes = (const char *) strings;
+  return 0;
+}
+
+/**
+ * Checks that the runs of a run-length encoded chunk cover its rows in order
+ * \param chunk the chunk
+ * \return true if the runs are valid, false otherwise
+ */
+static bool check_table_runs(const struct table_chunk * chunk) {
+  if(chunk->run_count == 0) {
+    return chunk->rows == 0;
+  }
+  for(size_t i = 0; i < chunk->run_count; ++i) {
+    if((i > 0 ? chunk->run_ends[i] <= chunk->run_ends[i - 1] : chunk->run_ends[i] == 0)
+       || (chunk->run_codes != NULL && chunk->run_codes[i] >= chunk->dictionary_size)) {
+      return false;
+    }
+  }
+  return chunk->run_ends[chunk->run_count - 1] == chunk->rows;
+}
+
+int read_table_chunk(struct table * t, size_t column, size_t group, struct table_chunk * chunk) {
+  assert(t != NULL);
+  assert(chunk != NULL);
+  assert(column < t->schema.column_count);
+  assert(group < t->row_group_count);
+
+  struct table_column * c = &t->columns[column];
+  if(c->map == NULL && map_table_column(t, column) != 0) {
+    return -1;
+  }
+  const struct table_row_group * g = &c->groups[group];
+  struct table_group_header h;
+  memcpy(&h, c->map + g->offset, sizeof(struct table_group_header));
+  const char * data = c->map + g->offset + sizeof(struct table_group_header);
+  uint64_t available = g->len - sizeof(struct table_group_header);
+  memset(chunk, 0, sizeof(struct table_chunk));
+  chunk->type = t->schema.columns[column].type;
+  chunk->first_row = (uint64_t) group * t->row_group_size;
+  chunk->rows = (size_t) g->rows;
+  chunk->encoding = (enum table_encoding) h.encoding;
+  chunk->base = h.base;
+  chunk->code_bits = h.bits;
+  chunk->run_count = (size_t) h.run_count;
+  bool strings = chunk->type == TABLE_COLUMN_STRING;
+  if(strings && read_table_dictionary(t, column, group, &h, &data, &available, chunk) != 0) {
+    return -1;
+  }
+
+  bool ok = h.bits <= MAX_BITPACK_WIDTH && h.run_count <= g->rows;
+  uint64_t packed_len = get_bitpack_words(chunk->rows, h.bits) * sizeof(uint64_t);
+  switch(h.encoding) {
+  case TABLE_ENCODING_DICTIONARY:
+    ok = ok && strings && (chunk->codes = (const uint64_t *) take_table_section(&data, &available, packed_len)) != NULL;
+    break;
+  case TABLE_ENCODING_PLAIN:
+    ok = ok && !strings && (chunk->integers = (const int64_t *) take_table_section(&data, &available, g->rows * sizeof(int64_t))) != NULL;
+    break;
+  case TABLE_ENCODING_RUN_LENGTH:
+    if(strings) {
+      ok = ok && (chunk->run_codes = (const uint32_t *) take_table_section(&data, &available, h.run_count * sizeof(uint32_t))) != NULL;
+    } else {
+      ok = ok && (chunk->run_values = (const int64_t *) take_table_section(&data, &available, h.run_count * sizeof(int64_t))) != NULL;
+    }
+    ok = ok && (chunk->run_ends = (const uint32_t *) take_table_section(&data, &available, h.run_count * sizeof(uint32_t))) != NULL
+      && check_table_runs(chunk);
+    break;
+  case TABLE_ENCODING_DELTA:
+    ok = ok && (chunk->checkpoints = (const int64_t *) take_table_section(&data, &available, (g->rows + TABLE_DELTA_BLOCK_ROWS - 1) / TABLE_DELTA_BLOCK_ROWS * sizeof(int64_t))) != NULL;
+    // fall through
+  case TABLE_ENCODING_FRAME_OF_REFERENCE:
+    ok = ok && !strings && (chunk->codes = (const uint64_t *) take_table_section(&data, &available, packed_len)) != NULL;
+    break;
+  default:
+    ok = false;
+  }
+  if(!ok) {
+    LOG_ERROR("invalid row group %zu in column %s", group, t->schema.columns[column].name);
+    return -1;
+  }
+  return 0;
+}
+
+int test_table_row_group(struct table * t, size_t column, size_t group, const struct table_value * value) {
+  assert(t != NULL);
+  assert(column < t->schema.column_count);
+  assert(group < t->row_group_count);
+  assert(value != NULL);
+
+  struct table_column * c = &t->columns[column];
+  if(c->map == NULL && map_table_column(t, column) != 0) {
+    return -1;
+  }
+  const struct table_row_group * g = &c->groups[group];
+  if(t->schema.columns[column].type != TABLE_COLUMN_STRING) {
+    return value->integer >= g->min && value->integer <= g->max ? 1 : 0;
+  }
+
+  // Truncating keeps the order, the prefix of a string in the row group lies between the prefixes of its bounds
+  size_t len = value->len < TABLE_ZONE_PREFIX_LENGTH ? value->len : TABLE_ZONE_PREFIX_LENGTH;
+  if(compare_table_strings(value->text, len, g->min_text, g->min_len) < 0 || compare_table_strings(value->text, len, g->max_text, g->max_len) > 0) {
+    return 0;
+  }
+  if(g->bloom_size == 0) {
+    return 1;
+  }
+  struct bloom_filter bloom = { (unsigned char *) (c->map + g->bloom_offset), g->bloom_size, g->bloom_hash_count };
+  return test_bloom_key(&bloom, value->text, value->len) ? 1 : 0;
+}
+
+size_t find_table_run(const struct table_chunk * chunk, size_t index) {
+  assert(chunk != NULL);
+  assert(chunk->encoding == TABLE_ENCODING_RUN_LENGTH);
+  assert(index < chunk->rows);
+
+  size_t low = 0;
+  size_t high = chunk->run_count - 1;
+  while(low < high) {
+    size_t middle = low + (high - low) / 2;
+    if(chunk->run_ends[middle] <= index) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+int64_t get_table_integer(const struct table_chunk * chunk, size_t index) {
+  assert(chunk != NULL);
+  assert(chunk->type == TABLE_COLUMN_INT64);
+  assert(index < chunk->rows);
+
+  switch(chunk->encoding) {
+  case TABLE_ENCODING_RUN_LENGTH:
+    return chunk->run_values[find_table_run(chunk, index)];
+  case TABLE_ENCODING_FRAME_OF_REFERENCE:
+    return (int64_t) ((uint64_t) chunk->base + get_packed_value(chunk->codes, chunk->code_bits, index));
+  case TABLE_ENCODING_DELTA: {
+    size_t row = index / TABLE_DELTA_BLOCK_ROWS * TABLE_DELTA_BLOCK_ROWS;
+    uint64_t value = (uint64_t) chunk->checkpoints[index / TABLE_DELTA_BLOCK_ROWS];
+    while(row < index) {
+      value += (uint64_t) chunk->base + get_packed_value(chunk->codes, chunk->code_bits, ++row);
+    }
+    return (int64_t) value;
+  }
+  default:
+    return chunk->integers[index];
+  }
+}
+
+void decode_table_integers(const struct table_chunk * chunk, size_t first, size_t count, int64_t * dest) {
+  assert(chunk != NULL);
+  assert(chunk->type == TABLE_COLUMN_INT64);
+  assert(first <= chunk->rows && count <= chunk->rows - first);
+  assert(dest != NULL || count == 0);
+
+  if(count == 0) {
+    return;
+  }
+  uint32_t packed[TABLE_DECODE_BATCH];
+  switch(chunk->encoding) {
+  case TABLE_ENCODING_RUN_LENGTH:
+    for(size_t run = find_table_run(chunk, first), i = 0; i < count; ++run) {
+      size_t end = chunk->run_ends[run] - first < count ? chunk->run_ends[run] - first : count;
+      while(i < end) {
+	dest[i++] = chunk->run_values[run];
+      }
+    }
+    break;
+  case TABLE_ENCODING_FRAME_OF_REFERENCE:
+    for(size_t i = 0; i < count; i += TABLE_DECODE_BATCH) {
+      size_t n = count - i < TABLE_DECODE_BATCH ? count - i : TABLE_DECODE_BATCH;
+      unpack_bits(packed, chunk->codes, chunk->code_bits, first + i, n);
+      for(size_t j = 0; j < n; ++j) {
+	dest[i + j] = (int64_t) ((uint64_t) chunk->base + packed[j]);
+      }
+    }
+    break;
+  case TABLE_ENCODING_DELTA:
+    // Each block is summed from its checkpoint, skipping to the first row in the first block
+    for(size_t block = first / TABLE_DELTA_BLOCK_ROWS; block * TABLE_DELTA_BLOCK_ROWS < first + count; ++block) {
+      size_t start = block * TABLE_DELTA_BLOCK_ROWS;
+      size_t end = first + count - start < TABLE_DELTA_BLOCK_ROWS ? first + count : start + TABLE_DELTA_BLOCK_ROWS;
+      unpack_bits(packed, chunk->codes, chunk->code_bits, start, end - start);
+      uint64_t value = (uint64_t) chunk->checkpoints[block];
+      size_t i = 0;
+      for(; start + i < first; ++i) {
+	value += (uint64_t) chunk->base + packed[i + 1];
+      }
+      dest[start + i - first] = (int64_t) value;
+      for(++i; start + i < end; ++i) {
+	value += (uint64_t) chunk->base + packed[i];
+	dest[start + i - first] = (int64_t) value;
+      }
+    }
+    break;
+  default:
+    memcpy(dest, chunk->integers + first, count * sizeof(int64_t));
+  }
+}
+
+uint32_t get_table_code(const struct table_chunk * chunk, size_t index) {
+  assert(chunk != NULL);
+  assert(chunk->type == TABLE_COLUMN_STRING);
+  assert(index < chunk->rows);
+
+  if(chunk->encoding == TABLE_ENCODING_RUN_LENGTH) {
+    return chunk->run_codes[find_table_run(chunk, index)];
+  }
+  return get_packed_value(chunk->codes, chunk->code_bits, index);
+}
+
+void decode_table_codes(const struct table_chunk * chunk, size_t first, size_t count, uint32_t * dest) {
+  assert(chunk != NULL);
+  assert(chunk->type == TABLE_COLUMN_STRING);
+  assert(first <= chunk->rows && count <= chunk->rows - first);
+  assert(dest != NULL || count == 0);
+
+  if(count == 0) {
+    return;
+  }
+  if(chunk->encoding != TABLE_ENCODING_RUN_LENGTH) {
+    unpack_bits(dest, chunk->codes, chunk->code_bits, first, count);
+    return;
+  }
+  for(size_t run = find_table_run(chunk, first), i = 0; i < count; ++run) {
+    size_t end = chunk->run_ends[run] - first < count ? chunk->run_ends[run] - first : count;
+    while(i < end) {
+      dest[i++] = chunk->run_codes[run];
+    }
+  }
+}
+
+const char * get_table_string(const struct table_chunk * chunk, size_t index, size_t * len) {
+  assert(chunk != NULL);
+  assert(chunk->type == TABLE_COLUMN_STRING);
+  assert(index < chunk->rows);
+  assert(len != NULL);
+
+  uint32_t code = get_table_code(chunk, index);
+  *len = (size_t) (chunk->offsets[code + 1] - chunk->offsets[code]);
+  return chunk->bytes + chunk->offsets[code];
+}
+
+bool find_table_code(const struct table_chunk * chunk, const char * text, size_t len, uint32_t * code) {
+  assert(chunk != NULL);
+  assert(chunk->type == TABLE_COLUMN_STRING);
+  assert(text != NULL || len == 0);
+  assert(code != NULL);
+
+  size_t low = 0;
+  size_t high = chunk->dictionary_size;
+  while(low < high) {
+    size_t middle = low + (high - low) / 2;
+    struct table_dictionary_entry entry = { chunk->bytes + chunk->offsets[middle], (size_t) (chunk->offsets[middle + 1] - chunk->offsets[middle]), 0 };
+    struct table_dictionary_entry key = { text, len, 0 };
+    int order = compare_table_dictionary_entries(&entry, &key);
+    if(order == 0) {
+      *code = (uint32_t) middle;
+      return true;
+    }
+    if(order < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return false;
+}
+
+void close_table(struct table * t) {
+  assert(t != NULL);
+
+  for(size_t i = 0; i < t->schema.column_count; ++i) {
+    struct table_column * c = &t->columns[i];
+    if(c->map != NULL) {
+      munmap((void *) c->map, c->map_len);
+      c->map = NULL;
+    }
+    if(c->dictionaries != NULL) {
+      for(size_t j = 0; j < t->row_group_count; ++j) {
+	free((void *) atomic_load_explicit(&c->dictionaries[j], memory_order_relaxed));
+      }
+      free(c->dictionaries);
+      c->dictionaries = NULL;
+    }
+    if(c->fd >= 0) {
+      close(c->fd);
+      c->fd = -1;
+    }
+  }
+}
@@ -0,0 +1,658 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The magic bytes at the start of a table metadata file
+ */
+#define TABLE_MAGIC "DBTABLE\1"
+
+/**
+ * The magic bytes at the start and at the end of a column file
+ */
+#define TABLE_COLUMN_MAGIC "DBCOLMN\1"
+
+/**
+ * The length of the magic bytes
+ */
+#define TABLE_MAGIC_LENGTH 8
+
+/**
+ * Written after the magic bytes in native byte order, to detect files written on a machine with another byte order
+ */
+#define TABLE_BYTE_ORDER 0x01020304u
+
+/**
+ * The name of the metadata file in a table directory
+ */
+#define TABLE_META_FILE_NAME "table.meta"
+
+/**
+ * The suffix of the column files in a table directory
+ */
+#define TABLE_COLUMN_FILE_SUFFIX ".col"
+
+/**
+ * The maximum number of columns of a table
+ */
+#define MAX_TABLE_COLUMNS 64
+
+/**
+ * The maximum length of a table or column name, including the terminating 0
+ */
+#define MAX_TABLE_NAME_LENGTH 128
+
+/**
+ * The maximum length of a table path
+ */
+#define MAX_TABLE_PATH_LENGTH 4096
+
+/**
+ * The default number of rows in a row group
+ */
+#define DEFAULT_TABLE_ROW_GROUP_SIZE 65536
+
+/**
+ * The number of leading bytes of the smallest and largest strings of a row group kept in its zone map
+ */
+#define TABLE_ZONE_PREFIX_LENGTH 16
+
+/**
+ * The number of rows between the absolute values kept by a delta encoded row group, bounding the deltas a lookup adds up
+ */
+#define TABLE_DELTA_BLOCK_ROWS 128
+
+/**
+ * The type of the values of a column
+ */
+enum table_column_type {
+  /**
+   * 64 bit signed integers, stored per row group with the encoding that suits their values best
+   */
+  TABLE_COLUMN_INT64,
+
+  /**
+   * Byte strings, stored per row group as a sorted dictionary of the distinct strings and codes into it
+   */
+  TABLE_COLUMN_STRING
+};
+
+/**
+ * The way the values of a row group are stored, in the row group header
+ */
+enum table_encoding {
+  /**
+   * A sorted dictionary of the distinct strings and the bit-packed code of each row
+   */
+  TABLE_ENCODING_DICTIONARY = 1,
+
+  /**
+   * The values as they are
+   */
+  TABLE_ENCODING_PLAIN = 2,
+
+  /**
+   * Runs of equal values, each stored once with the row at which it ends, of dictionary codes for strings
+   */
+  TABLE_ENCODING_RUN_LENGTH = 3,
+
+  /**
+   * The smallest value and the bit-packed difference of each value from it
+   */
+  TABLE_ENCODING_FRAME_OF_REFERENCE = 4,
+
+  /**
+   * The smallest difference between consecutive values and the bit-packed excess of each difference over it,
+   * with the absolute value of every TABLE_DELTA_BLOCK_ROWS rows
+   */
+  TABLE_ENCODING_DELTA = 5
+};
+
+/**
+ * The definition of a column
+ */
+struct table_column_def {
+  /**
+   * The name of the column, an identifier
+   */
+  char name[MAX_TABLE_NAME_LENGTH];
+
+  /**
+   * The type of the values
+   */
+  enum table_column_type type;
+};
+
+/**
+ * The columns of a table
+ */
+struct table_schema {
+  /**
+   * The column definitions
+   */
+  struct table_column_def columns[MAX_TABLE_COLUMNS];
+
+  /**
+   * The number of columns
+   */
+  size_t column_count;
+};
+
+/**
+ * Options for creating a table
+ */
+struct table_options {
+  /**
+   * The number of rows in a row group, the unit in which columns are written and scanned
+   */
+  size_t row_group_size;
+
+  /**
+   * The number of Bloom filter bits per distinct string of a row group of a string column, 0 for no Bloom filters
+   */
+  unsigned int bloom_bits_per_key;
+
+  /**
+   * Whether row groups are stored with the smallest lightweight encoding of their values and string dictionaries compressed,
+   * rather than as plain integers and bit-packed dictionary codes
+   */
+  bool compressed;
+};
+
+/**
+ * A value of a row to append, the member matching the column type is used
+ */
+struct table_value {
+  /**
+   * The value of an integer column
+   */
+  int64_t integer;
+
+  /**
+   * The bytes of a string column
+   */
+  const char * text;
+
+  /**
+   * The number of bytes of a string column
+   */
+  size_t len;
+};
+
+/**
+ * The location of a row group in a column file and its zone map, which tells whether a value may be in it without reading it
+ */
+struct table_row_group {
+  /**
+   * The offset of the row group in the column file
+   */
+  uint64_t offset;
+
+  /**
+   * The length of the row group in bytes
+   */
+  uint64_t len;
+
+  /**
+   * The number of rows in the row group
+   */
+  uint64_t rows;
+
+  /**
+   * The smallest value of an integer column
+   */
+  int64_t min;
+
+  /**
+   * The largest value of an integer column
+   */
+  int64_t max;
+
+  /**
+   * The offset of the Bloom filter of the strings in the column file
+   */
+  uint64_t bloom_offset;
+
+  /**
+   * The number of bytes of the Bloom filter, 0 if there is none
+   */
+  uint32_t bloom_size;
+
+  /**
+   * The number of hash functions of the Bloom filter
+   */
+  uint32_t bloom_hash_count;
+
+  /**
+   * The length of the prefix of the smallest string
+   */
+  uint32_t min_len;
+
+  /**
+   * The length of the prefix of the largest string
+   */
+  uint32_t max_len;
+
+  /**
+   * The first TABLE_ZONE_PREFIX_LENGTH bytes at most of the smallest string of a string column
+   */
+  char min_text[TABLE_ZONE_PREFIX_LENGTH];
+
+  /**
+   * The first TABLE_ZONE_PREFIX_LENGTH bytes at most of the largest string of a string column
+   */
+  char max_text[TABLE_ZONE_PREFIX_LENGTH];
+};
+
+/**
+ * The values of a column buffered by a table writer until its row group is complete
+ */
+struct table_column_buffer {
+  /**
+   * The file descriptor of the column file
+   */
+  int fd;
+
+  /**
+   * The number of bytes written to the column file
+   */
+  uint64_t offset;
+
+  /**
+   * The fixed width values, or the offsets of the strings into the bytes with one extra offset for the end
+   */
+  char * values;
+
+  /**
+   * The size of the values buffer
+   */
+  size_t values_size;
+
+  /**
+   * The bytes of the strings
+   */
+  char * bytes;
+
+  /**
+   * The number of bytes of the strings
+   */
+  size_t bytes_len;
+
+  /**
+   * The size of the bytes buffer
+   */
+  size_t bytes_size;
+
+  /**
+   * The row groups written so far
+   */
+  struct table_row_group * groups;
+
+  /**
+   * The size of the row group array
+   */
+  size_t groups_size;
+};
+
+/**
+ * Writes a new table one row at a time, a row group at a time per column file
+ */
+struct table_writer {
+  /**
+   * The path of the table directory
+   */
+  char path[MAX_TABLE_PATH_LENGTH];
+
+  /**
+   * The columns
+   */
+  struct table_schema schema;
+
+  /**
+   * The options
+   */
+  struct table_options options;
+
+  /**
+   * The buffered values per column
+   */
+  struct table_column_buffer buffers[MAX_TABLE_COLUMNS];
+
+  /**
+   * The number of rows in the current row group
+   */
+  size_t group_rows;
+
+  /**
+   * The number of complete row groups
+   */
+  size_t group_count;
+
+  /**
+   * The number of rows appended
+   */
+  uint64_t row_count;
+};
+
+/**
+ * A column of an open table, mapped into memory the first time it is read
+ */
+struct table_column {
+  /**
+   * The file descriptor of the column file
+   */
+  int fd;
+
+  /**
+   * The mapped column file or NULL if it has not been mapped yet
+   */
+  const char * map;
+
+  /**
+   * The length of the mapping
+   */
+  size_t map_len;
+
+  /**
+   * The row groups of the column, pointing into the mapping
+   */
+  const struct table_row_group * groups;
+
+  /**
+   * The decompressed dictionaries of the row groups of a string column, decompressed on first read by any thread
+   */
+  atomic_uintptr_t * dictionaries;
+};
+
+/**
+ * An open table
+ */
+struct table {
+  /**
+   * The path of the table directory
+   */
+  char path[MAX_TABLE_PATH_LENGTH];
+
+  /**
+   * The columns
+   */
+  struct table_schema schema;
+
+  /**
+   * The number of rows in a row group, the last row group may be smaller
+   */
+  size_t row_group_size;
+
+  /**
+   * The number of row groups
+   */
+  size_t row_group_count;
+
+  /**
+   * The number of rows
+   */
+  uint64_t row_count;
+
+  /**
+   * The column files
+   */
+  struct table_column columns[MAX_TABLE_COLUMNS];
+};
+
+/**
+ * The values of a column in a row group, pointing into the mapped column file
+ */
+struct table_chunk {
+  /**
+   * The type of the values
+   */
+  enum table_column_type type;
+
+  /**
+   * The index of the first row of the chunk in the table
+   */
+  uint64_t first_row;
+
+  /**
+   * The number of rows
+   */
+  size_t rows;
+
+  /**
+   * The way the values are stored
+   */
+  enum table_encoding encoding;
+
+  /**
+   * The values of a plain integer column
+   */
+  const int64_t * integers;
+
+  /**
+   * The smallest value of a frame of reference encoded integer column, or the smallest difference of a delta encoded one
+   */
+  int64_t base;
+
+  /**
+   * The value of every TABLE_DELTA_BLOCK_ROWS rows of a delta encoded integer column
+   */
+  const int64_t * checkpoints;
+
+  /**
+   * The number of runs of a run-length encoded column
+   */
+  size_t run_count;
+
+  /**
+   * The index in the chunk of the row after each run, increasing up to the number of rows
+   */
+  const uint32_t * run_ends;
+
+  /**
+   * The value of each run of an integer column
+   */
+  const int64_t * run_values;
+
+  /**
+   * The dictionary code of each run of a string column
+   */
+  const uint32_t * run_codes;
+
+  /**
+   * The offsets of the dictionary strings into the bytes, dictionary_size + 1 entries, for a string column
+   */
+  const uint64_t * offsets;
+
+  /**
+   * The bytes of the dictionary strings of a string column
+   */
+  const char * bytes;
+
+  /**
+   * The number of distinct strings of a string column, in byte order so codes compare like their strings
+   */
+  size_t dictionary_size;
+
+  /**
+   * The bit-packed dictionary codes of the rows of a string column,
+   * the differences from the base of a frame of reference encoded integer column or the excess differences of a delta encoded one
+   */
+  const uint64_t * codes;
+
+  /**
+   * The width in bits of the codes
+   */
+  unsigned int code_bits;
+};
+
+/**
+ * Initializes table options with the defaults
+ * \param options the options
+ */
+void init_table_options(struct table_options * options);
+
+/**
+ * Adds a column to a schema
+ * \param schema the schema
+ * \param name the name of the column, an identifier
+ * \param type the type of the values
+ * \return the index of the column or -1 on error
+ */
+int add_table_column(struct table_schema * schema, const char * name, enum table_column_type type);
+
+/**
+ * Creates a table directory and starts writing the table
+ * \param w the writer
+ * \param path the path of the table directory, which must not exist
+ * \param schema the columns, which are copied
+ * \param options the options, which are copied
+ * \return 0 on success, -1 on error
+ */
+int create_table(struct table_writer * w, const char * path, const struct table_schema * schema, const struct table_options * options);
+
+/**
+ * Appends a row to a table
+ * \param w the writer
+ * \param values the values of the row, one per column
+ * \return 0 on success, -1 on error
+ */
+int append_table_row(struct table_writer * w, const struct table_value * values);
+
+/**
+ * Writes the last row group and the metadata of a table and releases the writer
+ * \param w the writer
+ * \return 0 on success, -1 on error
+ */
+int close_table_writer(struct table_writer * w);
+
+/**
+ * Opens a table for reading, column files are only mapped when they are read
+ * \param t the table
+ * \param path the path of the table directory
+ * \return 0 on success, -1 on error
+ */
+int open_table(struct table * t, const char * path);
+
+/**
+ * Opens the table named by the identifier of a FROM clause
+ * \param t the table
+ * \param dir the directory holding the tables
+ * \param name the table name, not necessarily 0 terminated
+ * \param len the length of the table name
+ * \return 0 on success, -1 on error
+ */
+int open_named_table(struct table * t, const char * dir, const char * name, size_t len);
+
+/**
+ * Finds a column of a table by name
+ * \param t the table
+ * \param name the column name, not necessarily 0 terminated
+ * \param len the length of the column name
+ * \return the index of the column or -1 if there is no such column
+ */
+int find_table_column(const struct table * t, const char * name, size_t len);
+
+/**
+ * Reads the values of a column in a row group, mapping the column file on first use
+ * \param t the table
+ * \param column the index of the column
+ * \param group the index of the row group
+ * \param chunk the destination for the values
+ * \return 0 on success, -1 on error
+ */
+int read_table_chunk(struct table * t, size_t column, size_t group, struct table_chunk * chunk);
+
+/**
+ * Checks whether a row group may hold a value from its zone map, without reading the row group
+ * \param t the table
+ * \param column the index of the column
+ * \param group the index of the row group
+ * \param value the value, of the type of the column
+ * \return 1 if the row group may hold the value, 0 if it does not, -1 on error
+ */
+int test_table_row_group(struct table * t, size_t column, size_t group, const struct table_value * value);
+
+/**
+ * Gets a value of a chunk of an integer column
+ * \param chunk the chunk
+ * \param index the index of the row in the chunk
+ * \return the value
+ */
+int64_t get_table_integer(const struct table_chunk * chunk, size_t index);
+
+/**
+ * Decodes consecutive values of a chunk of an integer column
+ * \param chunk the chunk
+ * \param first the index of the first row in the chunk
+ * \param count the number of rows
+ * \param dest the destination for the values
+ */
+void decode_table_integers(const struct table_chunk * chunk, size_t first, size_t count, int64_t * dest);
+
+/**
+ * Gets the dictionary code of a row of a chunk of a string column
+ * \param chunk the chunk
+ * \param index the index of the row in the chunk
+ * \return the code
+ */
+uint32_t get_table_code(const struct table_chunk * chunk, size_t index);
+
+/**
+ * Decodes the dictionary codes of consecutive rows of a chunk of a string column
+ * \param chunk the chunk
+ * \param first the index of the first row in the chunk
+ * \param count the number of rows
+ * \param dest the destination for the codes
+ */
+void decode_table_codes(const struct table_chunk * chunk, size_t first, size_t count, uint32_t * dest);
+
+/**
+ * Finds the run holding a row of a run-length encoded chunk
+ * \param chunk the chunk
+ * \param index the index of the row in the chunk
+ * \return the index of the run
+ */
+size_t find_table_run(const struct table_chunk * chunk, size_t index);
+
+/**
+ * Gets a string of a chunk of a string column
+ * \param chunk the chunk
+ * \param index the index of the row in the chunk
+ * \param len the destination for the length of the string
+ * \return the bytes of the string, pointing into the dictionary, which lives as long as the table is open
+ */
+const char * get_table_string(const struct table_chunk * chunk, size_t index, size_t * len);
+
+/**
+ * Finds the dictionary code of a string in a chunk of a string column
+ * \param chunk the chunk
+ * \param text the bytes of the string
+ * \param len the length of the string
+ * \param code the destination for the code
+ * \return true if the string is in the dictionary, false if no row of the chunk holds it
+ */
+bool find_table_code(const struct table_chunk * chunk, const char * text, size_t len, uint32_t * code);
+
+/**
+ * Closes a table, unmapping its column files
+ * \param t the table
+ */
+void close_table(struct table * t);
+
+#endif
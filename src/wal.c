@@ -0,0 +1,473 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#define LOG_MODULE "wal"
+
+#include "wal.h"
+#include "logger.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * The permissions of newly created logs
+ */
+#define WAL_FILE_MODE 0644
+
+/**
+ * The header of a record in the log, followed by its data
+ */
+struct wal_record_header {
+  /**
+   * The length of the data
+   */
+  uint32_t len;
+
+  /**
+   * The CRC-32 of the LSN and the data, to detect torn writes
+   */
+  uint32_t checksum;
+
+  /**
+   * The LSN of the record
+   */
+  uint64_t lsn;
+};
+
+/**
+ * The CRC-32 of each byte value
+ */
+static uint32_t crc_table[256];
+
+/**
+ * Guards the computation of the CRC-32 table
+ */
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Computes the CRC-32 table
+ */
+static void init_wal_crc_table() {
+  for(uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for(int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+    }
+    crc_table[i] = crc;
+  }
+}
+
+/**
+ * Continues a CRC-32
+ * \param crc the CRC-32 of the previous bytes, inverted
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return the CRC-32 including the bytes, inverted
+ */
+static uint32_t update_wal_crc(uint32_t crc, const char * data, size_t len) {
+  for(size_t i = 0; i < len; ++i) {
+    crc = crc_table[(crc ^ (unsigned char) data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+/**
+ * Computes the checksum of a record
+ * \param lsn the LSN of the record
+ * \param data the bytes of the record
+ * \param len the length of the record
+ * \return the checksum
+ */
+static uint32_t get_wal_checksum(uint64_t lsn, const char * data, size_t len) {
+  uint32_t crc = update_wal_crc(0xffffffffu, (const char *) &lsn, sizeof(lsn));
+  return ~update_wal_crc(crc, data, len);
+}
+
+/**
+ * Reads bytes of the log, stopping early at the end of the file
+ * \param fd the file descriptor
+ * \param dest the destination buffer
+ * \param len the number of bytes to read
+ * \param offset the offset in the file
+ * \return the number of bytes read, or -1 on error
+ */
+static ssize_t read_wal_bytes(int fd, char * dest, size_t len, uint64_t offset) {
+  size_t done = 0;
+  while(done < len) {
+    ssize_t n = pread(fd, dest + done, len - done, (off_t) (offset + done));
+    if(n < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      LOG_ERROR("could not read log at offset %lu: %s", (unsigned long) (offset + done), strerror(errno));
+      return -1;
+    }
+    if(n == 0) {
+      break;
+    }
+    done += (size_t) n;
+  }
+  return (ssize_t) done;
+}
+
+/**
+ * Writes bytes of the log
+ * \param fd the file descriptor
+ * \param data the bytes
+ * \param len the number of bytes
+ * \param offset the offset in the file
+ * \return 0 on success, -1 on error
+ */
+static int write_wal_bytes(int fd, const char * data, size_t len, uint64_t offset) {
+  size_t done = 0;
+  while(done < len) {
+    ssize_t n = pwrite(fd, data + done, len - done, (off_t) (offset + done));
+    if(n < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      LOG_ERROR("could not write log at offset %lu: %s", (unsigned long) (offset + done), strerror(errno));
+      return -1;
+    }
+    done += (size_t) n;
+  }
+  return 0;
+}
+
+/**
+ * Reads the records of the log, truncating it after the last valid record
+ * \param w the log, whose LSNs are set to the end of the last valid record
+ * \param replay the function receiving the records, or NULL
+ * \param context the context passed to the replay function
+ * \return 0 on success, -1 on error
+ */
+static int recover_wal(struct wal * w, wal_replay_function replay, void * context) {
+  char * data = NULL;
+  size_t size = 0;
+  uint64_t offset = 0;
+  int result = 0;
+  while(true) {
+    struct wal_record_header header;
+    ssize_t n = read_wal_bytes(w->fd, (char *) &header, sizeof(header), offset);
+    if(n < 0) {
+      result = -1;
+      break;
+    }
+    uint64_t end = offset + sizeof(header) + header.len;
+    if((size_t) n < sizeof(header) || header.len > MAX_WAL_RECORD_LENGTH || header.lsn != end) {
+      break;
+    }
+    if(header.len > size) {
+      char * bigger = (char *) realloc(data, header.len);
+      if(bigger == NULL) {
+	LOG_ERROR("could not allocate a record of %lu bytes", (unsigned long) header.len);
+	result = -1;
+	break;
+      }
+      data = bigger;
+      size = header.len;
+    }
+    n = read_wal_bytes(w->fd, data, header.len, offset + sizeof(header));
+    if(n < 0) {
+      result = -1;
+      break;
+    }
+    if((size_t) n < header.len || get_wal_checksum(header.lsn, data, header.len) != header.checksum) {
+      break;
+    }
+    if(replay != NULL && replay(context, header.lsn, data, header.len) != 0) {
+      result = -1;
+      break;
+    }
+    offset = end;
+  }
+  free(data);
+  if(result != 0) {
+    return -1;
+  }
+
+  // Records after a torn write were never acknowledged, new records overwrite them
+  off_t file_size = lseek(w->fd, 0, SEEK_END);
+  if(file_size < 0) {
+    LOG_ERROR("could not find the size of the log: %s", strerror(errno));
+    return -1;
+  }
+  if((uint64_t) file_size > offset) {
+    LOG_WARNING("truncating %lu bytes after the last valid record of the log", (unsigned long) ((uint64_t) file_size - offset));
+    if(ftruncate(w->fd, (off_t) offset) != 0 || fdatasync(w->fd) != 0) {
+      LOG_ERROR("could not truncate the log: %s", strerror(errno));
+      return -1;
+    }
+  }
+  w->next_lsn = offset;
+  w->durable_lsn = offset;
+  return 0;
+}
+
+/**
+ * Runs in the writer thread
+ * Everything appended while the previous batch was being synced is written and synced at once
+ * \param arg the log
+ * \return always NULL, failures are recorded in the log
+ */
+static void * run_wal_writer(void * arg) {
+  struct wal * w = (struct wal *) arg;
+  if(pthread_mutex_lock(&w->mutex) != 0) {
+    LOG_ERROR("could not lock log");
+    w->failed = true;
+    return NULL;
+  }
+  while(true) {
+    while(w->len == 0 && !w->stopping) {
+      pthread_cond_wait(&w->work_cond, &w->mutex);
+    }
+    if(w->len == 0) {
+      break;
+    }
+
+    // The writer owns the spare buffer, appenders fill the other one meanwhile
+    char * batch = w->buffer;
+    size_t len = w->len;
+    size_t batch_size = w->size;
+    uint64_t offset = w->durable_lsn;
+    uint64_t end = w->next_lsn;
+    w->buffer = w->spare;
+    w->size = w->spare_size;
+    w->len = 0;
+    w->spare = batch;
+    w->spare_size = batch_size;
+    pthread_cond_broadcast(&w->space_cond);
+    pthread_mutex_unlock(&w->mutex);
+
+    int result = write_wal_bytes(w->fd, batch, len, offset);
+    if(result == 0 && fdatasync(w->fd) != 0) {
+      LOG_ERROR("could not sync log: %s", strerror(errno));
+      result = -1;
+    }
+
+    if(pthread_mutex_lock(&w->mutex) != 0) {
+      LOG_ERROR("could not lock log");
+      w->failed = true;
+      return NULL;
+    }
+    // A failed sync may have dropped the dirty pages, so later syncs prove nothing about the records
+    if(result != 0) {
+      w->failed = true;
+      pthread_cond_broadcast(&w->durable_cond);
+      pthread_cond_broadcast(&w->space_cond);
+      break;
+    }
+    w->durable_lsn = end;
+    w->stats.bytes += len;
+    ++w->stats.syncs;
+    pthread_cond_broadcast(&w->durable_cond);
+  }
+  pthread_mutex_unlock(&w->mutex);
+  return NULL;
+}
+
+int open_wal(struct wal * w, const char * path, wal_replay_function replay, void * context) {
+  assert(w != NULL);
+  assert(path != NULL);
+
+  memset(w, 0, sizeof(struct wal));
+  if(pthread_once(&crc_table_once, init_wal_crc_table) != 0) {
+    LOG_ERROR("could not compute the CRC-32 table");
+    return -1;
+  }
+  w->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, WAL_FILE_MODE);
+  if(w->fd < 0) {
+    LOG_ERROR("could not open log %s: %s", path, strerror(errno));
+    return -1;
+  }
+  if(recover_wal(w, replay, context) != 0) {
+    close(w->fd);
+    return -1;
+  }
+  w->size = WAL_BUFFER_SIZE;
+  w->spare_size = WAL_BUFFER_SIZE;
+  w->buffer = (char *) malloc(w->size);
+  w->spare = (char *) malloc(w->spare_size);
+  if(w->buffer == NULL || w->spare == NULL) {
+    LOG_ERROR("could not allocate log buffers");
+    free(w->buffer);
+    free(w->spare);
+    close(w->fd);
+    return -1;
+  }
+
+  int result = pthread_mutex_init(&w->mutex, NULL);
+  if(result == 0) {
+    result = pthread_cond_init(&w->work_cond, NULL);
+    if(result == 0) {
+      result = pthread_cond_init(&w->space_cond, NULL);
+      if(result == 0) {
+	result = pthread_cond_init(&w->durable_cond, NULL);
+	if(result != 0) {
+	  pthread_cond_destroy(&w->space_cond);
+	}
+      }
+      if(result != 0) {
+	pthread_cond_destroy(&w->work_cond);
+      }
+    }
+    if(result != 0) {
+      pthread_mutex_destroy(&w->mutex);
+    }
+  }
+  if(result != 0) {
+    LOG_ERROR("could not initialize log mutex: %s", strerror(result));
+  } else {
+    result = pthread_create(&w->thread, NULL, run_wal_writer, w);
+    if(result != 0) {
+      LOG_ERROR("could not start log writer: %s", strerror(result));
+      pthread_cond_destroy(&w->durable_cond);
+      pthread_cond_destroy(&w->space_cond);
+      pthread_cond_destroy(&w->work_cond);
+      pthread_mutex_destroy(&w->mutex);
+    }
+  }
+  if(result != 0) {
+    free(w->buffer);
+    free(w->spare);
+    close(w->fd);
+    return -1;
+  }
+  return 0;
+}
+
+int append_wal_record(struct wal * w, const char * data, size_t len, uint64_t * lsn) {
+  assert(w != NULL);
+  assert(data != NULL || len == 0);
+  assert(lsn != NULL);
+
+  if(len > MAX_WAL_RECORD_LENGTH) {
+    LOG_ERROR("record of %lu bytes too long for the log", (unsigned long) len);
+    return -1;
+  }
+  size_t total = sizeof(struct wal_record_header) + len;
+  if(pthread_mutex_lock(&w->mutex) != 0) {
+    LOG_ERROR("could not lock log");
+    return -1;
+  }
+  // A record never waits for more than one batch, an empty buffer grows to fit it
+  while(!w->failed && w->len != 0 && w->len + total > w->size) {
+    pthread_cond_wait(&w->space_cond, &w->mutex);
+  }
+  if(w->failed) {
+    pthread_mutex_unlock(&w->mutex);
+    return -1;
+  }
+  if(total > w->size) {
+    char * bigger = (char *) realloc(w->buffer, total);
+    if(bigger == NULL) {
+      LOG_ERROR("could not allocate a log buffer of %lu bytes", (unsigned long) total);
+      pthread_mutex_unlock(&w->mutex);
+      return -1;
+    }
+    w->buffer = bigger;
+    w->size = total;
+  }
+
+  struct wal_record_header header;
+  header.len = (uint32_t) len;
+  header.lsn = w->next_lsn + total;
+  header.checksum = get_wal_checksum(header.lsn, data, len);
+  memcpy(w->buffer + w->len, &header, sizeof(header));
+  if(len > 0) {
+    memcpy(w->buffer + w->len + sizeof(header), data, len);
+  }
+  bool wake = w->len == 0;
+  w->len += total;
+  w->next_lsn = header.lsn;
+  ++w->stats.records;
+  *lsn = header.lsn;
+  if(wake) {
+    pthread_cond_signal(&w->work_cond);
+  }
+  pthread_mutex_unlock(&w->mutex);
+  return 0;
+}
+
+int wait_for_wal(struct wal * w, uint64_t lsn) {
+  assert(w != NULL);
+
+  if(pthread_mutex_lock(&w->mutex) != 0) {
+    LOG_ERROR("could not lock log");
+    return -1;
+  }
+  while(w->durable_lsn < lsn && !w->failed) {
+    pthread_cond_wait(&w->durable_cond, &w->mutex);
+  }
+  int result = w->durable_lsn >= lsn ? 0 : -1;
+  pthread_mutex_unlock(&w->mutex);
+  return result;
+}
+
+int commit_wal_record(struct wal * w, const char * data, size_t len, uint64_t * lsn) {
+  uint64_t record_lsn;
+  if(append_wal_record(w, data, len, &record_lsn) != 0 || wait_for_wal(w, record_lsn) != 0) {
+    return -1;
+  }
+  if(lsn != NULL) {
+    *lsn = record_lsn;
+  }
+  return 0;
+}
+
+void get_wal_stats(struct wal * w, struct wal_stats * stats) {
+  assert(w != NULL);
+  assert(stats != NULL);
+
+  if(pthread_mutex_lock(&w->mutex) != 0) {
+    memset(stats, 0, sizeof(struct wal_stats));
+    return;
+  }
+  *stats = w->stats;
+  pthread_mutex_unlock(&w->mutex);
+}
+
+int close_wal(struct wal * w) {
+  assert(w != NULL);
+
+  int result = 0;
+  if(pthread_mutex_lock(&w->mutex) != 0) {
+    LOG_ERROR("could not lock log");
+    result = -1;
+  } else {
+    w->stopping = true;
+    pthread_cond_signal(&w->work_cond);
+    pthread_mutex_unlock(&w->mutex);
+  }
+  pthread_join(w->thread, NULL);
+  if(w->failed || w->durable_lsn != w->next_lsn) {
+    result = -1;
+  }
+  if(close(w->fd) != 0) {
+    LOG_ERROR("could not close log: %s", strerror(errno));
+    result = -1;
+  }
+  pthread_cond_destroy(&w->durable_cond);
+  pthread_cond_destroy(&w->space_cond);
+  pthread_cond_destroy(&w->work_cond);
+  pthread_mutex_destroy(&w->mutex);
+  free(w->buffer);
+  free(w->spare);
+  return result;
+}
@@ -0,0 +1,201 @@
+/* 
+ * This file is part of DB.
+ * DB is free software: you can redistribute it and/or modify it under the terms of 
+ * the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * DB is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with DB. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ */
+
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The maximum length of the data of a record
+ */
+#define MAX_WAL_RECORD_LENGTH (16 * 1024 * 1024)
+
+/**
+ * The initial size in bytes of the buffers records are appended to
+ */
+#define WAL_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * A function receiving the records found when a write-ahead log is opened
+ * \param context the context given to open_wal
+ * \param lsn the LSN of the record
+ * \param data the bytes of the record, only valid during the call
+ * \param len the length of the record
+ * \return 0 to continue, -1 to fail opening the log
+ */
+typedef int (*wal_replay_function)(void * context, uint64_t lsn, const char * data, size_t len);
+
+/**
+ * Counters of a write-ahead log
+ */
+struct wal_stats {
+  /**
+   * The number of records appended
+   */
+  uint64_t records;
+
+  /**
+   * The number of bytes written
+   */
+  uint64_t bytes;
+
+  /**
+   * The number of writes, each followed by a sync
+   */
+  uint64_t syncs;
+};
+
+/**
+ * A write-ahead log of records tagged with a log sequence number (LSN), the offset of the end of the record in the log
+ * Records are appended to a buffer in memory and a single writer thread writes and syncs everything appended
+ * while it was syncing the previous batch, so concurrent commits share a sync instead of waiting for one each
+ */
+struct wal {
+  /**
+   * The file descriptor
+   */
+  int fd;
+
+  /**
+   * The mutex protecting the buffers and the LSNs
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signaled when records are appended or the log should stop
+   */
+  pthread_cond_t work_cond;
+
+  /**
+   * Signaled when the writer takes the buffer
+   */
+  pthread_cond_t space_cond;
+
+  /**
+   * Signaled when records become durable or the writer fails
+   */
+  pthread_cond_t durable_cond;
+
+  /**
+   * The writer thread
+   */
+  pthread_t thread;
+
+  /**
+   * The buffer records are appended to
+   */
+  char * buffer;
+
+  /**
+   * The number of bytes appended to the buffer
+   */
+  size_t len;
+
+  /**
+   * The size of the buffer
+   */
+  size_t size;
+
+  /**
+   * The buffer being written by the writer thread
+   */
+  char * spare;
+
+  /**
+   * The size of the spare buffer
+   */
+  size_t spare_size;
+
+  /**
+   * The LSN of the last record appended
+   */
+  uint64_t next_lsn;
+
+  /**
+   * The LSN up to which records are synced to disk
+   */
+  uint64_t durable_lsn;
+
+  /**
+   * Whether the writer should stop once the buffer is written
+   */
+  bool stopping;
+
+  /**
+   * Whether a write or a sync failed, after which nothing more is made durable
+   */
+  bool failed;
+
+  /**
+   * The counters
+   */
+  struct wal_stats stats;
+};
+
+/**
+ * Opens a write-ahead log, creating it if it does not exist, and starts its writer thread
+ * The records of the log are passed to the replay function in order, a torn or corrupted tail is truncated
+ * \param w the log
+ * \param path the path of the file
+ * \param replay the function receiving the records, or NULL
+ * \param context the context passed to the replay function
+ * \return 0 on success, -1 on error
+ */
+int open_wal(struct wal * w, const char * path, wal_replay_function replay, void * context);
+
+/**
+ * Appends a record without waiting for it to be durable
+ * \param w the log
+ * \param data the bytes of the record
+ * \param len the length of the record, at most MAX_WAL_RECORD_LENGTH
+ * \param lsn the destination for the LSN of the record
+ * \return 0 on success, -1 on error
+ */
+int append_wal_record(struct wal * w, const char * data, size_t len, uint64_t * lsn);
+
+/**
+ * Waits until the records up to an LSN are synced to disk
+ * \param w the log
+ * \param lsn the LSN
+ * \return 0 once the records are durable, -1 if they never will be
+ */
+int wait_for_wal(struct wal * w, uint64_t lsn);
+
+/**
+ * Appends a record and waits until it is synced to disk
+ * \param w the log
+ * \param data the bytes of the record
+ * \param len the length of the record, at most MAX_WAL_RECORD_LENGTH
+ * \param lsn the destination for the LSN of the record, or NULL
+ * \return 0 on success, -1 on error
+ */
+int commit_wal_record(struct wal * w, const char * data, size_t len, uint64_t * lsn);
+
+/**
+ * Copies the counters of a write-ahead log
+ * \param w the log
+ * \param stats the destination for the counters
+ */
+void get_wal_stats(struct wal * w, struct wal_stats * stats);
+
+/**
+ * Writes and syncs the appended records, stops the writer thread and closes a write-ahead log
+ * \param w the log
+ * \return 0 on success, -1 if some records could not be made durable
+ */
+int close_wal(struct wal * w);
+
+#endif